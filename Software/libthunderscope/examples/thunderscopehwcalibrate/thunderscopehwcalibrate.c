@@ -22,6 +22,7 @@ struct Option options[] = {
 	{"verbose",            false, 2 },
 	{"repeat",             true,  3 },
 	{"help",               false, 4 },
+	{"no-store",           false, 5 },
 };
 
 #define TS_RUN(X) do {							\
@@ -36,7 +37,8 @@ void usage() {
 	printf("thunderscopehwcalibrate [options]\n"
                "   --device=<deviceid>\n"
 	       "   --verbose\n"
-	       "   --repeat=<repetitions>\n");
+	       "   --repeat=<repetitions>\n"
+	       "   --no-store  only print, leave the stored calibration alone\n");
 }
 
 char* optarg;
@@ -68,6 +70,7 @@ int mygetopt(int argc, char** argv) {
 int main(int argc, char** argv) {
 	int verbose = 0;
 	int repeat = 1;
+	bool store = true;
 	uint64_t scope_id = 0;
 	uint64_t samples = 0;
 	int samplerate = 0;
@@ -91,6 +94,9 @@ int main(int argc, char** argv) {
 		case 4:
 			usage();
 			exit(0);
+		case 5:
+			store = false;
+			continue;
 		default:
 			continue;
 		case -1:
@@ -116,69 +122,34 @@ int main(int argc, char** argv) {
 		scope_id = scope_ids[0];
 	}
 
-#define BUFFER_SIZE (1<<20)
-	uint8_t* buffer;
-#ifdef _WIN32
-        buffer = _aligned_malloc(BUFFER_SIZE, 4096);
-#else
-	posix_memalign((void**)&buffer, 4096, BUFFER_SIZE);
-#endif
-
 	struct ThunderScopeHW *ts = thunderscopehw_create();
-	enum ThunderScopeHWStatus ret;
 	TS_RUN(connect(ts, scope_id));
 
-	for (int channel = 0; channel < 4; channel++) {
-		TS_RUN(enable_channel(ts, channel));
-		// 1mV / div
-		TS_RUN(voltage_division_set(ts, channel, 1));
-#ifdef WIN32
-		Sleep(500);
-#else
-		usleep(500000);
-#endif
-
-		for (int i = 0; i < repeat; i++) {
-			double minoffset = -0.5;
-			double maxoffset = 0.5;
-			for (int j = 0; j < 20; j++) {
-				double midoffset = (minoffset + maxoffset) / 2;
-				TS_RUN(voltage_offset_set(ts, channel, midoffset));
-				TS_RUN(start(ts));
-				enum ThunderScopeHWStatus status = thunderscopehw_read(ts, buffer, BUFFER_SIZE);
-				if (status != THUNDERSCOPEHW_STATUS_OK) {
-					fprintf(stderr, "thunderscopehw_read failed, error = %s\n", thunderscopehw_describe_error(status));
-					j--;
-					TS_RUN(stop(ts));
-					continue;
-				}
-				// Convert signed output to unsigned output
-				for (size_t i = 0; i < BUFFER_SIZE; i++) {
-					buffer[i] += 0x80;
-				}
-				TS_RUN(stop(ts));
-				int high = 0;
-				int low = 0;
-				uint64_t sum = 0;
-				for (size_t i = 0; i < BUFFER_SIZE; i++) {
-					if (buffer[i] > 0x80) high++;
-					if (buffer[i] < 0x80) low++;
-					sum += buffer[i];
-				}
-				if (verbose) {
-					fprintf(stderr," min = %8.4f  max = %8.4f  mid = %8.4f  high=%d low=%d avg=%f\n",
-						minoffset, maxoffset, midoffset,
-						high, low,
-						sum / (double)BUFFER_SIZE);
-				}
-				if (high > low) {
-					minoffset = midoffset;
-				} else {
-					maxoffset = midoffset;
+	struct ThunderScopeHWOffsetCalibration calibration;
+	for (int i = 0; i < repeat; i++) {
+		TS_RUN(calibrate_offsets(ts, &calibration));
+		for (int channel = 0; channel < 4; channel++) {
+			for (int v = 0; v < THUNDERSCOPEHW_CALIBRATION_VDIVS; v++) {
+				static const int bandwidths[THUNDERSCOPEHW_CALIBRATION_BANDWIDTHS] = { 20, 100, 200, 350 };
+				for (int bw = 0; bw < THUNDERSCOPEHW_CALIBRATION_BANDWIDTHS; bw++) {
+					printf("Channel %d %5d mV/div %3d MHz: ", channel + 1,
+					       thunderscopehw_calibration_vdiv(v), bandwidths[bw]);
+					if (calibration.codes_per_dac[channel][v][bw] == 0) {
+						printf("failed\n");
+						continue;
+					}
+					printf("dac = %4d", calibration.dac[channel][v][bw]);
+					if (verbose) printf("  codes/dac = %8.4f", calibration.codes_per_dac[channel][v][bw]);
+					printf("\n");
 				}
 			}
-			printf("Channel %d calibration = %f\n", channel + 1, (minoffset + maxoffset) / 2);
 		}
-		TS_RUN(disable_channel(ts, channel));
+	}
+
+	if (store) {
+		struct ThunderScopeHWCalibration stored;
+		TS_RUN(calibration_get(ts, &stored));
+		stored.offsets = calibration;
+		TS_RUN(calibration_store(ts, &stored));
 	}
 }
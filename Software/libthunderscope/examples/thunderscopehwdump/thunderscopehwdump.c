@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <math.h>
 #include <string.h>
 
 #ifdef WIN32
@@ -31,6 +32,9 @@ struct Option options[] = {
 	{"samples",            true,  2 },
 	{"output-samplerate",  true,  3 },
 	{"help",               false, 4 },
+	{"demod",              true,  5 },
+	{"demod-frequency",    true,  6 },
+	{"autosetup",          false, 7 },
 
 	{"bw-all",             true,  0x10 },
 	{"bw1",                true,  0x11 },
@@ -75,7 +79,10 @@ void usage()
 		"thunderscopehwdump [options] [filename.wav]\n"
 		"  --device=<deviceid>\n"
 		"  --samples=<number of samples> must be divisable by 4096\n"
-		"  --output-samplerate=<rate> samplerate used in wav file\n"
+		"  --output-samplerate=<rate> resample each channel to this rate, 16 bit wav\n"
+		"  --demod=am/fm/pm demodulate each channel to audio, 48000 Hz unless --output-samplerate is given\n"
+		"  --demod-frequency=<carrier> (Hz)\n"
+		"  --autosetup pick channels, vdiv and voffset from the signals, after the options below\n"
 		"  --bw[1/2/3/4/-all]=20/100/200/350 (Hz)\n"
 		"  --vdiv[1/2/3/4/-all]=1/2/5/10/20/50/100/200/500/1000/2000/5000/10000 (mV)\n"
 		"  --voffset[1/2/3/4/-all]=<voltage offset> (volts)\n"
@@ -110,10 +117,136 @@ int mygetopt(int argc, char** argv) {
 	exit(1);
 }
 
+#define RESAMPLE_CHUNK (1 << 20)
+
+size_t process_channel(struct ThunderScopeHWResampler* resampler, struct ThunderScopeHWDemod* demod,
+		       const int8_t* samples, size_t length, float* out)
+{
+	if (demod) return thunderscopehw_demod_process(demod, samples, length, out);
+	return thunderscopehw_resampler_process(resampler, samples, length, out);
+}
+
+// Reads samples interleaved samples and writes the channels in the given
+// interleave slots as 16 bit PCM, exactly output_samples frames. Channels are
+// either resampled or, with a demodulation mode, demodulated at the carrier.
+// Returns false after printing the error.
+bool write_resampled(struct ThunderScopeHW* ts, FILE* outfile, uint64_t samples, int interleave,
+		     const int* slots, int channels, int samplerate, uint64_t output_samples,
+		     int demod, double carrier)
+{
+	enum ThunderScopeHWStatus ret;
+	bool ok = false;
+	size_t chunk = RESAMPLE_CHUNK / interleave;
+	struct ThunderScopeHWResampler* resamplers[4] = { NULL };
+	struct ThunderScopeHWDemod* demods[4] = { NULL };
+	float scale[4];
+	size_t max_output = 0;
+	int8_t* deinterleaved[4] = { NULL };
+	float* resampled[4] = { NULL };
+	int16_t* frames = NULL;
+	uint8_t* buffer = NULL;
+#ifdef _WIN32
+	buffer = _aligned_malloc(RESAMPLE_CHUNK, 4096);
+#else
+	if (posix_memalign((void**)&buffer, 4096, RESAMPLE_CHUNK)) buffer = NULL;
+#endif
+	for (int i = 0; i < interleave; i++) deinterleaved[i] = (int8_t*)malloc(chunk);
+	for (int c = 0; c < channels; c++) {
+		if (demod) {
+			demods[c] = thunderscopehw_demod_create((enum ThunderScopeHWDemodulation)demod, 1e9 / interleave,
+								carrier, 0, samplerate);
+			if (!demods[c]) {
+				fprintf(stderr, "Unsupported demodulation settings.\n");
+				goto done;
+			}
+			// Full scale of the demodulator maps to full scale of the wav.
+			scale[c] = (float)(INT16_MAX / thunderscopehw_demod_full_scale(demods[c]));
+			max_output = thunderscopehw_demod_max_output(demods[c], chunk);
+		} else {
+			resamplers[c] = thunderscopehw_resampler_create(1e9 / interleave, samplerate);
+			if (!resamplers[c]) {
+				fprintf(stderr, "Unsupported output samplerate.\n");
+				goto done;
+			}
+			scale[c] = 256;
+			max_output = thunderscopehw_resampler_max_output(resamplers[c], chunk);
+		}
+		resampled[c] = (float*)malloc(max_output * sizeof(float));
+		if (!resampled[c]) break;
+	}
+	frames = (int16_t*)malloc(max_output * channels * sizeof(int16_t));
+	bool allocated = buffer && frames;
+	for (int i = 0; i < interleave; i++) allocated = allocated && deinterleaved[i];
+	for (int c = 0; c < channels; c++) allocated = allocated && resampled[c];
+	if (!allocated) {
+		fprintf(stderr, "Out of memory.\n");
+		goto done;
+	}
+
+	while (output_samples) {
+		size_t produced = 0;
+		if (samples) {
+			int64_t to_copy = samples;
+			if (to_copy > RESAMPLE_CHUNK) to_copy = RESAMPLE_CHUNK;
+			ret = thunderscopehw_read(ts, buffer, to_copy);
+			if (ret != THUNDERSCOPEHW_STATUS_OK) {
+				fprintf(stderr, "Thunderscope read error, error = %s\n", thunderscopehw_describe_error(ret));
+				goto done;
+			}
+			thunderscopehw_deinterleave((const int8_t*)buffer, to_copy, interleave, deinterleaved);
+			for (int c = 0; c < channels; c++) {
+				produced = process_channel(resamplers[c], demods[c], deinterleaved[slots[c]],
+							   to_copy / interleave, resampled[c]);
+			}
+			samples -= to_copy;
+		} else {
+			// Flush the filter delay with silence.
+			memset(deinterleaved[0], 0, chunk);
+			for (int c = 0; c < channels; c++) {
+				produced = process_channel(resamplers[c], demods[c], deinterleaved[0], chunk, resampled[c]);
+			}
+		}
+		if (produced > output_samples) produced = output_samples;
+		for (size_t i = 0; i < produced; i++) {
+			for (int c = 0; c < channels; c++) {
+				// Rounded, truncating would bias every frame by half an LSB.
+				float v = resampled[c][i] * scale[c];
+				if (v > INT16_MAX) v = INT16_MAX;
+				if (v < INT16_MIN) v = INT16_MIN;
+				frames[i * channels + c] = (int16_t)lrintf(v);
+			}
+		}
+		if (fwrite(frames, sizeof(int16_t) * channels, produced, outfile) != produced) {
+			perror("fwrite");
+			goto done;
+		}
+		output_samples -= produced;
+	}
+	ok = true;
+
+done:
+	for (int c = 0; c < channels; c++) {
+		thunderscopehw_resampler_destroy(resamplers[c]);
+		thunderscopehw_demod_destroy(demods[c]);
+		free(resampled[c]);
+	}
+	for (int i = 0; i < interleave; i++) free(deinterleaved[i]);
+	free(frames);
+#ifdef _WIN32
+	_aligned_free(buffer);
+#else
+	free(buffer);
+#endif
+	return ok;
+}
+
 int main(int argc, char** argv) {
 	uint64_t scope_id = 0;
 	uint64_t samples = 0;
 	int samplerate = 0;
+	int demod = 0;
+	double carrier = 0;
+	bool autosetup = false;
 	while (1) {
 		switch (mygetopt(argc, argv)) {
 		case 1:
@@ -137,6 +270,27 @@ int main(int argc, char** argv) {
 		case 4:
 			usage();
 			exit(0);
+		case 5:
+			if (!strcmp(optarg, "am")) {
+				demod = THUNDERSCOPEHW_DEMODULATION_AM;
+			} else if (!strcmp(optarg, "fm")) {
+				demod = THUNDERSCOPEHW_DEMODULATION_FM;
+			} else if (!strcmp(optarg, "pm")) {
+				demod = THUNDERSCOPEHW_DEMODULATION_PM;
+			} else {
+				fprintf(stderr, "Demodulation must be am, fm or pm.\n");
+				exit(1);
+			}
+			continue;
+		case 6:
+			if (!sscanf(optarg, "%lf", &carrier)) {
+			        fprintf(stderr, "Carrier frequency must be a number.\n");
+				exit(1);
+			}
+			continue;
+		case 7:
+			autosetup = true;
+			continue;
 		default:
 			continue;
 		case -1:
@@ -145,6 +299,8 @@ int main(int argc, char** argv) {
 		break;
 	}
 
+	if (demod && !samplerate) samplerate = 48000;
+
 	if (scope_id == 0) {
 		uint64_t scope_ids[32];
 		int scopes = thunderscopehw_scan(scope_ids, 32);
@@ -231,6 +387,25 @@ int main(int argc, char** argv) {
 		}
 	}
 
+	if (autosetup) {
+		struct ThunderScopeHWAutosetup setup;
+		ret = thunderscopehw_autosetup(ts, &setup);
+		if (ret != THUNDERSCOPEHW_STATUS_OK) {
+			fprintf(stderr, "Autosetup failed. error =%s\n", thunderscopehw_describe_error(ret));
+			exit(1);
+		}
+		enabled_channels = 0;
+		num_channels = 0;
+		for (int channel = 0; channel < 4; channel++) {
+			const struct ThunderScopeHWAutosetupChannel* c = &setup.channels[channel];
+			if (!c->active) continue;
+			fprintf(stderr, "Channel %d: %d mV/div, voffset %.4f, %.3f Vpp, %.1f Hz\n",
+				channel + 1, c->vdiv, c->voffset, c->peak_to_peak, c->frequency);
+			enabled_channels |= 1 << channel;
+			num_channels++;
+		}
+	}
+
 	if (!num_channels) {
 		fprintf(stderr, "No channels selected.\n");
 		exit(1);
@@ -246,6 +421,18 @@ int main(int argc, char** argv) {
 		exit(1);
 	}
 
+	// Interleave slot of each enabled channel, in file order. With three
+	// channels enabled the scope still runs in four channel mode.
+	int interleave = thunderscopehw_interleave_count(ts);
+	int slots[4];
+	int slot = 0;
+	for (int channel = 0; channel < 4; channel++) {
+		if (!(enabled_channels & (1 << channel))) continue;
+		slots[slot] = interleave == 4 ? channel : slot;
+		slot++;
+	}
+	uint64_t output_samples = (uint64_t)((double)samples * samplerate / 1e9);
+
 	FILE* outfile = stdout;
 	if (optind < argc) {
 		outfile = fopen(argv[optind], "wb");
@@ -272,24 +459,29 @@ int main(int argc, char** argv) {
 	struct Fmt fmt;
 	fmt.pcm = 1;
 	fmt.channels = num_channels;
+	uint64_t data_size = samples * fmt.channels;
 	if (samplerate) {
 		fmt.rate = samplerate;
+		fmt.block_align = 2 * fmt.channels;
+		fmt.byterate = fmt.rate * fmt.block_align;
+		fmt.bits_per_sample = 16;
+		data_size = output_samples * fmt.block_align;
 	} else {
 		fmt.rate = 1000000000 / fmt.channels;
+		fmt.byterate = 1000000000;
+		fmt.block_align = 0;
+		fmt.bits_per_sample = 8;
 	}
-	fmt.byterate = 1000000000;
-	fmt.block_align = 0;
-	fmt.bits_per_sample = 8;
 
 	fwrite("RIFF", 4, 1, outfile);
 	write32(4ull +
 		16 + 8 + /* fmt */
-		samples * fmt.channels + 8 /* data */, outfile);
+		data_size + 8 /* data */, outfile);
 	fwrite("WAVEfmt ", 8, 1, outfile);
 	write32(16, outfile);
 	fwrite(&fmt, 16, 1, outfile);
 	fwrite("data", 4, 1, outfile);
-	write32(samples * fmt.channels, outfile);
+	write32(data_size, outfile);
 
 	ret = thunderscopehw_start(ts);
 	if (ret != THUNDERSCOPEHW_STATUS_OK) {
@@ -297,6 +489,11 @@ int main(int argc, char** argv) {
 		exit(1);
 	}
 
+	if (samplerate) {
+		return write_resampled(ts, outfile, samples, interleave, slots, num_channels, samplerate, output_samples,
+				       demod, carrier) ? 0 : 1;
+	}
+
 #define BUFFER_SIZE samples
 	uint8_t* buffer;
 #ifdef _WIN32
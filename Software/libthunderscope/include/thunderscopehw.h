@@ -27,6 +27,7 @@ enum ThunderScopeHWStatus {
 	THUNDERSCOPEHW_STATUS_ALREADY_STOPPED,
 	THUNDERSCOPEHW_STATUS_OFFSET_TOO_LOW,
 	THUNDERSCOPEHW_STATUS_OFFSET_TOO_HIGH,
+	THUNDERSCOPEHW_STATUS_INVALID_PARAMETER,
 };
 
 // Return's number of scopes.
@@ -54,4 +55,712 @@ int64_t thunderscopehw_available(struct ThunderScopeHW* ts);
 
 const char* thunderscopehw_describe_error(enum ThunderScopeHWStatus err);
 
+// Aggregate ADC sample rate, split evenly between the interleaved channels.
+#define THUNDERSCOPEHW_SAMPLE_RATE 1000000000
+
+// Number of channels interleaved in the data returned by thunderscopehw_read (1, 2 or 4).
+int thunderscopehw_interleave_count(struct ThunderScopeHW* ts);
+
+// Volts represented by one ADC code at the channel's current vdiv (10 divisions full scale).
+double thunderscopehw_volts_per_lsb(struct ThunderScopeHW* ts, int channel);
+
+// Front end equalizer taps for one channel at one bandwidth setting (20/100/200/350),
+// copied into ts. Zero taps removes the equalizer.
+enum ThunderScopeHWStatus thunderscopehw_equalizer_set(struct ThunderScopeHW* ts, int channel, int bandwidth,
+						       const float* taps, size_t taps_count);
+// Designs taps (an odd number) inverting a measured response given at ascending frequencies
+// (Hz) as linear gain and phase (radians, bulk delay removed). Boost is limited to max_gain,
+// above the last frequency the response rolls off. The taps add (taps_count - 1) / 2 samples delay.
+enum ThunderScopeHWStatus thunderscopehw_equalizer_design(const double* frequencies, const double* gains,
+							  const double* phases, size_t points, double sample_rate,
+							  double max_gain, float* taps, size_t taps_count);
+
+// Conversion of one channel to volts, optionally fused with the equalizer of its
+// current bandwidth setting. Settings are captured at creation. Short equalizers
+// run as a direct convolution, long ones as FFT overlap-save, emitting whole blocks.
+struct ThunderScopeHWConverter;
+
+struct ThunderScopeHWConverter* thunderscopehw_converter_create(struct ThunderScopeHW* ts, int channel, bool equalize);
+void thunderscopehw_converter_destroy(struct ThunderScopeHWConverter* c);
+void thunderscopehw_converter_reset(struct ThunderScopeHWConverter* c);
+// Samples the output lags the input by.
+size_t thunderscopehw_converter_delay(struct ThunderScopeHWConverter* c);
+// Upper bound on the outputs produced by `length` more inputs.
+size_t thunderscopehw_converter_max_output(struct ThunderScopeHWConverter* c, size_t length);
+// Consumes samples of one channel, returns the number of volts written.
+size_t thunderscopehw_converter_process(struct ThunderScopeHWConverter* c, const int8_t* samples, size_t length, float* volts);
+
+// ADC core mismatch. The HMCAD1511 time interleaves 8 cores, byte i of a read comes
+// from core i % 8 in every channel mode, so trims are per core, relative to the other
+// cores feeding the same channel. Trims are kept per interleave count in the
+// calibration store and applied by thunderscopehw_read while correction is enabled.
+#define THUNDERSCOPEHW_ADC_CORES 8
+
+struct ThunderScopeHWCoreTrim {
+	float offset[THUNDERSCOPEHW_ADC_CORES];  // codes added by the core
+	float gain[THUNDERSCOPEHW_ADC_CORES];    // gain relative to the channel, 0.5 to 2
+};
+
+// Offset calibration: the offset DAC code centring each channel on code 0 at every
+// vdiv (1/2/5/10/20/50/100/200/500/1000/2000/5000/10000 mV) and bandwidth (20/100/200/350),
+// with the slope in ADC codes per DAC code. Inputs must be terminated. All channels are
+// measured at once in four channel mode, a few short reads per point. Points that could
+// not be solved have a zero slope. Channel settings are restored afterwards.
+#define THUNDERSCOPEHW_CALIBRATION_VDIVS 13
+#define THUNDERSCOPEHW_CALIBRATION_BANDWIDTHS 4
+
+struct ThunderScopeHWOffsetCalibration {
+	uint16_t dac[4][THUNDERSCOPEHW_CALIBRATION_VDIVS][THUNDERSCOPEHW_CALIBRATION_BANDWIDTHS];
+	float codes_per_dac[4][THUNDERSCOPEHW_CALIBRATION_VDIVS][THUNDERSCOPEHW_CALIBRATION_BANDWIDTHS];
+};
+
+// Vdiv in mV of a calibration table index.
+int thunderscopehw_calibration_vdiv(int index);
+enum ThunderScopeHWStatus thunderscopehw_calibrate_offsets(struct ThunderScopeHW* ts, struct ThunderScopeHWOffsetCalibration* calibration);
+
+// Calibration store, one versioned binary file per device in $THUNDERSCOPEHW_CAL_DIR
+// (default ~/.thunderscopehw), memory mapped at connect. Channel settings then look
+// up the offset DAC code, volts per code include the gain, and reads apply the core
+// trims. Zero slopes and gains mark entries left at the nominal values.
+struct ThunderScopeHWCalibration {
+	struct ThunderScopeHWOffsetCalibration offsets;
+	float gain[4][THUNDERSCOPEHW_CALIBRATION_VDIVS][THUNDERSCOPEHW_CALIBRATION_BANDWIDTHS];  // actual / nominal volts per code
+	double skew[4];                 // seconds each channel lags channel 1
+	uint32_t core_trim_valid;       // bit m set for interleave count 1 << m
+	struct ThunderScopeHWCoreTrim core_trim[3];
+};
+
+// Current calibration of the connected device, all zero when there is none.
+enum ThunderScopeHWStatus thunderscopehw_calibration_get(struct ThunderScopeHW* ts, struct ThunderScopeHWCalibration* calibration);
+// Writes the device's calibration file and maps it in place of the old one.
+enum ThunderScopeHWStatus thunderscopehw_calibration_store(struct ThunderScopeHW* ts, const struct ThunderScopeHWCalibration* calibration);
+
+// Auto setup: picks the vdiv and offset that centre each channel's signal at about 80%
+// of full scale. All channels are ranged at once in four channel mode with short reads,
+// then one longer read at the new settings finds the fundamental and a trigger level.
+// Channels under 10 mV peak to peak and within 100 mV of ground are turned off, unless
+// no channel has a signal, in which case the settings are left as they were. Bandwidth
+// and coupling are kept. Signals below about 1 kHz are ranged on part of a period.
+struct ThunderScopeHWAutosetupChannel {
+	bool active;
+	int vdiv;               // mV
+	double voffset;         // as passed to thunderscopehw_voltage_offset_set
+	double peak_to_peak;    // volts
+	double frequency;       // Hz, 0 without a waveform or two full periods
+	float trigger_level;    // code halfway between base and top at the new settings
+};
+
+struct ThunderScopeHWAutosetup {
+	struct ThunderScopeHWAutosetupChannel channels[4];
+};
+
+enum ThunderScopeHWStatus thunderscopehw_autosetup(struct ThunderScopeHW* ts, struct ThunderScopeHWAutosetup* result);
+
+
+// Background estimator fed with consecutive uncorrected reads.
+struct ThunderScopeHWCoreEstimator;
+
+struct ThunderScopeHWCoreEstimator* thunderscopehw_core_estimator_create(int interleave);
+void thunderscopehw_core_estimator_destroy(struct ThunderScopeHWCoreEstimator* e);
+void thunderscopehw_core_estimator_reset(struct ThunderScopeHWCoreEstimator* e);
+void thunderscopehw_core_estimator_process(struct ThunderScopeHWCoreEstimator* e, const int8_t* data, size_t length);
+// Fails while a core has seen no signal.
+enum ThunderScopeHWStatus thunderscopehw_core_estimator_estimate(struct ThunderScopeHWCoreEstimator* e, struct ThunderScopeHWCoreTrim* trim);
+
+// Corrects data starting at core 0 in place.
+void thunderscopehw_core_correct(const struct ThunderScopeHWCoreTrim* trim, int8_t* data, size_t length);
+// Stores the trim for an interleave count, and in the calibration store when connected.
+enum ThunderScopeHWStatus thunderscopehw_core_trim_set(struct ThunderScopeHW* ts, int interleave, const struct ThunderScopeHWCoreTrim* trim);
+enum ThunderScopeHWStatus thunderscopehw_core_trim_get(struct ThunderScopeHW* ts, int interleave, struct ThunderScopeHWCoreTrim* trim);
+void thunderscopehw_core_correction_enable(struct ThunderScopeHW* ts, bool enable);
+
+// Splits interleaved samples into one buffer per channel, each receiving length / num_channels samples.
+void thunderscopehw_deinterleave(const int8_t* data, size_t length, int num_channels, int8_t* const* out);
+
+// Amplitude statistics of one channel in ADC codes, accumulated over any number of spans.
+struct ThunderScopeHWStats {
+	int8_t threshold;      // high/low are counted relative to this code
+	bool with_histogram;
+	uint64_t count;
+	int64_t sum;
+	uint64_t sum_squares;
+	int8_t min;
+	int8_t max;
+	uint64_t high;
+	uint64_t low;
+	uint64_t histogram[256];  // indexed by code + 128
+};
+
+struct ThunderScopeHWMeasurements {
+	double mean;
+	double rms;
+	double ac_rms;
+	double min;
+	double max;
+	double peak_to_peak;
+	double crest_factor;
+};
+
+void thunderscopehw_stats_init(struct ThunderScopeHWStats* stats, int8_t threshold, bool with_histogram);
+// Single pass over samples updating every statistic.
+void thunderscopehw_stats_update(struct ThunderScopeHWStats* stats, const int8_t* samples, size_t length);
+void thunderscopehw_stats_merge(struct ThunderScopeHWStats* dst, const struct ThunderScopeHWStats* src);
+// Derived measurements, in volts when volts_per_lsb comes from thunderscopehw_volts_per_lsb (1.0 gives codes).
+void thunderscopehw_stats_measure(const struct ThunderScopeHWStats* stats, double volts_per_lsb, struct ThunderScopeHWMeasurements* out);
+
+// Statistics over a window sliding by block_size samples and spanning `blocks` blocks.
+struct ThunderScopeHWStatsWindow;
+
+struct ThunderScopeHWStatsWindow* thunderscopehw_stats_window_create(size_t block_size, size_t blocks, int8_t threshold);
+void thunderscopehw_stats_window_destroy(struct ThunderScopeHWStatsWindow* w);
+void thunderscopehw_stats_window_reset(struct ThunderScopeHWStatsWindow* w);
+// Consumes samples of one channel, returns the number of blocks completed.
+size_t thunderscopehw_stats_window_process(struct ThunderScopeHWStatsWindow* w, const int8_t* samples, size_t length);
+// Statistics of the completed blocks in the window (without histogram).
+void thunderscopehw_stats_window_get(struct ThunderScopeHWStatsWindow* w, struct ThunderScopeHWStats* stats);
+
+// Running mean / deviation / extremes of a measurement.
+struct ThunderScopeHWMeasureStat {
+	uint64_t count;
+	double mean;
+	double m2;
+	double min;
+	double max;
+	double last;
+};
+
+void thunderscopehw_measure_stat_clear(struct ThunderScopeHWMeasureStat* stat);
+void thunderscopehw_measure_stat_add(struct ThunderScopeHWMeasureStat* stat, double value);
+double thunderscopehw_measure_stat_stddev(const struct ThunderScopeHWMeasureStat* stat);
+
+// Timing: edge measurements using 10/50/90% reference levels between base and top (codes).
+// Times are in seconds, duty cycle, overshoot, undershoot and preshoot in percent of
+// amplitude. Overshoot above top and undershoot below base come from the rising and
+// falling edges' ringing; preshoot is the dip below base in about the last fifth to
+// third of the low state, before a rising edge.
+struct ThunderScopeHWTimingResults {
+	struct ThunderScopeHWMeasureStat rise_time;
+	struct ThunderScopeHWMeasureStat fall_time;
+	struct ThunderScopeHWMeasureStat period;
+	struct ThunderScopeHWMeasureStat frequency;
+	struct ThunderScopeHWMeasureStat positive_width;
+	struct ThunderScopeHWMeasureStat negative_width;
+	struct ThunderScopeHWMeasureStat duty_cycle;
+	struct ThunderScopeHWMeasureStat overshoot;
+	struct ThunderScopeHWMeasureStat preshoot;
+	struct ThunderScopeHWMeasureStat undershoot;
+};
+
+struct ThunderScopeHWTiming;
+
+struct ThunderScopeHWTiming* thunderscopehw_timing_create(double sample_rate, float base, float top);
+void thunderscopehw_timing_destroy(struct ThunderScopeHWTiming* t);
+void thunderscopehw_timing_set_levels(struct ThunderScopeHWTiming* t, float base, float top);
+// Base and top from the histogram modes of each half, or min/max without a histogram.
+void thunderscopehw_timing_levels(const struct ThunderScopeHWStats* stats, float* base, float* top);
+// Starts a new acquisition, statistics are kept.
+void thunderscopehw_timing_restart(struct ThunderScopeHWTiming* t);
+void thunderscopehw_timing_clear_results(struct ThunderScopeHWTiming* t);
+// Consumes samples of one channel, returns the number of edges completed.
+size_t thunderscopehw_timing_process(struct ThunderScopeHWTiming* t, const int8_t* samples, size_t length);
+const struct ThunderScopeHWTimingResults* thunderscopehw_timing_results(struct ThunderScopeHWTiming* t);
+
+// High resolution: CIC plus droop compensating FIR decimation of one channel, by a
+// total of `decimation` (even, 4 to THUNDERSCOPEHW_ERES_MAX_DECIMATION). Output codes
+// are scaled by 256, so the low byte carries the extra resolution gained by averaging.
+// Past the maximum the CIC gain no longer fits its 64 bit accumulators.
+#define THUNDERSCOPEHW_ERES_MAX_DECIMATION (1 << 18)
+
+struct ThunderScopeHWEres;
+
+struct ThunderScopeHWEres* thunderscopehw_eres_create(uint32_t decimation);
+void thunderscopehw_eres_destroy(struct ThunderScopeHWEres* e);
+void thunderscopehw_eres_reset(struct ThunderScopeHWEres* e);
+// Consumes samples of one channel, returns the number of outputs (at most length / decimation + 1).
+size_t thunderscopehw_eres_process(struct ThunderScopeHWEres* e, const int8_t* samples, size_t length, int16_t* out);
+// Bits of resolution gained on white noise, half a bit per octave of decimation.
+double thunderscopehw_eres_extra_bits(struct ThunderScopeHWEres* e);
+
+// Resampler: arbitrary rate conversion of one channel. Large ratios are first
+// decimated by a CIC, the rest runs through a polyphase bank, exact L/M when the
+// rates allow and interpolated between phases otherwise.
+struct ThunderScopeHWResampler;
+
+struct ThunderScopeHWResampler* thunderscopehw_resampler_create(double input_rate, double output_rate);
+void thunderscopehw_resampler_destroy(struct ThunderScopeHWResampler* r);
+void thunderscopehw_resampler_reset(struct ThunderScopeHWResampler* r);
+// Upper bound on the outputs produced by `length` more inputs.
+size_t thunderscopehw_resampler_max_output(struct ThunderScopeHWResampler* r, size_t length);
+// Consumes samples of one channel, writes outputs in ADC codes, returns their number.
+size_t thunderscopehw_resampler_process(struct ThunderScopeHWResampler* r, const int8_t* samples, size_t length, float* out);
+
+// Digital downconverter: mixes one channel with an NCO at `frequency` and
+// decimates the complex result by `decimation` (even, 4 to 2048) through a CIC
+// and a compensating FIR. Outputs are interleaved I/Q pairs in ADC codes, a
+// tone of amplitude A comes out with magnitude A / 2. Independent DDCs can
+// share one input, each object is self contained and may run on its own thread.
+struct ThunderScopeHWDdc;
+
+struct ThunderScopeHWDdc* thunderscopehw_ddc_create(double sample_rate, double frequency, uint32_t decimation);
+void thunderscopehw_ddc_destroy(struct ThunderScopeHWDdc* ddc);
+void thunderscopehw_ddc_reset(struct ThunderScopeHWDdc* ddc);
+// Retunes without a phase jump.
+void thunderscopehw_ddc_set_frequency(struct ThunderScopeHWDdc* ddc, double frequency);
+double thunderscopehw_ddc_output_rate(struct ThunderScopeHWDdc* ddc);
+// Consumes samples of one channel, returns the number of I/Q pairs (at most length / decimation + 1).
+size_t thunderscopehw_ddc_process(struct ThunderScopeHWDdc* ddc, const int8_t* samples, size_t length, float* iq);
+// Same with the codes scaled by 256.
+size_t thunderscopehw_ddc_process_i16(struct ThunderScopeHWDdc* ddc, const int8_t* samples, size_t length, int16_t* iq);
+// Runs several DDCs over the same input tile by tile, so it is read from memory once.
+// Pair counts are returned in `pairs`.
+void thunderscopehw_ddc_process_multi(struct ThunderScopeHWDdc* const* ddcs, int count, const int8_t* samples,
+				      size_t length, float* const* iq, size_t* pairs);
+
+// Demodulator: tunes a DDC to the carrier and demodulates the baseband I/Q.
+// AM gives the carrier amplitude in codes, FM the frequency offset in Hz and PM
+// the phase in radians. With an audio rate the output is resampled to it,
+// otherwise it comes at the DDC rate. Decimation 0 picks the largest DDC
+// decimation that keeps four times the audio rate.
+enum ThunderScopeHWDemodulation {
+	THUNDERSCOPEHW_DEMODULATION_AM = 60000,
+	THUNDERSCOPEHW_DEMODULATION_FM,
+	THUNDERSCOPEHW_DEMODULATION_PM,
+};
+
+struct ThunderScopeHWDemod;
+
+struct ThunderScopeHWDemod* thunderscopehw_demod_create(enum ThunderScopeHWDemodulation mode, double sample_rate,
+							double frequency, uint32_t decimation, double audio_rate);
+void thunderscopehw_demod_destroy(struct ThunderScopeHWDemod* d);
+void thunderscopehw_demod_reset(struct ThunderScopeHWDemod* d);
+double thunderscopehw_demod_output_rate(struct ThunderScopeHWDemod* d);
+// Largest output magnitude: 128 codes, half the DDC rate or pi.
+double thunderscopehw_demod_full_scale(struct ThunderScopeHWDemod* d);
+// Upper bound on the outputs produced by `length` more inputs.
+size_t thunderscopehw_demod_max_output(struct ThunderScopeHWDemod* d, size_t length);
+// Consumes samples of one channel, returns the number of outputs.
+size_t thunderscopehw_demod_process(struct ThunderScopeHWDemod* d, const int8_t* samples, size_t length, float* out);
+
+// Peak detect: reduces each block of `decimation` samples per channel to a (min, max) pair.
+struct ThunderScopeHWPeakDetect;
+
+struct ThunderScopeHWPeakDetect* thunderscopehw_peak_detect_create(int num_channels, uint64_t decimation);
+void thunderscopehw_peak_detect_destroy(struct ThunderScopeHWPeakDetect* pd);
+void thunderscopehw_peak_detect_reset(struct ThunderScopeHWPeakDetect* pd);
+// Decimation giving roughly output_rate (min, max) pairs per second per channel.
+uint64_t thunderscopehw_peak_detect_decimation(int num_channels, double output_rate);
+// Upper bound on the points produced by feeding `length` interleaved samples.
+size_t thunderscopehw_peak_detect_max_points(struct ThunderScopeHWPeakDetect* pd, size_t length);
+// Consumes interleaved samples (length a multiple of num_channels) and writes
+// min0, max0, min1, max1, ... per completed point. Returns the number of points.
+size_t thunderscopehw_peak_detect_process(struct ThunderScopeHWPeakDetect* pd, const int8_t* data, size_t length, int8_t* out);
+
+// Roll mode: peak detected strip chart keeping the last history_points points.
+struct ThunderScopeHWRoll;
+
+struct ThunderScopeHWRoll* thunderscopehw_roll_create(int num_channels, double points_per_second, size_t history_points);
+void thunderscopehw_roll_destroy(struct ThunderScopeHWRoll* roll);
+void thunderscopehw_roll_reset(struct ThunderScopeHWRoll* roll);
+// Consumes interleaved samples, returns the number of points appended.
+size_t thunderscopehw_roll_process(struct ThunderScopeHWRoll* roll, const int8_t* data, size_t length);
+// Sequence number of the next point to be appended.
+uint64_t thunderscopehw_roll_total_points(struct ThunderScopeHWRoll* roll);
+// Copies up to max_points points starting at *cursor, in peak detect layout, and
+// advances *cursor. A cursor older than the history is moved to the oldest point kept.
+size_t thunderscopehw_roll_read(struct ThunderScopeHWRoll* roll, uint64_t* cursor, int8_t* out, size_t max_points);
+
+// Persistence: intensity graded histogram of time bin x ADC code.
+enum ThunderScopeHWPersistenceMode {
+	THUNDERSCOPEHW_PERSISTENCE_INFINITE = 30000,
+	// Counts are halved every decay_records records.
+	THUNDERSCOPEHW_PERSISTENCE_DECAY,
+};
+
+struct ThunderScopeHWPersistence;
+
+struct ThunderScopeHWPersistence* thunderscopehw_persistence_create(size_t time_bins, enum ThunderScopeHWPersistenceMode mode, uint32_t decay_records);
+void thunderscopehw_persistence_destroy(struct ThunderScopeHWPersistence* p);
+void thunderscopehw_persistence_clear(struct ThunderScopeHWPersistence* p);
+// Adds one triggered record of a single channel, stretched over all time bins.
+void thunderscopehw_persistence_add(struct ThunderScopeHWPersistence* p, const int8_t* record, size_t length);
+// Adds the counts of src (e.g. filled by another thread) to dst and clears src.
+enum ThunderScopeHWStatus thunderscopehw_persistence_merge(struct ThunderScopeHWPersistence* dst, struct ThunderScopeHWPersistence* src);
+uint64_t thunderscopehw_persistence_records(struct ThunderScopeHWPersistence* p);
+// Hit counts indexed [time_bin * 256 + code + 128].
+const uint32_t* thunderscopehw_persistence_counts(struct ThunderScopeHWPersistence* p);
+// Renders 256 rows (code 127 first) of time_bins columns, scaled so the busiest cell is 255.
+void thunderscopehw_persistence_image(struct ThunderScopeHWPersistence* p, uint8_t* image);
+
+// Averaging and envelope over triggered records of one channel. Each record is aligned
+// on the sub-sample position `start` of its first point in `samples` (for instance the
+// interpolated trigger crossing minus the pretrigger), and points are interpolated to
+// 1/256 of a sample. Results are in codes and can be read at any time.
+#define THUNDERSCOPEHW_AVERAGE_MAX_RECORDS 65536
+
+struct ThunderScopeHWAverage;
+
+// Mean of the last `records` records (a power of two up to THUNDERSCOPEHW_AVERAGE_MAX_RECORDS),
+// exact until that many were added, exponential with the same weight afterwards.
+struct ThunderScopeHWAverage* thunderscopehw_average_create(size_t points, uint32_t records);
+void thunderscopehw_average_destroy(struct ThunderScopeHWAverage* a);
+void thunderscopehw_average_reset(struct ThunderScopeHWAverage* a);
+// Fails unless samples cover every point from start.
+enum ThunderScopeHWStatus thunderscopehw_average_add(struct ThunderScopeHWAverage* a, const int8_t* samples, size_t length, double start);
+// Adds the records of src (e.g. filled by another thread) to dst and resets src.
+enum ThunderScopeHWStatus thunderscopehw_average_merge(struct ThunderScopeHWAverage* dst, struct ThunderScopeHWAverage* src);
+uint64_t thunderscopehw_average_records(struct ThunderScopeHWAverage* a);
+void thunderscopehw_average_read(struct ThunderScopeHWAverage* a, float* out);
+
+// Minimum and maximum of every point over all records since the last reset.
+struct ThunderScopeHWEnvelope;
+
+struct ThunderScopeHWEnvelope* thunderscopehw_envelope_create(size_t points);
+void thunderscopehw_envelope_destroy(struct ThunderScopeHWEnvelope* e);
+void thunderscopehw_envelope_reset(struct ThunderScopeHWEnvelope* e);
+enum ThunderScopeHWStatus thunderscopehw_envelope_add(struct ThunderScopeHWEnvelope* e, const int8_t* samples, size_t length, double start);
+enum ThunderScopeHWStatus thunderscopehw_envelope_merge(struct ThunderScopeHWEnvelope* dst, struct ThunderScopeHWEnvelope* src);
+uint64_t thunderscopehw_envelope_records(struct ThunderScopeHWEnvelope* e);
+// Points never reached read as 0.
+void thunderscopehw_envelope_read(struct ThunderScopeHWEnvelope* e, float* min, float* max);
+
+// Math channels: an expression over the deinterleaved channels, compiled once into a
+// chain of vector kernels that run a tile at a time. Expressions use + - * /, unary
+// minus, parentheses, numbers, ch1..ch4 and the functions integ(x) (over seconds),
+// deriv(x) (per second) and abs(x). Constants are folded and scales and offsets merged
+// into the kernels before them. Channels are in volts when volts_per_lsb (one entry per
+// channel) is given, codes otherwise. integ and deriv carry their state across calls.
+struct ThunderScopeHWMath;
+
+// NULL when the expression does not parse.
+struct ThunderScopeHWMath* thunderscopehw_math_create(const char* expression, double sample_rate, const double* volts_per_lsb);
+void thunderscopehw_math_destroy(struct ThunderScopeHWMath* m);
+void thunderscopehw_math_reset(struct ThunderScopeHWMath* m);
+// Channels used, bit c for ch<c + 1>.
+int thunderscopehw_math_channels(struct ThunderScopeHWMath* m);
+// channels[c] holds `length` samples of channel c, only used channels are read.
+void thunderscopehw_math_process(struct ThunderScopeHWMath* m, const int8_t* const* channels, size_t length, float* out);
+// Same, rounded to int8 codes of units_per_code each and saturated to +-127 (NaN,
+// e.g. 0 / 0, gives 0), so the result feeds anything taking a physical channel.
+void thunderscopehw_math_process_i8(struct ThunderScopeHWMath* m, const int8_t* const* channels, size_t length,
+				    double units_per_code, int8_t* out);
+
+// Logic: thresholds one channel with hysteresis into a logic stream. Samples above
+// `high` set the level, samples below `low` clear it, samples in between keep it. The
+// level starts low.
+struct ThunderScopeHWLogic;
+
+struct ThunderScopeHWLogic* thunderscopehw_logic_create(int8_t low, int8_t high);
+void thunderscopehw_logic_destroy(struct ThunderScopeHWLogic* l);
+void thunderscopehw_logic_reset(struct ThunderScopeHWLogic* l);
+// Level after the last sample processed.
+bool thunderscopehw_logic_level(struct ThunderScopeHWLogic* l);
+// Samples processed since the last reset.
+uint64_t thunderscopehw_logic_position(struct ThunderScopeHWLogic* l);
+// Consumes samples of one channel. With bits, writes (length + 7) / 8 bytes, sample i
+// in bit i % 8 of byte i / 8 (lengths that are a multiple of 8 keep the stream
+// contiguous across calls). With transitions (room for `length` entries), writes the
+// position of every sample whose level differs from the one before it; run lengths
+// are their differences. Returns the number of transitions.
+size_t thunderscopehw_logic_process(struct ThunderScopeHWLogic* l, const int8_t* samples, size_t length,
+				    uint8_t* bits, uint64_t* transitions);
+
+// Serial decoders: threshold their inputs like thunderscopehw_logic_create and
+// decode the transitions. State is carried between calls, so a capture can be fed
+// a page at a time. Packets are stamped with sample positions since the last reset;
+// start is the first edge of the packet, end the last sample belonging to it.
+enum ThunderScopeHWPacketType {
+	// value: data bits.
+	THUNDERSCOPEHW_PACKET_UART = 70000,
+	// value: MOSI word, value2: MISO word.
+	THUNDERSCOPEHW_PACKET_SPI,
+	THUNDERSCOPEHW_PACKET_I2C_START,
+	// value: 7 bit address.
+	THUNDERSCOPEHW_PACKET_I2C_ADDRESS,
+	// value: byte.
+	THUNDERSCOPEHW_PACKET_I2C_DATA,
+	THUNDERSCOPEHW_PACKET_I2C_STOP,
+	// value: identifier, value2: DLC, data: payload.
+	THUNDERSCOPEHW_PACKET_CAN,
+	// Frame abandoned at `start`, flags give the reason.
+	THUNDERSCOPEHW_PACKET_CAN_ERROR,
+	// value: frame identifier, value2: checksum byte, data: response.
+	THUNDERSCOPEHW_PACKET_LIN,
+};
+
+#define THUNDERSCOPEHW_PACKET_PARITY_ERROR  0x01
+#define THUNDERSCOPEHW_PACKET_FRAMING_ERROR 0x02
+#define THUNDERSCOPEHW_PACKET_NACK          0x04
+#define THUNDERSCOPEHW_PACKET_READ          0x08
+#define THUNDERSCOPEHW_PACKET_RESTART       0x10
+#define THUNDERSCOPEHW_PACKET_EXTENDED      0x20
+#define THUNDERSCOPEHW_PACKET_REMOTE        0x40
+#define THUNDERSCOPEHW_PACKET_FD            0x80
+#define THUNDERSCOPEHW_PACKET_BRS           0x100
+#define THUNDERSCOPEHW_PACKET_ESI           0x200
+#define THUNDERSCOPEHW_PACKET_CRC_ERROR     0x400
+#define THUNDERSCOPEHW_PACKET_STUFF_ERROR   0x800
+#define THUNDERSCOPEHW_PACKET_FORM_ERROR    0x1000
+#define THUNDERSCOPEHW_PACKET_CHECKSUM_ERROR 0x2000
+
+#define THUNDERSCOPEHW_PACKET_MAX_DATA 64
+
+struct ThunderScopeHWPacket {
+	enum ThunderScopeHWPacketType type;
+	uint32_t flags;
+	uint64_t start;
+	uint64_t end;
+	uint32_t value;
+	uint32_t value2;
+	uint32_t length;
+	uint8_t data[THUNDERSCOPEHW_PACKET_MAX_DATA];
+};
+
+enum ThunderScopeHWParity {
+	THUNDERSCOPEHW_PARITY_NONE = 80000,
+	THUNDERSCOPEHW_PARITY_ODD,
+	THUNDERSCOPEHW_PARITY_EVEN,
+};
+
+struct ThunderScopeHWDecoder;
+
+// Input 0: the line, idle high, LSB first, one stop bit. 5 to 9 data bits. Baud 0
+// measures the bit time from the first edges (the shortest run has to be one bit)
+// and snaps it to a standard rate within 2%.
+struct ThunderScopeHWDecoder* thunderscopehw_uart_decoder_create(double sample_rate, double baud, int data_bits,
+								 enum ThunderScopeHWParity parity,
+								 int8_t low, int8_t high);
+// Baud rate in use, 0 while it is still being measured.
+double thunderscopehw_uart_decoder_baud(struct ThunderScopeHWDecoder* d);
+// Inputs 0 to 3: SCLK, MOSI, MISO and active low CS; MISO and CS may be NULL.
+// Modes 0 to 3 (CPOL * 2 + CPHA), 1 to 32 bit words. Partial words are dropped
+// when CS goes inactive.
+struct ThunderScopeHWDecoder* thunderscopehw_spi_decoder_create(int mode, int word_bits, bool msb_first,
+								int8_t low, int8_t high);
+// Inputs 0 and 1: SCL and SDA.
+struct ThunderScopeHWDecoder* thunderscopehw_i2c_decoder_create(int8_t low, int8_t high);
+// Input 0: CAN_RX (dominant low) or, with dominant_high, CANH - CANL. CAN FD frames
+// with BRS switch to data_bitrate (0: no switching) at an 80% sample point. Frames
+// come out after the ACK delimiter with CRC_ERROR or NACK flagged; stuff and form
+// errors abandon the frame until 11 recessive bits.
+struct ThunderScopeHWDecoder* thunderscopehw_can_decoder_create(double sample_rate, double bitrate, double data_bitrate,
+								bool dominant_high, int8_t low, int8_t high);
+// Input 0: the LIN bus. A frame ends at the next break or 20 bits after its last
+// byte (100 after the header when no response comes). The checksum is checked as
+// enhanced for identifiers below 60, classic is accepted too.
+struct ThunderScopeHWDecoder* thunderscopehw_lin_decoder_create(double sample_rate, double baud, int8_t low, int8_t high);
+void thunderscopehw_decoder_destroy(struct ThunderScopeHWDecoder* d);
+void thunderscopehw_decoder_reset(struct ThunderScopeHWDecoder* d);
+// Consumes `length` samples of every input and returns the number of packets
+// written. Packets past max_packets are not written, thunderscopehw_decoder_dropped
+// counts them. An I2C START or STOP is a single SDA edge, so SDA toggling with SCL
+// high gives a packet per sample: length + 1 entries (one for an I2C byte carried
+// over from the last call) never drop. CAN, LIN and UART packets may complete up
+// to a few bit times after the edges they come from.
+size_t thunderscopehw_decoder_process(struct ThunderScopeHWDecoder* d, const int8_t* const* inputs, size_t length,
+				      struct ThunderScopeHWPacket* packets, size_t max_packets);
+uint64_t thunderscopehw_decoder_dropped(struct ThunderScopeHWDecoder* d);
+
+// Clock data recovery from the threshold crossings of one channel, interpolated at
+// the middle of the hysteresis band. The PLL is a second order loop updated at every
+// edge, loop bandwidth 0 picks bit rate / 1667. The histogram mode steps the clock to
+// the circular mean of the edge phases every 64 edges and needs the bit rate within
+// about 0.1%. Manchester runs the clock at twice the bit rate and finds the mid bit
+// edges; bits are the level of the second half (low to high is 1).
+enum ThunderScopeHWCdrMode {
+	THUNDERSCOPEHW_CDR_PLL = 90000,
+	THUNDERSCOPEHW_CDR_HISTOGRAM,
+};
+
+enum ThunderScopeHWLineCode {
+	THUNDERSCOPEHW_LINE_CODE_NRZ = 100000,
+	THUNDERSCOPEHW_LINE_CODE_MANCHESTER,
+};
+
+struct ThunderScopeHWCdr;
+
+struct ThunderScopeHWCdr* thunderscopehw_cdr_create(enum ThunderScopeHWCdrMode mode, enum ThunderScopeHWLineCode code,
+						    double sample_rate, double bit_rate, double loop_bandwidth,
+						    int8_t low, int8_t high);
+void thunderscopehw_cdr_destroy(struct ThunderScopeHWCdr* cdr);
+void thunderscopehw_cdr_reset(struct ThunderScopeHWCdr* cdr);
+// Recovered bit rate, averaged since the first edge.
+double thunderscopehw_cdr_bit_rate(struct ThunderScopeHWCdr* cdr);
+// Upper bound on the bits produced by `length` more samples.
+size_t thunderscopehw_cdr_max_output(struct ThunderScopeHWCdr* cdr, size_t length);
+// Consumes samples of one channel. Writes the start of every recovered bit, in
+// samples since the last reset, and its value, returns the number of bits. Bits
+// come out once the input is 16 samples past them.
+size_t thunderscopehw_cdr_process(struct ThunderScopeHWCdr* cdr, const int8_t* samples, size_t length,
+				  double* boundaries, uint8_t* bits);
+
+// Eye diagram: every bit is resampled at ui_bins columns spread over two unit
+// intervals, from half a UI before it starts to half a UI after it ends, linearly
+// interpolating between samples. Each bit is one persistence record of ui_bins
+// time bins. Masks are polygons over x in UI (0 to 1 is the bit, -0.5 to 1.5 shown)
+// and y in codes, tested at the centre of every column and code.
+#define THUNDERSCOPEHW_EYE_MAX_POLYGONS   8
+#define THUNDERSCOPEHW_EYE_MAX_VIOLATIONS 256
+
+struct ThunderScopeHWEyeViolation {
+	// Start of the bit, in samples since the clock was reset.
+	double start;
+	// Bit p is set when polygon p was hit.
+	uint32_t polygons;
+	// Columns of the bit inside the mask.
+	uint32_t hits;
+};
+
+struct ThunderScopeHWEye;
+
+// Without a CDR, bit k starts at phase + k * sample_rate / bit_rate samples.
+struct ThunderScopeHWEye* thunderscopehw_eye_create(size_t ui_bins, double sample_rate, double bit_rate, double phase);
+void thunderscopehw_eye_destroy(struct ThunderScopeHWEye* e);
+// Clears the diagram, hits and violations and restarts the clock, masks are kept.
+void thunderscopehw_eye_reset(struct ThunderScopeHWEye* e);
+// Consumes samples of one channel, returns the number of bits folded. With cdr
+// (created for the same bit rate and fed only through here since both were reset)
+// bits are clocked by its boundaries, otherwise by the ideal clock. Bits are folded
+// once the samples a UI past them are in.
+size_t thunderscopehw_eye_process(struct ThunderScopeHWEye* e, const int8_t* samples, size_t length,
+				  struct ThunderScopeHWCdr* cdr);
+// Adds the diagram, hits and violations of src (e.g. filled by another thread) to
+// dst and clears them in src. Both need the same bins and number of polygons.
+enum ThunderScopeHWStatus thunderscopehw_eye_merge(struct ThunderScopeHWEye* dst, struct ThunderScopeHWEye* src);
+// The diagram, for records, counts and images.
+struct ThunderScopeHWPersistence* thunderscopehw_eye_persistence(struct ThunderScopeHWEye* e);
+// Returns the polygon index, -1 when the mask is full or vertices < 3.
+int thunderscopehw_eye_add_polygon(struct ThunderScopeHWEye* e, const double* x, const double* y, size_t vertices);
+void thunderscopehw_eye_clear_mask(struct ThunderScopeHWEye* e);
+// Columns inside the polygon over all bits folded.
+uint64_t thunderscopehw_eye_hits(struct ThunderScopeHWEye* e, int polygon);
+// Bits with at least one column inside the mask.
+uint64_t thunderscopehw_eye_failed_bits(struct ThunderScopeHWEye* e);
+// Copies the first of the failed bits, up to THUNDERSCOPEHW_EYE_MAX_VIOLATIONS are kept.
+size_t thunderscopehw_eye_violations(struct ThunderScopeHWEye* e, struct ThunderScopeHWEyeViolation* out, size_t max);
+
+// Jitter: time interval error (TIE) of the threshold crossings of one channel,
+// interpolated like the CDR, against a reference clock of `rate` unit intervals per
+// second (the bit rate of data, twice the frequency of a clock, or its frequency
+// with rising_only). An edge's TIE is its time minus the nearest reference edge.
+// Both references start at the first edge, which only sets the phase. The ideal one
+// keeps exactly `rate`, so a rate offset shows as a TIE ramp; the recovered one is
+// the CDR's second order PLL (loop bandwidth 0 picks rate / 1667). Results are in
+// seconds and memory is fixed at create, so captures of any length can be streamed.
+enum ThunderScopeHWJitterClock {
+	THUNDERSCOPEHW_JITTER_IDEAL = 110000,
+	THUNDERSCOPEHW_JITTER_RECOVERED,
+};
+
+struct ThunderScopeHWJitterResults {
+	struct ThunderScopeHWMeasureStat tie;
+	// Time between consecutive edges over the unit intervals between them.
+	struct ThunderScopeHWMeasureStat period;
+	// Difference between consecutive periods.
+	struct ThunderScopeHWMeasureStat cycle_to_cycle;
+};
+
+struct ThunderScopeHWJitter;
+
+// The TIE histogram has histogram_bins bins over -0.5 to 0.5 UI. The TIE spectrum
+// runs over spectrum_size unit intervals (a power of two), edgeless ones being
+// interpolated between their neighbours.
+struct ThunderScopeHWJitter* thunderscopehw_jitter_create(enum ThunderScopeHWJitterClock clock, double sample_rate, double rate,
+							  double loop_bandwidth, bool rising_only, size_t histogram_bins,
+							  size_t spectrum_size, int8_t low, int8_t high);
+void thunderscopehw_jitter_destroy(struct ThunderScopeHWJitter* j);
+void thunderscopehw_jitter_reset(struct ThunderScopeHWJitter* j);
+// Consumes samples of one channel, returns the number of edges measured. With
+// times or tie (room for `length` entries) writes each edge's time in samples
+// since the last reset and its TIE in seconds.
+size_t thunderscopehw_jitter_process(struct ThunderScopeHWJitter* j, const int8_t* samples, size_t length,
+				     double* times, double* tie);
+const struct ThunderScopeHWJitterResults* thunderscopehw_jitter_results(struct ThunderScopeHWJitter* j);
+const uint64_t* thunderscopehw_jitter_histogram(struct ThunderScopeHWJitter* j);
+uint64_t thunderscopehw_jitter_spectrum_frames(struct ThunderScopeHWJitter* j);
+// spectrum_size / 2 + 1 bins, bin k at k * rate / spectrum_size Hz. Amplitude in
+// seconds of a sinusoidal jitter on the bin, averaged over all frames.
+void thunderscopehw_jitter_spectrum(struct ThunderScopeHWJitter* j, float* out);
+// Dual-Dirac fit of the histogram tails on the Q scale: random jitter (Gaussian
+// sigma), deterministic jitter (distance between the Diracs) and total jitter at
+// `ber`, as DJ + 2 Q(ber) RJ. Fails until both tails hold enough edges.
+enum ThunderScopeHWStatus thunderscopehw_jitter_dual_dirac(struct ThunderScopeHWJitter* j, double ber,
+							   double* rj, double* dj, double* tj);
+
+// Spectrum: windowed, averaged FFT over a single deinterleaved channel.
+#define THUNDERSCOPEHW_FFT_MAX_SIZE (1 << 24)
+
+enum ThunderScopeHWWindow {
+	THUNDERSCOPEHW_WINDOW_RECTANGULAR = 40000,
+	THUNDERSCOPEHW_WINDOW_HANN,
+	THUNDERSCOPEHW_WINDOW_HAMMING,
+	THUNDERSCOPEHW_WINDOW_BLACKMAN_HARRIS,
+	THUNDERSCOPEHW_WINDOW_FLAT_TOP,
+};
+
+enum ThunderScopeHWAveraging {
+	THUNDERSCOPEHW_AVERAGING_NONE = 50000,
+	// Mean of the last `averaging_param` frames, exponential once that many were seen.
+	THUNDERSCOPEHW_AVERAGING_LINEAR,
+	// New frames weighted by `averaging_param` (0..1].
+	THUNDERSCOPEHW_AVERAGING_EXPONENTIAL,
+	THUNDERSCOPEHW_AVERAGING_PEAK_HOLD,
+};
+
+struct ThunderScopeHWSpectrum;
+
+// fft_size is a power of two from 4 to THUNDERSCOPEHW_FFT_MAX_SIZE, overlap is in [0, 1).
+struct ThunderScopeHWSpectrum* thunderscopehw_spectrum_create(size_t fft_size, enum ThunderScopeHWWindow window, double overlap,
+                                                               enum ThunderScopeHWAveraging averaging, double averaging_param);
+void thunderscopehw_spectrum_destroy(struct ThunderScopeHWSpectrum* s);
+void thunderscopehw_spectrum_reset(struct ThunderScopeHWSpectrum* s);
+// Consumes samples of one channel, returns the number of FFT frames computed.
+size_t thunderscopehw_spectrum_process(struct ThunderScopeHWSpectrum* s, const int8_t* samples, size_t length);
+uint64_t thunderscopehw_spectrum_frames(struct ThunderScopeHWSpectrum* s);
+// fft_size / 2 + 1
+size_t thunderscopehw_spectrum_bins(struct ThunderScopeHWSpectrum* s);
+// Averaged magnitude per bin, 0 dBFS being a full scale sine.
+void thunderscopehw_spectrum_dbfs(struct ThunderScopeHWSpectrum* s, float* out);
+// Averaged magnitude per bin as power into 50 ohm, see thunderscopehw_volts_per_lsb.
+void thunderscopehw_spectrum_dbm(struct ThunderScopeHWSpectrum* s, double volts_per_lsb, float* out);
+
+// Cross correlation of two channels, accumulated over blocks of block_size samples
+// (a power of two) zero padded to twice that. Neighbouring blocks are correlated
+// too, so every lag below block_size sums over the whole capture, free of wrap
+// around and of any pull towards lag 0.
+struct ThunderScopeHWXcorr;
+
+struct ThunderScopeHWXcorr* thunderscopehw_xcorr_create(size_t block_size);
+void thunderscopehw_xcorr_destroy(struct ThunderScopeHWXcorr* x);
+void thunderscopehw_xcorr_reset(struct ThunderScopeHWXcorr* x);
+// Consumes `length` samples of each channel, returns the number of blocks completed.
+size_t thunderscopehw_xcorr_process(struct ThunderScopeHWXcorr* x, const int8_t* a, const int8_t* b, size_t length);
+// Same for two channels of interleaved data as returned by thunderscopehw_read, 0
+// when either channel is not below num_channels.
+size_t thunderscopehw_xcorr_process_interleaved(struct ThunderScopeHWXcorr* x, const int8_t* data, size_t length,
+                                                int num_channels, int channel_a, int channel_b);
+// Delay of b behind a in samples, searched within +-max_lag and refined by parabolic
+// interpolation, and the normalized correlation at that point. Of equal peaks a period
+// apart the one nearest 0 is taken. Divide by the per channel
+// sample rate to get seconds, e.g. the ADC sampling skew between two channels fed the same signal.
+enum ThunderScopeHWStatus thunderscopehw_xcorr_delay(struct ThunderScopeHWXcorr* x, double max_lag, double* delay, double* coefficient);
+// Phase of b relative to a in degrees at `frequency` cycles per sample.
+double thunderscopehw_xcorr_phase(struct ThunderScopeHWXcorr* x, double frequency);
+
+// Waterfall: one FFT row every row_interval input samples (>= fft_size, the rest
+// is skipped), quantized from db_min..db_max dBFS to 0..255 and kept in a ring of depth rows.
+struct ThunderScopeHWWaterfall;
+
+struct ThunderScopeHWWaterfall* thunderscopehw_waterfall_create(size_t fft_size, enum ThunderScopeHWWindow window, uint64_t row_interval,
+                                                                 size_t depth, float db_min, float db_max);
+void thunderscopehw_waterfall_destroy(struct ThunderScopeHWWaterfall* w);
+void thunderscopehw_waterfall_reset(struct ThunderScopeHWWaterfall* w);
+// Consumes samples of one channel, returns the number of rows produced.
+size_t thunderscopehw_waterfall_process(struct ThunderScopeHWWaterfall* w, const int8_t* samples, size_t length);
+// Sequence number of the next row to be produced.
+uint64_t thunderscopehw_waterfall_total_rows(struct ThunderScopeHWWaterfall* w);
+// fft_size / 2 + 1
+size_t thunderscopehw_waterfall_width(struct ThunderScopeHWWaterfall* w);
+// Row by sequence number, NULL if not produced yet or already dropped from the ring.
+const uint8_t* thunderscopehw_waterfall_row(struct ThunderScopeHWWaterfall* w, uint64_t row);
+
 #endif  // LIBTHUNDERSCOPEHW_THUNDERSCOPEHW_H
@@ -0,0 +1,1521 @@
+#include "thunderscopehw.h"
+#include "../thunderscopehw/thunderscopehw_private.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static int failures = 0;
+
+#define CHECK(X) do {							\
+	if (!(X)) {							\
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #X); \
+		failures++;						\
+	}								\
+} while(0)
+
+static void test_deinterleave()
+{
+	int8_t data[4 * 100];
+	int8_t channels[4][100];
+	int8_t* out[4] = { channels[0], channels[1], channels[2], channels[3] };
+	for (int i = 0; i < 400; i++) data[i] = (int8_t)(i % 4 * 10 + i / 4 % 7);
+	thunderscopehw_deinterleave(data, 400, 4, out);
+	for (int i = 0; i < 100; i++) {
+		for (int channel = 0; channel < 4; channel++) {
+			CHECK(channels[channel][i] == channel * 10 + i % 7);
+		}
+	}
+	thunderscopehw_deinterleave(data, 200, 2, out);
+	for (int i = 0; i < 100; i++) {
+		CHECK(channels[0][i] == data[2 * i] && channels[1][i] == data[2 * i + 1]);
+	}
+}
+
+static void test_stats()
+{
+	// Odd length exercises the vector body and the scalar tail.
+	const size_t length = 100003;
+	int8_t* samples = (int8_t*)malloc(length);
+	int64_t sum = 0;
+	uint64_t squares = 0, high = 0;
+	for (size_t i = 0; i < length; i++) {
+		samples[i] = (int8_t)((i * 7919) % 256 - 128);
+		sum += samples[i];
+		squares += samples[i] * samples[i];
+		if (samples[i] > 3) high++;
+	}
+	struct ThunderScopeHWStats stats;
+	thunderscopehw_stats_init(&stats, 3, true);
+	thunderscopehw_stats_update(&stats, samples, length);
+	CHECK(stats.count == length);
+	CHECK(stats.sum == sum);
+	CHECK(stats.sum_squares == squares);
+	CHECK(stats.high == high);
+	CHECK(stats.min == -128 && stats.max == 127);
+	uint64_t total = 0;
+	for (int code = 0; code < 256; code++) total += stats.histogram[code];
+	CHECK(total == length);
+
+	struct ThunderScopeHWMeasurements m;
+	thunderscopehw_stats_measure(&stats, 2.0, &m);
+	CHECK(m.peak_to_peak == 510.0);
+	CHECK(fabs(m.mean - 2.0 * sum / length) < 1e-9);
+
+	// Window of two blocks of 1000 samples.
+	struct ThunderScopeHWStatsWindow* w = thunderscopehw_stats_window_create(1000, 2, 0);
+	CHECK(thunderscopehw_stats_window_process(w, samples, 3500) == 3);
+	thunderscopehw_stats_window_get(w, &stats);
+	struct ThunderScopeHWStats expected;
+	thunderscopehw_stats_init(&expected, 0, false);
+	thunderscopehw_stats_update(&expected, samples + 1000, 2000);
+	CHECK(stats.count == 2000 && stats.sum == expected.sum && stats.sum_squares == expected.sum_squares);
+	thunderscopehw_stats_window_destroy(w);
+	free(samples);
+}
+
+static void test_timing()
+{
+	// 100 sample period: 10 sample ramps between -100 and 100, 40 samples flat each,
+	// one sample overshoot to 110 after each rising edge.
+	int8_t samples[2000];
+	for (int i = 0; i < 2000; i++) {
+		int phase = i % 100;
+		int v;
+		if (phase < 10) v = -100 + 20 * phase;
+		else if (phase < 50) v = 100;
+		else if (phase < 60) v = 100 - 20 * (phase - 50);
+		else v = -100;
+		if (phase == 11) v = 110;
+		samples[i] = (int8_t)v;
+	}
+	struct ThunderScopeHWTiming* t = thunderscopehw_timing_create(1e9, -100, 100);
+	thunderscopehw_timing_process(t, samples, 777);
+	thunderscopehw_timing_process(t, samples + 777, 2000 - 777);
+	const struct ThunderScopeHWTimingResults* r = thunderscopehw_timing_results(t);
+	CHECK(r->rise_time.count == 20 && fabs(r->rise_time.mean - 8e-9) < 1e-12);
+	CHECK(fabs(r->fall_time.mean - 8e-9) < 1e-12);
+	CHECK(r->period.count == 19 && fabs(r->period.mean - 100e-9) < 1e-12);
+	CHECK(thunderscopehw_measure_stat_stddev(&r->period) < 1e-15);
+	CHECK(fabs(r->frequency.mean - 10e6) < 1);
+	CHECK(fabs(r->positive_width.mean - 50e-9) < 1e-12);
+	CHECK(fabs(r->negative_width.mean - 50e-9) < 1e-12);
+	CHECK(fabs(r->duty_cycle.mean - 50) < 1e-6);
+	CHECK(fabs(r->overshoot.max - 5) < 1e-6);
+	CHECK(r->preshoot.max == 0);
+
+	// Statistics carry over a restart.
+	thunderscopehw_timing_restart(t);
+	thunderscopehw_timing_process(t, samples, 2000);
+	CHECK(r->rise_time.count == 40);
+	thunderscopehw_timing_destroy(t);
+
+	// 200 sample period between -50 and 50, 15% ringing after each edge that
+	// dies out within 40 samples and nothing before the edges: no preshoot.
+	for (int i = 0; i < 2000; i++) {
+		int phase = i % 200;
+		int edge = phase < 100 ? phase : phase - 100;
+		double v = edge < 10 ? -50 + 10 * edge : 50;
+		if (edge >= 10 && edge < 50) v += 15 * exp(-(edge - 10) / 8.0) * cos(2 * M_PI * (edge - 10) / 10);
+		samples[i] = (int8_t)lrint(phase < 100 ? v : -v);
+	}
+	t = thunderscopehw_timing_create(1e9, -50, 50);
+	thunderscopehw_timing_process(t, samples, 2000);
+	r = thunderscopehw_timing_results(t);
+	CHECK(r->preshoot.count == 9 && r->preshoot.max == 0);
+	CHECK(r->overshoot.count == 10 && fabs(r->overshoot.mean - 15) < 1e-6);
+	CHECK(r->undershoot.count == 9 && fabs(r->undershoot.mean - 15) < 1e-6);
+	thunderscopehw_timing_destroy(t);
+}
+
+static void test_peak_detect()
+{
+	// Two channels, a single sample glitch must survive 1000x decimation.
+	const size_t length = 2 * 10000;
+	int8_t* data = (int8_t*)malloc(length);
+	for (size_t i = 0; i < length; i++) data[i] = (i & 1) ? -5 : 5;
+	data[2 * 4321] = 100;
+	data[2 * 777 + 1] = -100;
+
+	struct ThunderScopeHWPeakDetect* pd = thunderscopehw_peak_detect_create(2, 1000);
+	int8_t out[2 * 2 * 10];
+	// Split the input to exercise blocks straddling calls.
+	size_t points = thunderscopehw_peak_detect_process(pd, data, 2 * 1500, out);
+	points += thunderscopehw_peak_detect_process(pd, data + 2 * 1500, length - 2 * 1500, out + 4 * points);
+	CHECK(points == 10);
+	CHECK(out[4 * 4 + 1] == 100 && out[4 * 4] == 5);
+	CHECK(out[4 * 0 + 2] == -100 && out[4 * 0 + 3] == -5);
+	CHECK(out[4 * 9] == 5 && out[4 * 9 + 1] == 5);
+	thunderscopehw_peak_detect_destroy(pd);
+	free(data);
+
+	CHECK(thunderscopehw_peak_detect_decimation(4, 1000.0) == 250000);
+}
+
+static void test_roll()
+{
+	// One channel at 1 GS/s decimated to 1 MS/s gives one point per 1000 samples.
+	struct ThunderScopeHWRoll* roll = thunderscopehw_roll_create(1, 1e6, 8);
+	int8_t data[1000 * 12];
+	for (int i = 0; i < 12; i++) memset(data + 1000 * i, i, 1000);
+
+	uint64_t cursor = 0;
+	int8_t out[2 * 16];
+	CHECK(thunderscopehw_roll_process(roll, data, 3000) == 3);
+	CHECK(thunderscopehw_roll_read(roll, &cursor, out, 16) == 3);
+	CHECK(cursor == 3 && out[4] == 2 && out[5] == 2);
+	// Nothing new, nothing read.
+	CHECK(thunderscopehw_roll_read(roll, &cursor, out, 16) == 0);
+
+	// Overrun the history, the reader is moved up to the oldest point kept.
+	CHECK(thunderscopehw_roll_process(roll, data + 3000, 9000) == 9);
+	CHECK(thunderscopehw_roll_total_points(roll) == 12);
+	CHECK(thunderscopehw_roll_read(roll, &cursor, out, 16) == 8);
+	CHECK(out[0] == 4 && out[2 * 7] == 11);
+	thunderscopehw_roll_destroy(roll);
+}
+
+static void test_persistence()
+{
+	int8_t record[64];
+	for (int i = 0; i < 64; i++) record[i] = (int8_t)(i - 32);
+
+	struct ThunderScopeHWPersistence* a = thunderscopehw_persistence_create(64, THUNDERSCOPEHW_PERSISTENCE_INFINITE, 0);
+	struct ThunderScopeHWPersistence* b = thunderscopehw_persistence_create(64, THUNDERSCOPEHW_PERSISTENCE_INFINITE, 0);
+	for (int i = 0; i < 3; i++) thunderscopehw_persistence_add(a, record, 64);
+	thunderscopehw_persistence_add(b, record, 64);
+	CHECK(thunderscopehw_persistence_merge(a, b) == THUNDERSCOPEHW_STATUS_OK);
+	CHECK(thunderscopehw_persistence_records(a) == 4);
+	CHECK(thunderscopehw_persistence_records(b) == 0);
+	CHECK(thunderscopehw_persistence_counts(a)[10 * 256 + (10 - 32) + 128] == 4);
+
+	uint8_t image[256 * 64];
+	thunderscopehw_persistence_image(a, image);
+	CHECK(image[(255 - (10 - 32 + 128)) * 64 + 10] == 255);
+	CHECK(image[(255 - 128) * 64 + 10] == 0);
+	thunderscopehw_persistence_destroy(a);
+	thunderscopehw_persistence_destroy(b);
+
+	// A record twice as long as the bins lands two samples per bin, halved every 2 records.
+	struct ThunderScopeHWPersistence* d = thunderscopehw_persistence_create(32, THUNDERSCOPEHW_PERSISTENCE_DECAY, 2);
+	int8_t flat[64];
+	memset(flat, 7, sizeof(flat));
+	thunderscopehw_persistence_add(d, flat, 64);
+	CHECK(thunderscopehw_persistence_counts(d)[5 * 256 + 7 + 128] == 2);
+	thunderscopehw_persistence_add(d, flat, 64);
+	CHECK(thunderscopehw_persistence_counts(d)[5 * 256 + 7 + 128] == 2);
+	thunderscopehw_persistence_destroy(d);
+}
+
+static void test_spectrum()
+{
+	// Full scale sine exactly on bin 64 of a 1024 point FFT.
+	const size_t n = 1024;
+	int8_t samples[4096];
+	for (size_t i = 0; i < 4096; i++) {
+		samples[i] = (int8_t)lrint(127 * sin(2 * 3.14159265358979 * 64 * i / n));
+	}
+	struct ThunderScopeHWSpectrum* s = thunderscopehw_spectrum_create(n, THUNDERSCOPEHW_WINDOW_HANN, 0.5, THUNDERSCOPEHW_AVERAGING_LINEAR, 8);
+	CHECK(s != NULL);
+	CHECK(thunderscopehw_spectrum_process(s, samples, 1000) == 0);
+	CHECK(thunderscopehw_spectrum_process(s, samples + 1000, 3096) == 7);
+	CHECK(thunderscopehw_spectrum_bins(s) == n / 2 + 1);
+
+	float dbfs[513];
+	thunderscopehw_spectrum_dbfs(s, dbfs);
+	CHECK(fabs(dbfs[64] - 20 * log10(127.0 / 128.0)) < 0.1);
+	CHECK(dbfs[200] < -60);
+
+	// 127 codes at 1 V/div is 4.96 V peak, 24.9 dBm into 50 ohm.
+	float dbm[513];
+	thunderscopehw_spectrum_dbm(s, 10.0 / 256, dbm);
+	CHECK(fabs(dbm[64] - 10 * log10(127 * 10.0 / 256 * 127 * 10.0 / 256 * 10)) < 0.1);
+	thunderscopehw_spectrum_destroy(s);
+
+	CHECK(thunderscopehw_spectrum_create(1000, THUNDERSCOPEHW_WINDOW_HANN, 0, THUNDERSCOPEHW_AVERAGING_NONE, 0) == NULL);
+}
+
+static void test_waterfall()
+{
+	// A tone hopping from bin 16 to bin 48 half way through.
+	const size_t n = 256;
+	int8_t samples[8192];
+	for (size_t i = 0; i < 8192; i++) {
+		int bin = i < 4096 ? 16 : 48;
+		samples[i] = (int8_t)lrint(100 * sin(2 * 3.14159265358979 * bin * i / n));
+	}
+	// One row per 1024 samples, depth of 4 rows.
+	struct ThunderScopeHWWaterfall* w = thunderscopehw_waterfall_create(n, THUNDERSCOPEHW_WINDOW_HANN, 1024, 4, -100, 0);
+	CHECK(thunderscopehw_waterfall_width(w) == n / 2 + 1);
+	CHECK(thunderscopehw_waterfall_process(w, samples, 100) == 0);
+	CHECK(thunderscopehw_waterfall_process(w, samples + 100, 8092) == 8);
+	CHECK(thunderscopehw_waterfall_total_rows(w) == 8);
+	CHECK(thunderscopehw_waterfall_row(w, 3) == NULL);
+	CHECK(thunderscopehw_waterfall_row(w, 8) == NULL);
+	const uint8_t* row = thunderscopehw_waterfall_row(w, 7);
+	// Old tone at least 40 dB down, leaving room for quantization spurs.
+	CHECK(row && row[48] > 240 && row[16] < row[48] - 100);
+	thunderscopehw_waterfall_destroy(w);
+}
+
+static void test_xcorr()
+{
+	// A handful of tones, channel b is channel a delayed by 3.25 samples.
+	const size_t length = 8192;
+	int8_t* a = (int8_t*)malloc(length);
+	int8_t* b = (int8_t*)malloc(length);
+	for (size_t i = 0; i < length; i++) {
+		double va = 0, vb = 0;
+		for (int tone = 1; tone <= 5; tone++) {
+			double w = 2 * 3.14159265358979 * 0.011 * tone * tone;
+			va += 20 * sin(w * i + tone);
+			vb += 20 * sin(w * (i - 3.25) + tone);
+		}
+		a[i] = (int8_t)lrint(va);
+		b[i] = (int8_t)lrint(vb);
+	}
+	struct ThunderScopeHWXcorr* x = thunderscopehw_xcorr_create(1024);
+	CHECK(thunderscopehw_xcorr_process(x, a, b, length) == 8);
+	double delay, coefficient;
+	CHECK(thunderscopehw_xcorr_delay(x, 64, &delay, &coefficient) == THUNDERSCOPEHW_STATUS_OK);
+	CHECK(fabs(delay - 3.25) < 0.1);
+	CHECK(coefficient > 0.95);
+	// Phase of a delay is -360 * f * delay, checked at the second tone.
+	CHECK(fabs(thunderscopehw_xcorr_phase(x, 0.044) + 360 * 0.044 * 3.25) < 5);
+
+	// A slow sine, a few cycles per block, delayed by a fraction of a sample.
+	for (size_t i = 0; i < length; i++) {
+		a[i] = (int8_t)lrint(100 * sin(2 * M_PI * 0.01 * i));
+		b[i] = (int8_t)lrint(100 * sin(2 * M_PI * 0.01 * (i - 2.3)));
+	}
+	thunderscopehw_xcorr_reset(x);
+	CHECK(thunderscopehw_xcorr_process(x, a, b, length) == 8);
+	CHECK(thunderscopehw_xcorr_delay(x, 20, &delay, &coefficient) == THUNDERSCOPEHW_STATUS_OK);
+	CHECK(fabs(delay - 2.3) < 0.03);
+	CHECK(fabs(coefficient - 1) < 0.01);
+
+	// Any lag below the block size is found, here noise delayed by 700 samples.
+	uint32_t seed = 1;
+	for (size_t i = 0; i < length; i++) {
+		seed = seed * 1664525 + 1013904223;
+		a[i] = (int8_t)(seed >> 24);
+	}
+	for (size_t i = 0; i < length; i++) b[i] = i >= 700 ? a[i - 700] : 0;
+	thunderscopehw_xcorr_reset(x);
+	CHECK(thunderscopehw_xcorr_process(x, a, b, length) == 8);
+	CHECK(thunderscopehw_xcorr_delay(x, 1000, &delay, &coefficient) == THUNDERSCOPEHW_STATUS_OK);
+	CHECK(fabs(delay - 700) < 0.5);
+	CHECK(thunderscopehw_xcorr_delay(x, 1024, &delay, &coefficient) == THUNDERSCOPEHW_STATUS_INVALID_PARAMETER);
+
+	// Channels outside the interleaving are refused.
+	int8_t interleaved[2 * 1024] = { 0 };
+	CHECK(thunderscopehw_xcorr_process_interleaved(x, interleaved, sizeof(interleaved), 2, 0, 2) == 0);
+	CHECK(thunderscopehw_xcorr_process_interleaved(x, interleaved, sizeof(interleaved), 2, -1, 1) == 0);
+	CHECK(thunderscopehw_xcorr_process_interleaved(x, interleaved, sizeof(interleaved), 0, 0, 0) == 0);
+	CHECK(thunderscopehw_xcorr_process_interleaved(x, interleaved, sizeof(interleaved), 2, 0, 1) == 1);
+	thunderscopehw_xcorr_destroy(x);
+	free(a);
+	free(b);
+}
+
+static void test_eres()
+{
+	// A code 10.5 level dithered between 10 and 11 resolves to 10.5 * 256.
+	const size_t length = 65536;
+	int8_t* samples = (int8_t*)malloc(length);
+	srand(2);
+	for (size_t i = 0; i < length; i++) samples[i] = (int8_t)(10 + (rand() & 1));
+	struct ThunderScopeHWEres* e = thunderscopehw_eres_create(64);
+	int16_t out[1025];
+	size_t outputs = thunderscopehw_eres_process(e, samples, 1000, out);
+	outputs += thunderscopehw_eres_process(e, samples + 1000, length - 1000, out + outputs);
+	CHECK(outputs == length / 64);
+	double sum = 0, squares = 0;
+	for (size_t i = 100; i < outputs; i++) {
+		sum += out[i];
+		squares += (out[i] - 2688.0) * (out[i] - 2688.0);
+	}
+	CHECK(fabs(sum / (outputs - 100) - 2688) < 4);
+	// Input noise is 128 rms at this scale, expect at least 2 more bits.
+	CHECK(sqrt(squares / (outputs - 100)) < 32);
+	CHECK(thunderscopehw_eres_extra_bits(e) == 3.0);
+	thunderscopehw_eres_destroy(e);
+	free(samples);
+
+	// Full scale at the largest decimation still fits the CIC accumulators.
+	CHECK(thunderscopehw_eres_create(THUNDERSCOPEHW_ERES_MAX_DECIMATION + 2) == NULL);
+	const size_t full = 24 * (size_t)THUNDERSCOPEHW_ERES_MAX_DECIMATION;
+	samples = (int8_t*)malloc(full);
+	memset(samples, -128, full);
+	e = thunderscopehw_eres_create(THUNDERSCOPEHW_ERES_MAX_DECIMATION);
+	outputs = thunderscopehw_eres_process(e, samples, full, out);
+	CHECK(outputs == 24 && abs(out[23] - -128 * 256) <= 1);
+	thunderscopehw_eres_destroy(e);
+	free(samples);
+}
+
+// Rms of a resampled tone after the filter has settled.
+static double resampled_rms(double input_rate, double output_rate, double frequency, size_t* outputs)
+{
+	const size_t length = 1000000;
+	int8_t* samples = (int8_t*)malloc(length);
+	for (size_t i = 0; i < length; i++) samples[i] = (int8_t)lrint(100 * sin(2 * M_PI * frequency * i / input_rate));
+	struct ThunderScopeHWResampler* r = thunderscopehw_resampler_create(input_rate, output_rate);
+	float* out = (float*)malloc(thunderscopehw_resampler_max_output(r, length) * sizeof(float));
+	*outputs = thunderscopehw_resampler_process(r, samples, 12345, out);
+	*outputs += thunderscopehw_resampler_process(r, samples + 12345, length - 12345, out + *outputs);
+	double squares = 0;
+	for (size_t i = 1000; i < *outputs; i++) squares += out[i] * out[i];
+	thunderscopehw_resampler_destroy(r);
+	free(out);
+	free(samples);
+	return sqrt(squares / (*outputs - 1000));
+}
+
+static void test_resampler()
+{
+	size_t outputs;
+	// Rational after the CIC, 1 MS/s decimated by 2 then 12/125.
+	CHECK(fabs(resampled_rms(1e6, 48000, 1000, &outputs) - 70.7) < 1);
+	CHECK(outputs >= 47999 && outputs <= 48001);
+	// Above the output Nyquist frequency the tone is filtered out.
+	CHECK(resampled_rms(1e6, 48000, 30000, &outputs) < 1);
+	// Fractional ratio, interpolated between phases.
+	CHECK(fabs(resampled_rms(1e6, 44100.5, 3000, &outputs) - 70.7) < 1);
+	CHECK(outputs >= 44100 && outputs <= 44102);
+	// Upsampling.
+	CHECK(fabs(resampled_rms(1e6, 3e6, 100000, &outputs) - 70.7) < 1);
+	CHECK(outputs >= 2999999 && outputs <= 3000001);
+}
+
+static void test_ddc()
+{
+	// 101 MHz and 120 MHz tones around a 100 MHz centre, 15.625 MHz out.
+	const size_t length = 1 << 20;
+	int8_t* samples = (int8_t*)malloc(length);
+	for (size_t i = 0; i < length; i++) {
+		samples[i] = (int8_t)lrint(60 * cos(2 * M_PI * 0.101 * i) + 40 * cos(2 * M_PI * 0.120 * i));
+	}
+	struct ThunderScopeHWDdc* ddcs[2];
+	ddcs[0] = thunderscopehw_ddc_create(1e9, 100e6, 64);
+	ddcs[1] = thunderscopehw_ddc_create(1e9, 119e6, 64);
+	CHECK(thunderscopehw_ddc_output_rate(ddcs[0]) == 15.625e6);
+	float* iq[2];
+	size_t pairs[2];
+	iq[0] = (float*)malloc((length / 64 + 1) * 2 * sizeof(float));
+	iq[1] = (float*)malloc((length / 64 + 1) * 2 * sizeof(float));
+	thunderscopehw_ddc_process_multi(ddcs, 2, samples, length, iq, pairs);
+	CHECK(pairs[0] == length / 64 && pairs[1] == length / 64);
+	// Only the 1 MHz offset tone survives, rotating forwards at 0.064 turns per pair.
+	for (int d = 0; d < 2; d++) {
+		double magnitude = 0, rotation = 0;
+		for (size_t i = 100; i < pairs[d]; i++) {
+			float* z = iq[d] + 2 * i;
+			magnitude += sqrt(z[0] * z[0] + z[1] * z[1]);
+			rotation += atan2(z[1] * z[-2] - z[0] * z[-1], z[0] * z[-2] + z[1] * z[-1]);
+		}
+		magnitude /= pairs[d] - 100;
+		rotation /= 2 * M_PI * (pairs[d] - 100);
+		CHECK(fabs(magnitude - (d ? 20 : 30)) < 0.5);
+		CHECK(fabs(rotation - 0.064) < 0.001);
+	}
+
+	// The int16 output matches the float one scaled by 256.
+	int16_t* iq16 = (int16_t*)malloc((length / 64 + 1) * 2 * sizeof(int16_t));
+	thunderscopehw_ddc_reset(ddcs[0]);
+	CHECK(thunderscopehw_ddc_process_i16(ddcs[0], samples, length, iq16) == pairs[0]);
+	CHECK(abs(iq16[2000] - (int)lrintf(iq[0][2000] * 256)) <= 1);
+	thunderscopehw_ddc_destroy(ddcs[0]);
+	thunderscopehw_ddc_destroy(ddcs[1]);
+	CHECK(!thunderscopehw_ddc_create(1e9, 0, 6000));
+	free(iq16);
+	free(iq[0]);
+	free(iq[1]);
+	free(samples);
+}
+
+// Range of a demodulated 1 kHz tone after the filters settle.
+static void demodulated_range(enum ThunderScopeHWDemodulation mode, const int8_t* samples, size_t length,
+			      double audio_rate, double* low, double* high)
+{
+	struct ThunderScopeHWDemod* d = thunderscopehw_demod_create(mode, 1e6, 100e3, 16, audio_rate);
+	float* out = (float*)malloc(thunderscopehw_demod_max_output(d, length) * sizeof(float));
+	size_t outputs = thunderscopehw_demod_process(d, samples, length, out);
+	CHECK(outputs + 2 >= length / 1e6 * thunderscopehw_demod_output_rate(d));
+	*low = 1e9;
+	*high = -1e9;
+	for (size_t i = outputs / 4; i < outputs; i++) {
+		if (out[i] < *low) *low = out[i];
+		if (out[i] > *high) *high = out[i];
+	}
+	thunderscopehw_demod_destroy(d);
+	free(out);
+}
+
+static void test_atan2()
+{
+	// Every angle around the circle at several magnitudes, odd lengths reach the scalar tail.
+	enum { N = 4099 };
+	static float y[N], x[N], out[N];
+	for (int scale = 0; scale < 3; scale++) {
+		double r = scale == 0 ? 1e-20 : scale == 1 ? 1 : 1e20;
+		for (int i = 0; i < N; i++) {
+			double a = -M_PI + 2 * M_PI * i / (N - 1);
+			y[i] = (float)(r * sin(a));
+			x[i] = (float)(r * cos(a));
+		}
+		thunderscopehw_atan2_f32(y, x, N, out);
+		double worst = 0;
+		for (int i = 0; i < N; i++) {
+			double e = fabs(out[i] - atan2(y[i], x[i]));
+			if (e > M_PI) e = 2 * M_PI - e;
+			if (e > worst) worst = e;
+		}
+		CHECK(worst < 1e-5);
+	}
+	y[0] = 0;
+	x[0] = 0;
+	thunderscopehw_atan2_f32(y, x, 1, out);
+	CHECK(out[0] == 0);
+}
+
+static void test_demod()
+{
+	// 100 kHz carrier at 1 MS/s, modulated by 1 kHz.
+	const size_t length = 20000;
+	int8_t* samples = (int8_t*)malloc(length);
+	double low, high;
+	for (size_t i = 0; i < length; i++) {
+		double t = i / 1e6;
+		samples[i] = (int8_t)lrint(60 * (1 + 0.5 * cos(2 * M_PI * 1e3 * t)) * cos(2 * M_PI * 100e3 * t));
+	}
+	demodulated_range(THUNDERSCOPEHW_DEMODULATION_AM, samples, length, 0, &low, &high);
+	CHECK(fabs(low - 30) < 1 && fabs(high - 90) < 1);
+
+	// 5 kHz deviation, the phase is the integral of the frequency.
+	for (size_t i = 0; i < length; i++) {
+		double t = i / 1e6;
+		samples[i] = (int8_t)lrint(100 * cos(2 * M_PI * 100e3 * t + 5 * sin(2 * M_PI * 1e3 * t)));
+	}
+	demodulated_range(THUNDERSCOPEHW_DEMODULATION_FM, samples, length, 0, &low, &high);
+	CHECK(fabs(low + 5000) < 50 && fabs(high - 5000) < 50);
+	// At 8 points per cycle the samples can miss the peak by up to 8%.
+	demodulated_range(THUNDERSCOPEHW_DEMODULATION_FM, samples, length, 8000, &low, &high);
+	CHECK(fabs(low + 4800) < 300 && fabs(high - 4800) < 300);
+
+	for (size_t i = 0; i < length; i++) {
+		double t = i / 1e6;
+		samples[i] = (int8_t)lrint(100 * cos(2 * M_PI * 100e3 * t + sin(2 * M_PI * 1e3 * t)));
+	}
+	demodulated_range(THUNDERSCOPEHW_DEMODULATION_PM, samples, length, 0, &low, &high);
+	CHECK(fabs(low + 1) < 0.01 && fabs(high - 1) < 0.01);
+	free(samples);
+}
+
+static void test_equalizer()
+{
+	// A [1 2 1] / 4 front end, measured with its one sample delay removed.
+	double frequencies[64], gains[64], phases[64];
+	for (int i = 0; i < 64; i++) {
+		frequencies[i] = i * 0.3e9 / 63;
+		gains[i] = 0.5 + 0.5 * cos(2 * M_PI * frequencies[i] / 1e9);
+		phases[i] = 0;
+	}
+	const size_t length = 20000;
+	int8_t* samples = (int8_t*)malloc(length);
+	float* volts = (float*)malloc((length + 4096) * sizeof(float));
+	for (size_t i = 0; i < length; i++) {
+		double x = 0;
+		for (int j = 0; j < 3; j++) x += (j == 1 ? 0.5 : 0.25) * 100 * sin(2 * M_PI * 0.2 * (i - j));
+		samples[i] = (int8_t)lrint(x);
+	}
+
+	struct ThunderScopeHW* ts = thunderscopehw_create();
+	double volts_per_lsb = thunderscopehw_volts_per_lsb(ts, 1);
+	float taps[255];
+	// 63 taps run direct, 255 through overlap-save.
+	for (int pass = 0; pass < 2; pass++) {
+		size_t count = pass ? 255 : 63;
+		CHECK(thunderscopehw_equalizer_design(frequencies, gains, phases, 64, 1e9, 10, taps, count) == THUNDERSCOPEHW_STATUS_OK);
+		CHECK(thunderscopehw_equalizer_set(ts, 1, 350, taps, count) == THUNDERSCOPEHW_STATUS_OK);
+		struct ThunderScopeHWConverter* c = thunderscopehw_converter_create(ts, 1, true);
+		CHECK(thunderscopehw_converter_delay(c) == (count - 1) / 2);
+		size_t outputs = thunderscopehw_converter_process(c, samples, 777, volts);
+		outputs += thunderscopehw_converter_process(c, samples + 777, length - 777, volts + outputs);
+		CHECK(outputs <= length && outputs + 4096 > length);
+		// The 0.2 fs tone, attenuated to 0.65 by the front end, is back to 100 codes.
+		double squares = 0;
+		for (size_t i = 1000; i < outputs; i++) squares += volts[i] * volts[i];
+		CHECK(fabs(sqrt(squares / (outputs - 1000)) / volts_per_lsb - 70.7) < 1);
+		thunderscopehw_converter_destroy(c);
+	}
+
+	// Without the equalizer it is a plain scale.
+	struct ThunderScopeHWConverter* c = thunderscopehw_converter_create(ts, 1, false);
+	CHECK(thunderscopehw_converter_process(c, samples, 100, volts) == 100);
+	CHECK(volts[17] == (float)(samples[17] * volts_per_lsb));
+	thunderscopehw_converter_destroy(c);
+	CHECK(thunderscopehw_equalizer_set(ts, 1, 30, taps, 3) == THUNDERSCOPEHW_STATUS_INVALID_BANDWIDTH);
+	thunderscopehw_destroy(ts);
+	free(samples);
+	free(volts);
+}
+
+static void test_core_trim()
+{
+	// Single channel mode with per core offsets and gains on a tone plus noise.
+	const size_t length = 1 << 20;
+	int8_t* data = (int8_t*)malloc(length);
+	srand(3);
+	for (size_t i = 0; i < length; i++) {
+		int k = i % 8;
+		double x = 50 * sin(2 * M_PI * 0.0123457 * i) + (rand() % 17 - 8);
+		data[i] = (int8_t)lrint(x * (1 + 0.02 * (k - 4)) + (k - 3) * 0.75);
+	}
+	struct ThunderScopeHWCoreEstimator* e = thunderscopehw_core_estimator_create(1);
+	struct ThunderScopeHWCoreTrim trim;
+	CHECK(thunderscopehw_core_estimator_estimate(e, &trim) == THUNDERSCOPEHW_STATUS_INVALID_PARAMETER);
+	thunderscopehw_core_estimator_process(e, data, 1001);
+	thunderscopehw_core_estimator_process(e, data + 1001, length - 1001);
+	CHECK(thunderscopehw_core_estimator_estimate(e, &trim) == THUNDERSCOPEHW_STATUS_OK);
+	CHECK(fabs(trim.offset[7] - trim.offset[0] - 7 * 0.75) < 0.1);
+	CHECK(fabs(trim.gain[7] / trim.gain[0] - 1.06 / 0.92) < 0.005);
+
+	// After correction the cores agree.
+	thunderscopehw_core_correct(&trim, data, length);
+	thunderscopehw_core_estimator_reset(e);
+	thunderscopehw_core_estimator_process(e, data, length);
+	struct ThunderScopeHWCoreTrim residual;
+	thunderscopehw_core_estimator_estimate(e, &residual);
+	for (int k = 0; k < 8; k++) {
+		CHECK(fabs(residual.offset[k]) < 0.1);
+		CHECK(fabs(residual.gain[k] - 1) < 0.003);
+	}
+	thunderscopehw_core_estimator_destroy(e);
+	free(data);
+
+#ifndef _WIN32
+	// Trims are saved per device and loaded again at connect.
+	char dir[] = "/tmp/thunderscopehwXXXXXX";
+	if (mkdtemp(dir)) {
+		setenv("THUNDERSCOPEHW_CAL_DIR", dir, 1);
+		struct ThunderScopeHW* ts = thunderscopehw_create();
+		thunderscopehw_connect(ts, 0);
+		CHECK(thunderscopehw_core_trim_set(ts, 2, &trim) == THUNDERSCOPEHW_STATUS_OK);
+		thunderscopehw_destroy(ts);
+		ts = thunderscopehw_create();
+		thunderscopehw_connect(ts, 0);
+		CHECK(thunderscopehw_core_trim_get(ts, 2, &residual) == THUNDERSCOPEHW_STATUS_OK);
+		CHECK(residual.offset[5] == trim.offset[5] && residual.gain[3] == trim.gain[3]);
+		CHECK(thunderscopehw_core_trim_get(ts, 4, &residual) == THUNDERSCOPEHW_STATUS_INVALID_PARAMETER);
+		thunderscopehw_destroy(ts);
+		char path[64];
+		snprintf(path, sizeof(path), "%s/0000000000000000.cal", dir);
+		remove(path);
+		rmdir(dir);
+	}
+#endif
+}
+
+static void test_calibration_store()
+{
+#ifndef _WIN32
+	char dir[] = "/tmp/thunderscopehwXXXXXX";
+	if (!mkdtemp(dir)) return;
+	setenv("THUNDERSCOPEHW_CAL_DIR", dir, 1);
+	struct ThunderScopeHW* ts = thunderscopehw_create();
+	struct ThunderScopeHWCalibration calibration;
+	CHECK(thunderscopehw_calibration_get(ts, &calibration) == THUNDERSCOPEHW_STATUS_NOT_CONNECTED);
+	thunderscopehw_connect(ts, 0);
+	double nominal = thunderscopehw_volts_per_lsb(ts, 2);
+	CHECK(thunderscopehw_calibration_get(ts, &calibration) == THUNDERSCOPEHW_STATUS_OK);
+	CHECK(calibration.offsets.dac[1][3][2] == 0 && calibration.core_trim_valid == 0);
+
+	// Default settings are 1000 mV/div (index 9) at 350 MHz (index 3).
+	calibration.offsets.dac[2][9][3] = 2100;
+	calibration.offsets.codes_per_dac[2][9][3] = -5.5f;
+	calibration.gain[2][9][3] = 1.02f;
+	calibration.skew[3] = 1.5e-10;
+	CHECK(thunderscopehw_calibration_store(ts, &calibration) == THUNDERSCOPEHW_STATUS_OK);
+	CHECK(fabs(thunderscopehw_volts_per_lsb(ts, 2) / nominal - 1.02) < 1e-6);
+	thunderscopehw_destroy(ts);
+
+	ts = thunderscopehw_create();
+	thunderscopehw_connect(ts, 0);
+	struct ThunderScopeHWCalibration loaded;
+	CHECK(thunderscopehw_calibration_get(ts, &loaded) == THUNDERSCOPEHW_STATUS_OK);
+	CHECK(loaded.offsets.dac[2][9][3] == 2100 && loaded.skew[3] == 1.5e-10);
+	CHECK(fabs(thunderscopehw_volts_per_lsb(ts, 2) / nominal - 1.02) < 1e-6);
+	CHECK(thunderscopehw_volts_per_lsb(ts, 1) == nominal);
+	thunderscopehw_destroy(ts);
+	char path[64];
+	snprintf(path, sizeof(path), "%s/0000000000000000.cal", dir);
+	remove(path);
+
+	// Connecting leaves a missing directory alone, storing creates it.
+	char sub[64];
+	snprintf(sub, sizeof(sub), "%s/cal", dir);
+	setenv("THUNDERSCOPEHW_CAL_DIR", sub, 1);
+	ts = thunderscopehw_create();
+	thunderscopehw_connect(ts, 0);
+	struct stat st;
+	CHECK(stat(sub, &st) != 0);
+	CHECK(thunderscopehw_calibration_store(ts, &calibration) == THUNDERSCOPEHW_STATUS_OK);
+	CHECK(stat(sub, &st) == 0 && S_ISDIR(st.st_mode));
+	thunderscopehw_destroy(ts);
+	snprintf(path, sizeof(path), "%s/0000000000000000.cal", sub);
+	remove(path);
+	rmdir(sub);
+	rmdir(dir);
+#endif
+}
+
+static void test_autosetup()
+{
+	struct ThunderScopeHW* ts = thunderscopehw_create();
+	struct ThunderScopeHWAutosetup result;
+	CHECK(thunderscopehw_autosetup(ts, &result) == THUNDERSCOPEHW_STATUS_NOT_CONNECTED);
+	thunderscopehw_connect(ts, 0);
+	CHECK(thunderscopehw_voltage_division_set(ts, 1, 100) == THUNDERSCOPEHW_STATUS_OK);
+	double before = thunderscopehw_volts_per_lsb(ts, 1);
+
+	// The simulator reads back a flat zero: no channel has a signal, so the
+	// settings are left as they were.
+	CHECK(thunderscopehw_autosetup(ts, &result) == THUNDERSCOPEHW_STATUS_OK);
+	for (int channel = 0; channel < 4; channel++) CHECK(!result.channels[channel].active);
+	CHECK(thunderscopehw_volts_per_lsb(ts, 1) == before);
+
+	CHECK(thunderscopehw_start(ts) == THUNDERSCOPEHW_STATUS_OK);
+	CHECK(thunderscopehw_autosetup(ts, &result) == THUNDERSCOPEHW_STATUS_ALREADY_STARTED);
+	thunderscopehw_destroy(ts);
+}
+
+static void test_calibrate_offsets()
+{
+	struct ThunderScopeHW* ts = thunderscopehw_create();
+	static struct ThunderScopeHWOffsetCalibration calibration;
+	CHECK(thunderscopehw_calibrate_offsets(ts, &calibration) == THUNDERSCOPEHW_STATUS_NOT_CONNECTED);
+	thunderscopehw_connect(ts, 0);
+	CHECK(thunderscopehw_voltage_division_set(ts, 1, 100) == THUNDERSCOPEHW_STATUS_OK);
+	CHECK(thunderscopehw_voltage_offset_set(ts, 1, 0.125) == THUNDERSCOPEHW_STATUS_OK);
+	struct ThunderScopeHWChannel before[4];
+	memcpy(before, ts->channels, sizeof(before));
+	double volts_per_lsb = thunderscopehw_volts_per_lsb(ts, 1);
+
+	// The simulator reads back a flat zero whatever the DAC is set to, so every
+	// point comes out with a zero slope and the DAC code left at 0.
+	CHECK(thunderscopehw_calibrate_offsets(ts, &calibration) == THUNDERSCOPEHW_STATUS_OK);
+	for (int channel = 0; channel < 4; channel++) {
+		for (int v = 0; v < THUNDERSCOPEHW_CALIBRATION_VDIVS; v++) {
+			for (int bw = 0; bw < THUNDERSCOPEHW_CALIBRATION_BANDWIDTHS; bw++) {
+				CHECK(calibration.codes_per_dac[channel][v][bw] == 0);
+				CHECK(calibration.dac[channel][v][bw] == 0);
+			}
+		}
+	}
+	for (int channel = 0; channel < 4; channel++) {
+		CHECK(ts->channels[channel].on == before[channel].on);
+		CHECK(ts->channels[channel].vdiv == before[channel].vdiv);
+		CHECK(ts->channels[channel].bw == before[channel].bw);
+		CHECK(ts->channels[channel].voffset == before[channel].voffset);
+	}
+	CHECK(thunderscopehw_volts_per_lsb(ts, 1) == volts_per_lsb);
+
+	CHECK(thunderscopehw_start(ts) == THUNDERSCOPEHW_STATUS_OK);
+	CHECK(thunderscopehw_calibrate_offsets(ts, &calibration) == THUNDERSCOPEHW_STATUS_ALREADY_STARTED);
+	thunderscopehw_destroy(ts);
+}
+
+static void test_average()
+{
+	int8_t ramp[64], flat[64];
+	for (int i = 0; i < 64; i++) ramp[i] = (int8_t)(i - 32);
+	memset(flat, 10, sizeof(flat));
+	float out[40], low[40], high[40];
+
+	// Half a sample into the ramp interpolates between codes.
+	struct ThunderScopeHWAverage* a = thunderscopehw_average_create(40, 4);
+	struct ThunderScopeHWAverage* b = thunderscopehw_average_create(40, 4);
+	CHECK(thunderscopehw_average_create(40, 3) == NULL);
+	CHECK(thunderscopehw_average_add(a, ramp, 64, 2.5) == THUNDERSCOPEHW_STATUS_OK);
+	CHECK(thunderscopehw_average_add(b, flat, 64, 0) == THUNDERSCOPEHW_STATUS_OK);
+	CHECK(thunderscopehw_average_add(a, ramp, 64, 24.5) == THUNDERSCOPEHW_STATUS_INVALID_PARAMETER);
+	CHECK(thunderscopehw_average_merge(a, b) == THUNDERSCOPEHW_STATUS_OK);
+	CHECK(thunderscopehw_average_records(a) == 2 && thunderscopehw_average_records(b) == 0);
+	thunderscopehw_average_read(a, out);
+	CHECK(out[0] == (-29.5f + 10) / 2 && out[39] == (9.5f + 10) / 2);
+	thunderscopehw_average_destroy(a);
+	thunderscopehw_average_destroy(b);
+
+	// Past `records` each new record takes 1 / records of the weight.
+	int8_t zero[64];
+	memset(zero, 0, sizeof(zero));
+	memset(flat, 100, sizeof(flat));
+	a = thunderscopehw_average_create(40, 2);
+	thunderscopehw_average_add(a, zero, 64, 0);
+	thunderscopehw_average_add(a, zero, 64, 0);
+	thunderscopehw_average_add(a, flat, 64, 0);
+	thunderscopehw_average_read(a, out);
+	CHECK(out[0] == 50 && out[39] == 50);
+	thunderscopehw_average_destroy(a);
+
+	struct ThunderScopeHWEnvelope* e = thunderscopehw_envelope_create(40);
+	struct ThunderScopeHWEnvelope* f = thunderscopehw_envelope_create(40);
+	thunderscopehw_envelope_add(e, ramp, 64, 0.25);
+	thunderscopehw_envelope_add(f, flat, 64, 0);
+	CHECK(thunderscopehw_envelope_merge(e, f) == THUNDERSCOPEHW_STATUS_OK);
+	thunderscopehw_envelope_read(e, low, high);
+	CHECK(low[0] == -31.75f && high[0] == 100 && low[39] == 7.25f);
+	CHECK(thunderscopehw_envelope_records(e) == 2);
+	thunderscopehw_envelope_destroy(e);
+	thunderscopehw_envelope_destroy(f);
+}
+
+static void test_math()
+{
+	enum { N = 5000 };
+	static int8_t a[N], b[N], q[N];
+	static float out[N];
+	for (int i = 0; i < N; i++) {
+		a[i] = (int8_t)(i % 50 - 25);
+		b[i] = 3;
+	}
+	const int8_t* channels[4] = { a, b, NULL, NULL };
+
+	CHECK(thunderscopehw_math_create("ch5", 1e9, NULL) == NULL);
+	CHECK(thunderscopehw_math_create("ch1 +", 1e9, NULL) == NULL);
+	CHECK(thunderscopehw_math_create("(ch1", 1e9, NULL) == NULL);
+	CHECK(thunderscopehw_math_create("deriv(ch1", 1e9, NULL) == NULL);
+
+	struct ThunderScopeHWMath* m = thunderscopehw_math_create("2 * (ch1 + 1) - ch2 / 3 - -1", 1e9, NULL);
+	CHECK(m && thunderscopehw_math_channels(m) == 3);
+	thunderscopehw_math_process(m, channels, N, out);
+	CHECK(out[0] == 2 * (-25 + 1) - 1 + 1 && out[N - 1] == 2 * (24 + 1) - 1 + 1);
+	thunderscopehw_math_destroy(m);
+
+	// Power in volts squared.
+	const double volts_per_lsb[4] = { 0.5, 0.25, 1, 1 };
+	m = thunderscopehw_math_create("CH1 * CH2", 1e9, volts_per_lsb);
+	thunderscopehw_math_process(m, channels, N, out);
+	CHECK(out[4097] == (4097 % 50 - 25) * 0.5f * 0.75f);
+	thunderscopehw_math_destroy(m);
+
+	// State carries across calls.
+	m = thunderscopehw_math_create("integ(ch2) + deriv(ch1)", 1000, NULL);
+	thunderscopehw_math_process(m, channels, 3000, out);
+	thunderscopehw_math_process(m, channels, 0, out);
+	const int8_t* rest[4] = { a + 3000, b + 3000, NULL, NULL };
+	thunderscopehw_math_process(m, rest, N - 3000, out + 3000);
+	CHECK(out[0] == 3 / 1000.0f);
+	CHECK(fabsf(out[2999] - (9.0f + 1000)) < 1e-3f);
+	CHECK(fabsf(out[3000] - (9.003f - 49000)) < 1e-2f);
+	CHECK(fabsf(out[3001] - (9.006f + 1000)) < 1e-3f);
+	CHECK(fabsf(out[3050] - (9.153f - 49000)) < 1e-2f);
+	thunderscopehw_math_destroy(m);
+
+	m = thunderscopehw_math_create("abs(ch1) * 8 - 100", 1e9, NULL);
+	thunderscopehw_math_process_i8(m, channels, N, 1, q);
+	CHECK(q[0] == 100 && q[25] == -100 && q[49] == 92);
+	thunderscopehw_math_process_i8(m, channels, N, 0.5, q);
+	CHECK(q[0] == 127 && q[25] == -127 && q[13] == -8);
+	thunderscopehw_math_destroy(m);
+
+	// Division by a zero code saturates the same in the vector loop and the tail.
+	static int8_t sign[N], zero[N];
+	for (int i = 0; i < N; i++) sign[i] = (int8_t)(i % 3 - 1);
+	const int8_t* divide[4] = { sign, zero, NULL, NULL };
+	m = thunderscopehw_math_create("ch1 / ch2", 1e9, NULL);
+	thunderscopehw_math_process_i8(m, divide, 17, 1, q);
+	bool saturated = true;
+	for (int i = 0; i < 17; i++) saturated = saturated && q[i] == 127 * sign[i];
+	CHECK(saturated);
+	thunderscopehw_math_destroy(m);
+}
+
+static void test_logic()
+{
+	enum { N = 1272 };
+	static int8_t samples[N];
+	static uint8_t bits[N / 8];
+	static uint64_t transitions[N];
+	// Slow square wave with noise crossing both thresholds around each edge.
+	uint32_t seed = 1;
+	for (int i = 0; i < N; i++) {
+		seed = seed * 1103515245 + 12345;
+		samples[i] = (int8_t)(((i / 50) & 1 ? 25 : -25) + (int)(seed >> 16) % 81 - 40);
+	}
+
+	struct ThunderScopeHWLogic* l = thunderscopehw_logic_create(-10, 10);
+	CHECK(thunderscopehw_logic_create(10, -10) == NULL);
+	size_t count = 0, offset = 0;
+	const size_t chunks[] = { 200, 64, 8, 1000 };
+	for (int c = 0; c < 4; c++) {
+		count += thunderscopehw_logic_process(l, samples + offset, chunks[c], bits + offset / 8, transitions + count);
+		offset += chunks[c];
+	}
+	CHECK(thunderscopehw_logic_position(l) == N);
+
+	bool level = false;
+	size_t expected = 0;
+	int mismatches = 0;
+	for (int i = 0; i < N; i++) {
+		bool next = samples[i] > 10 ? true : samples[i] < -10 ? false : level;
+		if (next != level && (expected >= count || transitions[expected++] != (uint64_t)i)) mismatches++;
+		level = next;
+		if (((bits[i / 8] >> (i % 8)) & 1) != level) mismatches++;
+	}
+	CHECK(mismatches == 0 && expected == count && count >= 25);
+	CHECK(thunderscopehw_logic_level(l) == level);
+	thunderscopehw_logic_destroy(l);
+}
+
+static void test_level_fill(int8_t* s, size_t from, size_t to, bool level)
+{
+	for (size_t i = from; i < to; i++) s[i] = level ? 60 : -60;
+}
+
+// I2C bus state written a stretch at a time.
+struct TestI2cBus {
+	int8_t* scl;
+	int8_t* sda;
+	size_t t;
+	bool sda_level;
+};
+
+static void test_i2c_hold(struct TestI2cBus* bus, size_t n, bool scl, bool sda)
+{
+	test_level_fill(bus->scl, bus->t, bus->t + n, scl);
+	test_level_fill(bus->sda, bus->t, bus->t + n, sda);
+	bus->t += n;
+	bus->sda_level = sda;
+}
+
+static void test_i2c_byte(struct TestI2cBus* bus, uint8_t byte, bool ack)
+{
+	for (int i = 0; i < 9; i++) {
+		bool b = i < 8 ? (byte >> (7 - i)) & 1 : !ack;
+		test_i2c_hold(bus, 5, false, bus->sda_level);
+		test_i2c_hold(bus, 5, false, b);
+		test_i2c_hold(bus, 10, true, b);
+	}
+	test_i2c_hold(bus, 5, false, bus->sda_level);
+}
+
+static void test_decoder()
+{
+	enum { N = 4000 };
+	static int8_t line[N];
+	static int8_t bus[4][N];
+	struct ThunderScopeHWPacket packets[N / 2];
+
+	// UART at 115200 baud, 8E1, with gaps between some bytes and a bad parity bit.
+	const char* text = "UHello, ThunderScope!";
+	size_t length = strlen(text);
+	double bit = 1e6 / 115200;
+	double t = 100;
+	test_level_fill(line, 0, N, true);
+	for (size_t i = 0; i < length; i++) {
+		int ones = 0;
+		for (int k = 0; k < 8; k++) ones += (text[i] >> k) & 1;
+		for (int k = 0; k < 11; k++) {
+			bool level = k == 0 ? false : k <= 8 ? (text[i] >> (k - 1)) & 1 : k == 9 ? (ones & 1) ^ (i == 5) : true;
+			test_level_fill(line, (size_t)lround(t + k * bit), (size_t)lround(t + (k + 1) * bit), level);
+		}
+		t += (11 + (i % 3 == 0 ? 4 : 0)) * bit;
+	}
+	CHECK(thunderscopehw_uart_decoder_create(1e6, 0, 10, THUNDERSCOPEHW_PARITY_NONE, -10, 10) == NULL);
+	struct ThunderScopeHWDecoder* d = thunderscopehw_uart_decoder_create(1e6, 0, 8, THUNDERSCOPEHW_PARITY_EVEN, -10, 10);
+	const int8_t* inputs[4] = { line };
+	size_t count = thunderscopehw_decoder_process(d, inputs, 1001, packets, N / 2);
+	inputs[0] = line + 1001;
+	count += thunderscopehw_decoder_process(d, inputs, N - 1001, packets + count, N / 2 - count);
+	CHECK(thunderscopehw_uart_decoder_baud(d) == 115200);
+	CHECK(count == length);
+	int mismatches = 0;
+	for (size_t i = 0; i < count && i < length; i++) {
+		if (packets[i].type != THUNDERSCOPEHW_PACKET_UART || packets[i].value != (uint8_t)text[i]) mismatches++;
+		if (packets[i].flags != (i == 5 ? THUNDERSCOPEHW_PACKET_PARITY_ERROR : 0)) mismatches++;
+	}
+	CHECK(mismatches == 0);
+	CHECK(packets[0].start == 100 && packets[0].end == 100 + (uint64_t)lround(11 * bit) - 1);
+	// Full buffer: packets are counted, not written.
+	thunderscopehw_decoder_reset(d);
+	inputs[0] = line;
+	CHECK(thunderscopehw_decoder_process(d, inputs, N, packets, 4) == 4);
+	CHECK(thunderscopehw_decoder_dropped(d) == length - 4);
+	thunderscopehw_decoder_destroy(d);
+
+	// SPI mode 3, CS qualified: two words, clocks with CS high, a partial word.
+	static const uint8_t mosi[2] = { 0xA5, 0x01 }, miso[2] = { 0x3C, 0xFE };
+	for (int i = 0; i < 4; i++) test_level_fill(bus[i], 0, 400, true);
+	test_level_fill(bus[3], 20, 190, false);
+	for (int j = 0; j < 16; j++) {
+		size_t edge = 25 + j * 10;
+		test_level_fill(bus[0], edge, edge + 5, false);
+		test_level_fill(bus[1], edge, edge + 10, (mosi[j / 8] >> (7 - j % 8)) & 1);
+		test_level_fill(bus[2], edge, edge + 10, (miso[j / 8] >> (7 - j % 8)) & 1);
+	}
+	for (int j = 0; j < 3; j++) test_level_fill(bus[0], 250 + j * 10, 255 + j * 10, false);
+	test_level_fill(bus[3], 300, 350, false);
+	for (int j = 0; j < 3; j++) test_level_fill(bus[0], 305 + j * 10, 310 + j * 10, false);
+	CHECK(thunderscopehw_spi_decoder_create(4, 8, true, -10, 10) == NULL);
+	d = thunderscopehw_spi_decoder_create(3, 8, true, -10, 10);
+	const int8_t* spi[4] = { bus[0], bus[1], bus[2], bus[3] };
+	count = thunderscopehw_decoder_process(d, spi, 400, packets, N / 2);
+	CHECK(count == 2);
+	CHECK(packets[0].type == THUNDERSCOPEHW_PACKET_SPI && packets[0].value == 0xA5 && packets[0].value2 == 0x3C);
+	CHECK(packets[0].start == 30 && packets[0].end == 100);
+	CHECK(packets[1].value == 0x01 && packets[1].value2 == 0xFE);
+	thunderscopehw_decoder_destroy(d);
+
+	// I2C: write 0x12 to 0x50, repeated start, read 0x34 with the master's NACK, stop.
+	struct TestI2cBus i2c = { bus[0], bus[1], 0, true };
+	test_i2c_hold(&i2c, 50, true, true);
+	test_i2c_hold(&i2c, 10, true, false);
+	test_i2c_byte(&i2c, 0xA0, true);
+	test_i2c_byte(&i2c, 0x12, true);
+	test_i2c_hold(&i2c, 5, false, true);
+	test_i2c_hold(&i2c, 10, true, true);
+	test_i2c_hold(&i2c, 10, true, false);
+	test_i2c_byte(&i2c, 0xA1, true);
+	test_i2c_byte(&i2c, 0x34, false);
+	test_i2c_hold(&i2c, 5, false, false);
+	test_i2c_hold(&i2c, 10, true, false);
+	test_i2c_hold(&i2c, 20, true, true);
+	d = thunderscopehw_i2c_decoder_create(-10, 10);
+	const int8_t* halves[2] = { bus[0], bus[1] };
+	count = thunderscopehw_decoder_process(d, halves, 333, packets, N / 2);
+	halves[0] = bus[0] + 333;
+	halves[1] = bus[1] + 333;
+	count += thunderscopehw_decoder_process(d, halves, i2c.t - 333, packets + count, N / 2 - count);
+	CHECK(count == 7);
+	if (count == 7) {
+		CHECK(packets[0].type == THUNDERSCOPEHW_PACKET_I2C_START && packets[0].flags == 0 && packets[0].start == 50);
+		CHECK(packets[1].type == THUNDERSCOPEHW_PACKET_I2C_ADDRESS && packets[1].value == 0x50 && packets[1].flags == 0);
+		CHECK(packets[2].type == THUNDERSCOPEHW_PACKET_I2C_DATA && packets[2].value == 0x12 && packets[2].flags == 0);
+		CHECK(packets[3].type == THUNDERSCOPEHW_PACKET_I2C_START && packets[3].flags == THUNDERSCOPEHW_PACKET_RESTART);
+		CHECK(packets[4].value == 0x50 && packets[4].flags == THUNDERSCOPEHW_PACKET_READ);
+		CHECK(packets[5].value == 0x34 && packets[5].flags == THUNDERSCOPEHW_PACKET_NACK);
+		CHECK(packets[6].type == THUNDERSCOPEHW_PACKET_I2C_STOP);
+	}
+
+	// SDA toggling every sample with SCL high: a START or STOP per edge, past
+	// length / 2 entries, the excess counted as dropped.
+	thunderscopehw_decoder_reset(d);
+	test_level_fill(bus[0], 0, 100, true);
+	for (size_t i = 0; i < 100; i++) bus[1][i] = i & 1 ? -60 : 60;
+	halves[0] = bus[0];
+	halves[1] = bus[1];
+	CHECK(thunderscopehw_decoder_process(d, halves, 100, packets, 50) == 50);
+	CHECK(thunderscopehw_decoder_dropped(d) == 49);
+	thunderscopehw_decoder_reset(d);
+	CHECK(thunderscopehw_decoder_process(d, halves, 100, packets, 101) == 99);
+	CHECK(thunderscopehw_decoder_dropped(d) == 0);
+	CHECK(packets[0].type == THUNDERSCOPEHW_PACKET_I2C_START && packets[98].type == THUNDERSCOPEHW_PACKET_I2C_START);
+	thunderscopehw_decoder_destroy(d);
+}
+
+// Bit level CAN writer for the decoder test: fields, stuffing and CRCs as a
+// controller puts them on the bus (dominant high, as CANH - CANL).
+struct TestCanBits {
+	int n;
+	uint8_t bits[1200];
+};
+
+static void test_can_push(struct TestCanBits* b, uint32_t value, int bits)
+{
+	for (int i = bits - 1; i >= 0; i--) b->bits[b->n++] = (value >> i) & 1;
+}
+
+static uint32_t test_can_crc(const struct TestCanBits* b, uint32_t crc, uint32_t poly, int width)
+{
+	for (int i = 0; i < b->n; i++) {
+		uint32_t top = (crc >> (width - 1)) & 1;
+		crc = (crc << 1) & ((1U << width) - 1);
+		if (top != b->bits[i]) crc ^= poly;
+	}
+	return crc;
+}
+
+static void test_can_write(int8_t* line, double* t, int bit, double duration)
+{
+	test_level_fill(line, (size_t)lround(*t), (size_t)lround(*t + duration), !bit);
+	*t += duration;
+}
+
+static void test_can_frame(int8_t* line, double* t, double nominal, double fast, uint32_t id, bool extended,
+			   bool fd, int dlc, const uint8_t* data, bool ack, bool corrupt)
+{
+	static const int lengths[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64 };
+	int length = fd ? lengths[dlc] : dlc;
+	struct TestCanBits f = { 0 };
+	test_can_push(&f, 0, 1);
+	if (extended) {
+		test_can_push(&f, id >> 18, 11);
+		test_can_push(&f, 3, 2);
+		test_can_push(&f, id & 0x3FFFF, 18);
+		test_can_push(&f, 0, 1);
+	} else {
+		test_can_push(&f, id, 11);
+		test_can_push(&f, 0, 2);
+	}
+	test_can_push(&f, 0, 1);
+	int brs = -1;
+	if (fd) {
+		// FDF, res, BRS, ESI.
+		f.bits[f.n - 1] = 1;
+		test_can_push(&f, 0, 1);
+		if (fast > 0) brs = f.n;
+		test_can_push(&f, fast > 0 ? 2 : 0, 2);
+	} else if (extended) {
+		test_can_push(&f, 0, 1);
+	}
+	test_can_push(&f, dlc, 4);
+	for (int i = 0; i < length; i++) test_can_push(&f, data[i], 8);
+	if (!fd) test_can_push(&f, test_can_crc(&f, 0, 0x4599, 15) ^ corrupt, 15);
+
+	// Dynamic stuffing, none after the last data bit of an FD frame.
+	struct TestCanBits raw = { 0 };
+	int run = 0, last = 1, stuffed = 0, raw_brs = -1;
+	for (int i = 0; i < f.n; i++) {
+		int bit = f.bits[i];
+		if (i == brs) raw_brs = raw.n;
+		raw.bits[raw.n++] = (uint8_t)bit;
+		run = bit == last ? run + 1 : 1;
+		last = bit;
+		if (run == 5 && !(fd && i == f.n - 1)) {
+			raw.bits[raw.n++] = (uint8_t)!bit;
+			last = !bit;
+			run = 1;
+			stuffed++;
+		}
+	}
+	if (fd) {
+		int count = stuffed & 7;
+		int gray = count ^ (count >> 1);
+		struct TestCanBits tail = { 0 };
+		test_can_push(&tail, gray, 3);
+		test_can_push(&tail, (gray ^ (gray >> 1) ^ (gray >> 2)) & 1, 1);
+		int width = length > 16 ? 21 : 17;
+		struct TestCanBits covered = raw;
+		test_can_push(&covered, tail.bits[0] * 8 + tail.bits[1] * 4 + tail.bits[2] * 2 + tail.bits[3], 4);
+		uint32_t crc = test_can_crc(&covered, 1U << (width - 1), width == 21 ? 0x102899 : 0x1685B, width);
+		test_can_push(&tail, crc ^ corrupt, width);
+		// Fixed stuff bits ahead of every 4 bits.
+		for (int i = 0; i < tail.n; i++) {
+			if (i % 4 == 0) {
+				raw.bits[raw.n] = !raw.bits[raw.n - 1];
+				raw.n++;
+			}
+			raw.bits[raw.n++] = tail.bits[i];
+		}
+	}
+	int delimiter = raw.n;
+	test_can_push(&raw, 1, 1);
+	test_can_push(&raw, !ack, 1);
+	test_can_push(&raw, 0x3FF, 10);
+
+	for (int i = 0; i < raw.n; i++) {
+		double duration = nominal;
+		if (raw_brs >= 0 && i == raw_brs) {
+			duration = 0.8 * nominal + 0.2 * fast;
+		} else if (raw_brs >= 0 && i > raw_brs && i < delimiter) {
+			duration = fast;
+		} else if (raw_brs >= 0 && i == delimiter) {
+			duration = 0.8 * fast + 0.2 * nominal;
+		}
+		test_can_write(line, t, raw.bits[i], duration);
+	}
+	test_can_write(line, t, 1, 5 * nominal);
+}
+
+static void test_uart_byte(int8_t* line, double* t, double bit, uint8_t value)
+{
+	for (int k = 0; k < 10; k++) {
+		bool level = k == 0 ? false : k <= 8 ? (value >> (k - 1)) & 1 : true;
+		test_level_fill(line, (size_t)lround(*t + k * bit), (size_t)lround(*t + (k + 1) * bit), level);
+	}
+	*t += 10 * bit;
+}
+
+static uint8_t test_lin_pid(uint8_t id)
+{
+	int b[6];
+	for (int i = 0; i < 6; i++) b[i] = (id >> i) & 1;
+	return (uint8_t)(id | (b[0] ^ b[1] ^ b[2] ^ b[4]) << 6 | !(b[1] ^ b[3] ^ b[4] ^ b[5]) << 7);
+}
+
+static void test_lin_frame(int8_t* line, double* t, double bit, uint8_t id, const uint8_t* data, int length,
+			   bool enhanced, bool corrupt)
+{
+	test_level_fill(line, (size_t)lround(*t), (size_t)lround(*t + 13 * bit), false);
+	*t += 14 * bit;
+	test_uart_byte(line, t, bit, 0x55);
+	uint8_t pid = test_lin_pid(id);
+	test_uart_byte(line, t, bit, pid);
+	if (!length) return;
+	unsigned sum = enhanced ? pid : 0;
+	for (int i = 0; i < length; i++) {
+		*t += bit;
+		test_uart_byte(line, t, bit, data[i]);
+		sum += data[i];
+		if (sum > 0xFF) sum -= 0xFF;
+	}
+	test_uart_byte(line, t, bit, (uint8_t)(~sum ^ corrupt));
+}
+
+static void test_bus_decoders()
+{
+	enum { N = 60000 };
+	static int8_t line[N];
+	struct ThunderScopeHWPacket packets[16];
+
+	// CAN at 500 kbit/s with 2 Mbit/s data phases, 20 MS/s.
+	const double nominal = 40, fast = 10;
+	uint8_t data[64];
+	for (int i = 0; i < 64; i++) data[i] = (uint8_t)(i * 7);
+	static const uint8_t classic[3] = { 0x00, 0xFF, 0x11 };
+	static const uint8_t zeros[12] = { 0 };
+	double t = 100;
+	test_level_fill(line, 0, N, false);
+	test_can_frame(line, &t, nominal, fast, 0x123, false, false, 3, classic, true, false);
+	test_can_frame(line, &t, nominal, fast, 0x1ABCDEF0, true, true, 13, data, true, false);
+	test_can_frame(line, &t, nominal, 0, 0x7FF, false, true, 9, zeros, true, false);
+	test_can_frame(line, &t, nominal, fast, 0x0, true, false, 8, data, true, true);
+	// Start of frame, one recessive bit, then an error flag breaking the stuffing rule.
+	size_t error_start = (size_t)lround(t);
+	test_level_fill(line, error_start, error_start + 40 * 12, true);
+	test_level_fill(line, error_start + 40, error_start + 80, false);
+	t += 40 * 30;
+	test_can_frame(line, &t, nominal, fast, 0x123, false, false, 3, classic, false, false);
+	// The CRC ends on five equal bits, a stuff bit comes before the delimiter.
+	static const uint8_t stuffed_crc[1] = { 0xA5 };
+	test_can_frame(line, &t, nominal, fast, 0x024, false, false, 1, stuffed_crc, true, false);
+	size_t length = (size_t)lround(t);
+
+	CHECK(thunderscopehw_can_decoder_create(20e6, 0, 0, true, -10, 10) == NULL);
+	struct ThunderScopeHWDecoder* d = thunderscopehw_can_decoder_create(20e6, 500e3, 2e6, true, -10, 10);
+	const int8_t* inputs[1] = { line };
+	size_t count = 0;
+	for (size_t offset = 0; offset < length; offset += 5000) {
+		inputs[0] = line + offset;
+		count += thunderscopehw_decoder_process(d, inputs, length - offset < 5000 ? length - offset : 5000,
+							packets + count, 16 - count);
+	}
+	CHECK(count == 7);
+	if (count == 7) {
+		CHECK(packets[0].type == THUNDERSCOPEHW_PACKET_CAN && packets[0].value == 0x123 && packets[0].flags == 0);
+		CHECK(packets[0].start == 100 && packets[0].length == 3 && memcmp(packets[0].data, classic, 3) == 0);
+		CHECK(packets[1].value == 0x1ABCDEF0 && packets[1].length == 32 && memcmp(packets[1].data, data, 32) == 0);
+		CHECK(packets[1].flags == (THUNDERSCOPEHW_PACKET_EXTENDED | THUNDERSCOPEHW_PACKET_FD | THUNDERSCOPEHW_PACKET_BRS));
+		CHECK(packets[2].value == 0x7FF && packets[2].value2 == 9 && packets[2].length == 12);
+		CHECK(packets[2].flags == THUNDERSCOPEHW_PACKET_FD);
+		CHECK(packets[3].flags == (THUNDERSCOPEHW_PACKET_EXTENDED | THUNDERSCOPEHW_PACKET_CRC_ERROR));
+		CHECK(packets[4].type == THUNDERSCOPEHW_PACKET_CAN_ERROR && packets[4].flags == THUNDERSCOPEHW_PACKET_STUFF_ERROR);
+		CHECK(packets[5].value == 0x123 && packets[5].flags == THUNDERSCOPEHW_PACKET_NACK);
+		CHECK(packets[6].type == THUNDERSCOPEHW_PACKET_CAN && packets[6].value == 0x024 && packets[6].flags == 0);
+		CHECK(packets[6].length == 1 && packets[6].data[0] == 0xA5);
+	}
+	thunderscopehw_decoder_destroy(d);
+
+	// LIN at 19200 baud: enhanced checksum, classic with a bad checksum, a bare header.
+	double bit = 1e6 / 19200;
+	static const uint8_t response[2] = { 0x01, 0x02 };
+	t = 200;
+	test_level_fill(line, 0, N, true);
+	test_lin_frame(line, &t, bit, 0x10, response, 2, true, false);
+	t += 30 * bit;
+	test_lin_frame(line, &t, bit, 0x3C, data, 8, false, true);
+	t += 30 * bit;
+	test_lin_frame(line, &t, bit, 0x21, NULL, 0, false, false);
+	d = thunderscopehw_lin_decoder_create(1e6, 19200, -10, 10);
+	inputs[0] = line;
+	count = thunderscopehw_decoder_process(d, inputs, N, packets, 16);
+	CHECK(count == 3);
+	if (count == 3) {
+		CHECK(packets[0].type == THUNDERSCOPEHW_PACKET_LIN && packets[0].value == 0x10 && packets[0].flags == 0);
+		CHECK(packets[0].start == 200 && packets[0].length == 2 && packets[0].data[1] == 0x02);
+		CHECK(packets[1].value == 0x3C && packets[1].length == 8 && packets[1].flags == THUNDERSCOPEHW_PACKET_CHECKSUM_ERROR);
+		CHECK(packets[2].value == 0x21 && packets[2].length == 0 && packets[2].flags == 0);
+	}
+	thunderscopehw_decoder_destroy(d);
+}
+
+// Symbol stream with jittered, linear 3 sample edges between -60 and 60 and some noise.
+static void test_symbols_fill(int8_t* samples, size_t n, const uint8_t* symbols, size_t count, double start, double ui,
+			      uint32_t* seed)
+{
+	size_t k = 0;
+	double edge = start, next = start + ui;
+	for (size_t i = 0; i < n; i++) {
+		while (k + 1 < count && i >= next) {
+			k++;
+			edge = next;
+			*seed = *seed * 1103515245 + 12345;
+			next = start + (k + 1) * ui + ((int)(*seed >> 16) % 101 - 50) * 0.001 * ui;
+		}
+		double level = symbols[k] ? 60 : -60;
+		double before = k && symbols[k - 1] ? 60 : -60;
+		double v = i < start ? -60 : i - edge < 3 ? before + (level - before) * (i - edge) / 3 : level;
+		*seed = *seed * 1103515245 + 12345;
+		samples[i] = (int8_t)lrint(v + (int)(*seed >> 16) % 11 - 5);
+	}
+}
+
+// Recovered bits against the sent ones by their boundary, skipping the first lock.
+static int test_cdr_run(struct ThunderScopeHWCdr* cdr, const int8_t* samples, size_t n, const uint8_t* sent, size_t count,
+			double start, double bit, size_t* checked)
+{
+	static double boundaries[40000];
+	static uint8_t bits[40000];
+	size_t total = 0;
+	for (size_t offset = 0; offset < n; offset += 1000) {
+		size_t length = n - offset < 1000 ? n - offset : 1000;
+		CHECK(total + thunderscopehw_cdr_max_output(cdr, length) <= 40000);
+		total += thunderscopehw_cdr_process(cdr, samples + offset, length, boundaries + total, bits + total);
+	}
+	int mismatches = 0;
+	*checked = 0;
+	for (size_t i = 0; i < total; i++) {
+		double k = (boundaries[i] - start) / bit;
+		if (k < 500 || k >= count - 1) continue;
+		size_t index = (size_t)lround(k);
+		if (fabs(k - index) > 0.25 || bits[i] != sent[index]) mismatches++;
+		(*checked)++;
+	}
+	return mismatches;
+}
+
+static void test_cdr()
+{
+	enum { N = 200000, BITS = 19000 };
+	static int8_t samples[N];
+	static uint8_t sent[BITS];
+	static uint8_t symbols[2 * BITS];
+	uint32_t seed = 7;
+	// PRBS7 at 100 Mbit/s plus 200 ppm, 1 GS/s.
+	uint32_t prbs = 0x7F;
+	for (int i = 0; i < BITS; i++) {
+		uint32_t b = ((prbs >> 6) ^ (prbs >> 5)) & 1;
+		prbs = ((prbs << 1) | b) & 0x7F;
+		sent[i] = (uint8_t)b;
+	}
+	double bit = 10 / 1.0002;
+	test_symbols_fill(samples, N, sent, BITS, 37.3, bit, &seed);
+
+	CHECK(thunderscopehw_cdr_create(THUNDERSCOPEHW_CDR_PLL, THUNDERSCOPEHW_LINE_CODE_NRZ, 1e9, 600e6, 0, -10, 10) == NULL);
+	size_t checked;
+	struct ThunderScopeHWCdr* cdr = thunderscopehw_cdr_create(THUNDERSCOPEHW_CDR_PLL, THUNDERSCOPEHW_LINE_CODE_NRZ,
+								  1e9, 100e6, 1e6, -10, 10);
+	CHECK(test_cdr_run(cdr, samples, N, sent, BITS, 37.3, bit, &checked) == 0 && checked > 18000);
+	CHECK(fabs(thunderscopehw_cdr_bit_rate(cdr) / 100.02e6 - 1) < 1e-4);
+	thunderscopehw_cdr_destroy(cdr);
+
+	cdr = thunderscopehw_cdr_create(THUNDERSCOPEHW_CDR_HISTOGRAM, THUNDERSCOPEHW_LINE_CODE_NRZ, 1e9, 100e6, 0, -10, 10);
+	CHECK(test_cdr_run(cdr, samples, N, sent, BITS, 37.3, bit, &checked) == 0 && checked > 18000);
+	CHECK(fabs(thunderscopehw_cdr_bit_rate(cdr) / 100.02e6 - 1) < 1e-4);
+	thunderscopehw_cdr_destroy(cdr);
+
+	// Manchester at 50 Mbit/s: first half inverted.
+	for (int i = 0; i < BITS / 2; i++) {
+		symbols[2 * i] = !sent[i];
+		symbols[2 * i + 1] = sent[i];
+	}
+	test_symbols_fill(samples, N, symbols, BITS, 37.3, bit, &seed);
+	cdr = thunderscopehw_cdr_create(THUNDERSCOPEHW_CDR_PLL, THUNDERSCOPEHW_LINE_CODE_MANCHESTER, 1e9, 50e6, 1e6, -10, 10);
+	CHECK(test_cdr_run(cdr, samples, N, sent, BITS / 2, 37.3, 2 * bit, &checked) == 0 && checked > 8900);
+	thunderscopehw_cdr_destroy(cdr);
+}
+
+static void test_eye()
+{
+	enum { N = 200000, BITS = 19000 };
+	static int8_t samples[N];
+	static uint8_t sent[BITS];
+	uint32_t seed = 11;
+	uint32_t prbs = 0x7F;
+	for (int i = 0; i < BITS; i++) {
+		uint32_t b = ((prbs >> 6) ^ (prbs >> 5)) & 1;
+		prbs = ((prbs << 1) | b) & 0x7F;
+		sent[i] = (uint8_t)b;
+	}
+	double bit = 10 / 1.0002;
+	test_symbols_fill(samples, N, sent, BITS, 37.3, bit, &seed);
+	// A glitch in the middle of bit 5000.
+	size_t glitch = (size_t)(37.3 + 5000.65 * bit);
+	for (size_t i = glitch - 1; i <= glitch + 1; i++) samples[i] = sent[5000] ? -60 : 60;
+
+	// Edges take 0.3 UI and jitter by 0.05, the eye is open from 0.35 to 1 UI within +-55 codes.
+	const double diamond_x[4] = {0.45, 0.675, 0.9, 0.675};
+	const double diamond_y[4] = {0, 40, 0, -40};
+	const double rail_x[4] = {-0.5, 1.5, 1.5, -0.5};
+	const double rail_y[4] = {80, 80, 127, 127};
+	CHECK(thunderscopehw_eye_create(64, 1e9, 600e6, 0) == NULL);
+	struct ThunderScopeHWEye* e = thunderscopehw_eye_create(64, 1e9, 100.02e6, 37.3);
+	CHECK(thunderscopehw_eye_add_polygon(e, diamond_x, diamond_y, 4) == 0);
+	CHECK(thunderscopehw_eye_add_polygon(e, rail_x, rail_y, 4) == 1);
+	size_t folded = 0;
+	for (size_t offset = 0; offset < N; offset += 1000) folded += thunderscopehw_eye_process(e, samples + offset, 1000, NULL);
+	// The last bit carries on to the end.
+	CHECK(folded > (N - 37.3) / bit - 4 && folded < (N - 37.3) / bit);
+	CHECK(thunderscopehw_persistence_records(thunderscopehw_eye_persistence(e)) == folded);
+	CHECK(thunderscopehw_eye_hits(e, 0) > 0 && thunderscopehw_eye_hits(e, 1) == 0);
+	CHECK(thunderscopehw_eye_failed_bits(e) == 1);
+	struct ThunderScopeHWEyeViolation violations[4];
+	CHECK(thunderscopehw_eye_violations(e, violations, 4) == 1);
+	CHECK(fabs(violations[0].start - (37.3 + 5000 * bit)) < 1e-6 && violations[0].polygons == 1);
+	CHECK(violations[0].hits == thunderscopehw_eye_hits(e, 0));
+	// Late in the bit the trace sits at -60 or 60.
+	const uint32_t* counts = thunderscopehw_persistence_counts(thunderscopehw_eye_persistence(e));
+	uint32_t rails = 0;
+	for (int code = -66; code <= -54; code++) rails += counts[43 * 256 + code + 128] + counts[43 * 256 - code + 128];
+	CHECK(rails == folded);
+
+	// Another thread's eye over the second half, clocked by a CDR.
+	struct ThunderScopeHWEye* b = thunderscopehw_eye_create(64, 1e9, 100.02e6, 0);
+	thunderscopehw_eye_add_polygon(b, diamond_x, diamond_y, 4);
+	struct ThunderScopeHWCdr* cdr = thunderscopehw_cdr_create(THUNDERSCOPEHW_CDR_PLL, THUNDERSCOPEHW_LINE_CODE_NRZ, 1e9, 100e6, 0, -10, 10);
+	size_t folded_b = thunderscopehw_eye_process(b, samples + N / 2, N / 2, cdr);
+	CHECK(folded_b > BITS / 2 - 10);
+	CHECK(thunderscopehw_eye_failed_bits(b) == 0);
+	CHECK(thunderscopehw_eye_merge(e, b) == THUNDERSCOPEHW_STATUS_INVALID_PARAMETER);
+	thunderscopehw_eye_add_polygon(b, rail_x, rail_y, 4);
+	CHECK(thunderscopehw_eye_merge(e, b) == THUNDERSCOPEHW_STATUS_OK);
+	CHECK(thunderscopehw_persistence_records(thunderscopehw_eye_persistence(e)) == folded + folded_b);
+	CHECK(thunderscopehw_persistence_records(thunderscopehw_eye_persistence(b)) == 0);
+	CHECK(thunderscopehw_eye_failed_bits(e) == 1);
+	thunderscopehw_cdr_destroy(cdr);
+	thunderscopehw_eye_destroy(b);
+
+	thunderscopehw_eye_reset(e);
+	CHECK(thunderscopehw_eye_failed_bits(e) == 0 && thunderscopehw_eye_hits(e, 0) == 0);
+	thunderscopehw_eye_clear_mask(e);
+	CHECK(thunderscopehw_eye_add_polygon(e, diamond_x, diamond_y, 2) == -1);
+	thunderscopehw_eye_destroy(e);
+}
+
+// Clock with 4 sample ramps between -60 and 60, high for half a period after each rising edge.
+static void test_clock_fill(int8_t* samples, size_t n, const double* rising, size_t count, double period)
+{
+	size_t k = 0;
+	for (size_t i = 0; i < n; i++) {
+		while (k + 1 < count && i >= rising[k + 1]) k++;
+		double t = i - rising[k], fall = t - period / 2;
+		double v = t < 0 ? -60 : t < 4 ? -60 + 30 * t : fall < 0 ? 60 : fall < 4 ? 60 - 30 * fall : -60;
+		samples[i] = (int8_t)lrint(v);
+	}
+}
+
+static double test_gauss(uint32_t* seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	double u = ((*seed >> 8) + 1) / 16777217.0;
+	*seed = *seed * 1103515245 + 12345;
+	double v = (*seed >> 8) / 16777216.0;
+	return sqrt(-2 * log(u)) * cos(2 * 3.14159265358979 * v);
+}
+
+static void test_jitter()
+{
+	enum { N = 2000000, EDGES = N / 20 - 10 };
+	static int8_t samples[N];
+	static double rising[EDGES];
+	static double tie[N / 10];
+	uint32_t seed = 5;
+
+	// 50 MHz at 1 GS/s, 0.15 ns RJ and 0.8 ns of DJ between two Diracs.
+	for (size_t k = 0; k < EDGES; k++) {
+		seed = seed * 1103515245 + 12345;
+		rising[k] = 100.3 + 20.0 * k + 0.15 * test_gauss(&seed) + ((seed >> 16) & 1 ? 0.4 : -0.4);
+	}
+	test_clock_fill(samples, N, rising, EDGES, 20);
+	CHECK(thunderscopehw_jitter_create(THUNDERSCOPEHW_JITTER_IDEAL, 1e9, 50e6, 0, true, 2048, 1000, -10, 10) == NULL);
+	struct ThunderScopeHWJitter* j = thunderscopehw_jitter_create(THUNDERSCOPEHW_JITTER_IDEAL, 1e9, 50e6, 0, true, 2048, 1024, -10, 10);
+	double rj, dj, tj;
+	CHECK(thunderscopehw_jitter_dual_dirac(j, 1e-12, &rj, &dj, &tj) == THUNDERSCOPEHW_STATUS_INVALID_PARAMETER);
+	size_t edges = 0;
+	for (size_t offset = 0; offset < N; offset += 100000) edges += thunderscopehw_jitter_process(j, samples + offset, 100000, NULL, NULL);
+	CHECK(edges == EDGES - 1);
+	const struct ThunderScopeHWJitterResults* r = thunderscopehw_jitter_results(j);
+	double expected = sqrt(0.15 * 0.15 + 0.4 * 0.4) * 1e-9;
+	CHECK(r->tie.count == EDGES - 1 && fabs(thunderscopehw_measure_stat_stddev(&r->tie) / expected - 1) < 0.05);
+	CHECK(fabs(r->period.mean - 20e-9) < 1e-12 && r->cycle_to_cycle.count == EDGES - 2);
+	CHECK(thunderscopehw_jitter_dual_dirac(j, 1e-12, &rj, &dj, &tj) == THUNDERSCOPEHW_STATUS_OK);
+	CHECK(fabs(rj / 0.15e-9 - 1) < 0.2 && fabs(dj / 0.8e-9 - 1) < 0.2);
+	CHECK(fabs(tj - (dj + 2 * 7.034 * rj)) < 1e-12);
+	uint64_t total = 0;
+	for (int i = 0; i < 2048; i++) total += thunderscopehw_jitter_histogram(j)[i];
+	CHECK(total == EDGES - 1);
+	thunderscopehw_jitter_destroy(j);
+
+	// 0.5 ns of sinusoidal jitter every 32 periods.
+	for (size_t k = 0; k < EDGES; k++) rising[k] = 100.3 + 20.0 * k + 0.5 * sin(2 * 3.14159265358979 * k / 32);
+	test_clock_fill(samples, N, rising, EDGES, 20);
+	j = thunderscopehw_jitter_create(THUNDERSCOPEHW_JITTER_IDEAL, 1e9, 50e6, 0, true, 2048, 1024, -10, 10);
+	edges = thunderscopehw_jitter_process(j, samples, N / 2, NULL, tie);
+	edges += thunderscopehw_jitter_process(j, samples + N / 2, N / 2, NULL, tie + edges);
+	CHECK(edges == EDGES - 1 && fabs(tie[7] - 0.5e-9 * sin(2 * 3.14159265358979 * 8 / 32)) < 0.03e-9);
+	CHECK(thunderscopehw_jitter_spectrum_frames(j) == (EDGES - 1) / 1024);
+	static float spectrum[513];
+	thunderscopehw_jitter_spectrum(j, spectrum);
+	CHECK(fabs(spectrum[32] / 0.5e-9 - 1) < 0.05 && spectrum[100] < 0.01e-9);
+	thunderscopehw_jitter_destroy(j);
+
+	// 200 ppm fast: against the ideal clock the TIE ramps, the recovered one follows.
+	for (size_t k = 0; k < EDGES; k++) rising[k] = 100.3 + 20.0 / 1.0002 * k + 0.15 * test_gauss(&seed);
+	test_clock_fill(samples, N, rising, EDGES, 20);
+	j = thunderscopehw_jitter_create(THUNDERSCOPEHW_JITTER_IDEAL, 1e9, 50e6, 0, true, 2048, 1024, -10, 10);
+	thunderscopehw_jitter_process(j, samples, N, NULL, NULL);
+	CHECK(thunderscopehw_measure_stat_stddev(&thunderscopehw_jitter_results(j)->tie) > 3e-9);
+	thunderscopehw_jitter_destroy(j);
+	j = thunderscopehw_jitter_create(THUNDERSCOPEHW_JITTER_RECOVERED, 1e9, 50e6, 0, true, 2048, 1024, -10, 10);
+	thunderscopehw_jitter_process(j, samples, N, NULL, NULL);
+	CHECK(thunderscopehw_measure_stat_stddev(&thunderscopehw_jitter_results(j)->tie) < 0.2e-9);
+	CHECK(fabs(thunderscopehw_jitter_results(j)->period.mean - 20e-9 / 1.0002) < 1e-13);
+	thunderscopehw_jitter_reset(j);
+	CHECK(thunderscopehw_jitter_results(j)->tie.count == 0 && thunderscopehw_jitter_spectrum_frames(j) == 0);
+	thunderscopehw_jitter_destroy(j);
+}
+
+int main(int argc, char** argv)
+{
+	(void)argc;
+	(void)argv;
+	test_deinterleave();
+	test_stats();
+	test_timing();
+	test_peak_detect();
+	test_roll();
+	test_persistence();
+	test_average();
+	test_math();
+	test_logic();
+	test_decoder();
+	test_bus_decoders();
+	test_cdr();
+	test_eye();
+	test_jitter();
+	test_spectrum();
+	test_waterfall();
+	test_xcorr();
+	test_eres();
+	test_resampler();
+	test_ddc();
+	test_atan2();
+	test_demod();
+	test_equalizer();
+	test_core_trim();
+	test_calibration_store();
+	test_autosetup();
+	test_calibrate_offsets();
+	if (failures) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	return 0;
+}
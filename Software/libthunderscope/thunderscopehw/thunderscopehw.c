@@ -13,6 +13,7 @@ struct ThunderScopeHW* thunderscopehw_create()
 	if (!ts) return ts;
 
 	ts->connected = false;
+	ts->scope_id = 0;
 	ts->board_en = false;
 	ts->adc_en = false;
 	ts->pll_en = false;
@@ -25,8 +26,18 @@ struct ThunderScopeHW* thunderscopehw_create()
 		ts->channels[i].bw = 350;
 		ts->channels[i].voffset = 0.0;
 		ts->channels[i].coupling = THUNDERSCOPEHW_COUPLING_DC;
+		for (int b = 0; b < THUNDERSCOPEHW_BANDWIDTHS; b++) {
+			ts->equalizer_taps[i][b] = NULL;
+			ts->equalizer_taps_count[i][b] = 0;
+		}
 	}
 
+	ts->core_correction = true;
+	for (int m = 0; m < THUNDERSCOPEHW_CORE_TRIM_MODES; m++) ts->core_trim_valid[m] = false;
+	ts->calibration = NULL;
+	ts->calibration_map = NULL;
+	ts->calibration_map_size = 0;
+
 	ts->user_handle = THUNDERSCOPEHW_INVALID_HANDLE_VALUE;
 	ts->c2h0_handle = THUNDERSCOPEHW_INVALID_HANDLE_VALUE;
 	ts->buffer_head = 0;
@@ -38,6 +49,14 @@ struct ThunderScopeHW* thunderscopehw_create()
 
 enum ThunderScopeHWStatus thunderscopehw_destroy(struct ThunderScopeHW* ts)
 {
+	for (int i = 0; i < THUNDERSCOPEHW_CHANNELS; i++) {
+		for (int b = 0; b < THUNDERSCOPEHW_BANDWIDTHS; b++) {
+			free(ts->equalizer_taps[i][b]);
+			ts->equalizer_taps[i][b] = NULL;
+			ts->equalizer_taps_count[i][b] = 0;
+		}
+	}
+	thunderscopehw_calibration_unload(ts);
 	THUNDERSCOPEHW_RUN(stop(ts));
 	return thunderscopehw_disconnect(ts);
 }
@@ -142,6 +161,35 @@ static enum ThunderScopeHWStatus thunderscopehw_update_buffer_head(struct Thunde
 	return THUNDERSCOPEHW_STATUS_OK;
 }
 
+int thunderscopehw_interleave_count(struct ThunderScopeHW* ts)
+{
+	int num_channels_on = 0;
+	for (int channel = 0; channel < THUNDERSCOPEHW_CHANNELS; channel++) {
+		if (ts->channels[channel].on) num_channels_on++;
+	}
+	// Three channels run the ADC in four channel mode,
+	// see thunderscopehw_configure_channels.
+	if (num_channels_on <= 1) return 1;
+	if (num_channels_on == 2) return 2;
+	return 4;
+}
+
+double thunderscopehw_volts_per_lsb(struct ThunderScopeHW* ts, int channel)
+{
+	return thunderscopehw_volts_per_lsb_setting(ts, channel, ts->channels[channel].vdiv, ts->channels[channel].bw);
+}
+
+double thunderscopehw_volts_per_lsb_setting(struct ThunderScopeHW* ts, int channel, int vdiv, int bandwidth)
+{
+	double volts = vdiv * 1e-3 * 10 / 256;
+	const struct ThunderScopeHWCalibration* calibration = ts->calibration;
+	int v = thunderscopehw_vdiv_index(vdiv);
+	int b = thunderscopehw_bandwidth_index(bandwidth);
+	if (calibration && v >= 0 && b >= 0 && calibration->gain[channel][v][b] != 0)
+		volts *= calibration->gain[channel][v][b];
+	return volts;
+}
+
 int64_t thunderscopehw_available(struct ThunderScopeHW* ts) {
 	THUNDERSCOPEHW_RUN(update_buffer_head(ts));
 	return (ts->buffer_head - ts->buffer_tail) << 12;
@@ -179,6 +227,7 @@ enum ThunderScopeHWStatus thunderscopehw_read(struct ThunderScopeHW* ts, uint8_t
 		if (pages_to_read > ts->ram_size_pages / 4) pages_to_read = ts->ram_size_pages / 4;
 
 		THUNDERSCOPEHW_RUN(read_handle(ts, ts->c2h0_handle, data, buffer_read_pos << 12, pages_to_read << 12));
+		thunderscopehw_core_trim_apply(ts, data, pages_to_read << 12);
 
 		data += pages_to_read << 12;
 		length -= pages_to_read << 12;
@@ -235,6 +284,8 @@ const char* thunderscopehw_describe_error(enum ThunderScopeHWStatus err) {
 		return "voffset too low";
 	case THUNDERSCOPEHW_STATUS_OFFSET_TOO_HIGH:
 		return "voffset too high";
+	case THUNDERSCOPEHW_STATUS_INVALID_PARAMETER:
+		return "invalid parameter";
 	}
 	return "unkonwn error";
 }
@@ -0,0 +1,376 @@
+#include "thunderscopehw_private.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bytes per ranging read in four channel mode and per frequency read at the
+// final settings, the first part is dropped while the front end settles.
+#define THUNDERSCOPEHW_AUTOSETUP_READ           (1024 * 1024)
+#define THUNDERSCOPEHW_AUTOSETUP_FREQUENCY_READ (4 * 1024 * 1024)
+#define THUNDERSCOPEHW_AUTOSETUP_SETTLE         (32 * 1024)
+#define THUNDERSCOPEHW_AUTOSETUP_READS          16
+// Target half span in codes, about 80% of full scale.
+#define THUNDERSCOPEHW_AUTOSETUP_FILL           100
+// Centred when the middle is within this many codes of 0.
+#define THUNDERSCOPEHW_AUTOSETUP_TOLERANCE      4
+// First offset probe without calibration, in voffset units.
+#define THUNDERSCOPEHW_AUTOSETUP_PROBE          0.05
+// Channels below both are inactive, in volts.
+#define THUNDERSCOPEHW_AUTOSETUP_MIN_SIGNAL     0.01
+#define THUNDERSCOPEHW_AUTOSETUP_MIN_DC         0.1
+// Base to top in codes below which there is only noise to time.
+#define THUNDERSCOPEHW_AUTOSETUP_MIN_AMPLITUDE  16
+
+// Search state of one channel. The signal is modelled by its middle and
+// span in volts, the offset DAC by its codes per voffset unit, measured at
+// one PGA setting and scaled to the others.
+struct ThunderScopeHWAutosetupSearch {
+	bool done;
+	int v;
+	int floor;
+	double voffset;
+	bool probing;
+	bool offset_dead;
+	double slope;
+	int slope_pga;
+	// Last read that did not clip.
+	bool point;
+	int point_v;
+	double point_voffset;
+	double point_middle;
+	// Signal, valid once a read did not clip.
+	bool signal;
+	double middle;
+	double span;
+};
+
+struct ThunderScopeHWAutosetupBuffers {
+	uint8_t* buffer;
+	int8_t* samples;
+};
+
+static const int thunderscopehw_autosetup_top = THUNDERSCOPEHW_CALIBRATION_VDIVS - 1;
+
+// Vdiv seen by the PGA, the attenuator takes care of a factor 100 above 100 mV
+// (see thunderscopehw_set_pga).
+static int thunderscopehw_autosetup_pga(int v)
+{
+	int vdiv = thunderscopehw_calibration_vdiv(v);
+	return vdiv > 100 ? vdiv / 100 : vdiv;
+}
+
+static double thunderscopehw_autosetup_volts_per_lsb(struct ThunderScopeHW* ts, int channel, int v)
+{
+	return thunderscopehw_volts_per_lsb_setting(ts, channel, thunderscopehw_calibration_vdiv(v), ts->channels[channel].bw);
+}
+
+// Codes per voffset unit at vdiv index v, 0 while unknown.
+static double thunderscopehw_autosetup_slope(struct ThunderScopeHW* ts, const struct ThunderScopeHWAutosetupSearch* s,
+					     int channel, int v)
+{
+	const struct ThunderScopeHWCalibration* calibration = ts->calibration;
+	int b = thunderscopehw_bandwidth_index(ts->channels[channel].bw);
+	if (calibration && b >= 0 && calibration->offsets.codes_per_dac[channel][v][b] != 0)
+		return calibration->offsets.codes_per_dac[channel][v][b] * 4095.0;
+	if (s->offset_dead || s->slope == 0) return 0;
+	return s->slope * s->slope_pga / thunderscopehw_autosetup_pga(v);
+}
+
+// Range of voffset keeping the DAC in range, see thunderscopehw_set_dac.
+static void thunderscopehw_autosetup_offset_range(struct ThunderScopeHW* ts, int channel, int v, double* low, double* high)
+{
+	double zero = 2047.5;
+	const struct ThunderScopeHWCalibration* calibration = ts->calibration;
+	int b = thunderscopehw_bandwidth_index(ts->channels[channel].bw);
+	if (calibration && b >= 0 && calibration->offsets.codes_per_dac[channel][v][b] != 0)
+		zero = calibration->offsets.dac[channel][v][b];
+	*low = -(zero - 0.5) / 4095;
+	*high = (4095 - zero - 0.5) / 4095;
+}
+
+// Smallest vdiv from index `from` holding the signal within the fill once
+// centred as far as the offset reaches, the largest when none does.
+static void thunderscopehw_autosetup_choose(struct ThunderScopeHW* ts, const struct ThunderScopeHWAutosetupSearch* s,
+					    int channel, int from, int* v, double* voffset)
+{
+	for (int c = from; c <= thunderscopehw_autosetup_top; c++) {
+		double volts_per_lsb = thunderscopehw_autosetup_volts_per_lsb(ts, channel, c);
+		double span = s->span / volts_per_lsb;
+		double middle = s->middle / volts_per_lsb;
+		double slope = thunderscopehw_autosetup_slope(ts, s, channel, c);
+		double offset = 0, low, high;
+		if (slope != 0) {
+			thunderscopehw_autosetup_offset_range(ts, channel, c, &low, &high);
+			offset = -middle / slope;
+			if (offset < low) offset = low;
+			if (offset > high) offset = high;
+		}
+		*v = c;
+		*voffset = offset;
+		if (fabs(middle + slope * offset) + span / 2 <= THUNDERSCOPEHW_AUTOSETUP_FILL) return;
+	}
+}
+
+// Folds in one read of the channel and picks the next setting.
+static void thunderscopehw_autosetup_update(struct ThunderScopeHW* ts, struct ThunderScopeHWAutosetupSearch* s,
+					    int channel, const struct ThunderScopeHWStats* stats)
+{
+	bool clip = stats->min == INT8_MIN || stats->max == INT8_MAX;
+	double middle = (stats->min + stats->max) / 2.0;
+
+	if (s->probing) {
+		s->probing = false;
+		double response = s->point ? fabs(middle - s->point_middle) : 0;
+		if (clip || response < 2) {
+			// Too far or too little, try a quarter or four times the step.
+			double probe = clip ? s->voffset / 4 : s->voffset * 4;
+			if (fabs(probe) < 1e-3 || fabs(probe) > 0.5) {
+				s->offset_dead = true;
+				s->voffset = 0;
+			} else {
+				s->voffset = probe;
+				s->probing = true;
+			}
+			return;
+		}
+	}
+
+	if (clip) {
+		if (s->v == thunderscopehw_autosetup_top) {
+			// Beyond full range, only a misplaced offset can still be undone.
+			if (s->voffset == 0) s->done = true;
+			s->voffset = 0;
+			return;
+		}
+		s->floor = s->v + 1;
+		if (s->signal) {
+			thunderscopehw_autosetup_choose(ts, s, channel, s->floor, &s->v, &s->voffset);
+		} else {
+			s->v = s->floor;
+		}
+		return;
+	}
+
+	// Two reads at one vdiv and different offsets give the slope.
+	if (s->point && s->point_v == s->v && s->voffset != s->point_voffset &&
+	    fabs(middle - s->point_middle) >= 2) {
+		s->slope = (middle - s->point_middle) / (s->voffset - s->point_voffset);
+		s->slope_pga = thunderscopehw_autosetup_pga(s->v);
+	}
+	s->point = true;
+	s->point_v = s->v;
+	s->point_voffset = s->voffset;
+	s->point_middle = middle;
+
+	double slope = thunderscopehw_autosetup_slope(ts, s, channel, s->v);
+	if (s->voffset != 0 && slope == 0) {
+		// Offset without a model, start over at zero offset.
+		s->voffset = 0;
+		return;
+	}
+	double volts_per_lsb = thunderscopehw_autosetup_volts_per_lsb(ts, channel, s->v);
+	s->signal = true;
+	s->middle = (middle - slope * s->voffset) * volts_per_lsb;
+	s->span = (stats->max - stats->min) * volts_per_lsb;
+
+	if (slope == 0 && !s->offset_dead) {
+		// Raising the DAC lowers the codes.
+		s->voffset = middle > 0 ? THUNDERSCOPEHW_AUTOSETUP_PROBE : -THUNDERSCOPEHW_AUTOSETUP_PROBE;
+		s->probing = true;
+		return;
+	}
+
+	// Zoom in at most a decade per read, the span is only known to a code.
+	int from = s->v - 3;
+	if (from < s->floor) from = s->floor;
+	int v;
+	double voffset;
+	thunderscopehw_autosetup_choose(ts, s, channel, from, &v, &voffset);
+	// Done when centred, or the offset is at its limit.
+	if (v == s->v && fabs(slope * (voffset - s->voffset)) <= THUNDERSCOPEHW_AUTOSETUP_TOLERANCE) {
+		s->done = true;
+		return;
+	}
+	s->v = v;
+	s->voffset = voffset;
+}
+
+static enum ThunderScopeHWStatus thunderscopehw_autosetup_read(struct ThunderScopeHW* ts, struct ThunderScopeHWAutosetupBuffers* b,
+							       int64_t length)
+{
+	THUNDERSCOPEHW_RUN(start(ts));
+	enum ThunderScopeHWStatus status = thunderscopehw_read(ts, b->buffer, length);
+	THUNDERSCOPEHW_RUN(stop(ts));
+	return status;
+}
+
+static enum ThunderScopeHWStatus thunderscopehw_autosetup_range(struct ThunderScopeHW* ts, struct ThunderScopeHWAutosetupBuffers* b,
+								struct ThunderScopeHWAutosetupSearch* search)
+{
+	for (int channel = 0; channel < THUNDERSCOPEHW_CHANNELS; channel++) {
+		struct ThunderScopeHWAutosetupSearch* s = &search[channel];
+		memset(s, 0, sizeof(*s));
+		s->v = thunderscopehw_autosetup_top;
+		ts->channels[channel].on = true;
+		ts->channels[channel].vdiv = thunderscopehw_calibration_vdiv(s->v);
+		ts->channels[channel].voffset = 0;
+		THUNDERSCOPEHW_RUN(set_pga(ts, channel));
+		THUNDERSCOPEHW_RUN(set_dac(ts, channel));
+	}
+	THUNDERSCOPEHW_RUN(configure_channels(ts));
+
+	size_t length = (THUNDERSCOPEHW_AUTOSETUP_READ - THUNDERSCOPEHW_AUTOSETUP_SETTLE) / THUNDERSCOPEHW_CHANNELS;
+	int8_t* channels[THUNDERSCOPEHW_CHANNELS];
+	for (int channel = 0; channel < THUNDERSCOPEHW_CHANNELS; channel++) channels[channel] = b->samples + channel * length;
+
+	for (int read = 0; read < THUNDERSCOPEHW_AUTOSETUP_READS; read++) {
+		THUNDERSCOPEHW_RUN(autosetup_read(ts, b, THUNDERSCOPEHW_AUTOSETUP_READ));
+		thunderscopehw_deinterleave((const int8_t*)b->buffer + THUNDERSCOPEHW_AUTOSETUP_SETTLE,
+					    THUNDERSCOPEHW_AUTOSETUP_READ - THUNDERSCOPEHW_AUTOSETUP_SETTLE,
+					    THUNDERSCOPEHW_CHANNELS, channels);
+
+		// Only write what changed, the relays are switched by the datamover register.
+		bool active = false, relays = false;
+		for (int channel = 0; channel < THUNDERSCOPEHW_CHANNELS; channel++) {
+			struct ThunderScopeHWAutosetupSearch* s = &search[channel];
+			if (s->done) continue;
+			struct ThunderScopeHWStats stats;
+			thunderscopehw_stats_init(&stats, 0, false);
+			thunderscopehw_stats_update(&stats, channels[channel], length);
+			thunderscopehw_autosetup_update(ts, s, channel, &stats);
+			if (s->done) continue;
+			active = true;
+
+			struct ThunderScopeHWChannel* c = &ts->channels[channel];
+			int vdiv = thunderscopehw_calibration_vdiv(s->v);
+			if (vdiv != c->vdiv) {
+				relays = relays || (vdiv > 100) != (c->vdiv > 100);
+				c->vdiv = vdiv;
+				c->voffset = s->voffset;
+				THUNDERSCOPEHW_RUN(set_pga(ts, channel));
+				THUNDERSCOPEHW_RUN(set_dac(ts, channel));
+			} else if (s->voffset != c->voffset) {
+				c->voffset = s->voffset;
+				THUNDERSCOPEHW_RUN(set_dac(ts, channel));
+			}
+		}
+		if (!active) break;
+		if (relays) THUNDERSCOPEHW_RUN(set_datamover_reg(ts));
+	}
+	return THUNDERSCOPEHW_STATUS_OK;
+}
+
+// Applies the result, then finds the fundamental and trigger level of active channels.
+static enum ThunderScopeHWStatus thunderscopehw_autosetup_apply(struct ThunderScopeHW* ts, struct ThunderScopeHWAutosetupBuffers* b,
+								struct ThunderScopeHWAutosetup* result)
+{
+	THUNDERSCOPEHW_RUN(configure_channels(ts));
+	for (int channel = 0; channel < THUNDERSCOPEHW_CHANNELS; channel++) {
+		THUNDERSCOPEHW_RUN(set_dac(ts, channel));
+		THUNDERSCOPEHW_RUN(set_pga(ts, channel));
+	}
+	THUNDERSCOPEHW_RUN(set_datamover_reg(ts));
+	THUNDERSCOPEHW_RUN(autosetup_read(ts, b, THUNDERSCOPEHW_AUTOSETUP_FREQUENCY_READ));
+
+	// Interleave slot of each channel, as in thunderscopehw_configure_channels.
+	int interleave = thunderscopehw_interleave_count(ts);
+	size_t length = (THUNDERSCOPEHW_AUTOSETUP_FREQUENCY_READ - THUNDERSCOPEHW_AUTOSETUP_SETTLE) / interleave;
+	int8_t* slots[THUNDERSCOPEHW_CHANNELS];
+	for (int slot = 0; slot < interleave; slot++) slots[slot] = b->samples + slot * length;
+	thunderscopehw_deinterleave((const int8_t*)b->buffer + THUNDERSCOPEHW_AUTOSETUP_SETTLE,
+				    THUNDERSCOPEHW_AUTOSETUP_FREQUENCY_READ - THUNDERSCOPEHW_AUTOSETUP_SETTLE, interleave, slots);
+
+	int slot = 0;
+	for (int channel = 0; channel < THUNDERSCOPEHW_CHANNELS; channel++) {
+		if (!ts->channels[channel].on) continue;
+		int8_t* samples = slots[interleave == 4 ? channel : slot++];
+		struct ThunderScopeHWAutosetupChannel* r = &result->channels[channel];
+		if (!r->active) continue;
+
+		struct ThunderScopeHWStats stats;
+		thunderscopehw_stats_init(&stats, 0, true);
+		thunderscopehw_stats_update(&stats, samples, length);
+		float base, top;
+		thunderscopehw_timing_levels(&stats, &base, &top);
+		r->peak_to_peak = (stats.max - stats.min) * thunderscopehw_volts_per_lsb(ts, channel);
+		r->trigger_level = (base + top) / 2;
+
+		if (top - base < THUNDERSCOPEHW_AUTOSETUP_MIN_AMPLITUDE) continue;
+		struct ThunderScopeHWTiming* timing = thunderscopehw_timing_create(1e9 / interleave, base, top);
+		if (!timing) continue;
+		thunderscopehw_timing_process(timing, samples, length);
+		const struct ThunderScopeHWTimingResults* timing_results = thunderscopehw_timing_results(timing);
+		if (timing_results->period.count) r->frequency = 1.0 / timing_results->period.mean;
+		thunderscopehw_timing_destroy(timing);
+	}
+	return THUNDERSCOPEHW_STATUS_OK;
+}
+
+enum ThunderScopeHWStatus thunderscopehw_autosetup(struct ThunderScopeHW* ts, struct ThunderScopeHWAutosetup* result)
+{
+	if (!ts->connected)
+		return THUNDERSCOPEHW_STATUS_NOT_CONNECTED;
+	if (ts->datamover_en)
+		return THUNDERSCOPEHW_STATUS_ALREADY_STARTED;
+	memset(result, 0, sizeof(*result));
+
+	struct ThunderScopeHWAutosetupBuffers b;
+#ifdef _WIN32
+	b.buffer = (uint8_t*)_aligned_malloc(THUNDERSCOPEHW_AUTOSETUP_FREQUENCY_READ, 4096);
+#else
+	if (posix_memalign((void**)&b.buffer, 4096, THUNDERSCOPEHW_AUTOSETUP_FREQUENCY_READ)) b.buffer = NULL;
+#endif
+	b.samples = (int8_t*)malloc(THUNDERSCOPEHW_AUTOSETUP_FREQUENCY_READ);
+
+	struct ThunderScopeHWChannel saved[THUNDERSCOPEHW_CHANNELS];
+	memcpy(saved, ts->channels, sizeof(saved));
+	struct ThunderScopeHWAutosetupSearch search[THUNDERSCOPEHW_CHANNELS];
+	enum ThunderScopeHWStatus status = b.buffer && b.samples ? thunderscopehw_autosetup_range(ts, &b, search)
+								 : THUNDERSCOPEHW_STATUS_MEMORY_FULL;
+
+	bool any = false;
+	if (status == THUNDERSCOPEHW_STATUS_OK) {
+		for (int channel = 0; channel < THUNDERSCOPEHW_CHANNELS; channel++) {
+			const struct ThunderScopeHWAutosetupSearch* s = &search[channel];
+			struct ThunderScopeHWAutosetupChannel* r = &result->channels[channel];
+			r->vdiv = thunderscopehw_calibration_vdiv(s->v);
+			r->voffset = s->voffset;
+			r->peak_to_peak = s->span;
+			r->active = s->signal && (s->span >= THUNDERSCOPEHW_AUTOSETUP_MIN_SIGNAL ||
+						  fabs(s->middle) >= THUNDERSCOPEHW_AUTOSETUP_MIN_DC);
+			any = any || r->active;
+		}
+	}
+
+	memcpy(ts->channels, saved, sizeof(saved));
+	if (any) {
+		for (int channel = 0; channel < THUNDERSCOPEHW_CHANNELS; channel++) {
+			const struct ThunderScopeHWAutosetupChannel* r = &result->channels[channel];
+			ts->channels[channel].on = r->active;
+			if (!r->active) continue;
+			ts->channels[channel].vdiv = r->vdiv;
+			ts->channels[channel].voffset = r->voffset;
+		}
+		status = thunderscopehw_autosetup_apply(ts, &b, result);
+	}
+	if (!any || status != THUNDERSCOPEHW_STATUS_OK) {
+		// Put the user's settings back.
+		memcpy(ts->channels, saved, sizeof(saved));
+		enum ThunderScopeHWStatus restore = thunderscopehw_configure_channels(ts);
+		for (int channel = 0; channel < THUNDERSCOPEHW_CHANNELS && restore == THUNDERSCOPEHW_STATUS_OK; channel++) {
+			restore = thunderscopehw_set_dac(ts, channel);
+			if (restore == THUNDERSCOPEHW_STATUS_OK) restore = thunderscopehw_set_pga(ts, channel);
+		}
+		if (restore == THUNDERSCOPEHW_STATUS_OK) restore = thunderscopehw_set_datamover_reg(ts);
+		if (status == THUNDERSCOPEHW_STATUS_OK) status = restore;
+	}
+
+#ifdef _WIN32
+	_aligned_free(b.buffer);
+#else
+	free(b.buffer);
+#endif
+	free(b.samples);
+	return status;
+}
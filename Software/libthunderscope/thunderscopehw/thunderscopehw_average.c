@@ -0,0 +1,260 @@
+#include "thunderscopehw_private.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#ifdef THUNDERSCOPEHW_SSE2
+#include <emmintrin.h>
+#endif
+
+// Points are accumulated in Q8 codes. A full average of 65536 records
+// of -128 * 256 still fits the int32 sums.
+struct ThunderScopeHWAverage {
+	size_t points;
+	uint32_t records;
+	int shift;
+	uint64_t count;
+	int32_t* sums;
+};
+
+struct ThunderScopeHWEnvelope {
+	size_t points;
+	uint64_t count;
+	int16_t* min;
+	int16_t* max;
+};
+
+// Splits the position of point 0 into a sample index and a Q8 weight towards
+// the next sample, false if the record does not cover all points.
+static bool thunderscopehw_record_position(size_t points, size_t length, double start, size_t* index, int* weight)
+{
+	if (!(start >= 0) || start >= (double)length) return false;
+	double whole = floor(start);
+	size_t k = (size_t)whole;
+	int w = (int)lrint((start - whole) * 256);
+	if (w == 256) {
+		k++;
+		w = 0;
+	}
+	if (k >= length || length - k < points + (w != 0)) return false;
+	*index = k;
+	*weight = w;
+	return true;
+}
+
+#ifdef THUNDERSCOPEHW_SSE2
+// Eight Q8 points between s[i] and s[i + 1]. The result fits 16 bits, so the
+// wrapping product still gives the right answer.
+static inline __m128i thunderscopehw_record_lerp8(const int8_t* s, __m128i weight)
+{
+	__m128i a = _mm_loadl_epi64((const __m128i*)s);
+	__m128i b = _mm_loadl_epi64((const __m128i*)(s + 1));
+	a = _mm_srai_epi16(_mm_unpacklo_epi8(a, a), 8);
+	b = _mm_srai_epi16(_mm_unpacklo_epi8(b, b), 8);
+	return _mm_add_epi16(_mm_slli_epi16(a, 8), _mm_mullo_epi16(_mm_sub_epi16(b, a), weight));
+}
+#endif
+
+static inline int32_t thunderscopehw_record_lerp(const int8_t* s, int weight)
+{
+	int32_t a = s[0];
+	if (!weight) return a * 256;
+	return a * 256 + (s[1] - a) * weight;
+}
+
+struct ThunderScopeHWAverage* thunderscopehw_average_create(size_t points, uint32_t records)
+{
+	if (points == 0 || records == 0 || records > THUNDERSCOPEHW_AVERAGE_MAX_RECORDS || (records & (records - 1)))
+		return NULL;
+	struct ThunderScopeHWAverage* a;
+	a = (struct ThunderScopeHWAverage*)malloc(sizeof(struct ThunderScopeHWAverage));
+	if (!a) return a;
+
+	a->points = points;
+	a->records = records;
+	a->shift = 0;
+	while ((1U << a->shift) < records) a->shift++;
+	a->sums = (int32_t*)malloc(points * sizeof(int32_t));
+	if (!a->sums) {
+		thunderscopehw_average_destroy(a);
+		return NULL;
+	}
+	thunderscopehw_average_reset(a);
+	return a;
+}
+
+void thunderscopehw_average_destroy(struct ThunderScopeHWAverage* a)
+{
+	if (!a) return;
+	free(a->sums);
+	free(a);
+}
+
+void thunderscopehw_average_reset(struct ThunderScopeHWAverage* a)
+{
+	for (size_t i = 0; i < a->points; i++) a->sums[i] = 0;
+	a->count = 0;
+}
+
+enum ThunderScopeHWStatus thunderscopehw_average_add(struct ThunderScopeHWAverage* a, const int8_t* samples, size_t length, double start)
+{
+	size_t k;
+	int weight;
+	if (!thunderscopehw_record_position(a->points, length, start, &k, &weight))
+		return THUNDERSCOPEHW_STATUS_INVALID_PARAMETER;
+	const int8_t* s = samples + k;
+	size_t available = length - k;
+	int32_t* sums = a->sums;
+	size_t i = 0;
+
+	// Once full, each record replaces 1 / records of the sum.
+	bool full = a->count >= a->records;
+	int shift = a->shift;
+	int32_t half = shift ? 1 << (shift - 1) : 0;
+#ifdef THUNDERSCOPEHW_SSE2
+	__m128i w = _mm_set1_epi16((int16_t)weight);
+	__m128i h = _mm_set1_epi32(half);
+	__m128i count = _mm_cvtsi32_si128(shift);
+	for (; i + 8 < available && i + 8 <= a->points; i += 8) {
+		__m128i y = thunderscopehw_record_lerp8(s + i, w);
+		__m128i y0 = _mm_srai_epi32(_mm_unpacklo_epi16(y, y), 16);
+		__m128i y1 = _mm_srai_epi32(_mm_unpackhi_epi16(y, y), 16);
+		__m128i s0 = _mm_loadu_si128((const __m128i*)(sums + i));
+		__m128i s1 = _mm_loadu_si128((const __m128i*)(sums + i + 4));
+		if (full) {
+			s0 = _mm_sub_epi32(s0, _mm_sra_epi32(_mm_add_epi32(s0, h), count));
+			s1 = _mm_sub_epi32(s1, _mm_sra_epi32(_mm_add_epi32(s1, h), count));
+		}
+		_mm_storeu_si128((__m128i*)(sums + i), _mm_add_epi32(s0, y0));
+		_mm_storeu_si128((__m128i*)(sums + i + 4), _mm_add_epi32(s1, y1));
+	}
+#endif
+	for (; i < a->points; i++) {
+		int32_t sum = sums[i];
+		if (full) sum -= (sum + half) >> shift;
+		sums[i] = sum + thunderscopehw_record_lerp(s + i, weight);
+	}
+	a->count++;
+	return THUNDERSCOPEHW_STATUS_OK;
+}
+
+enum ThunderScopeHWStatus thunderscopehw_average_merge(struct ThunderScopeHWAverage* dst, struct ThunderScopeHWAverage* src)
+{
+	if (dst->points != src->points || dst->records != src->records) return THUNDERSCOPEHW_STATUS_INVALID_PARAMETER;
+	uint64_t dst_records = dst->count < dst->records ? dst->count : dst->records;
+	uint64_t src_records = src->count < src->records ? src->count : src->records;
+	uint64_t total = dst_records + src_records;
+	if (total > dst->records) {
+		// Both sides already weigh the same per record, scale back to a full sum.
+		double scale = (double)dst->records / total;
+		for (size_t i = 0; i < dst->points; i++) {
+			dst->sums[i] = (int32_t)lrint(((double)dst->sums[i] + src->sums[i]) * scale);
+		}
+	} else {
+		for (size_t i = 0; i < dst->points; i++) dst->sums[i] += src->sums[i];
+	}
+	dst->count += src->count;
+	thunderscopehw_average_reset(src);
+	return THUNDERSCOPEHW_STATUS_OK;
+}
+
+uint64_t thunderscopehw_average_records(struct ThunderScopeHWAverage* a)
+{
+	return a->count;
+}
+
+void thunderscopehw_average_read(struct ThunderScopeHWAverage* a, float* out)
+{
+	uint64_t records = a->count < a->records ? a->count : a->records;
+	float scale = records ? 1.0f / (256.0f * records) : 0.0f;
+	for (size_t i = 0; i < a->points; i++) out[i] = a->sums[i] * scale;
+}
+
+struct ThunderScopeHWEnvelope* thunderscopehw_envelope_create(size_t points)
+{
+	if (points == 0) return NULL;
+	struct ThunderScopeHWEnvelope* e;
+	e = (struct ThunderScopeHWEnvelope*)malloc(sizeof(struct ThunderScopeHWEnvelope));
+	if (!e) return e;
+
+	e->points = points;
+	e->min = (int16_t*)malloc(points * sizeof(int16_t));
+	e->max = (int16_t*)malloc(points * sizeof(int16_t));
+	if (!e->min || !e->max) {
+		thunderscopehw_envelope_destroy(e);
+		return NULL;
+	}
+	thunderscopehw_envelope_reset(e);
+	return e;
+}
+
+void thunderscopehw_envelope_destroy(struct ThunderScopeHWEnvelope* e)
+{
+	if (!e) return;
+	free(e->min);
+	free(e->max);
+	free(e);
+}
+
+void thunderscopehw_envelope_reset(struct ThunderScopeHWEnvelope* e)
+{
+	for (size_t i = 0; i < e->points; i++) {
+		e->min[i] = INT16_MAX;
+		e->max[i] = INT16_MIN;
+	}
+	e->count = 0;
+}
+
+enum ThunderScopeHWStatus thunderscopehw_envelope_add(struct ThunderScopeHWEnvelope* e, const int8_t* samples, size_t length, double start)
+{
+	size_t k;
+	int weight;
+	if (!thunderscopehw_record_position(e->points, length, start, &k, &weight))
+		return THUNDERSCOPEHW_STATUS_INVALID_PARAMETER;
+	const int8_t* s = samples + k;
+	size_t available = length - k;
+	size_t i = 0;
+#ifdef THUNDERSCOPEHW_SSE2
+	__m128i w = _mm_set1_epi16((int16_t)weight);
+	for (; i + 8 < available && i + 8 <= e->points; i += 8) {
+		__m128i y = thunderscopehw_record_lerp8(s + i, w);
+		__m128i lo = _mm_loadu_si128((const __m128i*)(e->min + i));
+		__m128i hi = _mm_loadu_si128((const __m128i*)(e->max + i));
+		_mm_storeu_si128((__m128i*)(e->min + i), _mm_min_epi16(lo, y));
+		_mm_storeu_si128((__m128i*)(e->max + i), _mm_max_epi16(hi, y));
+	}
+#endif
+	for (; i < e->points; i++) {
+		int16_t y = (int16_t)thunderscopehw_record_lerp(s + i, weight);
+		if (y < e->min[i]) e->min[i] = y;
+		if (y > e->max[i]) e->max[i] = y;
+	}
+	e->count++;
+	return THUNDERSCOPEHW_STATUS_OK;
+}
+
+enum ThunderScopeHWStatus thunderscopehw_envelope_merge(struct ThunderScopeHWEnvelope* dst, struct ThunderScopeHWEnvelope* src)
+{
+	if (dst->points != src->points) return THUNDERSCOPEHW_STATUS_INVALID_PARAMETER;
+	for (size_t i = 0; i < dst->points; i++) {
+		if (src->min[i] < dst->min[i]) dst->min[i] = src->min[i];
+		if (src->max[i] > dst->max[i]) dst->max[i] = src->max[i];
+	}
+	dst->count += src->count;
+	thunderscopehw_envelope_reset(src);
+	return THUNDERSCOPEHW_STATUS_OK;
+}
+
+uint64_t thunderscopehw_envelope_records(struct ThunderScopeHWEnvelope* e)
+{
+	return e->count;
+}
+
+void thunderscopehw_envelope_read(struct ThunderScopeHWEnvelope* e, float* min, float* max)
+{
+	for (size_t i = 0; i < e->points; i++) {
+		bool seen = e->min[i] <= e->max[i];
+		min[i] = seen ? e->min[i] / 256.0f : 0.0f;
+		max[i] = seen ? e->max[i] / 256.0f : 0.0f;
+	}
+}
@@ -0,0 +1,244 @@
+#include "thunderscopehw_private.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bytes per read in four channel mode, the first quarter is dropped while
+// the offset settles.
+#define THUNDERSCOPEHW_CALIBRATION_READ     (128 * 1024)
+#define THUNDERSCOPEHW_CALIBRATION_SETTLE   (32 * 1024)
+#define THUNDERSCOPEHW_CALIBRATION_READS    10
+// Converged when the mean is within this many codes of 0.
+#define THUNDERSCOPEHW_CALIBRATION_TOLERANCE 0.25
+// Second probe distance from the first, in DAC codes.
+#define THUNDERSCOPEHW_CALIBRATION_PROBE    32
+
+static const int thunderscopehw_calibration_vdivs[THUNDERSCOPEHW_CALIBRATION_VDIVS] = {
+	1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000
+};
+static const int thunderscopehw_calibration_bandwidths[THUNDERSCOPEHW_CALIBRATION_BANDWIDTHS] = {
+	20, 100, 200, 350
+};
+
+int thunderscopehw_calibration_vdiv(int index)
+{
+	if (index < 0 || index >= THUNDERSCOPEHW_CALIBRATION_VDIVS) return 0;
+	return thunderscopehw_calibration_vdivs[index];
+}
+
+int thunderscopehw_vdiv_index(int vdiv)
+{
+	for (int i = 0; i < THUNDERSCOPEHW_CALIBRATION_VDIVS; i++) {
+		if (thunderscopehw_calibration_vdivs[i] == vdiv) return i;
+	}
+	return -1;
+}
+
+// Search state of one channel at one point. Probes that clip narrow the
+// bracket, the last two that do not give the secant.
+struct ThunderScopeHWOffsetSearch {
+	bool done;
+	int dac;
+	int low;
+	int high;
+	int points;
+	int dac_a, dac_b;
+	double mean_a, mean_b;
+	double slope;
+	double solution;
+};
+
+struct ThunderScopeHWCalibrationBuffers {
+	uint8_t* buffer;
+	int8_t* channels[THUNDERSCOPEHW_CHANNELS];
+};
+
+// One read at the current DACs, the mean code and clipping (-1, 0, 1) per channel.
+static enum ThunderScopeHWStatus thunderscopehw_calibration_measure(struct ThunderScopeHW* ts,
+								    struct ThunderScopeHWCalibrationBuffers* b,
+								    double* mean, int* clip)
+{
+	THUNDERSCOPEHW_RUN(start(ts));
+	enum ThunderScopeHWStatus status = thunderscopehw_read(ts, b->buffer, THUNDERSCOPEHW_CALIBRATION_READ);
+	THUNDERSCOPEHW_RUN(stop(ts));
+	if (status != THUNDERSCOPEHW_STATUS_OK) return status;
+
+	thunderscopehw_deinterleave((const int8_t*)b->buffer + THUNDERSCOPEHW_CALIBRATION_SETTLE,
+				    THUNDERSCOPEHW_CALIBRATION_READ - THUNDERSCOPEHW_CALIBRATION_SETTLE,
+				    THUNDERSCOPEHW_CHANNELS, b->channels);
+	size_t length = (THUNDERSCOPEHW_CALIBRATION_READ - THUNDERSCOPEHW_CALIBRATION_SETTLE) / THUNDERSCOPEHW_CHANNELS;
+	for (int channel = 0; channel < THUNDERSCOPEHW_CHANNELS; channel++) {
+		struct ThunderScopeHWStats stats;
+		thunderscopehw_stats_init(&stats, 0, true);
+		thunderscopehw_stats_update(&stats, b->channels[channel], length);
+		mean[channel] = (double)stats.sum / stats.count;
+		// More than 1% at a rail biases the mean.
+		clip[channel] = 0;
+		if (stats.histogram[255] * 100 > stats.count) clip[channel] = 1;
+		if (stats.histogram[0] * 100 > stats.count) clip[channel] = -1;
+	}
+	return THUNDERSCOPEHW_STATUS_OK;
+}
+
+// Folds in a measurement and picks the next probe.
+static void thunderscopehw_offset_search_update(struct ThunderScopeHWOffsetSearch* s, double mean, int clip)
+{
+	// Raising the DAC lowers the codes.
+	if (clip > 0) {
+		s->low = s->dac;
+	} else if (clip < 0) {
+		s->high = s->dac;
+	} else {
+		if (fabs(mean) < THUNDERSCOPEHW_CALIBRATION_TOLERANCE && s->points && s->slope != 0) {
+			s->solution = s->dac;
+			s->done = true;
+			return;
+		}
+		s->dac_a = s->dac_b;
+		s->mean_a = s->mean_b;
+		s->dac_b = s->dac;
+		s->mean_b = mean;
+		s->points++;
+	}
+
+	if (s->points >= 2 && s->dac_a != s->dac_b) {
+		s->slope = (s->mean_b - s->mean_a) / (s->dac_b - s->dac_a);
+		// No response to the DAC, nothing to solve for.
+		if (fabs(s->slope) < 1e-3) {
+			s->slope = 0;
+			s->done = true;
+			return;
+		}
+		s->solution = s->dac_b - s->mean_b / s->slope;
+		s->dac = (int)lrint(s->solution);
+	} else if (s->points >= 1 && !clip) {
+		s->dac = s->dac_b + (s->mean_b > 0 ? THUNDERSCOPEHW_CALIBRATION_PROBE : -THUNDERSCOPEHW_CALIBRATION_PROBE);
+	} else {
+		s->dac = (s->low + s->high) / 2;
+	}
+	if (s->dac <= s->low) s->dac = s->low + 1;
+	if (s->dac >= s->high) s->dac = s->high - 1;
+	// Secant landed on a probe already taken.
+	if (s->points >= 2 && s->dac == s->dac_b) s->done = true;
+}
+
+static enum ThunderScopeHWStatus thunderscopehw_calibrate_point(struct ThunderScopeHW* ts,
+								struct ThunderScopeHWCalibrationBuffers* b,
+								const int* start, int vdiv, int bandwidth,
+								struct ThunderScopeHWOffsetCalibration* calibration)
+{
+	struct ThunderScopeHWOffsetSearch search[THUNDERSCOPEHW_CHANNELS];
+	memset(search, 0, sizeof(search));
+	for (int channel = 0; channel < THUNDERSCOPEHW_CHANNELS; channel++) {
+		search[channel].dac = start[channel];
+		search[channel].low = -1;
+		search[channel].high = 4096;
+	}
+
+	for (int read = 0; read < THUNDERSCOPEHW_CALIBRATION_READS; read++) {
+		bool active = false;
+		for (int channel = 0; channel < THUNDERSCOPEHW_CHANNELS; channel++) {
+			if (search[channel].done) continue;
+			THUNDERSCOPEHW_RUN(set_dac_raw(ts, channel, search[channel].dac));
+			active = true;
+		}
+		if (!active) break;
+		double mean[THUNDERSCOPEHW_CHANNELS];
+		int clip[THUNDERSCOPEHW_CHANNELS];
+		THUNDERSCOPEHW_RUN(calibration_measure(ts, b, mean, clip));
+		for (int channel = 0; channel < THUNDERSCOPEHW_CHANNELS; channel++) {
+			if (search[channel].done) continue;
+			thunderscopehw_offset_search_update(&search[channel], mean[channel], clip[channel]);
+		}
+	}
+
+	for (int channel = 0; channel < THUNDERSCOPEHW_CHANNELS; channel++) {
+		struct ThunderScopeHWOffsetSearch* s = &search[channel];
+		double dac = s->slope != 0 ? s->solution : 0;
+		if (dac < 0) dac = 0;
+		if (dac > 0xFFF) dac = 0xFFF;
+		calibration->dac[channel][vdiv][bandwidth] = (uint16_t)lrint(dac);
+		calibration->codes_per_dac[channel][vdiv][bandwidth] = (float)s->slope;
+	}
+	return THUNDERSCOPEHW_STATUS_OK;
+}
+
+static enum ThunderScopeHWStatus thunderscopehw_calibrate_sweep(struct ThunderScopeHW* ts,
+								struct ThunderScopeHWCalibrationBuffers* b,
+								struct ThunderScopeHWOffsetCalibration* calibration)
+{
+	for (int channel = 0; channel < THUNDERSCOPEHW_CHANNELS; channel++) ts->channels[channel].on = true;
+	THUNDERSCOPEHW_RUN(configure_channels(ts));
+
+	// Vdivs ascending switch the attenuator relays once, bandwidths only
+	// touch the PGA register that has to be written for the vdiv anyway.
+	int attenuator = -1;
+	for (int v = 0; v < THUNDERSCOPEHW_CALIBRATION_VDIVS; v++) {
+		int start[THUNDERSCOPEHW_CHANNELS];
+		for (int bw = 0; bw < THUNDERSCOPEHW_CALIBRATION_BANDWIDTHS; bw++) {
+			for (int channel = 0; channel < THUNDERSCOPEHW_CHANNELS; channel++) {
+				ts->channels[channel].vdiv = thunderscopehw_calibration_vdivs[v];
+				ts->channels[channel].bw = thunderscopehw_calibration_bandwidths[bw];
+				THUNDERSCOPEHW_RUN(set_pga(ts, channel));
+				// Start from the neighbouring point's answer when there is one.
+				start[channel] = 2048;
+				if (bw && calibration->codes_per_dac[channel][v][bw - 1] != 0) {
+					start[channel] = calibration->dac[channel][v][bw - 1];
+				} else if (v && calibration->codes_per_dac[channel][v - 1][bw] != 0) {
+					start[channel] = calibration->dac[channel][v - 1][bw];
+				}
+			}
+			if (attenuator != (thunderscopehw_calibration_vdivs[v] > 100)) {
+				attenuator = thunderscopehw_calibration_vdivs[v] > 100;
+				THUNDERSCOPEHW_RUN(set_datamover_reg(ts));
+			}
+			THUNDERSCOPEHW_RUN(calibrate_point(ts, b, start, v, bw, calibration));
+		}
+	}
+	return THUNDERSCOPEHW_STATUS_OK;
+}
+
+enum ThunderScopeHWStatus thunderscopehw_calibrate_offsets(struct ThunderScopeHW* ts, struct ThunderScopeHWOffsetCalibration* calibration)
+{
+	if (!ts->connected)
+		return THUNDERSCOPEHW_STATUS_NOT_CONNECTED;
+	if (ts->datamover_en)
+		return THUNDERSCOPEHW_STATUS_ALREADY_STARTED;
+	memset(calibration, 0, sizeof(*calibration));
+
+	struct ThunderScopeHWCalibrationBuffers b;
+	memset(&b, 0, sizeof(b));
+#ifdef _WIN32
+	b.buffer = (uint8_t*)_aligned_malloc(THUNDERSCOPEHW_CALIBRATION_READ, 4096);
+#else
+	if (posix_memalign((void**)&b.buffer, 4096, THUNDERSCOPEHW_CALIBRATION_READ)) b.buffer = NULL;
+#endif
+	bool ok = b.buffer != NULL;
+	for (int channel = 0; channel < THUNDERSCOPEHW_CHANNELS; channel++) {
+		b.channels[channel] = (int8_t*)malloc(THUNDERSCOPEHW_CALIBRATION_READ / THUNDERSCOPEHW_CHANNELS);
+		ok = ok && b.channels[channel];
+	}
+
+	struct ThunderScopeHWChannel saved[THUNDERSCOPEHW_CHANNELS];
+	memcpy(saved, ts->channels, sizeof(saved));
+	enum ThunderScopeHWStatus status = ok ? thunderscopehw_calibrate_sweep(ts, &b, calibration)
+					      : THUNDERSCOPEHW_STATUS_MEMORY_FULL;
+
+	// Put the user's settings back.
+	memcpy(ts->channels, saved, sizeof(saved));
+	enum ThunderScopeHWStatus restore = thunderscopehw_configure_channels(ts);
+	for (int channel = 0; channel < THUNDERSCOPEHW_CHANNELS && restore == THUNDERSCOPEHW_STATUS_OK; channel++) {
+		restore = thunderscopehw_set_dac(ts, channel);
+		if (restore == THUNDERSCOPEHW_STATUS_OK) restore = thunderscopehw_set_pga(ts, channel);
+	}
+	if (restore == THUNDERSCOPEHW_STATUS_OK) restore = thunderscopehw_set_datamover_reg(ts);
+
+#ifdef _WIN32
+	_aligned_free(b.buffer);
+#else
+	free(b.buffer);
+#endif
+	for (int channel = 0; channel < THUNDERSCOPEHW_CHANNELS; channel++) free(b.channels[channel]);
+	return status != THUNDERSCOPEHW_STATUS_OK ? status : restore;
+}
@@ -0,0 +1,196 @@
+#include "thunderscopehw_private.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#define THUNDERSCOPEHW_CALIBRATION_MAGIC    "TSHWCAL"
+#define THUNDERSCOPEHW_CALIBRATION_VERSION  1
+
+// File layout, the calibration follows the header directly so the mapping
+// can be used in place. The size field catches layout changes between builds.
+struct ThunderScopeHWCalibrationHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t size;
+	uint64_t scope_id;
+};
+
+struct ThunderScopeHWCalibrationFile {
+	struct ThunderScopeHWCalibrationHeader header;
+	struct ThunderScopeHWCalibration calibration;
+};
+
+bool thunderscopehw_calibration_path(struct ThunderScopeHW* ts, const char* suffix, char* path, size_t size)
+{
+	const char* dir = getenv("THUNDERSCOPEHW_CAL_DIR");
+	int n;
+	if (dir && *dir) {
+		n = snprintf(path, size, "%s", dir);
+	} else {
+#ifdef _WIN32
+		const char* home = getenv("USERPROFILE");
+#else
+		const char* home = getenv("HOME");
+#endif
+		if (!home) return false;
+		n = snprintf(path, size, "%s/.thunderscopehw", home);
+	}
+	if (n < 0 || (size_t)n >= size) return false;
+	int m = snprintf(path + n, size - n, "/%016" PRIx64 ".%s", ts->scope_id, suffix);
+	return m >= 0 && (size_t)m < size - n;
+}
+
+// Creates the directory of a calibration file, done only when one is stored.
+static void thunderscopehw_calibration_mkdir(const char* path)
+{
+	char dir[1024];
+	const char* slash = strrchr(path, '/');
+	if (!slash || (size_t)(slash - path) >= sizeof(dir)) return;
+	memcpy(dir, path, slash - path);
+	dir[slash - path] = 0;
+#ifdef _WIN32
+	_mkdir(dir);
+#else
+	mkdir(dir, 0755);
+#endif
+}
+
+void thunderscopehw_calibration_unload(struct ThunderScopeHW* ts)
+{
+	if (ts->calibration_map) {
+#ifdef _WIN32
+		UnmapViewOfFile(ts->calibration_map);
+#else
+		munmap(ts->calibration_map, ts->calibration_map_size);
+#endif
+	}
+	ts->calibration = NULL;
+	ts->calibration_map = NULL;
+	ts->calibration_map_size = 0;
+}
+
+static void* thunderscopehw_calibration_map(const char* path, size_t size)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return NULL;
+	LARGE_INTEGER file_size;
+	void* map = NULL;
+	if (GetFileSizeEx(file, &file_size) && (uint64_t)file_size.QuadPart == size) {
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping) {
+			map = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, size);
+			CloseHandle(mapping);
+		}
+	}
+	CloseHandle(file);
+	return map;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return NULL;
+	struct stat st;
+	void* map = NULL;
+	if (!fstat(fd, &st) && (uint64_t)st.st_size == size) {
+		map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED) map = NULL;
+	}
+	close(fd);
+	return map;
+#endif
+}
+
+void thunderscopehw_calibration_load(struct ThunderScopeHW* ts)
+{
+	char path[1024];
+	thunderscopehw_calibration_unload(ts);
+	for (int m = 0; m < THUNDERSCOPEHW_CORE_TRIM_MODES; m++) ts->core_trim_valid[m] = false;
+	if (!thunderscopehw_calibration_path(ts, "cal", path, sizeof(path))) return;
+
+	size_t size = sizeof(struct ThunderScopeHWCalibrationFile);
+	void* map = thunderscopehw_calibration_map(path, size);
+	if (!map) return;
+	ts->calibration_map = map;
+	ts->calibration_map_size = size;
+
+	const struct ThunderScopeHWCalibrationFile* file = (const struct ThunderScopeHWCalibrationFile*)map;
+	if (memcmp(file->header.magic, THUNDERSCOPEHW_CALIBRATION_MAGIC, sizeof(file->header.magic))
+	    || file->header.version != THUNDERSCOPEHW_CALIBRATION_VERSION
+	    || file->header.size != size
+	    || file->header.scope_id != ts->scope_id) {
+		thunderscopehw_calibration_unload(ts);
+		return;
+	}
+	ts->calibration = &file->calibration;
+	for (int m = 0; m < THUNDERSCOPEHW_CORE_TRIM_MODES; m++) {
+		if (!(ts->calibration->core_trim_valid & (1u << m))) continue;
+		ts->core_trim[m] = ts->calibration->core_trim[m];
+		ts->core_trim_valid[m] = true;
+	}
+}
+
+enum ThunderScopeHWStatus thunderscopehw_calibration_get(struct ThunderScopeHW* ts, struct ThunderScopeHWCalibration* calibration)
+{
+	if (!ts->connected)
+		return THUNDERSCOPEHW_STATUS_NOT_CONNECTED;
+	if (ts->calibration) {
+		*calibration = *ts->calibration;
+	} else {
+		memset(calibration, 0, sizeof(*calibration));
+	}
+	return THUNDERSCOPEHW_STATUS_OK;
+}
+
+enum ThunderScopeHWStatus thunderscopehw_calibration_store(struct ThunderScopeHW* ts, const struct ThunderScopeHWCalibration* calibration)
+{
+	if (!ts->connected)
+		return THUNDERSCOPEHW_STATUS_NOT_CONNECTED;
+	char path[1024];
+	char temporary[1040];
+	if (!thunderscopehw_calibration_path(ts, "cal", path, sizeof(path)))
+		return THUNDERSCOPEHW_STATUS_WRITE_ERROR;
+	thunderscopehw_calibration_mkdir(path);
+	snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+
+	struct ThunderScopeHWCalibrationFile* file;
+	file = (struct ThunderScopeHWCalibrationFile*)calloc(1, sizeof(struct ThunderScopeHWCalibrationFile));
+	if (!file) return THUNDERSCOPEHW_STATUS_MEMORY_FULL;
+	memcpy(file->header.magic, THUNDERSCOPEHW_CALIBRATION_MAGIC, sizeof(THUNDERSCOPEHW_CALIBRATION_MAGIC));
+	file->header.version = THUNDERSCOPEHW_CALIBRATION_VERSION;
+	file->header.size = sizeof(struct ThunderScopeHWCalibrationFile);
+	file->header.scope_id = ts->scope_id;
+	file->calibration = *calibration;
+
+	// Written aside and renamed over the old file, which must not be mapped
+	// while it is replaced.
+	FILE* f = fopen(temporary, "wb");
+	bool ok = f && fwrite(file, sizeof(*file), 1, f) == 1;
+	if (f && fclose(f)) ok = false;
+	free(file);
+	if (!ok) {
+		remove(temporary);
+		return THUNDERSCOPEHW_STATUS_WRITE_ERROR;
+	}
+	thunderscopehw_calibration_unload(ts);
+#ifdef _WIN32
+	remove(path);
+#endif
+	if (rename(temporary, path)) {
+		remove(temporary);
+		thunderscopehw_calibration_load(ts);
+		return THUNDERSCOPEHW_STATUS_WRITE_ERROR;
+	}
+	thunderscopehw_calibration_load(ts);
+	return ts->calibration ? THUNDERSCOPEHW_STATUS_OK : THUNDERSCOPEHW_STATUS_WRITE_ERROR;
+}
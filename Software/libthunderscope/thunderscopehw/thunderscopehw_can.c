@@ -0,0 +1,390 @@
+#include "thunderscopehw_private.h"
+
+#include <string.h>
+
+// Where the bit rate switches within BRS and the CRC delimiter.
+#define THUNDERSCOPEHW_CAN_SAMPLE_POINT 0.8
+// Recessive bits ending a frame (EOF and intermission) and an error frame.
+#define THUNDERSCOPEHW_CAN_EOF_BITS     10
+#define THUNDERSCOPEHW_CAN_IDLE_BITS    11
+
+#define THUNDERSCOPEHW_CAN_CRC15 0x4599
+#define THUNDERSCOPEHW_CAN_CRC17 0x1685B
+#define THUNDERSCOPEHW_CAN_CRC21 0x102899
+
+enum ThunderScopeHWCanField {
+	THUNDERSCOPEHW_CAN_SOF,
+	THUNDERSCOPEHW_CAN_ID,
+	THUNDERSCOPEHW_CAN_RTR_SRR,
+	THUNDERSCOPEHW_CAN_IDE,
+	THUNDERSCOPEHW_CAN_ID_EXT,
+	THUNDERSCOPEHW_CAN_RTR_EXT,
+	THUNDERSCOPEHW_CAN_FDF,
+	THUNDERSCOPEHW_CAN_RES,
+	THUNDERSCOPEHW_CAN_R0,
+	THUNDERSCOPEHW_CAN_BRS,
+	THUNDERSCOPEHW_CAN_ESI,
+	THUNDERSCOPEHW_CAN_DLC,
+	THUNDERSCOPEHW_CAN_DATA,
+	THUNDERSCOPEHW_CAN_STUFF_COUNT,
+	THUNDERSCOPEHW_CAN_CRC,
+	THUNDERSCOPEHW_CAN_CRC_DELIMITER,
+	THUNDERSCOPEHW_CAN_ACK,
+	THUNDERSCOPEHW_CAN_ACK_DELIMITER,
+	THUNDERSCOPEHW_CAN_EOF,
+	// Waiting for the bus to go idle after an error.
+	THUNDERSCOPEHW_CAN_WAIT,
+};
+
+static const uint8_t thunderscopehw_can_fd_lengths[16] = {
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64
+};
+
+struct ThunderScopeHWDecoder* thunderscopehw_can_decoder_create(double sample_rate, double bitrate, double data_bitrate,
+								bool dominant_high, int8_t low, int8_t high)
+{
+	if (!(sample_rate > 0) || !(bitrate > 0) || bitrate * 2 > sample_rate || !(data_bitrate >= 0) ||
+	    data_bitrate * 2 > sample_rate)
+		return NULL;
+	struct ThunderScopeHWDecoder* d = thunderscopehw_decoder_alloc(THUNDERSCOPEHW_PROTOCOL_CAN, 1, low, high);
+	if (!d) return d;
+
+	struct ThunderScopeHWCan* c = &d->u.can;
+	c->nominal_bit = sample_rate / bitrate;
+	c->data_bit = data_bitrate > 0 ? sample_rate / data_bitrate : c->nominal_bit;
+	c->dominant_high = dominant_high;
+	thunderscopehw_decoder_reset(d);
+	return d;
+}
+
+void thunderscopehw_can_reset(struct ThunderScopeHWDecoder* d)
+{
+	d->u.can.in_frame = false;
+}
+
+static uint32_t thunderscopehw_can_crc(uint32_t crc, bool bit, uint32_t poly, int width)
+{
+	bool top = (crc >> (width - 1)) & 1;
+	crc = (crc << 1) & ((1U << width) - 1);
+	return top != bit ? crc ^ poly : crc;
+}
+
+static void thunderscopehw_can_expect(struct ThunderScopeHWCan* c, enum ThunderScopeHWCanField field, int bits)
+{
+	c->field = field;
+	c->remaining = bits;
+	c->shift = 0;
+}
+
+static void thunderscopehw_can_error(struct ThunderScopeHWDecoder* d, uint32_t flags, double time)
+{
+	struct ThunderScopeHWCan* c = &d->u.can;
+	struct ThunderScopeHWPacket p;
+	p.type = THUNDERSCOPEHW_PACKET_CAN_ERROR;
+	p.flags = flags;
+	p.start = (uint64_t)time;
+	p.end = (uint64_t)time;
+	p.value = c->id;
+	p.value2 = 0;
+	p.length = 0;
+	thunderscopehw_decoder_emit(d, &p);
+
+	// Error frames go at the nominal rate.
+	c->stuffing = false;
+	c->fixed_stuffing = false;
+	c->crc_active = false;
+	c->bit = c->nominal_bit;
+	thunderscopehw_can_expect(c, THUNDERSCOPEHW_CAN_WAIT, THUNDERSCOPEHW_CAN_IDLE_BITS);
+}
+
+// Data done: CAN FD switches to fixed stuff bits and sends the stuff count first.
+static void thunderscopehw_can_crc_field(struct ThunderScopeHWCan* c)
+{
+	c->crc_active = false;
+	if (c->flags & THUNDERSCOPEHW_PACKET_FD) {
+		c->stuffing = false;
+		c->fixed_stuffing = true;
+		c->fixed_left = 0;
+		thunderscopehw_can_expect(c, THUNDERSCOPEHW_CAN_STUFF_COUNT, 4);
+	} else {
+		thunderscopehw_can_expect(c, THUNDERSCOPEHW_CAN_CRC, 15);
+	}
+}
+
+static void thunderscopehw_can_frame(struct ThunderScopeHWDecoder* d, double start)
+{
+	struct ThunderScopeHWCan* c = &d->u.can;
+	struct ThunderScopeHWPacket p;
+	p.type = THUNDERSCOPEHW_PACKET_CAN;
+	p.flags = c->flags;
+	p.start = c->frame_start;
+	p.end = (uint64_t)(start + c->bit) - 1;
+	p.value = c->id;
+	p.value2 = c->dlc;
+	p.length = c->length;
+	memcpy(p.data, c->data, c->length);
+	thunderscopehw_decoder_emit(d, &p);
+}
+
+// One destuffed bit, recessive true, of the bit starting at `start`.
+static void thunderscopehw_can_field_bit(struct ThunderScopeHWDecoder* d, double start, bool bit)
+{
+	struct ThunderScopeHWCan* c = &d->u.can;
+	if (c->field == THUNDERSCOPEHW_CAN_EOF) {
+		// Dominant in the intermission starts an overload frame.
+		if (!bit && c->remaining > 3) {
+			thunderscopehw_can_error(d, THUNDERSCOPEHW_PACKET_FORM_ERROR, start);
+		} else if (!bit) {
+			thunderscopehw_can_expect(c, THUNDERSCOPEHW_CAN_WAIT, THUNDERSCOPEHW_CAN_IDLE_BITS);
+		} else if (--c->remaining == 0) {
+			c->in_frame = false;
+		}
+		return;
+	}
+	if (c->field == THUNDERSCOPEHW_CAN_WAIT) {
+		if (!bit) {
+			c->remaining = THUNDERSCOPEHW_CAN_IDLE_BITS;
+		} else if (--c->remaining == 0) {
+			c->in_frame = false;
+		}
+		return;
+	}
+
+	c->shift = (c->shift << 1) | bit;
+	if (--c->remaining > 0) return;
+	uint32_t value = c->shift;
+	switch ((enum ThunderScopeHWCanField)c->field) {
+	case THUNDERSCOPEHW_CAN_SOF:
+		// Not dominant at the sample point, a glitch.
+		if (bit) {
+			c->in_frame = false;
+			return;
+		}
+		thunderscopehw_can_expect(c, THUNDERSCOPEHW_CAN_ID, 11);
+		break;
+	case THUNDERSCOPEHW_CAN_ID:
+		c->id = value;
+		thunderscopehw_can_expect(c, THUNDERSCOPEHW_CAN_RTR_SRR, 1);
+		break;
+	case THUNDERSCOPEHW_CAN_RTR_SRR:
+		if (bit) c->flags |= THUNDERSCOPEHW_PACKET_REMOTE;
+		thunderscopehw_can_expect(c, THUNDERSCOPEHW_CAN_IDE, 1);
+		break;
+	case THUNDERSCOPEHW_CAN_IDE:
+		if (bit) {
+			// The bit before was SRR.
+			c->flags = (c->flags & ~THUNDERSCOPEHW_PACKET_REMOTE) | THUNDERSCOPEHW_PACKET_EXTENDED;
+			thunderscopehw_can_expect(c, THUNDERSCOPEHW_CAN_ID_EXT, 18);
+		} else {
+			thunderscopehw_can_expect(c, THUNDERSCOPEHW_CAN_FDF, 1);
+		}
+		break;
+	case THUNDERSCOPEHW_CAN_ID_EXT:
+		c->id = (c->id << 18) | value;
+		thunderscopehw_can_expect(c, THUNDERSCOPEHW_CAN_RTR_EXT, 1);
+		break;
+	case THUNDERSCOPEHW_CAN_RTR_EXT:
+		if (bit) c->flags |= THUNDERSCOPEHW_PACKET_REMOTE;
+		thunderscopehw_can_expect(c, THUNDERSCOPEHW_CAN_FDF, 1);
+		break;
+	case THUNDERSCOPEHW_CAN_FDF:
+		if (bit) {
+			// FD frames have no remote request, the bit was RRS.
+			c->flags = (c->flags & ~THUNDERSCOPEHW_PACKET_REMOTE) | THUNDERSCOPEHW_PACKET_FD;
+			thunderscopehw_can_expect(c, THUNDERSCOPEHW_CAN_RES, 1);
+		} else if (c->flags & THUNDERSCOPEHW_PACKET_EXTENDED) {
+			thunderscopehw_can_expect(c, THUNDERSCOPEHW_CAN_R0, 1);
+		} else {
+			thunderscopehw_can_expect(c, THUNDERSCOPEHW_CAN_DLC, 4);
+		}
+		break;
+	case THUNDERSCOPEHW_CAN_RES:
+		thunderscopehw_can_expect(c, THUNDERSCOPEHW_CAN_BRS, 1);
+		break;
+	case THUNDERSCOPEHW_CAN_R0:
+		thunderscopehw_can_expect(c, THUNDERSCOPEHW_CAN_DLC, 4);
+		break;
+	case THUNDERSCOPEHW_CAN_BRS:
+		if (bit) {
+			c->flags |= THUNDERSCOPEHW_PACKET_BRS;
+			c->bit_start = start + THUNDERSCOPEHW_CAN_SAMPLE_POINT * c->nominal_bit +
+				       (1 - THUNDERSCOPEHW_CAN_SAMPLE_POINT) * c->data_bit;
+			c->bit = c->data_bit;
+		}
+		thunderscopehw_can_expect(c, THUNDERSCOPEHW_CAN_ESI, 1);
+		break;
+	case THUNDERSCOPEHW_CAN_ESI:
+		if (bit) c->flags |= THUNDERSCOPEHW_PACKET_ESI;
+		thunderscopehw_can_expect(c, THUNDERSCOPEHW_CAN_DLC, 4);
+		break;
+	case THUNDERSCOPEHW_CAN_DLC:
+		c->dlc = value;
+		if (c->flags & THUNDERSCOPEHW_PACKET_FD) {
+			c->length = thunderscopehw_can_fd_lengths[value];
+		} else {
+			c->length = (c->flags & THUNDERSCOPEHW_PACKET_REMOTE) ? 0 : value > 8 ? 8 : value;
+		}
+		c->received = 0;
+		if (c->length) {
+			thunderscopehw_can_expect(c, THUNDERSCOPEHW_CAN_DATA, 8);
+		} else {
+			thunderscopehw_can_crc_field(c);
+		}
+		break;
+	case THUNDERSCOPEHW_CAN_DATA:
+		c->data[c->received++] = (uint8_t)value;
+		if (c->received < c->length) {
+			thunderscopehw_can_expect(c, THUNDERSCOPEHW_CAN_DATA, 8);
+		} else {
+			thunderscopehw_can_crc_field(c);
+		}
+		break;
+	case THUNDERSCOPEHW_CAN_STUFF_COUNT: {
+		// Gray coded count of dynamic stuff bits modulo 8 and an even parity bit.
+		uint32_t count = c->stuff_count & 7;
+		uint32_t gray = count ^ (count >> 1);
+		uint32_t parity = (gray ^ (gray >> 1) ^ (gray >> 2)) & 1;
+		if (value != ((gray << 1) | parity)) c->flags |= THUNDERSCOPEHW_PACKET_CRC_ERROR;
+		thunderscopehw_can_expect(c, THUNDERSCOPEHW_CAN_CRC, c->length > 16 ? 21 : 17);
+		break;
+	}
+	case THUNDERSCOPEHW_CAN_CRC: {
+		uint32_t crc = c->crc15;
+		if (c->flags & THUNDERSCOPEHW_PACKET_FD) crc = c->length > 16 ? c->crc21 : c->crc17;
+		if (value != crc) c->flags |= THUNDERSCOPEHW_PACKET_CRC_ERROR;
+		// A classic CRC ending on five equal bits still takes a stuff bit, so
+		// dynamic stuffing stays on until the delimiter.
+		c->fixed_stuffing = false;
+		thunderscopehw_can_expect(c, THUNDERSCOPEHW_CAN_CRC_DELIMITER, 1);
+		break;
+	}
+	case THUNDERSCOPEHW_CAN_CRC_DELIMITER:
+		c->stuffing = false;
+		if (c->bit != c->nominal_bit) {
+			c->bit_start = start + THUNDERSCOPEHW_CAN_SAMPLE_POINT * c->bit +
+				       (1 - THUNDERSCOPEHW_CAN_SAMPLE_POINT) * c->nominal_bit;
+			c->bit = c->nominal_bit;
+		}
+		if (!bit) {
+			thunderscopehw_can_error(d, THUNDERSCOPEHW_PACKET_FORM_ERROR, start);
+			return;
+		}
+		thunderscopehw_can_expect(c, THUNDERSCOPEHW_CAN_ACK, 1);
+		break;
+	case THUNDERSCOPEHW_CAN_ACK:
+		if (bit) c->flags |= THUNDERSCOPEHW_PACKET_NACK;
+		thunderscopehw_can_expect(c, THUNDERSCOPEHW_CAN_ACK_DELIMITER, 1);
+		break;
+	case THUNDERSCOPEHW_CAN_ACK_DELIMITER:
+		if (!bit) c->flags |= THUNDERSCOPEHW_PACKET_FORM_ERROR;
+		thunderscopehw_can_frame(d, start);
+		thunderscopehw_can_expect(c, THUNDERSCOPEHW_CAN_EOF, THUNDERSCOPEHW_CAN_EOF_BITS);
+		break;
+	case THUNDERSCOPEHW_CAN_EOF:
+	case THUNDERSCOPEHW_CAN_WAIT:
+		break;
+	}
+}
+
+// One bit off the bus, stuff bits included.
+static void thunderscopehw_can_bit(struct ThunderScopeHWDecoder* d, double start, bool bit)
+{
+	struct ThunderScopeHWCan* c = &d->u.can;
+	if (c->fixed_stuffing) {
+		// A fixed stuff bit ahead of every 4 bits, the complement of the one before.
+		if (c->fixed_left == 0) {
+			c->fixed_left = 4;
+			if (bit == c->last) {
+				thunderscopehw_can_error(d, THUNDERSCOPEHW_PACKET_STUFF_ERROR, start);
+				return;
+			}
+			c->last = bit;
+			return;
+		}
+		c->fixed_left--;
+		c->last = bit;
+	} else if (c->stuffing) {
+		if (c->run == 5) {
+			if (bit == c->last) {
+				thunderscopehw_can_error(d, THUNDERSCOPEHW_PACKET_STUFF_ERROR, start);
+				return;
+			}
+			// CAN FD CRCs include the dynamic stuff bits.
+			if (c->crc_active) {
+				c->crc17 = thunderscopehw_can_crc(c->crc17, bit, THUNDERSCOPEHW_CAN_CRC17, 17);
+				c->crc21 = thunderscopehw_can_crc(c->crc21, bit, THUNDERSCOPEHW_CAN_CRC21, 21);
+			}
+			c->stuff_count++;
+			c->run = 1;
+			c->last = bit;
+			return;
+		}
+		if (bit == c->last) {
+			c->run++;
+		} else {
+			c->run = 1;
+			c->last = bit;
+		}
+	}
+
+	if (c->crc_active) {
+		c->crc15 = thunderscopehw_can_crc(c->crc15, bit, THUNDERSCOPEHW_CAN_CRC15, 15);
+		c->crc17 = thunderscopehw_can_crc(c->crc17, bit, THUNDERSCOPEHW_CAN_CRC17, 17);
+		c->crc21 = thunderscopehw_can_crc(c->crc21, bit, THUNDERSCOPEHW_CAN_CRC21, 21);
+	} else if (c->field == THUNDERSCOPEHW_CAN_STUFF_COUNT) {
+		c->crc17 = thunderscopehw_can_crc(c->crc17, bit, THUNDERSCOPEHW_CAN_CRC17, 17);
+		c->crc21 = thunderscopehw_can_crc(c->crc21, bit, THUNDERSCOPEHW_CAN_CRC21, 21);
+	}
+	thunderscopehw_can_field_bit(d, start, bit);
+}
+
+// Samples the bits whose middle comes before `until`, the line having been at `level`.
+static void thunderscopehw_can_sample(struct ThunderScopeHWDecoder* d, uint64_t until, bool level)
+{
+	struct ThunderScopeHWCan* c = &d->u.can;
+	bool recessive = c->dominant_high ? !level : level;
+	while (c->in_frame) {
+		double start = c->bit_start;
+		if (start + c->bit * 0.5 >= (double)until) return;
+		c->bit_start = start + c->bit;
+		thunderscopehw_can_bit(d, start, recessive);
+	}
+}
+
+void thunderscopehw_can_edge(struct ThunderScopeHWDecoder* d, uint64_t time, int input, bool level)
+{
+	struct ThunderScopeHWCan* c = &d->u.can;
+	(void)input;
+	thunderscopehw_can_sample(d, time, !level);
+	// Every edge within a frame resynchronises, a dominant one on an idle bus
+	// is a start of frame.
+	if (c->in_frame) {
+		c->bit_start = (double)time;
+		return;
+	}
+	if (c->dominant_high != level) return;
+
+	c->in_frame = true;
+	c->frame_start = time;
+	c->bit_start = (double)time;
+	c->bit = c->nominal_bit;
+	c->stuffing = true;
+	c->fixed_stuffing = false;
+	c->last = true;
+	c->run = 0;
+	c->stuff_count = 0;
+	c->crc_active = true;
+	c->crc15 = 0;
+	c->crc17 = 1U << 16;
+	c->crc21 = 1U << 20;
+	c->id = 0;
+	c->flags = 0;
+	c->dlc = 0;
+	c->length = 0;
+	thunderscopehw_can_expect(c, THUNDERSCOPEHW_CAN_SOF, 1);
+}
+
+void thunderscopehw_can_flush(struct ThunderScopeHWDecoder* d, uint64_t now)
+{
+	thunderscopehw_can_sample(d, now, d->level[0]);
+}
@@ -0,0 +1,359 @@
+#include "thunderscopehw_private.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define THUNDERSCOPEHW_CDR_DAMPING     0.707
+// Histogram mode: phase bins per unit interval and edges per clock update.
+#define THUNDERSCOPEHW_CDR_BINS        32
+#define THUNDERSCOPEHW_CDR_BLOCK_EDGES 64
+// Bits are held back this many samples, crossings interpolate back across calls.
+#define THUNDERSCOPEHW_CDR_MARGIN      16
+// The unit interval is kept within this fraction of the nominal one.
+#define THUNDERSCOPEHW_CDR_RANGE       0.1
+
+struct ThunderScopeHWCdr {
+	enum ThunderScopeHWCdrMode mode;
+	enum ThunderScopeHWLineCode code;
+	double sample_rate;
+	// Samples per symbol, half a bit for Manchester.
+	double nominal_ui;
+	// Range the unit interval is kept in.
+	double ui_low;
+	double ui_high;
+	double kp;
+	double ki;
+	struct ThunderScopeHWCrossings crossings;
+	double* times;
+	bool* rising;
+	uint64_t position;
+
+	bool synced;
+	bool level;
+	double ui;
+	// Start of the next symbol to give out and its index, counted from the first edge.
+	double next;
+	uint64_t symbol;
+	double first;
+
+	// Sum over the block's edges of their bin's phase as a unit vector, the
+	// histogram weighted by every bin's cosine and sine.
+	double block_cos;
+	double block_sin;
+	double bin_cos[THUNDERSCOPEHW_CDR_BINS];
+	double bin_sin[THUNDERSCOPEHW_CDR_BINS];
+	// Histogram bins per sample of phase error, follows the unit interval.
+	double bin_scale;
+	uint32_t block_edges;
+	double block_start;
+
+	// Manchester: edges at even and odd symbol boundaries, the odd or even
+	// ones with more are mid bit. Start of the bit whose first half is out.
+	uint32_t boundary_edges[2];
+	bool half_pending;
+	double half_start;
+
+	double* boundaries;
+	uint8_t* bits;
+	size_t count;
+	size_t capacity;
+};
+
+struct ThunderScopeHWCdr* thunderscopehw_cdr_create(enum ThunderScopeHWCdrMode mode, enum ThunderScopeHWLineCode code,
+						    double sample_rate, double bit_rate, double loop_bandwidth,
+						    int8_t low, int8_t high)
+{
+	if (mode != THUNDERSCOPEHW_CDR_PLL && mode != THUNDERSCOPEHW_CDR_HISTOGRAM) return NULL;
+	if (code != THUNDERSCOPEHW_LINE_CODE_NRZ && code != THUNDERSCOPEHW_LINE_CODE_MANCHESTER) return NULL;
+	if (!(sample_rate > 0) || !(bit_rate > 0) || !(loop_bandwidth >= 0) || low > high) return NULL;
+	double symbol_rate = code == THUNDERSCOPEHW_LINE_CODE_MANCHESTER ? 2 * bit_rate : bit_rate;
+	if (symbol_rate * 2 > sample_rate || loop_bandwidth * 10 > symbol_rate) return NULL;
+	struct ThunderScopeHWCdr* cdr;
+	cdr = (struct ThunderScopeHWCdr*)calloc(1, sizeof(struct ThunderScopeHWCdr));
+	if (!cdr) return cdr;
+
+	cdr->mode = mode;
+	cdr->code = code;
+	cdr->sample_rate = sample_rate;
+	cdr->nominal_ui = sample_rate / symbol_rate;
+	cdr->ui_low = cdr->nominal_ui * (1 - THUNDERSCOPEHW_CDR_RANGE);
+	cdr->ui_high = cdr->nominal_ui * (1 + THUNDERSCOPEHW_CDR_RANGE);
+	if (loop_bandwidth == 0) loop_bandwidth = bit_rate / 1667;
+	double theta = 2 * M_PI * loop_bandwidth / symbol_rate;
+	cdr->kp = 2 * THUNDERSCOPEHW_CDR_DAMPING * theta;
+	cdr->ki = theta * theta;
+	for (int i = 0; i < THUNDERSCOPEHW_CDR_BINS; i++) {
+		double angle = 2 * M_PI * ((i + 0.5) / THUNDERSCOPEHW_CDR_BINS - 0.5);
+		cdr->bin_cos[i] = cos(angle);
+		cdr->bin_sin[i] = sin(angle);
+	}
+	cdr->times = (double*)malloc(THUNDERSCOPEHW_TILE_SAMPLES * sizeof(double));
+	cdr->rising = (bool*)malloc(THUNDERSCOPEHW_TILE_SAMPLES * sizeof(bool));
+	if (!thunderscopehw_crossings_init(&cdr->crossings, low, high) || !cdr->times || !cdr->rising) {
+		thunderscopehw_cdr_destroy(cdr);
+		return NULL;
+	}
+	thunderscopehw_cdr_reset(cdr);
+	return cdr;
+}
+
+void thunderscopehw_cdr_destroy(struct ThunderScopeHWCdr* cdr)
+{
+	if (!cdr) return;
+	thunderscopehw_crossings_free(&cdr->crossings);
+	free(cdr->times);
+	free(cdr->rising);
+	free(cdr);
+}
+
+void thunderscopehw_cdr_reset(struct ThunderScopeHWCdr* cdr)
+{
+	thunderscopehw_crossings_reset(&cdr->crossings);
+	cdr->position = 0;
+	cdr->synced = false;
+	cdr->ui = cdr->nominal_ui;
+	cdr->bin_scale = THUNDERSCOPEHW_CDR_BINS / cdr->ui;
+	cdr->block_cos = 0;
+	cdr->block_sin = 0;
+	cdr->block_edges = 0;
+	cdr->boundary_edges[0] = 0;
+	cdr->boundary_edges[1] = 0;
+	cdr->half_pending = false;
+}
+
+double thunderscopehw_cdr_bit_rate(struct ThunderScopeHWCdr* cdr)
+{
+	// Averaged since the first edge, the loop alone takes slow drift as phase steps.
+	double ui = cdr->synced && cdr->symbol ? (cdr->next - cdr->first) / cdr->symbol : cdr->ui;
+	double symbol_rate = cdr->sample_rate / ui;
+	return cdr->code == THUNDERSCOPEHW_LINE_CODE_MANCHESTER ? symbol_rate / 2 : symbol_rate;
+}
+
+size_t thunderscopehw_cdr_max_output(struct ThunderScopeHWCdr* cdr, size_t length)
+{
+	size_t symbols = (size_t)((length + THUNDERSCOPEHW_CDR_MARGIN) / (cdr->nominal_ui * (1 - THUNDERSCOPEHW_CDR_RANGE))) + 2;
+	return cdr->code == THUNDERSCOPEHW_LINE_CODE_MANCHESTER ? symbols / 2 + 1 : symbols;
+}
+
+static void thunderscopehw_cdr_manchester_symbol(struct ThunderScopeHWCdr* cdr, double start)
+{
+	// Manchester bits are the level of their second half.
+	uint32_t mid = cdr->boundary_edges[1] > cdr->boundary_edges[0];
+	if ((cdr->symbol & 1) != mid) {
+		cdr->half_pending = true;
+		cdr->half_start = start;
+	} else if (cdr->half_pending) {
+		cdr->boundaries[cdr->count] = cdr->half_start;
+		cdr->bits[cdr->count++] = cdr->level;
+		cdr->half_pending = false;
+	}
+}
+
+// Writes a run of n bits of one level from `next` on. Runs of up to four, most
+// of them, are four straight stores while there is room, those past the run
+// are overwritten by the next one.
+static inline void thunderscopehw_cdr_run(double* boundaries, uint8_t* bits, size_t room, double next, double ui,
+					  size_t n, bool level)
+{
+	if (n <= 4 && room >= 4) {
+		static const double ramp[4] = { 0, 1, 2, 3 };
+		uint32_t word = level * 0x01010101U;
+		for (int k = 0; k < 4; k++) boundaries[k] = next + ramp[k] * ui;
+		memcpy(bits, &word, 4);
+		return;
+	}
+	for (size_t k = 0; k < n; k++) {
+		boundaries[k] = next + (double)(int64_t)k * ui;
+		bits[k] = level;
+	}
+}
+
+// Gives out the symbols whose middle comes before `until`.
+static void thunderscopehw_cdr_advance(struct ThunderScopeHWCdr* cdr, double until)
+{
+	if (cdr->code == THUNDERSCOPEHW_LINE_CODE_NRZ) {
+		double run = (until - cdr->next) / cdr->ui + 0.5;
+		size_t n = run >= 1 ? (size_t)run : 0;
+		thunderscopehw_cdr_run(cdr->boundaries + cdr->count, cdr->bits + cdr->count, cdr->capacity - cdr->count,
+				       cdr->next, cdr->ui, n, cdr->level);
+		cdr->count += n;
+		cdr->next += (double)n * cdr->ui;
+		cdr->symbol += n;
+		return;
+	}
+	while (cdr->next + cdr->ui * 0.5 < until) {
+		thunderscopehw_cdr_manchester_symbol(cdr, cdr->next);
+		cdr->next += cdr->ui;
+		cdr->symbol++;
+	}
+}
+
+// Steps the clock to the circular mean of the block's edge phases.
+static void thunderscopehw_cdr_histogram_update(struct ThunderScopeHWCdr* cdr, double edge)
+{
+	double c = cdr->block_cos, s = cdr->block_sin;
+	cdr->block_cos = 0;
+	cdr->block_sin = 0;
+	double phase = atan2(s, c) / (2 * M_PI) * cdr->ui;
+	double intervals = (edge - cdr->block_start) / cdr->ui;
+	cdr->next += phase;
+	if (intervals >= 1) cdr->ui += phase / intervals;
+	if (cdr->ui < cdr->ui_low) cdr->ui = cdr->ui_low;
+	if (cdr->ui > cdr->ui_high) cdr->ui = cdr->ui_high;
+	cdr->bin_scale = THUNDERSCOPEHW_CDR_BINS / cdr->ui;
+	cdr->block_edges = 0;
+	cdr->block_start = edge;
+}
+
+static void thunderscopehw_cdr_edge(struct ThunderScopeHWCdr* cdr, double edge, bool rising)
+{
+	thunderscopehw_cdr_advance(cdr, edge);
+	// The next symbol's start is the nearest boundary, error within half a UI.
+	double error = edge - cdr->next;
+	cdr->boundary_edges[cdr->symbol & 1]++;
+	if (cdr->boundary_edges[0] + cdr->boundary_edges[1] >= 1024) {
+		cdr->boundary_edges[0] >>= 1;
+		cdr->boundary_edges[1] >>= 1;
+	}
+
+	if (cdr->mode == THUNDERSCOPEHW_CDR_PLL) {
+		cdr->next += cdr->kp * error;
+		cdr->ui += cdr->ki * error;
+		if (cdr->ui < cdr->ui_low) cdr->ui = cdr->ui_low;
+		if (cdr->ui > cdr->ui_high) cdr->ui = cdr->ui_high;
+	} else {
+		int bin = (int)(error * cdr->bin_scale + THUNDERSCOPEHW_CDR_BINS / 2);
+		if (bin < 0) bin = 0;
+		if (bin >= THUNDERSCOPEHW_CDR_BINS) bin = THUNDERSCOPEHW_CDR_BINS - 1;
+		cdr->block_cos += cdr->bin_cos[bin];
+		cdr->block_sin += cdr->bin_sin[bin];
+		if (++cdr->block_edges == THUNDERSCOPEHW_CDR_BLOCK_EDGES) thunderscopehw_cdr_histogram_update(cdr, edge);
+	}
+	cdr->level = rising;
+}
+
+// The same for NRZ with the clock in locals, the histogram mode being the loop
+// without gains. The run before an edge comes from the spacing of the edges,
+// corrected when jitter moves it a bit. Its error is expanded in terms of the
+// last edge's so that the chain from one edge to the next is one multiply-add:
+// the boundary and unit interval the last error gives, next = previous - (1 -
+// kp) * e and ui + ki * e, are only needed for the output.
+static inline void thunderscopehw_cdr_nrz_edges(struct ThunderScopeHWCdr* cdr, const double* times,
+						const bool* rising, size_t edges, bool pll)
+{
+	double kp = pll ? cdr->kp : 0, ki = pll ? cdr->ki : 0;
+	double ui_low = cdr->ui_low, ui_high = cdr->ui_high;
+	// The last edge, its error and the unit interval before it corrected the clock.
+	double previous = cdr->next, e = 0, ui = cdr->ui;
+	double inverse = 1 / ui, bin_scale = cdr->bin_scale;
+	double block_cos = cdr->block_cos, block_sin = cdr->block_sin;
+	uint32_t block_edges = cdr->block_edges;
+	bool level = cdr->level;
+	double* boundaries = cdr->boundaries;
+	uint8_t* bits = cdr->bits;
+	size_t count = cdr->count, capacity = cdr->capacity;
+	for (size_t j = 0; j < edges; j++) {
+		double edge = times[j];
+		// Without gains (folded away for the histogram) the clock runs free.
+		double next = pll ? previous - (1 - kp) * e : previous - e;
+		double step = pll ? ui + ki * e : ui;
+		// Signed conversions, unsigned ones take a branch on SSE2.
+		int64_t n = (int64_t)((edge - previous) * inverse + 0.5);
+		double error = edge - previous - (double)n * ui;
+		error += pll ? (1 - kp - (double)n * ki) * e : e;
+		if (step < ui_low || step > ui_high) {
+			step = step < ui_low ? ui_low : ui_high;
+			error = edge - (next + (double)n * step);
+		}
+		// The next symbol's start is the nearest boundary, error within half a UI.
+		if (fabs(error) >= 0.5 * step) {
+			while (error > 0.5 * step) {
+				n++;
+				error -= step;
+			}
+			while (n > 0 && error <= -0.5 * step) {
+				n--;
+				error += step;
+			}
+		}
+		thunderscopehw_cdr_run(boundaries + count, bits + count, capacity - count, next, step, (size_t)n, level);
+		count += (size_t)n;
+		previous = edge;
+		e = error;
+		ui = step;
+		level = rising[j];
+
+		if (!pll) {
+			int bin = (int)(error * bin_scale + THUNDERSCOPEHW_CDR_BINS / 2);
+			if (bin < 0) bin = 0;
+			if (bin >= THUNDERSCOPEHW_CDR_BINS) bin = THUNDERSCOPEHW_CDR_BINS - 1;
+			block_cos += cdr->bin_cos[bin];
+			block_sin += cdr->bin_sin[bin];
+			if (++block_edges == THUNDERSCOPEHW_CDR_BLOCK_EDGES) {
+				cdr->next = edge - error;
+				cdr->ui = ui;
+				cdr->block_cos = block_cos;
+				cdr->block_sin = block_sin;
+				thunderscopehw_cdr_histogram_update(cdr, edge);
+				block_edges = 0;
+				block_cos = 0;
+				block_sin = 0;
+				previous = cdr->next;
+				e = 0;
+				ui = cdr->ui;
+				inverse = 1 / ui;
+				bin_scale = cdr->bin_scale;
+			}
+		}
+	}
+	cdr->next = previous - (1 - kp) * e;
+	cdr->ui = ui + ki * e;
+	if (cdr->ui < ui_low) cdr->ui = ui_low;
+	if (cdr->ui > ui_high) cdr->ui = ui_high;
+	cdr->block_cos = block_cos;
+	cdr->block_sin = block_sin;
+	cdr->block_edges = block_edges;
+	cdr->level = level;
+	cdr->symbol += count - cdr->count;
+	cdr->count = count;
+}
+
+size_t thunderscopehw_cdr_process(struct ThunderScopeHWCdr* cdr, const int8_t* samples, size_t length,
+				  double* boundaries, uint8_t* bits)
+{
+	cdr->boundaries = boundaries;
+	cdr->bits = bits;
+	cdr->count = 0;
+	cdr->capacity = thunderscopehw_cdr_max_output(cdr, length);
+	for (size_t offset = 0; offset < length; offset += THUNDERSCOPEHW_TILE_SAMPLES) {
+		size_t n = length - offset;
+		if (n > THUNDERSCOPEHW_TILE_SAMPLES) n = THUNDERSCOPEHW_TILE_SAMPLES;
+		size_t edges = thunderscopehw_crossings_process(&cdr->crossings, samples + offset, n, cdr->times, cdr->rising);
+		size_t j = 0;
+		if (edges && !cdr->synced) {
+			cdr->synced = true;
+			cdr->next = cdr->times[0];
+			cdr->first = cdr->times[0];
+			cdr->symbol = 0;
+			cdr->block_start = cdr->times[0];
+			cdr->level = cdr->rising[0];
+			j = 1;
+		}
+		if (cdr->code == THUNDERSCOPEHW_LINE_CODE_NRZ && cdr->mode == THUNDERSCOPEHW_CDR_PLL) {
+			thunderscopehw_cdr_nrz_edges(cdr, cdr->times + j, cdr->rising + j, edges - j, true);
+		} else if (cdr->code == THUNDERSCOPEHW_LINE_CODE_NRZ) {
+			thunderscopehw_cdr_nrz_edges(cdr, cdr->times + j, cdr->rising + j, edges - j, false);
+		} else {
+			for (; j < edges; j++) thunderscopehw_cdr_edge(cdr, cdr->times[j], cdr->rising[j]);
+		}
+		cdr->position += n;
+	}
+	if (cdr->synced && cdr->position > THUNDERSCOPEHW_CDR_MARGIN)
+		thunderscopehw_cdr_advance(cdr, (double)(cdr->position - THUNDERSCOPEHW_CDR_MARGIN));
+	return cdr->count;
+}
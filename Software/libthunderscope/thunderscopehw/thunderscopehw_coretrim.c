@@ -0,0 +1,192 @@
+#include "thunderscopehw_private.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef THUNDERSCOPEHW_SSE2
+#include <emmintrin.h>
+#endif
+
+struct ThunderScopeHWCoreEstimator {
+	int interleave;
+	int64_t sum[THUNDERSCOPEHW_ADC_CORES];
+	uint64_t sum_squares[THUNDERSCOPEHW_ADC_CORES];
+	uint64_t count[THUNDERSCOPEHW_ADC_CORES];
+	// Core of the next sample.
+	int core;
+};
+
+static int thunderscopehw_core_trim_mode(int interleave)
+{
+	switch (interleave) {
+	case 1: return 0;
+	case 2: return 1;
+	case 4: return 2;
+	default: return -1;
+	}
+}
+
+struct ThunderScopeHWCoreEstimator* thunderscopehw_core_estimator_create(int interleave)
+{
+	if (thunderscopehw_core_trim_mode(interleave) < 0) return NULL;
+	struct ThunderScopeHWCoreEstimator* e;
+	e = (struct ThunderScopeHWCoreEstimator*)malloc(sizeof(struct ThunderScopeHWCoreEstimator));
+	if (!e) return e;
+	e->interleave = interleave;
+	thunderscopehw_core_estimator_reset(e);
+	return e;
+}
+
+void thunderscopehw_core_estimator_destroy(struct ThunderScopeHWCoreEstimator* e)
+{
+	free(e);
+}
+
+void thunderscopehw_core_estimator_reset(struct ThunderScopeHWCoreEstimator* e)
+{
+	memset(e->sum, 0, sizeof(e->sum));
+	memset(e->sum_squares, 0, sizeof(e->sum_squares));
+	memset(e->count, 0, sizeof(e->count));
+	e->core = 0;
+}
+
+void thunderscopehw_core_estimator_process(struct ThunderScopeHWCoreEstimator* e, const int8_t* data, size_t length)
+{
+	size_t i = 0;
+	for (; i < length && e->core; i++) {
+		e->sum[e->core] += data[i];
+		e->sum_squares[e->core] += data[i] * data[i];
+		e->count[e->core]++;
+		e->core = (e->core + 1) % THUNDERSCOPEHW_ADC_CORES;
+	}
+	// Whole rounds of cores, in 32 bit partials that cannot overflow.
+	while (length - i >= THUNDERSCOPEHW_ADC_CORES) {
+		size_t rounds = (length - i) / THUNDERSCOPEHW_ADC_CORES;
+		if (rounds > 65536) rounds = 65536;
+		int32_t sum[THUNDERSCOPEHW_ADC_CORES] = { 0 };
+		uint32_t sum_squares[THUNDERSCOPEHW_ADC_CORES] = { 0 };
+		for (size_t r = 0; r < rounds; r++, i += THUNDERSCOPEHW_ADC_CORES) {
+			for (int k = 0; k < THUNDERSCOPEHW_ADC_CORES; k++) {
+				int x = data[i + k];
+				sum[k] += x;
+				sum_squares[k] += (uint32_t)(x * x);
+			}
+		}
+		for (int k = 0; k < THUNDERSCOPEHW_ADC_CORES; k++) {
+			e->sum[k] += sum[k];
+			e->sum_squares[k] += sum_squares[k];
+			e->count[k] += rounds;
+		}
+	}
+	for (; i < length; i++) {
+		e->sum[e->core] += data[i];
+		e->sum_squares[e->core] += data[i] * data[i];
+		e->count[e->core]++;
+		e->core = (e->core + 1) % THUNDERSCOPEHW_ADC_CORES;
+	}
+}
+
+enum ThunderScopeHWStatus thunderscopehw_core_estimator_estimate(struct ThunderScopeHWCoreEstimator* e, struct ThunderScopeHWCoreTrim* trim)
+{
+	double mean[THUNDERSCOPEHW_ADC_CORES];
+	double deviation[THUNDERSCOPEHW_ADC_CORES];
+	for (int k = 0; k < THUNDERSCOPEHW_ADC_CORES; k++) {
+		if (e->count[k] < 2) return THUNDERSCOPEHW_STATUS_INVALID_PARAMETER;
+		mean[k] = (double)e->sum[k] / e->count[k];
+		double variance = (double)e->sum_squares[k] / e->count[k] - mean[k] * mean[k];
+		if (!(variance > 0)) return THUNDERSCOPEHW_STATUS_INVALID_PARAMETER;
+		deviation[k] = sqrt(variance);
+	}
+	// Cores k, k + interleave, ... feed the same channel.
+	for (int channel = 0; channel < e->interleave; channel++) {
+		double channel_mean = 0, channel_deviation = 0;
+		int cores = THUNDERSCOPEHW_ADC_CORES / e->interleave;
+		for (int k = channel; k < THUNDERSCOPEHW_ADC_CORES; k += e->interleave) {
+			channel_mean += mean[k] / cores;
+			channel_deviation += deviation[k] / cores;
+		}
+		for (int k = channel; k < THUNDERSCOPEHW_ADC_CORES; k += e->interleave) {
+			trim->offset[k] = (float)(mean[k] - channel_mean);
+			trim->gain[k] = (float)(deviation[k] / channel_deviation);
+		}
+	}
+	return THUNDERSCOPEHW_STATUS_OK;
+}
+
+void thunderscopehw_core_correct(const struct ThunderScopeHWCoreTrim* trim, int8_t* data, size_t length)
+{
+	// x / gain * 64 as (x * 256 * G) >> 16 with G = 16384 / gain, then the
+	// offset and rounding in the same 1/64 code units.
+	int16_t g[THUNDERSCOPEHW_ADC_CORES];
+	int16_t o[THUNDERSCOPEHW_ADC_CORES];
+	for (int k = 0; k < THUNDERSCOPEHW_ADC_CORES; k++) {
+		float gain = trim->gain[k];
+		if (gain < 0.5f) gain = 0.5f;
+		if (gain > 2.0f) gain = 2.0f;
+		long gq = lrintf(16384 / gain);
+		g[k] = (int16_t)(gq > INT16_MAX ? INT16_MAX : gq);
+		float offset = trim->offset[k];
+		if (offset > 64) offset = 64;
+		if (offset < -64) offset = -64;
+		o[k] = (int16_t)(lrintf(-offset / gain * 64) + 32);
+	}
+
+	size_t i = 0;
+#ifdef THUNDERSCOPEHW_SSE2
+	// 8 int16 lanes are exactly one round of cores.
+	const __m128i vg = _mm_loadu_si128((const __m128i*)g);
+	const __m128i vo = _mm_loadu_si128((const __m128i*)o);
+	for (; i + 16 <= length; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+		__m128i lo = _mm_unpacklo_epi8(_mm_setzero_si128(), v);
+		__m128i hi = _mm_unpackhi_epi8(_mm_setzero_si128(), v);
+		lo = _mm_srai_epi16(_mm_add_epi16(_mm_mulhi_epi16(lo, vg), vo), 6);
+		hi = _mm_srai_epi16(_mm_add_epi16(_mm_mulhi_epi16(hi, vg), vo), 6);
+		_mm_storeu_si128((__m128i*)(data + i), _mm_packs_epi16(lo, hi));
+	}
+#endif
+	for (; i < length; i++) {
+		int k = i % THUNDERSCOPEHW_ADC_CORES;
+		int32_t y = ((data[i] * 256 * g[k]) >> 16) + o[k];
+		y >>= 6;
+		if (y > INT8_MAX) y = INT8_MAX;
+		if (y < INT8_MIN) y = INT8_MIN;
+		data[i] = (int8_t)y;
+	}
+}
+
+void thunderscopehw_core_trim_apply(struct ThunderScopeHW* ts, uint8_t* data, size_t length)
+{
+	if (!ts->core_correction) return;
+	int m = thunderscopehw_core_trim_mode(thunderscopehw_interleave_count(ts));
+	if (!ts->core_trim_valid[m]) return;
+	thunderscopehw_core_correct(&ts->core_trim[m], (int8_t*)data, length);
+}
+
+void thunderscopehw_core_correction_enable(struct ThunderScopeHW* ts, bool enable)
+{
+	ts->core_correction = enable;
+}
+
+enum ThunderScopeHWStatus thunderscopehw_core_trim_set(struct ThunderScopeHW* ts, int interleave, const struct ThunderScopeHWCoreTrim* trim)
+{
+	int m = thunderscopehw_core_trim_mode(interleave);
+	if (m < 0) return THUNDERSCOPEHW_STATUS_INVALID_PARAMETER;
+	ts->core_trim[m] = *trim;
+	ts->core_trim_valid[m] = true;
+	if (!ts->connected) return THUNDERSCOPEHW_STATUS_OK;
+	struct ThunderScopeHWCalibration calibration;
+	THUNDERSCOPEHW_RUN(calibration_get(ts, &calibration));
+	calibration.core_trim[m] = *trim;
+	calibration.core_trim_valid |= 1u << m;
+	return thunderscopehw_calibration_store(ts, &calibration);
+}
+
+enum ThunderScopeHWStatus thunderscopehw_core_trim_get(struct ThunderScopeHW* ts, int interleave, struct ThunderScopeHWCoreTrim* trim)
+{
+	int m = thunderscopehw_core_trim_mode(interleave);
+	if (m < 0 || !ts->core_trim_valid[m]) return THUNDERSCOPEHW_STATUS_INVALID_PARAMETER;
+	*trim = ts->core_trim[m];
+	return THUNDERSCOPEHW_STATUS_OK;
+}
@@ -0,0 +1,174 @@
+#include "thunderscopehw_private.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define THUNDERSCOPEHW_DDC_STAGES           4
+#define THUNDERSCOPEHW_DDC_TAPS             63
+#define THUNDERSCOPEHW_DDC_MAX_DECIMATION   2048
+#define THUNDERSCOPEHW_DDC_TABLE_BITS       12
+#define THUNDERSCOPEHW_DDC_TABLE_SIZE       (1 << THUNDERSCOPEHW_DDC_TABLE_BITS)
+#define THUNDERSCOPEHW_DDC_TABLE_ONE        16384
+
+// NCO is a 32 bit phase accumulator indexing a cosine table, sine is the
+// same table a quarter turn back. The CIC decimates by decimation / 2, the
+// FIR by the remaining 2, as in the high resolution mode.
+struct ThunderScopeHWDdc {
+	double sample_rate;
+	uint32_t decimation;
+	uint32_t phase;
+	uint32_t phase_step;
+	struct ThunderScopeHWCic cic_i;
+	struct ThunderScopeHWCic cic_q;
+	struct ThunderScopeHWFir fir_i;
+	struct ThunderScopeHWFir fir_q;
+	float scale;
+	int16_t table[THUNDERSCOPEHW_DDC_TABLE_SIZE];
+	int32_t mixed_i[THUNDERSCOPEHW_TILE_SAMPLES];
+	int32_t mixed_q[THUNDERSCOPEHW_TILE_SAMPLES];
+	int64_t cic_out[THUNDERSCOPEHW_TILE_SAMPLES / 2 + 1];
+	float fir_in[THUNDERSCOPEHW_TILE_SAMPLES / 2 + 1];
+	float fir_out_i[THUNDERSCOPEHW_TILE_SAMPLES / 4 + 1];
+	float fir_out_q[THUNDERSCOPEHW_TILE_SAMPLES / 4 + 1];
+};
+
+struct ThunderScopeHWDdc* thunderscopehw_ddc_create(double sample_rate, double frequency, uint32_t decimation)
+{
+	if (!(sample_rate > 0)) return NULL;
+	if (decimation < 4 || decimation > THUNDERSCOPEHW_DDC_MAX_DECIMATION || (decimation & 1)) return NULL;
+	struct ThunderScopeHWDdc* ddc;
+	ddc = (struct ThunderScopeHWDdc*)calloc(1, sizeof(struct ThunderScopeHWDdc));
+	if (!ddc) return ddc;
+
+	ddc->sample_rate = sample_rate;
+	ddc->decimation = decimation;
+	for (int i = 0; i < THUNDERSCOPEHW_DDC_TABLE_SIZE; i++) {
+		ddc->table[i] = (int16_t)lrint(THUNDERSCOPEHW_DDC_TABLE_ONE * cos(2 * M_PI * i / THUNDERSCOPEHW_DDC_TABLE_SIZE));
+	}
+	float taps[THUNDERSCOPEHW_DDC_TAPS];
+	// Pass band up to 80% of the output Nyquist frequency on either side.
+	thunderscopehw_fir_design(taps, THUNDERSCOPEHW_DDC_TAPS, 0.2, THUNDERSCOPEHW_DDC_STAGES, decimation / 2);
+	if (!thunderscopehw_fir_init(&ddc->fir_i, taps, THUNDERSCOPEHW_DDC_TAPS, 2)
+	    || !thunderscopehw_fir_init(&ddc->fir_q, taps, THUNDERSCOPEHW_DDC_TAPS, 2)) {
+		thunderscopehw_ddc_destroy(ddc);
+		return NULL;
+	}
+	thunderscopehw_ddc_set_frequency(ddc, frequency);
+	thunderscopehw_ddc_reset(ddc);
+	return ddc;
+}
+
+void thunderscopehw_ddc_destroy(struct ThunderScopeHWDdc* ddc)
+{
+	if (!ddc) return;
+	thunderscopehw_fir_free(&ddc->fir_i);
+	thunderscopehw_fir_free(&ddc->fir_q);
+	free(ddc);
+}
+
+void thunderscopehw_ddc_reset(struct ThunderScopeHWDdc* ddc)
+{
+	ddc->phase = 0;
+	thunderscopehw_cic_init(&ddc->cic_i, THUNDERSCOPEHW_DDC_STAGES, ddc->decimation / 2);
+	thunderscopehw_cic_init(&ddc->cic_q, THUNDERSCOPEHW_DDC_STAGES, ddc->decimation / 2);
+	thunderscopehw_fir_reset(&ddc->fir_i);
+	thunderscopehw_fir_reset(&ddc->fir_q);
+	ddc->scale = (float)(1.0 / (thunderscopehw_cic_gain(&ddc->cic_i) * THUNDERSCOPEHW_DDC_TABLE_ONE));
+}
+
+void thunderscopehw_ddc_set_frequency(struct ThunderScopeHWDdc* ddc, double frequency)
+{
+	double cycles = frequency / ddc->sample_rate;
+	cycles -= floor(cycles);
+	ddc->phase_step = (uint32_t)(uint64_t)llround(cycles * 4294967296.0);
+}
+
+double thunderscopehw_ddc_output_rate(struct ThunderScopeHWDdc* ddc)
+{
+	return ddc->sample_rate / ddc->decimation;
+}
+
+// One tile through mixer, CICs and FIRs, leaves the pairs in fir_out_i/q.
+static size_t thunderscopehw_ddc_tile(struct ThunderScopeHWDdc* ddc, const int8_t* samples, size_t tile)
+{
+	const int shift = 32 - THUNDERSCOPEHW_DDC_TABLE_BITS;
+	const uint32_t quarter = THUNDERSCOPEHW_DDC_TABLE_SIZE / 4;
+	const uint32_t mask = THUNDERSCOPEHW_DDC_TABLE_SIZE - 1;
+	uint32_t phase = ddc->phase;
+	for (size_t i = 0; i < tile; i++) {
+		uint32_t index = phase >> shift;
+		// Multiply by e^-j phase.
+		ddc->mixed_i[i] = samples[i] * ddc->table[index];
+		ddc->mixed_q[i] = -samples[i] * ddc->table[(index - quarter) & mask];
+		phase += ddc->phase_step;
+	}
+	ddc->phase = phase;
+
+	size_t n = thunderscopehw_cic_process_i32(&ddc->cic_i, ddc->mixed_i, tile, ddc->cic_out);
+	for (size_t i = 0; i < n; i++) ddc->fir_in[i] = ddc->cic_out[i] * ddc->scale;
+	size_t pairs = thunderscopehw_fir_process(&ddc->fir_i, ddc->fir_in, n, ddc->fir_out_i);
+	n = thunderscopehw_cic_process_i32(&ddc->cic_q, ddc->mixed_q, tile, ddc->cic_out);
+	for (size_t i = 0; i < n; i++) ddc->fir_in[i] = ddc->cic_out[i] * ddc->scale;
+	thunderscopehw_fir_process(&ddc->fir_q, ddc->fir_in, n, ddc->fir_out_q);
+	return pairs;
+}
+
+size_t thunderscopehw_ddc_process(struct ThunderScopeHWDdc* ddc, const int8_t* samples, size_t length, float* iq)
+{
+	size_t pairs = 0;
+	while (length) {
+		size_t tile = length < THUNDERSCOPEHW_TILE_SAMPLES ? length : THUNDERSCOPEHW_TILE_SAMPLES;
+		size_t n = thunderscopehw_ddc_tile(ddc, samples, tile);
+		for (size_t i = 0; i < n; i++) {
+			iq[2 * (pairs + i)] = ddc->fir_out_i[i];
+			iq[2 * (pairs + i) + 1] = ddc->fir_out_q[i];
+		}
+		pairs += n;
+		samples += tile;
+		length -= tile;
+	}
+	return pairs;
+}
+
+static int16_t thunderscopehw_ddc_i16(float v)
+{
+	v *= 256;
+	if (v > INT16_MAX) v = INT16_MAX;
+	if (v < INT16_MIN) v = INT16_MIN;
+	return (int16_t)lrintf(v);
+}
+
+size_t thunderscopehw_ddc_process_i16(struct ThunderScopeHWDdc* ddc, const int8_t* samples, size_t length, int16_t* iq)
+{
+	size_t pairs = 0;
+	while (length) {
+		size_t tile = length < THUNDERSCOPEHW_TILE_SAMPLES ? length : THUNDERSCOPEHW_TILE_SAMPLES;
+		size_t n = thunderscopehw_ddc_tile(ddc, samples, tile);
+		for (size_t i = 0; i < n; i++) {
+			iq[2 * (pairs + i)] = thunderscopehw_ddc_i16(ddc->fir_out_i[i]);
+			iq[2 * (pairs + i) + 1] = thunderscopehw_ddc_i16(ddc->fir_out_q[i]);
+		}
+		pairs += n;
+		samples += tile;
+		length -= tile;
+	}
+	return pairs;
+}
+
+void thunderscopehw_ddc_process_multi(struct ThunderScopeHWDdc* const* ddcs, int count, const int8_t* samples,
+				      size_t length, float* const* iq, size_t* pairs)
+{
+	for (int d = 0; d < count; d++) pairs[d] = 0;
+	while (length) {
+		size_t tile = length < THUNDERSCOPEHW_TILE_SAMPLES ? length : THUNDERSCOPEHW_TILE_SAMPLES;
+		for (int d = 0; d < count; d++) {
+			pairs[d] += thunderscopehw_ddc_process(ddcs[d], samples, tile, iq[d] + 2 * pairs[d]);
+		}
+		samples += tile;
+		length -= tile;
+	}
+}
@@ -0,0 +1,148 @@
+#include "thunderscopehw_private.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+void thunderscopehw_cic_init(struct ThunderScopeHWCic* cic, int stages, uint32_t decimation)
+{
+	memset(cic, 0, sizeof(*cic));
+	cic->stages = stages;
+	cic->decimation = decimation;
+}
+
+double thunderscopehw_cic_gain(const struct ThunderScopeHWCic* cic)
+{
+	return pow(cic->decimation, cic->stages);
+}
+
+// All five integrators always run, which keeps the inner loop free of
+// branches, the output is taken after the last one in use. Exactly one of
+// in8 and in32 is given; inlined into each caller the choice folds away.
+static inline size_t thunderscopehw_cic_process(struct ThunderScopeHWCic* cic, const int8_t* in8, const int32_t* in32,
+						size_t length, int64_t* out)
+{
+	uint64_t i0 = cic->integrators[0], i1 = cic->integrators[1];
+	uint64_t i2 = cic->integrators[2], i3 = cic->integrators[3];
+	uint64_t i4 = cic->integrators[4];
+	size_t outputs = 0;
+	size_t i = 0;
+	while (i < length) {
+		size_t run = cic->decimation - cic->phase;
+		if (run > length - i) run = length - i;
+		for (size_t end = i + run; i < end; i++) {
+			i0 += (uint64_t)(int64_t)(in8 ? in8[i] : in32[i]);
+			i1 += i0;
+			i2 += i1;
+			i3 += i2;
+			i4 += i3;
+		}
+		cic->phase += (uint32_t)run;
+		if (cic->phase < cic->decimation) break;
+		cic->phase = 0;
+		uint64_t integrated[5] = { i0, i1, i2, i3, i4 };
+		uint64_t v = integrated[cic->stages - 1];
+		for (int s = 0; s < cic->stages; s++) {
+			uint64_t previous = cic->combs[s];
+			cic->combs[s] = v;
+			v -= previous;
+		}
+		out[outputs++] = (int64_t)v;
+	}
+	cic->integrators[0] = i0;
+	cic->integrators[1] = i1;
+	cic->integrators[2] = i2;
+	cic->integrators[3] = i3;
+	cic->integrators[4] = i4;
+	return outputs;
+}
+
+size_t thunderscopehw_cic_process_i8(struct ThunderScopeHWCic* cic, const int8_t* in, size_t length, int64_t* out)
+{
+	return thunderscopehw_cic_process(cic, in, NULL, length, out);
+}
+
+size_t thunderscopehw_cic_process_i32(struct ThunderScopeHWCic* cic, const int32_t* in, size_t length, int64_t* out)
+{
+	return thunderscopehw_cic_process(cic, NULL, in, length, out);
+}
+
+bool thunderscopehw_fir_init(struct ThunderScopeHWFir* fir, const float* taps, size_t taps_count, uint32_t decimation)
+{
+	memset(fir, 0, sizeof(*fir));
+	fir->taps = (float*)malloc(taps_count * sizeof(float));
+	fir->history = (float*)malloc(2 * taps_count * sizeof(float));
+	if (!fir->taps || !fir->history) {
+		thunderscopehw_fir_free(fir);
+		return false;
+	}
+	fir->taps_count = taps_count;
+	fir->decimation = decimation ? decimation : 1;
+	for (size_t i = 0; i < taps_count; i++) fir->taps[i] = taps[taps_count - 1 - i];
+	thunderscopehw_fir_reset(fir);
+	return true;
+}
+
+void thunderscopehw_fir_free(struct ThunderScopeHWFir* fir)
+{
+	free(fir->taps);
+	free(fir->history);
+	fir->taps = NULL;
+	fir->history = NULL;
+}
+
+void thunderscopehw_fir_reset(struct ThunderScopeHWFir* fir)
+{
+	memset(fir->history, 0, 2 * fir->taps_count * sizeof(float));
+	fir->position = 0;
+	fir->phase = 0;
+}
+
+size_t thunderscopehw_fir_process(struct ThunderScopeHWFir* fir, const float* in, size_t length, float* out)
+{
+	size_t outputs = 0;
+	size_t n = fir->taps_count;
+	for (size_t i = 0; i < length; i++) {
+		// Each sample is written twice, history[position + 1 .. position + n]
+		// is then always the last n samples, oldest first.
+		fir->history[fir->position] = in[i];
+		fir->history[fir->position + n] = in[i];
+		fir->position = fir->position + 1 == n ? 0 : fir->position + 1;
+		if (++fir->phase < fir->decimation) continue;
+		fir->phase = 0;
+		out[outputs++] = thunderscopehw_dot_f32(fir->history + fir->position, fir->taps, n);
+	}
+	return outputs;
+}
+
+void thunderscopehw_fir_design(float* taps, size_t taps_count, double cutoff, int cic_stages, uint32_t cic_decimation)
+{
+	// Frequency sampling of the ideal response, Blackman windowed.
+	const int grid = 1024;
+	double centre = (taps_count - 1) / 2.0;
+	double dc = 0;
+	for (size_t n = 0; n < taps_count; n++) {
+		double sum = 0;
+		for (int k = 0; k < grid; k++) {
+			double f = (k + 0.5) * 0.5 / grid;
+			if (f > cutoff) break;
+			double gain = 1.0;
+			if (cic_stages) {
+				// CIC response at its output rate.
+				double num = sin(M_PI * f);
+				double den = cic_decimation * sin(M_PI * f / cic_decimation);
+				gain = 1.0 / pow(num / den, cic_stages);
+			}
+			sum += gain * cos(2 * M_PI * f * (n - centre));
+		}
+		double x = taps_count > 1 ? 2 * M_PI * n / (taps_count - 1) : 0;
+		double window = 0.42 - 0.5 * cos(x) + 0.08 * cos(2 * x);
+		taps[n] = (float)(sum * window);
+		dc += taps[n];
+	}
+	for (size_t n = 0; n < taps_count; n++) taps[n] = (float)(taps[n] / dc);
+}
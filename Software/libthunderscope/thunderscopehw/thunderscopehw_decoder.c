@@ -0,0 +1,164 @@
+#include "thunderscopehw_private.h"
+
+#include <stdlib.h>
+
+struct ThunderScopeHWDecoder* thunderscopehw_decoder_alloc(enum ThunderScopeHWProtocol protocol, int inputs,
+							   int8_t low, int8_t high)
+{
+	if (low > high) return NULL;
+	struct ThunderScopeHWDecoder* d;
+	d = (struct ThunderScopeHWDecoder*)calloc(1, sizeof(struct ThunderScopeHWDecoder));
+	if (!d) return d;
+
+	d->protocol = protocol;
+	d->inputs = inputs;
+	for (int i = 0; i < inputs; i++) {
+		d->logic[i] = thunderscopehw_logic_create(low, high);
+		d->transitions[i] = (uint64_t*)malloc(THUNDERSCOPEHW_TILE_SAMPLES * sizeof(uint64_t));
+		if (!d->logic[i] || !d->transitions[i]) {
+			thunderscopehw_decoder_destroy(d);
+			return NULL;
+		}
+	}
+	return d;
+}
+
+void thunderscopehw_decoder_destroy(struct ThunderScopeHWDecoder* d)
+{
+	if (!d) return;
+	for (int i = 0; i < d->inputs; i++) {
+		thunderscopehw_logic_destroy(d->logic[i]);
+		free(d->transitions[i]);
+	}
+	free(d);
+}
+
+void thunderscopehw_decoder_reset(struct ThunderScopeHWDecoder* d)
+{
+	for (int i = 0; i < d->inputs; i++) {
+		thunderscopehw_logic_reset(d->logic[i]);
+		d->level[i] = false;
+	}
+	d->position = 0;
+	d->dropped = 0;
+	switch (d->protocol) {
+	case THUNDERSCOPEHW_PROTOCOL_UART:
+		thunderscopehw_uart_reset(d);
+		break;
+	case THUNDERSCOPEHW_PROTOCOL_SPI:
+		thunderscopehw_spi_reset(d);
+		break;
+	case THUNDERSCOPEHW_PROTOCOL_I2C:
+		thunderscopehw_i2c_reset(d);
+		break;
+	case THUNDERSCOPEHW_PROTOCOL_CAN:
+		thunderscopehw_can_reset(d);
+		break;
+	case THUNDERSCOPEHW_PROTOCOL_LIN:
+		thunderscopehw_lin_reset(d);
+		break;
+	}
+}
+
+void thunderscopehw_decoder_emit(struct ThunderScopeHWDecoder* d, const struct ThunderScopeHWPacket* packet)
+{
+	if (d->count < d->max_packets) {
+		d->packets[d->count++] = *packet;
+	} else {
+		d->dropped++;
+	}
+}
+
+static void thunderscopehw_decoder_edge(struct ThunderScopeHWDecoder* d, uint64_t time, int input)
+{
+	bool level = d->level[input];
+	switch (d->protocol) {
+	case THUNDERSCOPEHW_PROTOCOL_UART:
+		thunderscopehw_uart_edge(d, time, input, level);
+		break;
+	case THUNDERSCOPEHW_PROTOCOL_SPI:
+		thunderscopehw_spi_edge(d, time, input, level);
+		break;
+	case THUNDERSCOPEHW_PROTOCOL_I2C:
+		thunderscopehw_i2c_edge(d, time, input, level);
+		break;
+	case THUNDERSCOPEHW_PROTOCOL_CAN:
+		thunderscopehw_can_edge(d, time, input, level);
+		break;
+	case THUNDERSCOPEHW_PROTOCOL_LIN:
+		thunderscopehw_lin_edge(d, time, input, level);
+		break;
+	}
+}
+
+// Lets bit sampled protocols finish bits that have no edge before `now`.
+static void thunderscopehw_decoder_flush(struct ThunderScopeHWDecoder* d, uint64_t now)
+{
+	switch (d->protocol) {
+	case THUNDERSCOPEHW_PROTOCOL_UART:
+		thunderscopehw_uart_flush(d, now);
+		break;
+	case THUNDERSCOPEHW_PROTOCOL_CAN:
+		thunderscopehw_can_flush(d, now);
+		break;
+	case THUNDERSCOPEHW_PROTOCOL_LIN:
+		thunderscopehw_lin_flush(d, now);
+		break;
+	default:
+		break;
+	}
+}
+
+size_t thunderscopehw_decoder_process(struct ThunderScopeHWDecoder* d, const int8_t* const* inputs, size_t length,
+				      struct ThunderScopeHWPacket* packets, size_t max_packets)
+{
+	d->packets = packets;
+	d->max_packets = max_packets;
+	d->count = 0;
+	for (int i = 0; i < d->inputs; i++) d->present[i] = inputs[i] != NULL;
+
+	// Idle stretches come out of the thresholding as empty transition lists,
+	// so the decoders only see the edges.
+	for (size_t offset = 0; offset < length; offset += THUNDERSCOPEHW_TILE_SAMPLES) {
+		size_t n = length - offset;
+		if (n > THUNDERSCOPEHW_TILE_SAMPLES) n = THUNDERSCOPEHW_TILE_SAMPLES;
+		size_t count[THUNDERSCOPEHW_DECODER_INPUTS];
+		size_t next[THUNDERSCOPEHW_DECODER_INPUTS];
+		for (int i = 0; i < d->inputs; i++) {
+			count[i] = 0;
+			next[i] = 0;
+			if (d->present[i])
+				count[i] = thunderscopehw_logic_process(d->logic[i], inputs[i] + offset, n, NULL, d->transitions[i]);
+		}
+
+		// Merge in time order, lower inputs first on a tie.
+		for (;;) {
+			int input = -1;
+			uint64_t time = UINT64_MAX;
+			for (int i = 0; i < d->inputs; i++) {
+				if (next[i] < count[i] && d->transitions[i][next[i]] < time) {
+					time = d->transitions[i][next[i]];
+					input = i;
+				}
+			}
+			if (input < 0) break;
+			next[input]++;
+			d->level[input] = !d->level[input];
+			// The first sample only sets the idle level.
+			if (time == 0) continue;
+			thunderscopehw_decoder_edge(d, time, input);
+		}
+
+		d->position += n;
+		thunderscopehw_decoder_flush(d, d->position);
+	}
+
+	d->packets = NULL;
+	d->max_packets = 0;
+	return d->count;
+}
+
+uint64_t thunderscopehw_decoder_dropped(struct ThunderScopeHWDecoder* d)
+{
+	return d->dropped;
+}
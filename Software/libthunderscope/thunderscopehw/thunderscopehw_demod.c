@@ -0,0 +1,147 @@
+#include "thunderscopehw_private.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define THUNDERSCOPEHW_DEMOD_MAX_DECIMATION 2048
+#define THUNDERSCOPEHW_DEMOD_PAIRS          (THUNDERSCOPEHW_TILE_SAMPLES / 4 + 1)
+
+struct ThunderScopeHWDemod {
+	enum ThunderScopeHWDemodulation mode;
+	struct ThunderScopeHWDdc* ddc;
+	uint32_t decimation;
+	bool audio;
+	struct ThunderScopeHWPolyphase polyphase;
+	double iq_rate;
+	// Last pair of the previous tile, for the FM discriminator.
+	float previous[2];
+	float iq[2 * THUNDERSCOPEHW_DEMOD_PAIRS];
+	float y[THUNDERSCOPEHW_DEMOD_PAIRS];
+	float x[THUNDERSCOPEHW_DEMOD_PAIRS];
+	float values[THUNDERSCOPEHW_DEMOD_PAIRS];
+};
+
+struct ThunderScopeHWDemod* thunderscopehw_demod_create(enum ThunderScopeHWDemodulation mode, double sample_rate,
+							double frequency, uint32_t decimation, double audio_rate)
+{
+	if (mode != THUNDERSCOPEHW_DEMODULATION_AM && mode != THUNDERSCOPEHW_DEMODULATION_FM
+	    && mode != THUNDERSCOPEHW_DEMODULATION_PM) return NULL;
+	if (!(sample_rate > 0) || audio_rate < 0) return NULL;
+	if (!decimation) {
+		if (!(audio_rate > 0)) return NULL;
+		double limit = floor(sample_rate / (4 * audio_rate));
+		if (limit > THUNDERSCOPEHW_DEMOD_MAX_DECIMATION) limit = THUNDERSCOPEHW_DEMOD_MAX_DECIMATION;
+		decimation = (uint32_t)limit & ~1u;
+		if (decimation < 4) decimation = 4;
+	}
+
+	struct ThunderScopeHWDemod* d;
+	d = (struct ThunderScopeHWDemod*)calloc(1, sizeof(struct ThunderScopeHWDemod));
+	if (!d) return d;
+	d->mode = mode;
+	d->decimation = decimation;
+	d->ddc = thunderscopehw_ddc_create(sample_rate, frequency, decimation);
+	if (!d->ddc) {
+		thunderscopehw_demod_destroy(d);
+		return NULL;
+	}
+	d->iq_rate = thunderscopehw_ddc_output_rate(d->ddc);
+	if (audio_rate > 0) {
+		if (!thunderscopehw_polyphase_init(&d->polyphase, d->iq_rate, audio_rate)) {
+			thunderscopehw_demod_destroy(d);
+			return NULL;
+		}
+		d->audio = true;
+	}
+	return d;
+}
+
+void thunderscopehw_demod_destroy(struct ThunderScopeHWDemod* d)
+{
+	if (!d) return;
+	thunderscopehw_ddc_destroy(d->ddc);
+	if (d->audio) thunderscopehw_polyphase_free(&d->polyphase);
+	free(d);
+}
+
+void thunderscopehw_demod_reset(struct ThunderScopeHWDemod* d)
+{
+	thunderscopehw_ddc_reset(d->ddc);
+	if (d->audio) thunderscopehw_polyphase_reset(&d->polyphase);
+	d->previous[0] = 0;
+	d->previous[1] = 0;
+}
+
+double thunderscopehw_demod_output_rate(struct ThunderScopeHWDemod* d)
+{
+	return d->audio ? d->iq_rate / d->polyphase.step : d->iq_rate;
+}
+
+double thunderscopehw_demod_full_scale(struct ThunderScopeHWDemod* d)
+{
+	switch (d->mode) {
+	case THUNDERSCOPEHW_DEMODULATION_AM:
+		return 128;
+	case THUNDERSCOPEHW_DEMODULATION_FM:
+		return d->iq_rate / 2;
+	default:
+		return M_PI;
+	}
+}
+
+size_t thunderscopehw_demod_max_output(struct ThunderScopeHWDemod* d, size_t length)
+{
+	size_t pairs = length / d->decimation + 1;
+	return d->audio ? thunderscopehw_polyphase_max_output(&d->polyphase, pairs) : pairs;
+}
+
+size_t thunderscopehw_demod_process(struct ThunderScopeHWDemod* d, const int8_t* samples, size_t length, float* out)
+{
+	size_t outputs = 0;
+	while (length) {
+		size_t tile = length < THUNDERSCOPEHW_TILE_SAMPLES ? length : THUNDERSCOPEHW_TILE_SAMPLES;
+		size_t pairs = thunderscopehw_ddc_process(d->ddc, samples, tile, d->iq);
+		samples += tile;
+		length -= tile;
+		if (!pairs) continue;
+
+		float* iq = d->iq;
+		if (d->mode == THUNDERSCOPEHW_DEMODULATION_AM) {
+			// Real mixing halves the amplitude.
+			thunderscopehw_magnitude_f32(iq, pairs, d->values);
+			for (size_t i = 0; i < pairs; i++) d->values[i] *= 2;
+		} else if (d->mode == THUNDERSCOPEHW_DEMODULATION_PM) {
+			for (size_t i = 0; i < pairs; i++) {
+				d->x[i] = iq[2 * i];
+				d->y[i] = iq[2 * i + 1];
+			}
+			thunderscopehw_atan2_f32(d->y, d->x, pairs, d->values);
+		} else {
+			// Angle of z[n] * conj(z[n - 1]).
+			float pr = d->previous[0], pi = d->previous[1];
+			for (size_t i = 0; i < pairs; i++) {
+				float re = iq[2 * i], im = iq[2 * i + 1];
+				d->x[i] = re * pr + im * pi;
+				d->y[i] = im * pr - re * pi;
+				pr = re;
+				pi = im;
+			}
+			d->previous[0] = pr;
+			d->previous[1] = pi;
+			thunderscopehw_atan2_f32(d->y, d->x, pairs, d->values);
+			float hz = (float)(d->iq_rate / (2 * M_PI));
+			for (size_t i = 0; i < pairs; i++) d->values[i] *= hz;
+		}
+
+		if (d->audio) {
+			outputs += thunderscopehw_polyphase_process(&d->polyphase, d->values, pairs, out + outputs);
+		} else {
+			for (size_t i = 0; i < pairs; i++) out[outputs++] = d->values[i];
+		}
+	}
+	return outputs;
+}
@@ -0,0 +1,193 @@
+#include "thunderscopehw_private.h"
+
+#include <math.h>
+
+#ifdef THUNDERSCOPEHW_SSE2
+#include <emmintrin.h>
+#endif
+
+// Odd minimax fit of atan on [0, 1], 2.4e-6 rad before float rounding.
+#define THUNDERSCOPEHW_ATAN_C3  -0.332966556f
+#define THUNDERSCOPEHW_ATAN_C5  0.195188473f
+#define THUNDERSCOPEHW_ATAN_C7  -0.119836228f
+#define THUNDERSCOPEHW_ATAN_C9  0.0558276949f
+#define THUNDERSCOPEHW_ATAN_C11 -0.0128176577f
+#define THUNDERSCOPEHW_HALF_PI  1.57079632679f
+#define THUNDERSCOPEHW_PI       3.14159265359f
+
+void thunderscopehw_deinterleave(const int8_t* data, size_t length, int num_channels, int8_t* const* out)
+{
+	size_t samples = length / num_channels;
+	size_t i = 0;
+
+	if (num_channels == 1) {
+		for (; i < samples; i++) out[0][i] = data[i];
+		return;
+	}
+#ifdef THUNDERSCOPEHW_SSE2
+	// Splitting even and odd bytes twice separates four channels.
+	const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+	if (num_channels == 2) {
+		for (; i + 16 <= samples; i += 16) {
+			__m128i a = _mm_loadu_si128((const __m128i*)(data + 2 * i));
+			__m128i b = _mm_loadu_si128((const __m128i*)(data + 2 * i + 16));
+			__m128i even = _mm_packus_epi16(_mm_and_si128(a, low_bytes), _mm_and_si128(b, low_bytes));
+			__m128i odd = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+			_mm_storeu_si128((__m128i*)(out[0] + i), even);
+			_mm_storeu_si128((__m128i*)(out[1] + i), odd);
+		}
+	} else if (num_channels == 4) {
+		for (; i + 16 <= samples; i += 16) {
+			__m128i v[4], even[2], odd[2];
+			for (int j = 0; j < 4; j++) {
+				v[j] = _mm_loadu_si128((const __m128i*)(data + 4 * i + 16 * j));
+			}
+			for (int j = 0; j < 2; j++) {
+				even[j] = _mm_packus_epi16(_mm_and_si128(v[2 * j], low_bytes), _mm_and_si128(v[2 * j + 1], low_bytes));
+				odd[j] = _mm_packus_epi16(_mm_srli_epi16(v[2 * j], 8), _mm_srli_epi16(v[2 * j + 1], 8));
+			}
+			_mm_storeu_si128((__m128i*)(out[0] + i), _mm_packus_epi16(_mm_and_si128(even[0], low_bytes), _mm_and_si128(even[1], low_bytes)));
+			_mm_storeu_si128((__m128i*)(out[2] + i), _mm_packus_epi16(_mm_srli_epi16(even[0], 8), _mm_srli_epi16(even[1], 8)));
+			_mm_storeu_si128((__m128i*)(out[1] + i), _mm_packus_epi16(_mm_and_si128(odd[0], low_bytes), _mm_and_si128(odd[1], low_bytes)));
+			_mm_storeu_si128((__m128i*)(out[3] + i), _mm_packus_epi16(_mm_srli_epi16(odd[0], 8), _mm_srli_epi16(odd[1], 8)));
+		}
+	}
+#endif
+	for (; i < samples; i++) {
+		for (int channel = 0; channel < num_channels; channel++) {
+			out[channel][i] = data[i * num_channels + channel];
+		}
+	}
+}
+
+void thunderscopehw_minmax_i8(const int8_t* data, size_t length, int8_t* min, int8_t* max)
+{
+	int8_t lo = INT8_MAX;
+	int8_t hi = INT8_MIN;
+	size_t i = 0;
+#ifdef THUNDERSCOPEHW_SSE2
+	if (length >= 64) {
+		// SSE2 only has unsigned byte min/max, flip the sign bit around them.
+		const __m128i sign = _mm_set1_epi8((char)0x80);
+		__m128i vlo = _mm_set1_epi8((char)0xFF);
+		__m128i vhi = _mm_setzero_si128();
+		for (; i + 16 <= length; i += 16) {
+			__m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(data + i)), sign);
+			vlo = _mm_min_epu8(vlo, v);
+			vhi = _mm_max_epu8(vhi, v);
+		}
+		uint8_t lanes_lo[16], lanes_hi[16];
+		_mm_storeu_si128((__m128i*)lanes_lo, _mm_xor_si128(vlo, sign));
+		_mm_storeu_si128((__m128i*)lanes_hi, _mm_xor_si128(vhi, sign));
+		for (int j = 0; j < 16; j++) {
+			if ((int8_t)lanes_lo[j] < lo) lo = (int8_t)lanes_lo[j];
+			if ((int8_t)lanes_hi[j] > hi) hi = (int8_t)lanes_hi[j];
+		}
+	}
+#endif
+	for (; i < length; i++) {
+		if (data[i] < lo) lo = data[i];
+		if (data[i] > hi) hi = data[i];
+	}
+	*min = lo;
+	*max = hi;
+}
+
+float thunderscopehw_dot_f32(const float* a, const float* b, size_t length)
+{
+	size_t i = 0;
+	float sum = 0;
+#ifdef THUNDERSCOPEHW_SSE2
+	__m128 acc0 = _mm_setzero_ps();
+	__m128 acc1 = _mm_setzero_ps();
+	for (; i + 8 <= length; i += 8) {
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+	}
+	float lanes[4];
+	_mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+	sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+	for (; i < length; i++) sum += a[i] * b[i];
+	return sum;
+}
+
+void thunderscopehw_i8_to_f32(const int8_t* samples, size_t length, float scale, float* out)
+{
+	size_t i = 0;
+#ifdef THUNDERSCOPEHW_SSE2
+	// Sign extend by unpacking each byte into the top of a wider lane and
+	// shifting back down.
+	const __m128 vscale = _mm_set1_ps(scale);
+	for (; i + 16 <= length; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(samples + i));
+		__m128i lo = _mm_unpacklo_epi8(v, v);
+		__m128i hi = _mm_unpackhi_epi8(v, v);
+		__m128i w0 = _mm_srai_epi32(_mm_unpacklo_epi16(lo, lo), 24);
+		__m128i w1 = _mm_srai_epi32(_mm_unpackhi_epi16(lo, lo), 24);
+		__m128i w2 = _mm_srai_epi32(_mm_unpacklo_epi16(hi, hi), 24);
+		__m128i w3 = _mm_srai_epi32(_mm_unpackhi_epi16(hi, hi), 24);
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(w0), vscale));
+		_mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(w1), vscale));
+		_mm_storeu_ps(out + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(w2), vscale));
+		_mm_storeu_ps(out + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(w3), vscale));
+	}
+#endif
+	for (; i < length; i++) out[i] = samples[i] * scale;
+}
+
+void thunderscopehw_atan2_f32(const float* y, const float* x, size_t length, float* out)
+{
+	size_t i = 0;
+#ifdef THUNDERSCOPEHW_SSE2
+	// Same octant reduction as below, the branches become masks.
+	const __m128 sign = _mm_set1_ps(-0.0f);
+	const __m128 tiny = _mm_set1_ps(1e-30f);
+	for (; i + 4 <= length; i += 4) {
+		__m128 vy = _mm_loadu_ps(y + i);
+		__m128 vx = _mm_loadu_ps(x + i);
+		__m128 ay = _mm_andnot_ps(sign, vy);
+		__m128 ax = _mm_andnot_ps(sign, vx);
+		__m128 a = _mm_div_ps(_mm_min_ps(ax, ay), _mm_max_ps(_mm_max_ps(ax, ay), tiny));
+		__m128 s = _mm_mul_ps(a, a);
+		__m128 r = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(THUNDERSCOPEHW_ATAN_C11), s), _mm_set1_ps(THUNDERSCOPEHW_ATAN_C9));
+		r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(THUNDERSCOPEHW_ATAN_C7));
+		r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(THUNDERSCOPEHW_ATAN_C5));
+		r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(THUNDERSCOPEHW_ATAN_C3));
+		r = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(r, s), a), a);
+		__m128 steep = _mm_cmpgt_ps(ay, ax);
+		r = _mm_or_ps(_mm_and_ps(steep, _mm_sub_ps(_mm_set1_ps(THUNDERSCOPEHW_HALF_PI), r)), _mm_andnot_ps(steep, r));
+		__m128 left = _mm_cmplt_ps(vx, _mm_setzero_ps());
+		r = _mm_or_ps(_mm_and_ps(left, _mm_sub_ps(_mm_set1_ps(THUNDERSCOPEHW_PI), r)), _mm_andnot_ps(left, r));
+		r = _mm_or_ps(r, _mm_and_ps(sign, vy));
+		_mm_storeu_ps(out + i, r);
+	}
+#endif
+	for (; i < length; i++) {
+		float ay = fabsf(y[i]);
+		float ax = fabsf(x[i]);
+		float big = ax > ay ? ax : ay;
+		float a = (ax < ay ? ax : ay) / (big > 1e-30f ? big : 1e-30f);
+		float s = a * a;
+		float r = (THUNDERSCOPEHW_ATAN_C11 * s + THUNDERSCOPEHW_ATAN_C9) * s + THUNDERSCOPEHW_ATAN_C7;
+		r = ((r * s + THUNDERSCOPEHW_ATAN_C5) * s + THUNDERSCOPEHW_ATAN_C3) * s * a + a;
+		if (ay > ax) r = THUNDERSCOPEHW_HALF_PI - r;
+		if (x[i] < 0) r = THUNDERSCOPEHW_PI - r;
+		out[i] = y[i] < 0 ? -r : r;
+	}
+}
+
+void thunderscopehw_magnitude_f32(const float* iq, size_t pairs, float* out)
+{
+	size_t i = 0;
+#ifdef THUNDERSCOPEHW_SSE2
+	for (; i + 4 <= pairs; i += 4) {
+		__m128 a = _mm_loadu_ps(iq + 2 * i);
+		__m128 b = _mm_loadu_ps(iq + 2 * i + 4);
+		__m128 re = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+		__m128 im = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+		_mm_storeu_ps(out + i, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(re, re), _mm_mul_ps(im, im))));
+	}
+#endif
+	for (; i < pairs; i++) out[i] = sqrtf(iq[2 * i] * iq[2 * i] + iq[2 * i + 1] * iq[2 * i + 1]);
+}
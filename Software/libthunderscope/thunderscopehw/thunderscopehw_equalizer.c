@@ -0,0 +1,260 @@
+#include "thunderscopehw_private.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Longer equalizers use overlap-save.
+#define THUNDERSCOPEHW_EQUALIZER_DIRECT_TAPS    64
+#define THUNDERSCOPEHW_EQUALIZER_DESIGN_GRID    4096
+
+int thunderscopehw_bandwidth_index(int bandwidth)
+{
+	switch (bandwidth) {
+	case  20: return 0;
+	case 100: return 1;
+	case 200: return 2;
+	case 350: return 3;
+	default: return -1;
+	}
+}
+
+enum ThunderScopeHWStatus thunderscopehw_equalizer_set(struct ThunderScopeHW* ts, int channel, int bandwidth,
+						       const float* taps, size_t taps_count)
+{
+	if (channel < 0 || channel >= THUNDERSCOPEHW_CHANNELS)
+		return THUNDERSCOPEHW_STATUS_INVALID_PARAMETER;
+	int b = thunderscopehw_bandwidth_index(bandwidth);
+	if (b < 0)
+		return THUNDERSCOPEHW_STATUS_INVALID_BANDWIDTH;
+	float* copy = NULL;
+	if (taps_count) {
+		copy = (float*)malloc(taps_count * sizeof(float));
+		if (!copy) return THUNDERSCOPEHW_STATUS_MEMORY_FULL;
+		memcpy(copy, taps, taps_count * sizeof(float));
+	}
+	free(ts->equalizer_taps[channel][b]);
+	ts->equalizer_taps[channel][b] = copy;
+	ts->equalizer_taps_count[channel][b] = taps_count;
+	return THUNDERSCOPEHW_STATUS_OK;
+}
+
+enum ThunderScopeHWStatus thunderscopehw_equalizer_design(const double* frequencies, const double* gains,
+							  const double* phases, size_t points, double sample_rate,
+							  double max_gain, float* taps, size_t taps_count)
+{
+	if (!points || !(sample_rate > 0) || !(max_gain > 0) || !(taps_count & 1))
+		return THUNDERSCOPEHW_STATUS_INVALID_PARAMETER;
+	for (size_t p = 0; p < points; p++) {
+		if (!(gains[p] > 0) || (p && frequencies[p] <= frequencies[p - 1]))
+			return THUNDERSCOPEHW_STATUS_INVALID_PARAMETER;
+	}
+
+	// Inverse response on a uniform grid, interpolated between the measured points.
+	const int grid = THUNDERSCOPEHW_EQUALIZER_DESIGN_GRID;
+	double* inverse_gain = (double*)malloc(grid * sizeof(double));
+	double* inverse_phase = (double*)malloc(grid * sizeof(double));
+	if (!inverse_gain || !inverse_phase) {
+		free(inverse_gain);
+		free(inverse_phase);
+		return THUNDERSCOPEHW_STATUS_MEMORY_FULL;
+	}
+	size_t p = 0;
+	for (int k = 0; k < grid; k++) {
+		double f = (k + 0.5) * 0.5 * sample_rate / grid;
+		while (p + 1 < points && frequencies[p + 1] < f) p++;
+		double gain, phase;
+		if (f > frequencies[points - 1]) {
+			gain = 0;
+			phase = 0;
+		} else if (f <= frequencies[0] || p + 1 >= points) {
+			gain = gains[0];
+			phase = phases[0];
+		} else {
+			double t = (f - frequencies[p]) / (frequencies[p + 1] - frequencies[p]);
+			gain = gains[p] + t * (gains[p + 1] - gains[p]);
+			phase = phases[p] + t * (phases[p + 1] - phases[p]);
+		}
+		inverse_gain[k] = gain > 0 ? 1 / gain : 0;
+		if (inverse_gain[k] > max_gain) inverse_gain[k] = max_gain;
+		inverse_phase[k] = -phase;
+	}
+
+	// Frequency sampling around the centre tap, Blackman windowed.
+	double centre = (taps_count - 1) / 2.0;
+	for (size_t n = 0; n < taps_count; n++) {
+		double sum = 0;
+		for (int k = 0; k < grid; k++) {
+			if (!inverse_gain[k]) continue;
+			double f = (k + 0.5) * 0.5 / grid;
+			sum += inverse_gain[k] * cos(2 * M_PI * f * (n - centre) + inverse_phase[k]);
+		}
+		double x = taps_count > 1 ? 2 * M_PI * n / (taps_count - 1) : 0;
+		double window = 0.42 - 0.5 * cos(x) + 0.08 * cos(2 * x);
+		taps[n] = (float)(sum / grid * window);
+	}
+	free(inverse_gain);
+	free(inverse_phase);
+	return THUNDERSCOPEHW_STATUS_OK;
+}
+
+struct ThunderScopeHWConverter {
+	float scale;
+	size_t taps_count;
+	// Direct convolution, taps scaled to volts.
+	bool direct;
+	struct ThunderScopeHWFir fir;
+	// Overlap-save: blocks of size inputs, the first taps_count - 1 kept from
+	// the previous block, producing hop outputs each.
+	struct ThunderScopeHWFft* fft;
+	size_t size;
+	size_t hop;
+	size_t fill;
+	float* response;
+	float* block;
+	float* spectrum;
+	float* result;
+	float tile[THUNDERSCOPEHW_TILE_SAMPLES];
+};
+
+struct ThunderScopeHWConverter* thunderscopehw_converter_create(struct ThunderScopeHW* ts, int channel, bool equalize)
+{
+	if (channel < 0 || channel >= THUNDERSCOPEHW_CHANNELS) return NULL;
+	struct ThunderScopeHWConverter* c;
+	c = (struct ThunderScopeHWConverter*)calloc(1, sizeof(struct ThunderScopeHWConverter));
+	if (!c) return c;
+	c->scale = (float)thunderscopehw_volts_per_lsb(ts, channel);
+
+	int b = thunderscopehw_bandwidth_index(ts->channels[channel].bw);
+	const float* taps = NULL;
+	if (equalize && b >= 0) {
+		taps = ts->equalizer_taps[channel][b];
+		c->taps_count = ts->equalizer_taps_count[channel][b];
+	}
+	if (!c->taps_count) return c;
+
+	float* scaled = (float*)malloc(c->taps_count * sizeof(float));
+	if (!scaled) {
+		thunderscopehw_converter_destroy(c);
+		return NULL;
+	}
+	for (size_t i = 0; i < c->taps_count; i++) scaled[i] = taps[i] * c->scale;
+
+	if (c->taps_count <= THUNDERSCOPEHW_EQUALIZER_DIRECT_TAPS) {
+		c->direct = true;
+		bool ok = thunderscopehw_fir_init(&c->fir, scaled, c->taps_count, 1);
+		free(scaled);
+		if (!ok) {
+			thunderscopehw_converter_destroy(c);
+			return NULL;
+		}
+		return c;
+	}
+
+	c->size = 1024;
+	while (c->size < 4 * c->taps_count) c->size <<= 1;
+	c->hop = c->size - (c->taps_count - 1);
+	c->fft = thunderscopehw_fft_create(c->size);
+	c->response = (float*)malloc((c->size + 2) * sizeof(float));
+	c->block = (float*)calloc(c->size, sizeof(float));
+	c->spectrum = (float*)malloc((c->size + 2) * sizeof(float));
+	c->result = (float*)malloc(c->size * sizeof(float));
+	if (!c->fft || !c->response || !c->block || !c->spectrum || !c->result) {
+		free(scaled);
+		thunderscopehw_converter_destroy(c);
+		return NULL;
+	}
+	memset(c->result, 0, c->size * sizeof(float));
+	memcpy(c->result, scaled, c->taps_count * sizeof(float));
+	thunderscopehw_fft_forward(c->fft, c->result, c->response);
+	free(scaled);
+	thunderscopehw_converter_reset(c);
+	return c;
+}
+
+void thunderscopehw_converter_destroy(struct ThunderScopeHWConverter* c)
+{
+	if (!c) return;
+	if (c->direct) thunderscopehw_fir_free(&c->fir);
+	thunderscopehw_fft_destroy(c->fft);
+	free(c->response);
+	free(c->block);
+	free(c->spectrum);
+	free(c->result);
+	free(c);
+}
+
+void thunderscopehw_converter_reset(struct ThunderScopeHWConverter* c)
+{
+	if (c->direct) thunderscopehw_fir_reset(&c->fir);
+	if (c->fft) {
+		memset(c->block, 0, c->size * sizeof(float));
+		c->fill = 0;
+	}
+}
+
+size_t thunderscopehw_converter_delay(struct ThunderScopeHWConverter* c)
+{
+	return c->taps_count ? (c->taps_count - 1) / 2 : 0;
+}
+
+size_t thunderscopehw_converter_max_output(struct ThunderScopeHWConverter* c, size_t length)
+{
+	return c->fft ? (c->fill + length) / c->hop * c->hop : length;
+}
+
+// One full block: spectrum times response, the last hop outputs are the
+// linear convolution.
+static void thunderscopehw_converter_block(struct ThunderScopeHWConverter* c, float* out)
+{
+	thunderscopehw_fft_forward(c->fft, c->block, c->spectrum);
+	for (size_t k = 0; k <= c->size / 2; k++) {
+		float re = c->spectrum[2 * k], im = c->spectrum[2 * k + 1];
+		float hre = c->response[2 * k], him = c->response[2 * k + 1];
+		c->spectrum[2 * k] = re * hre - im * him;
+		c->spectrum[2 * k + 1] = re * him + im * hre;
+	}
+	thunderscopehw_fft_inverse(c->fft, c->spectrum, c->result);
+	size_t keep = c->taps_count - 1;
+	memcpy(out, c->result + keep, c->hop * sizeof(float));
+	memmove(c->block, c->block + c->hop, keep * sizeof(float));
+	c->fill = 0;
+}
+
+size_t thunderscopehw_converter_process(struct ThunderScopeHWConverter* c, const int8_t* samples, size_t length, float* volts)
+{
+	if (!c->taps_count) {
+		thunderscopehw_i8_to_f32(samples, length, c->scale, volts);
+		return length;
+	}
+	if (c->direct) {
+		size_t outputs = 0;
+		while (length) {
+			size_t tile = length < THUNDERSCOPEHW_TILE_SAMPLES ? length : THUNDERSCOPEHW_TILE_SAMPLES;
+			thunderscopehw_i8_to_f32(samples, tile, 1.0f, c->tile);
+			outputs += thunderscopehw_fir_process(&c->fir, c->tile, tile, volts + outputs);
+			samples += tile;
+			length -= tile;
+		}
+		return outputs;
+	}
+	size_t outputs = 0;
+	size_t keep = c->taps_count - 1;
+	while (length) {
+		size_t n = c->hop - c->fill;
+		if (n > length) n = length;
+		thunderscopehw_i8_to_f32(samples, n, 1.0f, c->block + keep + c->fill);
+		c->fill += n;
+		samples += n;
+		length -= n;
+		if (c->fill == c->hop) {
+			thunderscopehw_converter_block(c, volts + outputs);
+			outputs += c->hop;
+		}
+	}
+	return outputs;
+}
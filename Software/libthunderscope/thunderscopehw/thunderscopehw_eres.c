@@ -0,0 +1,78 @@
+#include "thunderscopehw_private.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#define THUNDERSCOPEHW_ERES_STAGES          3
+#define THUNDERSCOPEHW_ERES_TAPS            31
+
+// The CIC decimates by decimation / 2, the FIR cleans up its droop and
+// aliasing and decimates by the remaining 2.
+struct ThunderScopeHWEres {
+	uint32_t decimation;
+	struct ThunderScopeHWCic cic;
+	struct ThunderScopeHWFir fir;
+	float scale;
+	int64_t cic_out[THUNDERSCOPEHW_TILE_SAMPLES / 2 + 1];
+	float fir_in[THUNDERSCOPEHW_TILE_SAMPLES / 2 + 1];
+	float fir_out[THUNDERSCOPEHW_TILE_SAMPLES / 4 + 1];
+};
+
+struct ThunderScopeHWEres* thunderscopehw_eres_create(uint32_t decimation)
+{
+	if (decimation < 4 || decimation > THUNDERSCOPEHW_ERES_MAX_DECIMATION || (decimation & 1)) return NULL;
+	struct ThunderScopeHWEres* e;
+	e = (struct ThunderScopeHWEres*)malloc(sizeof(struct ThunderScopeHWEres));
+	if (!e) return e;
+
+	float taps[THUNDERSCOPEHW_ERES_TAPS];
+	e->decimation = decimation;
+	thunderscopehw_cic_init(&e->cic, THUNDERSCOPEHW_ERES_STAGES, decimation / 2);
+	// Pass band up to 80% of the output Nyquist frequency.
+	thunderscopehw_fir_design(taps, THUNDERSCOPEHW_ERES_TAPS, 0.2, THUNDERSCOPEHW_ERES_STAGES, decimation / 2);
+	if (!thunderscopehw_fir_init(&e->fir, taps, THUNDERSCOPEHW_ERES_TAPS, 2)) {
+		free(e);
+		return NULL;
+	}
+	// Codes scaled by 256 in the int16 output.
+	e->scale = (float)(256.0 / thunderscopehw_cic_gain(&e->cic));
+	return e;
+}
+
+void thunderscopehw_eres_destroy(struct ThunderScopeHWEres* e)
+{
+	if (!e) return;
+	thunderscopehw_fir_free(&e->fir);
+	free(e);
+}
+
+void thunderscopehw_eres_reset(struct ThunderScopeHWEres* e)
+{
+	thunderscopehw_cic_init(&e->cic, THUNDERSCOPEHW_ERES_STAGES, e->decimation / 2);
+	thunderscopehw_fir_reset(&e->fir);
+}
+
+size_t thunderscopehw_eres_process(struct ThunderScopeHWEres* e, const int8_t* samples, size_t length, int16_t* out)
+{
+	size_t outputs = 0;
+	while (length) {
+		size_t tile = length < THUNDERSCOPEHW_TILE_SAMPLES ? length : THUNDERSCOPEHW_TILE_SAMPLES;
+		size_t cic_outputs = thunderscopehw_cic_process_i8(&e->cic, samples, tile, e->cic_out);
+		for (size_t i = 0; i < cic_outputs; i++) e->fir_in[i] = e->cic_out[i] * e->scale;
+		size_t fir_outputs = thunderscopehw_fir_process(&e->fir, e->fir_in, cic_outputs, e->fir_out);
+		for (size_t i = 0; i < fir_outputs; i++) {
+			float v = e->fir_out[i];
+			if (v > INT16_MAX) v = INT16_MAX;
+			if (v < INT16_MIN) v = INT16_MIN;
+			out[outputs++] = (int16_t)lrintf(v);
+		}
+		samples += tile;
+		length -= tile;
+	}
+	return outputs;
+}
+
+double thunderscopehw_eres_extra_bits(struct ThunderScopeHWEres* e)
+{
+	return 0.5 * log2((double)e->decimation);
+}
@@ -0,0 +1,249 @@
+#include "thunderscopehw_private.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define THUNDERSCOPEHW_EYE_CODES 256
+// Bits from the CDR can be this many samples late, plus a few UIs.
+#define THUNDERSCOPEHW_EYE_LATENCY 64
+// Boundaries written per tile, the CDR gives at most one per 1.8 samples.
+#define THUNDERSCOPEHW_EYE_TILE_BITS (THUNDERSCOPEHW_TILE_SAMPLES + THUNDERSCOPEHW_EYE_LATENCY)
+// Bits further than this from the nominal UI (lost lock) are not folded.
+#define THUNDERSCOPEHW_EYE_UI_RANGE 1.5
+
+struct ThunderScopeHWEye {
+	size_t ui_bins;
+	// Nominal samples per bit and start of the first ideal bit.
+	double ui;
+	double phase;
+	struct ThunderScopeHWPersistence* persistence;
+	int8_t* record;
+
+	// The last samples, history[0] being sample history_start.
+	int8_t* history;
+	size_t history_length;
+	size_t keep;
+	uint64_t history_start;
+	uint64_t position;
+
+	// Bit starts not folded yet, a bit needs the next one for its UI.
+	double* pending;
+	size_t pending_count;
+	uint8_t* bits;
+	uint64_t ideal_bits;
+
+	// Bit p of a cell is set when its centre is inside polygon p. Indexed [code * ui_bins + column]
+	// so a flat trace reads neighbouring bytes.
+	uint8_t* mask;
+	int polygons;
+	uint64_t hits[THUNDERSCOPEHW_EYE_MAX_POLYGONS];
+	uint64_t failed_bits;
+	struct ThunderScopeHWEyeViolation violations[THUNDERSCOPEHW_EYE_MAX_VIOLATIONS];
+	size_t violation_count;
+};
+
+struct ThunderScopeHWEye* thunderscopehw_eye_create(size_t ui_bins, double sample_rate, double bit_rate, double phase)
+{
+	if (ui_bins < 2 || !(sample_rate > 0) || !(bit_rate > 0) || bit_rate * 2 > sample_rate) return NULL;
+	struct ThunderScopeHWEye* e;
+	e = (struct ThunderScopeHWEye*)calloc(1, sizeof(struct ThunderScopeHWEye));
+	if (!e) return e;
+
+	e->ui_bins = ui_bins;
+	e->ui = sample_rate / bit_rate;
+	e->phase = phase;
+	// Windows of pending bits start less than three of the longest UIs plus the latency back.
+	e->keep = (size_t)(3 * THUNDERSCOPEHW_EYE_UI_RANGE * e->ui) + THUNDERSCOPEHW_EYE_LATENCY;
+	e->persistence = thunderscopehw_persistence_create(ui_bins, THUNDERSCOPEHW_PERSISTENCE_INFINITE, 0);
+	e->record = (int8_t*)malloc(ui_bins);
+	e->history = (int8_t*)malloc(e->keep + THUNDERSCOPEHW_TILE_SAMPLES);
+	e->pending = (double*)malloc(2 * THUNDERSCOPEHW_EYE_TILE_BITS * sizeof(double));
+	e->bits = (uint8_t*)malloc(THUNDERSCOPEHW_EYE_TILE_BITS);
+	e->mask = (uint8_t*)calloc(ui_bins * THUNDERSCOPEHW_EYE_CODES, 1);
+	if (!e->persistence || !e->record || !e->history || !e->pending || !e->bits || !e->mask) {
+		thunderscopehw_eye_destroy(e);
+		return NULL;
+	}
+	thunderscopehw_eye_reset(e);
+	return e;
+}
+
+void thunderscopehw_eye_destroy(struct ThunderScopeHWEye* e)
+{
+	if (!e) return;
+	thunderscopehw_persistence_destroy(e->persistence);
+	free(e->record);
+	free(e->history);
+	free(e->pending);
+	free(e->bits);
+	free(e->mask);
+	free(e);
+}
+
+static void thunderscopehw_eye_clear(struct ThunderScopeHWEye* e)
+{
+	thunderscopehw_persistence_clear(e->persistence);
+	for (int p = 0; p < THUNDERSCOPEHW_EYE_MAX_POLYGONS; p++) e->hits[p] = 0;
+	e->failed_bits = 0;
+	e->violation_count = 0;
+}
+
+void thunderscopehw_eye_reset(struct ThunderScopeHWEye* e)
+{
+	thunderscopehw_eye_clear(e);
+	e->history_length = 0;
+	e->history_start = 0;
+	e->position = 0;
+	e->pending_count = 0;
+	e->ideal_bits = 0;
+}
+
+// Resamples the bit whose window starts `first` samples into the history.
+static void thunderscopehw_eye_fold(struct ThunderScopeHWEye* e, double first, double ui, double start)
+{
+	const int8_t* history = e->history;
+	int8_t* record = e->record;
+	const uint8_t* mask = e->mask;
+	size_t bins = e->ui_bins;
+	// 32.32 fixed point sample position of each column's centre.
+	double step = 2 * ui / bins;
+	uint64_t position = (uint64_t)((first + 0.5 * step) * 4294967296.0);
+	uint64_t increment = (uint64_t)(step * 4294967296.0);
+	uint32_t polygons = 0;
+	for (size_t c = 0; c < bins; c++, position += increment) {
+		size_t i = (size_t)(position >> 32);
+		uint32_t f = (uint32_t)(position >> 24) & 255;
+		uint32_t a = (uint32_t)(history[i] + 128), b = (uint32_t)(history[i + 1] + 128);
+		uint32_t code = (a * (256 - f) + b * f + 128) >> 8;
+		record[c] = (int8_t)(code - 128);
+		polygons |= mask[code * bins + c];
+	}
+	thunderscopehw_persistence_add(e->persistence, record, bins);
+	if (!polygons) return;
+
+	uint32_t hits = 0;
+	for (size_t c = 0; c < bins; c++) {
+		uint8_t m = mask[(uint8_t)(record[c] + 128) * bins + c];
+		hits += m != 0;
+		for (int p = 0; p < e->polygons; p++) e->hits[p] += (m >> p) & 1;
+	}
+	e->failed_bits++;
+	if (e->violation_count < THUNDERSCOPEHW_EYE_MAX_VIOLATIONS) {
+		struct ThunderScopeHWEyeViolation* v = &e->violations[e->violation_count++];
+		v->start = start;
+		v->polygons = polygons;
+		v->hits = hits;
+	}
+}
+
+size_t thunderscopehw_eye_process(struct ThunderScopeHWEye* e, const int8_t* samples, size_t length,
+				  struct ThunderScopeHWCdr* cdr)
+{
+	size_t folded = 0;
+	for (size_t offset = 0; offset < length; offset += THUNDERSCOPEHW_TILE_SAMPLES) {
+		size_t n = length - offset;
+		if (n > THUNDERSCOPEHW_TILE_SAMPLES) n = THUNDERSCOPEHW_TILE_SAMPLES;
+		if (e->history_length > e->keep) {
+			size_t drop = e->history_length - e->keep;
+			memmove(e->history, e->history + drop, e->keep);
+			e->history_start += drop;
+			e->history_length = e->keep;
+		}
+		memcpy(e->history + e->history_length, samples + offset, n);
+		e->history_length += n;
+		e->position += n;
+
+		if (cdr) {
+			e->pending_count += thunderscopehw_cdr_process(cdr, samples + offset, n, e->pending + e->pending_count, e->bits);
+		} else {
+			for (;;) {
+				double start = e->phase + e->ideal_bits * e->ui;
+				if (start >= (double)e->position) break;
+				e->pending[e->pending_count++] = start;
+				e->ideal_bits++;
+			}
+		}
+
+		size_t k = 0;
+		for (; k + 1 < e->pending_count; k++) {
+			double start = e->pending[k];
+			double ui = e->pending[k + 1] - start;
+			if (start + 1.5 * ui + 1 >= (double)e->position) break;
+			if (ui * THUNDERSCOPEHW_EYE_UI_RANGE < e->ui || ui > e->ui * THUNDERSCOPEHW_EYE_UI_RANGE) continue;
+			double first = start - 0.5 * ui - (double)e->history_start;
+			// Bits before the first sample.
+			if (first < 0) continue;
+			thunderscopehw_eye_fold(e, first, ui, start);
+			folded++;
+		}
+		memmove(e->pending, e->pending + k, (e->pending_count - k) * sizeof(double));
+		e->pending_count -= k;
+	}
+	return folded;
+}
+
+enum ThunderScopeHWStatus thunderscopehw_eye_merge(struct ThunderScopeHWEye* dst, struct ThunderScopeHWEye* src)
+{
+	if (dst->ui_bins != src->ui_bins || dst->polygons != src->polygons) return THUNDERSCOPEHW_STATUS_INVALID_PARAMETER;
+	thunderscopehw_persistence_merge(dst->persistence, src->persistence);
+	for (int p = 0; p < dst->polygons; p++) dst->hits[p] += src->hits[p];
+	dst->failed_bits += src->failed_bits;
+	for (size_t i = 0; i < src->violation_count && dst->violation_count < THUNDERSCOPEHW_EYE_MAX_VIOLATIONS; i++) {
+		dst->violations[dst->violation_count++] = src->violations[i];
+	}
+	thunderscopehw_eye_clear(src);
+	return THUNDERSCOPEHW_STATUS_OK;
+}
+
+struct ThunderScopeHWPersistence* thunderscopehw_eye_persistence(struct ThunderScopeHWEye* e)
+{
+	return e->persistence;
+}
+
+int thunderscopehw_eye_add_polygon(struct ThunderScopeHWEye* e, const double* x, const double* y, size_t vertices)
+{
+	if (e->polygons == THUNDERSCOPEHW_EYE_MAX_POLYGONS || vertices < 3) return -1;
+	int polygon = e->polygons++;
+	for (size_t c = 0; c < e->ui_bins; c++) {
+		double cx = -0.5 + 2 * (c + 0.5) / e->ui_bins;
+		for (int code = 0; code < THUNDERSCOPEHW_EYE_CODES; code++) {
+			double cy = code - 128;
+			// Even-odd rule, a ray to the right of the centre.
+			bool inside = false;
+			for (size_t i = 0, j = vertices - 1; i < vertices; j = i++) {
+				if ((y[i] > cy) != (y[j] > cy) && cx < x[j] + (cy - y[j]) * (x[i] - x[j]) / (y[i] - y[j])) {
+					inside = !inside;
+				}
+			}
+			if (inside) e->mask[code * e->ui_bins + c] |= (uint8_t)(1 << polygon);
+		}
+	}
+	return polygon;
+}
+
+void thunderscopehw_eye_clear_mask(struct ThunderScopeHWEye* e)
+{
+	memset(e->mask, 0, e->ui_bins * THUNDERSCOPEHW_EYE_CODES);
+	e->polygons = 0;
+	for (int p = 0; p < THUNDERSCOPEHW_EYE_MAX_POLYGONS; p++) e->hits[p] = 0;
+	e->failed_bits = 0;
+	e->violation_count = 0;
+}
+
+uint64_t thunderscopehw_eye_hits(struct ThunderScopeHWEye* e, int polygon)
+{
+	if (polygon < 0 || polygon >= e->polygons) return 0;
+	return e->hits[polygon];
+}
+
+uint64_t thunderscopehw_eye_failed_bits(struct ThunderScopeHWEye* e)
+{
+	return e->failed_bits;
+}
+
+size_t thunderscopehw_eye_violations(struct ThunderScopeHWEye* e, struct ThunderScopeHWEyeViolation* out, size_t max)
+{
+	size_t count = e->violation_count < max ? e->violation_count : max;
+	memcpy(out, e->violations, count * sizeof(struct ThunderScopeHWEyeViolation));
+	return count;
+}
@@ -0,0 +1,193 @@
+#include "thunderscopehw_private.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// The n point real transform runs as an n / 2 point complex transform
+// on even and odd samples, followed by a split pass. Complex data is
+// kept as separate real and imaginary arrays so butterflies stay
+// unit stride and vectorize.
+struct ThunderScopeHWFft {
+	size_t n;
+	size_t m;
+	uint32_t* bitrev;
+	// Butterfly twiddles, the stage with span h starts at index h - 1.
+	float* stage_re;
+	float* stage_im;
+	// exp(-2 pi i k / n) for the split pass.
+	float* split_re;
+	float* split_im;
+	float* re;
+	float* im;
+};
+
+struct ThunderScopeHWFft* thunderscopehw_fft_create(size_t n)
+{
+	if (n < 4 || n > THUNDERSCOPEHW_FFT_MAX_SIZE || (n & (n - 1)))
+		return NULL;
+	struct ThunderScopeHWFft* fft;
+	fft = (struct ThunderScopeHWFft*)calloc(1, sizeof(struct ThunderScopeHWFft));
+	if (!fft) return fft;
+
+	size_t m = n / 2;
+	fft->n = n;
+	fft->m = m;
+	fft->bitrev = (uint32_t*)malloc(m * sizeof(uint32_t));
+	fft->stage_re = (float*)malloc(m * sizeof(float));
+	fft->stage_im = (float*)malloc(m * sizeof(float));
+	fft->split_re = (float*)malloc(m * sizeof(float));
+	fft->split_im = (float*)malloc(m * sizeof(float));
+	fft->re = (float*)malloc(m * sizeof(float));
+	fft->im = (float*)malloc(m * sizeof(float));
+	if (!fft->bitrev || !fft->stage_re || !fft->stage_im || !fft->split_re || !fft->split_im || !fft->re || !fft->im) {
+		thunderscopehw_fft_destroy(fft);
+		return NULL;
+	}
+
+	int bits = 0;
+	while (((size_t)1 << bits) < m) bits++;
+	for (size_t k = 0; k < m; k++) {
+		uint32_t r = 0;
+		for (int b = 0; b < bits; b++) {
+			if (k & ((size_t)1 << b)) r |= 1U << (bits - 1 - b);
+		}
+		fft->bitrev[k] = r;
+	}
+	for (size_t h = 1; h < m; h <<= 1) {
+		for (size_t k = 0; k < h; k++) {
+			fft->stage_re[h - 1 + k] = (float)cos(-M_PI * k / h);
+			fft->stage_im[h - 1 + k] = (float)sin(-M_PI * k / h);
+		}
+	}
+	for (size_t k = 0; k < m; k++) {
+		fft->split_re[k] = (float)cos(-2 * M_PI * k / n);
+		fft->split_im[k] = (float)sin(-2 * M_PI * k / n);
+	}
+	return fft;
+}
+
+void thunderscopehw_fft_destroy(struct ThunderScopeHWFft* fft)
+{
+	if (!fft) return;
+	free(fft->bitrev);
+	free(fft->stage_re);
+	free(fft->stage_im);
+	free(fft->split_re);
+	free(fft->split_im);
+	free(fft->re);
+	free(fft->im);
+	free(fft);
+}
+
+// Radix 2 decimation in time over bit reversed input.
+static void thunderscopehw_fft_complex(struct ThunderScopeHWFft* fft, float* re, float* im)
+{
+	size_t m = fft->m;
+	for (size_t h = 1; h < m; h <<= 1) {
+		const float* wr = fft->stage_re + h - 1;
+		const float* wi = fft->stage_im + h - 1;
+		for (size_t j = 0; j < m; j += 2 * h) {
+			float* ar = re + j;
+			float* ai = im + j;
+			float* br = re + j + h;
+			float* bi = im + j + h;
+			for (size_t k = 0; k < h; k++) {
+				float tr = br[k] * wr[k] - bi[k] * wi[k];
+				float ti = br[k] * wi[k] + bi[k] * wr[k];
+				br[k] = ar[k] - tr;
+				bi[k] = ai[k] - ti;
+				ar[k] += tr;
+				ai[k] += ti;
+			}
+		}
+	}
+}
+
+void thunderscopehw_fft_forward(struct ThunderScopeHWFft* fft, const float* in, float* spectrum)
+{
+	size_t m = fft->m;
+	float* re = fft->re;
+	float* im = fft->im;
+	for (size_t k = 0; k < m; k++) {
+		re[fft->bitrev[k]] = in[2 * k];
+		im[fft->bitrev[k]] = in[2 * k + 1];
+	}
+	thunderscopehw_fft_complex(fft, re, im);
+
+	spectrum[0] = re[0] + im[0];
+	spectrum[1] = 0;
+	spectrum[2 * m] = re[0] - im[0];
+	spectrum[2 * m + 1] = 0;
+	for (size_t k = 1; k < m; k++) {
+		// Even and odd sample spectra from Z[k] and conj(Z[m - k]).
+		float zr = re[k], zi = im[k];
+		float cr = re[m - k], ci = -im[m - k];
+		float er = (zr + cr) * 0.5f, ei = (zi + ci) * 0.5f;
+		float or_ = (zi - ci) * 0.5f, oi = (cr - zr) * 0.5f;
+		float wr = fft->split_re[k], wi = fft->split_im[k];
+		spectrum[2 * k] = er + wr * or_ - wi * oi;
+		spectrum[2 * k + 1] = ei + wr * oi + wi * or_;
+	}
+}
+
+void thunderscopehw_fft_inverse(struct ThunderScopeHWFft* fft, const float* spectrum, float* out)
+{
+	size_t m = fft->m;
+	float* re = fft->re;
+	float* im = fft->im;
+	for (size_t k = 0; k < m; k++) {
+		float xr = spectrum[2 * k], xi = spectrum[2 * k + 1];
+		float cr = spectrum[2 * (m - k)], ci = -spectrum[2 * (m - k) + 1];
+		float er = (xr + cr) * 0.5f, ei = (xi + ci) * 0.5f;
+		float dr = (xr - cr) * 0.5f, di = (xi - ci) * 0.5f;
+		// Odd spectrum is the difference rotated by conj(W^k).
+		float wr = fft->split_re[k], wi = -fft->split_im[k];
+		float or_ = dr * wr - di * wi, oi = dr * wi + di * wr;
+		// Z = E + i O, loaded with real and imaginary swapped to run
+		// the inverse through the forward butterflies.
+		im[fft->bitrev[k]] = er - oi;
+		re[fft->bitrev[k]] = ei + or_;
+	}
+	thunderscopehw_fft_complex(fft, re, im);
+
+	float scale = 1.0f / m;
+	for (size_t k = 0; k < m; k++) {
+		out[2 * k] = im[k] * scale;
+		out[2 * k + 1] = re[k] * scale;
+	}
+}
+
+double thunderscopehw_window_fill(enum ThunderScopeHWWindow window, float* coefficients, size_t n)
+{
+	double sum = 0;
+	for (size_t i = 0; i < n; i++) {
+		double x = 2 * M_PI * i / n;
+		double w;
+		switch (window) {
+		case THUNDERSCOPEHW_WINDOW_HANN:
+			w = 0.5 - 0.5 * cos(x);
+			break;
+		case THUNDERSCOPEHW_WINDOW_HAMMING:
+			w = 0.54 - 0.46 * cos(x);
+			break;
+		case THUNDERSCOPEHW_WINDOW_BLACKMAN_HARRIS:
+			w = 0.35875 - 0.48829 * cos(x) + 0.14128 * cos(2 * x) - 0.01168 * cos(3 * x);
+			break;
+		case THUNDERSCOPEHW_WINDOW_FLAT_TOP:
+			w = 0.21557895 - 0.41663158 * cos(x) + 0.277263158 * cos(2 * x)
+			    - 0.083578947 * cos(3 * x) + 0.006947368 * cos(4 * x);
+			break;
+		case THUNDERSCOPEHW_WINDOW_RECTANGULAR:
+		default:
+			w = 1.0;
+			break;
+		}
+		coefficients[i] = (float)w;
+		sum += w;
+	}
+	return sum / n;
+}
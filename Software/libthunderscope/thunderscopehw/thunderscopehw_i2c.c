@@ -0,0 +1,85 @@
+#include "thunderscopehw_private.h"
+
+#define THUNDERSCOPEHW_I2C_SCL 0
+#define THUNDERSCOPEHW_I2C_SDA 1
+
+struct ThunderScopeHWDecoder* thunderscopehw_i2c_decoder_create(int8_t low, int8_t high)
+{
+	struct ThunderScopeHWDecoder* d = thunderscopehw_decoder_alloc(THUNDERSCOPEHW_PROTOCOL_I2C, 2, low, high);
+	if (!d) return d;
+	thunderscopehw_decoder_reset(d);
+	return d;
+}
+
+void thunderscopehw_i2c_reset(struct ThunderScopeHWDecoder* d)
+{
+	d->u.i2c.active = false;
+	d->u.i2c.address_next = false;
+	d->u.i2c.bits = 0;
+	d->u.i2c.byte = 0;
+}
+
+static void thunderscopehw_i2c_mark(struct ThunderScopeHWDecoder* d, enum ThunderScopeHWPacketType type,
+				    uint32_t flags, uint64_t time)
+{
+	struct ThunderScopeHWPacket p;
+	p.type = type;
+	p.flags = flags;
+	p.start = time;
+	p.end = time;
+	p.value = 0;
+	p.value2 = 0;
+	p.length = 0;
+	thunderscopehw_decoder_emit(d, &p);
+}
+
+void thunderscopehw_i2c_edge(struct ThunderScopeHWDecoder* d, uint64_t time, int input, bool level)
+{
+	struct ThunderScopeHWI2c* c = &d->u.i2c;
+	bool scl = d->level[THUNDERSCOPEHW_I2C_SCL];
+	bool sda = d->level[THUNDERSCOPEHW_I2C_SDA];
+
+	// SDA only moves with SCL high for start (falling) and stop (rising).
+	if (input == THUNDERSCOPEHW_I2C_SDA) {
+		if (!scl) return;
+		if (!level) {
+			thunderscopehw_i2c_mark(d, THUNDERSCOPEHW_PACKET_I2C_START, c->active ? THUNDERSCOPEHW_PACKET_RESTART : 0, time);
+			c->active = true;
+			c->address_next = true;
+		} else {
+			if (c->active) thunderscopehw_i2c_mark(d, THUNDERSCOPEHW_PACKET_I2C_STOP, 0, time);
+			c->active = false;
+		}
+		c->bits = 0;
+		c->byte = 0;
+		return;
+	}
+
+	if (!level || !c->active) return;
+	if (c->bits < 8) {
+		if (c->bits == 0) c->byte_start = time;
+		c->byte = (c->byte << 1) | sda;
+		c->bits++;
+		return;
+	}
+
+	// Ninth clock: the receiver pulls SDA low to acknowledge.
+	struct ThunderScopeHWPacket p;
+	p.flags = sda ? THUNDERSCOPEHW_PACKET_NACK : 0;
+	p.start = c->byte_start;
+	p.end = time;
+	p.value2 = 0;
+	p.length = 0;
+	if (c->address_next) {
+		p.type = THUNDERSCOPEHW_PACKET_I2C_ADDRESS;
+		p.value = c->byte >> 1;
+		if (c->byte & 1) p.flags |= THUNDERSCOPEHW_PACKET_READ;
+		c->address_next = false;
+	} else {
+		p.type = THUNDERSCOPEHW_PACKET_I2C_DATA;
+		p.value = c->byte;
+	}
+	thunderscopehw_decoder_emit(d, &p);
+	c->bits = 0;
+	c->byte = 0;
+}
@@ -11,6 +11,7 @@
 
 enum ThunderScopeHWStatus thunderscopehw_initboard(struct ThunderScopeHW* ts)
 {
+	thunderscopehw_calibration_load(ts);
 	THUNDERSCOPEHW_RUN(write32(ts, DATAMOVER_REG_OUT, 0));
 	ts->board_en = true;
 	THUNDERSCOPEHW_RUN(set_datamover_reg(ts));
@@ -124,14 +125,24 @@ enum ThunderScopeHWStatus thunderscopehw_set_pga(struct ThunderScopeHW* ts, int
 
 enum ThunderScopeHWStatus thunderscopehw_set_dac(struct ThunderScopeHW* ts, int channel)
 {
-	// value is 12-bit
-	// Is this right?? Or is it rounding wrong?
-	int dac_value = (unsigned int)round((ts->channels[channel].voffset + 0.5) * 4095);
+	// value is 12-bit, voffset spans the DAC range around the calibrated
+	// zero, or around mid scale without calibration.
+	double voffset = ts->channels[channel].voffset;
+	int dac_value = (int)lround((voffset + 0.5) * 4095);
+	const struct ThunderScopeHWCalibration* calibration = ts->calibration;
+	int v = thunderscopehw_vdiv_index(ts->channels[channel].vdiv);
+	int b = thunderscopehw_bandwidth_index(ts->channels[channel].bw);
+	if (calibration && v >= 0 && b >= 0 && calibration->offsets.codes_per_dac[channel][v][b] != 0)
+		dac_value = calibration->offsets.dac[channel][v][b] + (int)lround(voffset * 4095);
 	if (dac_value < 0)
 		return THUNDERSCOPEHW_STATUS_OFFSET_TOO_LOW;
 	if (dac_value > 0xFFF)
 		return THUNDERSCOPEHW_STATUS_OFFSET_TOO_HIGH;
+	return thunderscopehw_set_dac_raw(ts, channel, dac_value);
+}
 
+enum ThunderScopeHWStatus thunderscopehw_set_dac_raw(struct ThunderScopeHW* ts, int channel, int dac_value)
+{
 	uint8_t fifo[5];
 	fifo[0] = 0xFF;  // I2C
 	fifo[1] = 0xC2;  // DAC?
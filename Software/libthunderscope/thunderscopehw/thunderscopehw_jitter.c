@@ -0,0 +1,338 @@
+#include "thunderscopehw_private.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define THUNDERSCOPEHW_JITTER_DAMPING 0.707
+// The recovered unit interval is kept within this fraction of the nominal one.
+#define THUNDERSCOPEHW_JITTER_RANGE   0.1
+// Tail points for the dual-Dirac fit: at least this many edges out, at most this fraction.
+#define THUNDERSCOPEHW_JITTER_TAIL_MIN_EDGES 16
+#define THUNDERSCOPEHW_JITTER_TAIL_MAX_CDF   0.1
+
+struct ThunderScopeHWJitter {
+	enum ThunderScopeHWJitterClock clock;
+	double seconds_per_sample;
+	// Samples per unit interval.
+	double nominal_ui;
+	double ui_per_sample;
+	double kp;
+	double ki;
+	bool rising_only;
+	struct ThunderScopeHWCrossings crossings;
+	double* times;
+	bool* rising;
+
+	bool synced;
+	double first;
+	double ui;
+	// Nearest reference edge to the last edge and its unit interval since the first.
+	double reference;
+	uint64_t index;
+	double last_time;
+	double last_tie;
+	double last_period;
+	struct ThunderScopeHWJitterResults results;
+
+	size_t histogram_bins;
+	uint64_t* histogram;
+
+	// TIE in UI once per unit interval, windowed and transformed every spectrum_size.
+	size_t spectrum_size;
+	struct ThunderScopeHWFft* fft;
+	double coherent_gain;
+	float* window;
+	float* series;
+	size_t fill;
+	float* frame;
+	float* bins;
+	float* power;
+	uint64_t frames;
+};
+
+struct ThunderScopeHWJitter* thunderscopehw_jitter_create(enum ThunderScopeHWJitterClock clock, double sample_rate, double rate,
+							  double loop_bandwidth, bool rising_only, size_t histogram_bins,
+							  size_t spectrum_size, int8_t low, int8_t high)
+{
+	if (clock != THUNDERSCOPEHW_JITTER_IDEAL && clock != THUNDERSCOPEHW_JITTER_RECOVERED) return NULL;
+	if (!(sample_rate > 0) || !(rate > 0) || rate * 2 > sample_rate || low > high) return NULL;
+	if (!(loop_bandwidth >= 0) || loop_bandwidth * 10 > rate || histogram_bins < 2) return NULL;
+	if (spectrum_size < 4 || spectrum_size > THUNDERSCOPEHW_FFT_MAX_SIZE || (spectrum_size & (spectrum_size - 1))) return NULL;
+	struct ThunderScopeHWJitter* j;
+	j = (struct ThunderScopeHWJitter*)calloc(1, sizeof(struct ThunderScopeHWJitter));
+	if (!j) return j;
+
+	j->clock = clock;
+	j->seconds_per_sample = 1 / sample_rate;
+	j->nominal_ui = sample_rate / rate;
+	j->ui_per_sample = rate / sample_rate;
+	if (loop_bandwidth == 0) loop_bandwidth = rate / 1667;
+	double theta = 2 * M_PI * loop_bandwidth / rate;
+	j->kp = 2 * THUNDERSCOPEHW_JITTER_DAMPING * theta;
+	j->ki = theta * theta;
+	j->rising_only = rising_only;
+	j->histogram_bins = histogram_bins;
+	j->spectrum_size = spectrum_size;
+	j->times = (double*)malloc(THUNDERSCOPEHW_TILE_SAMPLES * sizeof(double));
+	j->rising = (bool*)malloc(THUNDERSCOPEHW_TILE_SAMPLES * sizeof(bool));
+	j->histogram = (uint64_t*)malloc(histogram_bins * sizeof(uint64_t));
+	j->fft = thunderscopehw_fft_create(spectrum_size);
+	j->window = (float*)malloc(spectrum_size * sizeof(float));
+	j->series = (float*)malloc(spectrum_size * sizeof(float));
+	j->frame = (float*)malloc(spectrum_size * sizeof(float));
+	j->bins = (float*)malloc((spectrum_size + 2) * sizeof(float));
+	j->power = (float*)malloc((spectrum_size / 2 + 1) * sizeof(float));
+	if (!thunderscopehw_crossings_init(&j->crossings, low, high) || !j->times || !j->rising || !j->histogram || !j->fft ||
+	    !j->window || !j->series || !j->frame || !j->bins || !j->power) {
+		thunderscopehw_jitter_destroy(j);
+		return NULL;
+	}
+	j->coherent_gain = thunderscopehw_window_fill(THUNDERSCOPEHW_WINDOW_HANN, j->window, spectrum_size);
+	thunderscopehw_jitter_reset(j);
+	return j;
+}
+
+void thunderscopehw_jitter_destroy(struct ThunderScopeHWJitter* j)
+{
+	if (!j) return;
+	thunderscopehw_crossings_free(&j->crossings);
+	free(j->times);
+	free(j->rising);
+	free(j->histogram);
+	thunderscopehw_fft_destroy(j->fft);
+	free(j->window);
+	free(j->series);
+	free(j->frame);
+	free(j->bins);
+	free(j->power);
+	free(j);
+}
+
+void thunderscopehw_jitter_reset(struct ThunderScopeHWJitter* j)
+{
+	thunderscopehw_crossings_reset(&j->crossings);
+	j->synced = false;
+	j->ui = j->nominal_ui;
+	thunderscopehw_measure_stat_clear(&j->results.tie);
+	thunderscopehw_measure_stat_clear(&j->results.period);
+	thunderscopehw_measure_stat_clear(&j->results.cycle_to_cycle);
+	memset(j->histogram, 0, j->histogram_bins * sizeof(uint64_t));
+	j->fill = 0;
+	j->frames = 0;
+	memset(j->power, 0, (j->spectrum_size / 2 + 1) * sizeof(float));
+}
+
+static void thunderscopehw_jitter_frame(struct ThunderScopeHWJitter* j)
+{
+	size_t bins = j->spectrum_size / 2 + 1;
+	for (size_t i = 0; i < j->spectrum_size; i++) j->frame[i] = j->window[i] * j->series[i];
+	thunderscopehw_fft_forward(j->fft, j->frame, j->bins);
+	j->frames++;
+	float weight = 1.0f / (float)j->frames;
+	for (size_t k = 0; k < bins; k++) {
+		float p = j->bins[2 * k] * j->bins[2 * k] + j->bins[2 * k + 1] * j->bins[2 * k + 1];
+		j->power[k] += (p - j->power[k]) * weight;
+	}
+	j->fill = 0;
+}
+
+// Measures one edge against the reference, returns its TIE in samples.
+static double thunderscopehw_jitter_edge(struct ThunderScopeHWJitter* j, double time)
+{
+	// Unit intervals since the last edge.
+	double slots = floor((time - j->reference) / j->ui + 0.5);
+	if (slots < 0) slots = 0;
+	j->index += (uint64_t)slots;
+	if (j->clock == THUNDERSCOPEHW_JITTER_IDEAL) {
+		// From the first edge each time, long captures do not build up rounding.
+		j->reference = j->first + j->index * j->ui;
+	} else {
+		j->reference += slots * j->ui;
+	}
+	double error = time - j->reference;
+	if (j->clock == THUNDERSCOPEHW_JITTER_RECOVERED) {
+		j->reference += j->kp * error;
+		j->ui += j->ki * error;
+		double low = j->nominal_ui * (1 - THUNDERSCOPEHW_JITTER_RANGE);
+		double high = j->nominal_ui * (1 + THUNDERSCOPEHW_JITTER_RANGE);
+		if (j->ui < low) j->ui = low;
+		if (j->ui > high) j->ui = high;
+	}
+
+	double seconds = j->seconds_per_sample;
+	thunderscopehw_measure_stat_add(&j->results.tie, error * seconds);
+	double tie = error * j->ui_per_sample;
+	long bin = (long)floor((tie + 0.5) * j->histogram_bins);
+	if (bin < 0) bin = 0;
+	if (bin >= (long)j->histogram_bins) bin = (long)j->histogram_bins - 1;
+	j->histogram[bin]++;
+
+	if (slots >= 1) {
+		double period = (time - j->last_time) / slots * seconds;
+		if (j->results.period.count) thunderscopehw_measure_stat_add(&j->results.cycle_to_cycle, period - j->last_period);
+		thunderscopehw_measure_stat_add(&j->results.period, period);
+		j->last_period = period;
+		// Unit intervals without an edge get the line between their neighbours.
+		for (double s = 1; s <= slots; s++) {
+			j->series[j->fill++] = (float)(j->last_tie + (tie - j->last_tie) * s / slots);
+			if (j->fill == j->spectrum_size) thunderscopehw_jitter_frame(j);
+		}
+	}
+	j->last_time = time;
+	j->last_tie = tie;
+	return error;
+}
+
+size_t thunderscopehw_jitter_process(struct ThunderScopeHWJitter* j, const int8_t* samples, size_t length,
+				     double* times, double* tie)
+{
+	size_t count = 0;
+	for (size_t offset = 0; offset < length; offset += THUNDERSCOPEHW_TILE_SAMPLES) {
+		size_t n = length - offset;
+		if (n > THUNDERSCOPEHW_TILE_SAMPLES) n = THUNDERSCOPEHW_TILE_SAMPLES;
+		size_t edges = thunderscopehw_crossings_process(&j->crossings, samples + offset, n, j->times, j->rising);
+		for (size_t e = 0; e < edges; e++) {
+			if (j->rising_only && !j->rising[e]) continue;
+			double time = j->times[e];
+			if (!j->synced) {
+				j->synced = true;
+				j->first = time;
+				j->reference = time;
+				j->index = 0;
+				j->last_time = time;
+				j->last_tie = 0;
+				continue;
+			}
+			double error = thunderscopehw_jitter_edge(j, time);
+			if (times) times[count] = time;
+			if (tie) tie[count] = error * j->seconds_per_sample;
+			count++;
+		}
+	}
+	return count;
+}
+
+const struct ThunderScopeHWJitterResults* thunderscopehw_jitter_results(struct ThunderScopeHWJitter* j)
+{
+	return &j->results;
+}
+
+const uint64_t* thunderscopehw_jitter_histogram(struct ThunderScopeHWJitter* j)
+{
+	return j->histogram;
+}
+
+uint64_t thunderscopehw_jitter_spectrum_frames(struct ThunderScopeHWJitter* j)
+{
+	return j->frames;
+}
+
+void thunderscopehw_jitter_spectrum(struct ThunderScopeHWJitter* j, float* out)
+{
+	size_t bins = j->spectrum_size / 2 + 1;
+	double scale = j->nominal_ui * j->seconds_per_sample / (j->spectrum_size * j->coherent_gain / 2);
+	for (size_t k = 0; k < bins; k++) out[k] = (float)(sqrt(j->power[k]) * scale);
+}
+
+// Inverse of the standard normal distribution, Q(p) with Phi(Q) = p.
+static double thunderscopehw_jitter_q(double p)
+{
+	double low = -40, high = 40;
+	for (int i = 0; i < 64; i++) {
+		double mid = (low + high) / 2;
+		if (0.5 * erfc(-mid / sqrt(2.0)) < p) {
+			low = mid;
+		} else {
+			high = mid;
+		}
+	}
+	return (low + high) / 2;
+}
+
+// Fits the left tail x = mu + sigma Q(cdf / rho), trying tail weights rho from
+// 0.15 (deterministic jitter spread out) to 1 (Gaussian only) for the straightest line.
+static bool thunderscopehw_jitter_tail(const double* x, const double* cdf, size_t n, double* mu, double* sigma)
+{
+	double best = INFINITY;
+	for (int r = 3; r <= 20; r++) {
+		double rho = r * 0.05;
+		double sq = 0, sx = 0, sqq = 0, sqx = 0;
+		for (size_t i = 0; i < n; i++) {
+			double q = thunderscopehw_jitter_q(cdf[i] / rho);
+			sq += q;
+			sx += x[i];
+			sqq += q * q;
+			sqx += q * x[i];
+		}
+		double var = sqq - sq * sq / n;
+		if (var <= 0) continue;
+		double s = (sqx - sq * sx / n) / var;
+		double m = (sx - s * sq) / n;
+		if (s <= 0) continue;
+		double residual = 0;
+		for (size_t i = 0; i < n; i++) {
+			double d = x[i] - m - s * thunderscopehw_jitter_q(cdf[i] / rho);
+			residual += d * d;
+		}
+		if (residual < best) {
+			best = residual;
+			*mu = m;
+			*sigma = s;
+		}
+	}
+	return best < INFINITY;
+}
+
+enum ThunderScopeHWStatus thunderscopehw_jitter_dual_dirac(struct ThunderScopeHWJitter* j, double ber,
+							   double* rj, double* dj, double* tj)
+{
+	if (!(ber > 0 && ber < 0.5)) return THUNDERSCOPEHW_STATUS_INVALID_PARAMETER;
+	uint64_t total = 0;
+	for (size_t i = 0; i < j->histogram_bins; i++) total += j->histogram[i];
+	if (!total) return THUNDERSCOPEHW_STATUS_INVALID_PARAMETER;
+
+	double* x = (double*)malloc(j->histogram_bins * sizeof(double));
+	double* cdf = (double*)malloc(j->histogram_bins * sizeof(double));
+	if (!x || !cdf) {
+		free(x);
+		free(cdf);
+		return THUNDERSCOPEHW_STATUS_MEMORY_FULL;
+	}
+	double width = 1.0 / j->histogram_bins;
+	double mu[2], sigma[2];
+	bool fitted = true;
+	// The right tail is fitted mirrored, as a left tail of -x.
+	for (int side = 0; side < 2 && fitted; side++) {
+		size_t n = 0;
+		uint64_t cumulative = 0;
+		for (size_t b = 0; b < j->histogram_bins; b++) {
+			size_t i = side ? j->histogram_bins - 1 - b : b;
+			if (!j->histogram[i]) continue;
+			cumulative += j->histogram[i];
+			if (cumulative > total * THUNDERSCOPEHW_JITTER_TAIL_MAX_CDF) break;
+			if (cumulative < THUNDERSCOPEHW_JITTER_TAIL_MIN_EDGES) continue;
+			// The distribution is known at the outer edge of the bin.
+			double edge = -0.5 + (i + 1 - side) * width;
+			x[n] = side ? -edge : edge;
+			cdf[n] = (double)cumulative / total;
+			n++;
+		}
+		fitted = n >= 3 && thunderscopehw_jitter_tail(x, cdf, n, &mu[side], &sigma[side]);
+	}
+	free(x);
+	free(cdf);
+	if (!fitted) return THUNDERSCOPEHW_STATUS_INVALID_PARAMETER;
+
+	double seconds = j->nominal_ui * j->seconds_per_sample;
+	double deterministic = -mu[1] - mu[0];
+	if (deterministic < 0) deterministic = 0;
+	*rj = (sigma[0] + sigma[1]) / 2 * seconds;
+	*dj = deterministic * seconds;
+	*tj = *dj - 2 * thunderscopehw_jitter_q(ber) * *rj;
+	return THUNDERSCOPEHW_STATUS_OK;
+}
@@ -0,0 +1,140 @@
+#include "thunderscopehw_private.h"
+
+#include <string.h>
+
+// A break is nominally 13 dominant bits, fewer than 11 is a 0x00 byte.
+#define THUNDERSCOPEHW_LIN_BREAK_BITS          11
+// Idle bits closing a frame after a response byte, and after a bare header.
+#define THUNDERSCOPEHW_LIN_TIMEOUT_BITS        20
+#define THUNDERSCOPEHW_LIN_HEADER_TIMEOUT_BITS 100
+
+enum ThunderScopeHWLinState {
+	THUNDERSCOPEHW_LIN_IDLE,
+	THUNDERSCOPEHW_LIN_SYNC,
+	THUNDERSCOPEHW_LIN_PID,
+	THUNDERSCOPEHW_LIN_RESPONSE,
+};
+
+struct ThunderScopeHWDecoder* thunderscopehw_lin_decoder_create(double sample_rate, double baud, int8_t low, int8_t high)
+{
+	if (!(sample_rate > 0) || !(baud > 0) || baud * 2 > sample_rate) return NULL;
+	struct ThunderScopeHWDecoder* d = thunderscopehw_decoder_alloc(THUNDERSCOPEHW_PROTOCOL_LIN, 1, low, high);
+	if (!d) return d;
+
+	thunderscopehw_uart_init(&d->u.lin.uart, sample_rate, baud, 8, THUNDERSCOPEHW_PARITY_NONE);
+	thunderscopehw_decoder_reset(d);
+	return d;
+}
+
+void thunderscopehw_lin_reset(struct ThunderScopeHWDecoder* d)
+{
+	thunderscopehw_uart_reset(d);
+	d->u.lin.state = THUNDERSCOPEHW_LIN_IDLE;
+	d->u.lin.break_pending = false;
+}
+
+static uint8_t thunderscopehw_lin_pid(uint32_t id)
+{
+	uint32_t p0 = (id ^ (id >> 1) ^ (id >> 2) ^ (id >> 4)) & 1;
+	uint32_t p1 = ~((id >> 1) ^ (id >> 3) ^ (id >> 4) ^ (id >> 5)) & 1;
+	return (uint8_t)(id | (p0 << 6) | (p1 << 7));
+}
+
+// Sum with the carries added back in, inverted.
+static uint8_t thunderscopehw_lin_checksum(uint32_t sum, const uint8_t* data, uint32_t length)
+{
+	for (uint32_t i = 0; i < length; i++) {
+		sum += data[i];
+		if (sum > 0xFF) sum -= 0xFF;
+	}
+	return (uint8_t)~sum;
+}
+
+static void thunderscopehw_lin_close(struct ThunderScopeHWDecoder* d)
+{
+	struct ThunderScopeHWLin* l = &d->u.lin;
+	if (l->state == THUNDERSCOPEHW_LIN_IDLE) return;
+	struct ThunderScopeHWPacket p;
+	p.type = THUNDERSCOPEHW_PACKET_LIN;
+	p.flags = l->flags;
+	p.start = l->frame_start;
+	p.end = l->last_end;
+	p.value = l->pid & 0x3F;
+	p.value2 = 0;
+	p.length = 0;
+	if (l->state != THUNDERSCOPEHW_LIN_RESPONSE) {
+		p.flags |= THUNDERSCOPEHW_PACKET_FORM_ERROR;
+	} else if (l->count) {
+		// The last byte is the checksum. Identifiers 60 and up (diagnostics) use
+		// the classic one, LIN 1.x nodes use it for everything.
+		p.length = l->count - 1;
+		p.value2 = l->bytes[p.length];
+		memcpy(p.data, l->bytes, p.length);
+		bool classic = thunderscopehw_lin_checksum(0, p.data, p.length) == p.value2;
+		bool enhanced = p.value < 60 && thunderscopehw_lin_checksum(l->pid, p.data, p.length) == p.value2;
+		if (!classic && !enhanced) p.flags |= THUNDERSCOPEHW_PACKET_CHECKSUM_ERROR;
+	}
+	thunderscopehw_decoder_emit(d, &p);
+	l->state = THUNDERSCOPEHW_LIN_IDLE;
+}
+
+void thunderscopehw_lin_byte(struct ThunderScopeHWDecoder* d, const struct ThunderScopeHWPacket* byte)
+{
+	struct ThunderScopeHWLin* l = &d->u.lin;
+	// Possibly a break, decided by its length once the bus goes recessive.
+	if (byte->value == 0 && (byte->flags & THUNDERSCOPEHW_PACKET_FRAMING_ERROR)) {
+		l->break_pending = true;
+		l->break_start = byte->start;
+		return;
+	}
+
+	switch (l->state) {
+	case THUNDERSCOPEHW_LIN_SYNC:
+		if (byte->value != 0x55) l->flags |= THUNDERSCOPEHW_PACKET_FORM_ERROR;
+		l->state = THUNDERSCOPEHW_LIN_PID;
+		break;
+	case THUNDERSCOPEHW_LIN_PID:
+		l->pid = (uint8_t)byte->value;
+		if (thunderscopehw_lin_pid(byte->value & 0x3F) != l->pid) l->flags |= THUNDERSCOPEHW_PACKET_PARITY_ERROR;
+		l->state = THUNDERSCOPEHW_LIN_RESPONSE;
+		break;
+	case THUNDERSCOPEHW_LIN_RESPONSE:
+		if (l->count == THUNDERSCOPEHW_PACKET_MAX_DATA) {
+			l->flags |= THUNDERSCOPEHW_PACKET_FORM_ERROR;
+			break;
+		}
+		l->bytes[l->count++] = (uint8_t)byte->value;
+		break;
+	default:
+		return;
+	}
+	l->flags |= byte->flags & THUNDERSCOPEHW_PACKET_FRAMING_ERROR;
+	l->last_end = byte->end;
+}
+
+void thunderscopehw_lin_edge(struct ThunderScopeHWDecoder* d, uint64_t time, int input, bool level)
+{
+	struct ThunderScopeHWLin* l = &d->u.lin;
+	thunderscopehw_uart_edge(d, time, input, level);
+	if (!level || !l->break_pending) return;
+
+	l->break_pending = false;
+	if ((double)(time - l->break_start) < THUNDERSCOPEHW_LIN_BREAK_BITS * l->uart.bit) return;
+	thunderscopehw_lin_close(d);
+	l->state = THUNDERSCOPEHW_LIN_SYNC;
+	l->frame_start = l->break_start;
+	l->last_end = time;
+	l->flags = 0;
+	l->pid = 0;
+	l->count = 0;
+}
+
+void thunderscopehw_lin_flush(struct ThunderScopeHWDecoder* d, uint64_t now)
+{
+	struct ThunderScopeHWLin* l = &d->u.lin;
+	thunderscopehw_uart_flush(d, now);
+	if (l->state == THUNDERSCOPEHW_LIN_IDLE || l->break_pending) return;
+	int bits = l->state == THUNDERSCOPEHW_LIN_RESPONSE && l->count ? THUNDERSCOPEHW_LIN_TIMEOUT_BITS
+									: THUNDERSCOPEHW_LIN_HEADER_TIMEOUT_BITS;
+	if ((double)now > l->last_end + bits * l->uart.bit) thunderscopehw_lin_close(d);
+}
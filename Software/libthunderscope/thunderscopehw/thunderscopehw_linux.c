@@ -48,6 +48,7 @@ enum ThunderScopeHWStatus thunderscopehw_connect(struct ThunderScopeHW* ts, uint
 	ts->c2h0_handle = thunderscopehw_open_helper(scope_id, C2H_0_DEVICE_PATH);
 	if (ts->c2h0_handle <= 0) return THUNDERSCOPEHW_STATUS_OPEN_FAILED;
 	ts->connected = true;
+	ts->scope_id = scope_id;
 	return thunderscopehw_initboard(ts);
 }
 
@@ -0,0 +1,167 @@
+#include "thunderscopehw_private.h"
+
+#include <stdlib.h>
+
+#ifdef THUNDERSCOPEHW_SSE2
+#include <emmintrin.h>
+#endif
+
+struct ThunderScopeHWLogic {
+	int8_t low;
+	int8_t high;
+	bool level;
+	uint64_t position;
+};
+
+struct ThunderScopeHWLogic* thunderscopehw_logic_create(int8_t low, int8_t high)
+{
+	if (low > high) return NULL;
+	struct ThunderScopeHWLogic* l;
+	l = (struct ThunderScopeHWLogic*)malloc(sizeof(struct ThunderScopeHWLogic));
+	if (!l) return l;
+
+	l->low = low;
+	l->high = high;
+	thunderscopehw_logic_reset(l);
+	return l;
+}
+
+void thunderscopehw_logic_destroy(struct ThunderScopeHWLogic* l)
+{
+	free(l);
+}
+
+void thunderscopehw_logic_reset(struct ThunderScopeHWLogic* l)
+{
+	l->level = false;
+	l->position = 0;
+}
+
+bool thunderscopehw_logic_level(struct ThunderScopeHWLogic* l)
+{
+	return l->level;
+}
+
+uint64_t thunderscopehw_logic_position(struct ThunderScopeHWLogic* l)
+{
+	return l->position;
+}
+
+// Bits of up to 64 samples above high (set) and below low (reset).
+static inline void thunderscopehw_logic_masks(int8_t low, int8_t high, const int8_t* samples, size_t n,
+					      uint64_t* set, uint64_t* reset)
+{
+	uint64_t s = 0, r = 0;
+	size_t i = 0;
+#ifdef THUNDERSCOPEHW_SSE2
+	const __m128i vhigh = _mm_set1_epi8(high);
+	const __m128i vlow = _mm_set1_epi8(low);
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(samples + i));
+		s |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpgt_epi8(v, vhigh)) << i;
+		r |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpgt_epi8(vlow, v)) << i;
+	}
+#endif
+	for (; i < n; i++) {
+		s |= (uint64_t)(samples[i] > high) << i;
+		r |= (uint64_t)(samples[i] < low) << i;
+	}
+	*set = s;
+	*reset = r;
+}
+
+size_t thunderscopehw_logic_process(struct ThunderScopeHWLogic* l, const int8_t* samples, size_t length,
+				    uint8_t* bits, uint64_t* transitions)
+{
+	// In locals, the output stores could alias the state.
+	int8_t low = l->low, high = l->high;
+	uint64_t level = l->level, position = l->position;
+	size_t count = 0;
+	for (size_t offset = 0; offset < length; offset += 64) {
+		size_t n = length - offset;
+		if (n > 64) n = 64;
+		uint64_t valid = n == 64 ? ~0ULL : (1ULL << n) - 1;
+		uint64_t set, reset;
+		thunderscopehw_logic_masks(low, high, samples + offset, n, &set, &reset);
+
+		// Samples between the thresholds hold the level before them. Adding a
+		// bit at the start of each held run that follows a set sample carries
+		// through the run, the bits it flips are the run to fill with ones.
+		uint64_t hold = ~(set | reset) & valid;
+		uint64_t start = ((set << 1) | level) & hold;
+		uint64_t word = set | (((hold + start) ^ hold) & hold);
+
+		if (transitions) {
+			uint64_t changes = (word ^ ((word << 1) | level)) & valid;
+			while (changes) {
+				transitions[count++] = position + thunderscopehw_ctz64(changes);
+				changes &= changes - 1;
+			}
+		}
+		if (bits) {
+			for (size_t b = 0; b < (n + 7) / 8; b++) *bits++ = (uint8_t)(word >> (8 * b));
+		}
+		level = (word >> (n - 1)) & 1;
+		position += n;
+	}
+	l->level = level;
+	l->position = position;
+	return count;
+}
+
+bool thunderscopehw_crossings_init(struct ThunderScopeHWCrossings* c, int8_t low, int8_t high)
+{
+	c->logic = thunderscopehw_logic_create(low, high);
+	c->transitions = (uint64_t*)malloc(THUNDERSCOPEHW_TILE_SAMPLES * sizeof(uint64_t));
+	c->threshold = (low + high) * 0.5f;
+	c->twice_threshold = low + high;
+	c->previous = 0;
+	for (int d = -255; d <= 255; d++) c->reciprocal[d + 255] = d ? 1.0f / d : 0;
+	return c->logic && c->transitions;
+}
+
+void thunderscopehw_crossings_free(struct ThunderScopeHWCrossings* c)
+{
+	thunderscopehw_logic_destroy(c->logic);
+	free(c->transitions);
+}
+
+void thunderscopehw_crossings_reset(struct ThunderScopeHWCrossings* c)
+{
+	thunderscopehw_logic_reset(c->logic);
+	c->previous = 0;
+}
+
+size_t thunderscopehw_crossings_process(struct ThunderScopeHWCrossings* c, const int8_t* samples, size_t length,
+					double* times, bool* rising)
+{
+	uint64_t base = thunderscopehw_logic_position(c->logic);
+	bool level = thunderscopehw_logic_level(c->logic);
+	size_t count = thunderscopehw_logic_process(c->logic, samples, length, NULL, c->transitions);
+	float threshold = c->threshold;
+	int twice_threshold = c->twice_threshold;
+	size_t out = 0;
+	for (size_t j = 0; j < count; j++) {
+		level = !level;
+		// The first sample only sets the level.
+		if (c->transitions[j] == 0) continue;
+
+		// Walk back from where the band was left to where the threshold was crossed.
+		size_t k = (size_t)(c->transitions[j] - base);
+		if (level) {
+			while (k > 0 && 2 * samples[k - 1] > twice_threshold) k--;
+		} else {
+			while (k > 0 && 2 * samples[k - 1] < twice_threshold) k--;
+		}
+		int b = samples[k];
+		int a = k ? samples[k - 1] : c->previous;
+		float fraction = b != a ? (threshold - a) * c->reciprocal[b - a + 255] : 1.0f;
+		if (fraction < 0) fraction = 0;
+		if (fraction > 1) fraction = 1;
+		times[out] = (double)(int64_t)(base + k) - 1 + fraction;
+		rising[out] = level;
+		out++;
+	}
+	if (length) c->previous = samples[length - 1];
+	return out;
+}
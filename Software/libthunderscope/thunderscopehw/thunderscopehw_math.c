@@ -0,0 +1,489 @@
+#include "thunderscopehw_private.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef THUNDERSCOPEHW_SSE2
+#include <emmintrin.h>
+#endif
+
+enum ThunderScopeHWMathOpcode {
+	THUNDERSCOPEHW_MATH_LOAD,    // push channel * a + b
+	THUNDERSCOPEHW_MATH_CONST,   // push b
+	THUNDERSCOPEHW_MATH_AFFINE,  // top = top * a + b
+	THUNDERSCOPEHW_MATH_ADD,
+	THUNDERSCOPEHW_MATH_SUB,
+	THUNDERSCOPEHW_MATH_MUL,
+	THUNDERSCOPEHW_MATH_DIV,
+	THUNDERSCOPEHW_MATH_ABS,
+	THUNDERSCOPEHW_MATH_INTEG,
+	THUNDERSCOPEHW_MATH_DERIV,
+};
+
+struct ThunderScopeHWMathOp {
+	enum ThunderScopeHWMathOpcode opcode;
+	int channel;
+	float a;
+	float b;
+	// Running integral or previous input.
+	double state;
+	bool primed;
+};
+
+// The expression is compiled to postfix with constants folded and scales and
+// offsets merged into the kernel before them, then run one tile at a time on
+// a stack of tile buffers.
+struct ThunderScopeHWMath {
+	struct ThunderScopeHWMathOp* ops;
+	size_t count;
+	int depth;
+	int channels;
+	double seconds_per_sample;
+	float* stack;
+};
+
+struct ThunderScopeHWMathParser {
+	const char* p;
+	struct ThunderScopeHWMath* m;
+	const double* volts_per_lsb;
+	bool error;
+};
+
+static size_t thunderscopehw_math_emit(struct ThunderScopeHWMathParser* ps, enum ThunderScopeHWMathOpcode opcode, float a, float b)
+{
+	struct ThunderScopeHWMathOp* op = &ps->m->ops[ps->m->count];
+	memset(op, 0, sizeof(*op));
+	op->opcode = opcode;
+	op->a = a;
+	op->b = b;
+	return ps->m->count++;
+}
+
+// Applies x * a + b to the last operand, merging into its final kernel when possible.
+static void thunderscopehw_math_affine(struct ThunderScopeHWMathParser* ps, float a, float b)
+{
+	struct ThunderScopeHWMathOp* last = &ps->m->ops[ps->m->count - 1];
+	switch (last->opcode) {
+	case THUNDERSCOPEHW_MATH_CONST:
+		last->b = last->b * a + b;
+		return;
+	case THUNDERSCOPEHW_MATH_LOAD:
+	case THUNDERSCOPEHW_MATH_AFFINE:
+		last->a *= a;
+		last->b = last->b * a + b;
+		return;
+	default:
+		thunderscopehw_math_emit(ps, THUNDERSCOPEHW_MATH_AFFINE, a, b);
+	}
+}
+
+static bool thunderscopehw_math_is_const(struct ThunderScopeHWMathParser* ps, size_t start, size_t end)
+{
+	return end - start == 1 && ps->m->ops[start].opcode == THUNDERSCOPEHW_MATH_CONST;
+}
+
+// Combines the operands at [left, right) and [right, end) with a binary operator.
+static void thunderscopehw_math_binary(struct ThunderScopeHWMathParser* ps, size_t left, size_t right, char op)
+{
+	struct ThunderScopeHWMath* m = ps->m;
+	size_t end = m->count;
+	bool left_const = thunderscopehw_math_is_const(ps, left, right);
+	bool right_const = thunderscopehw_math_is_const(ps, right, end);
+
+	if (right_const) {
+		float k = m->ops[right].b;
+		m->count--;
+		if (left_const) {
+			float x = m->ops[left].b;
+			switch (op) {
+			case '+': m->ops[left].b = x + k; break;
+			case '-': m->ops[left].b = x - k; break;
+			case '*': m->ops[left].b = x * k; break;
+			default:  m->ops[left].b = x / k; break;
+			}
+			return;
+		}
+		switch (op) {
+		case '+': thunderscopehw_math_affine(ps, 1, k); break;
+		case '-': thunderscopehw_math_affine(ps, 1, -k); break;
+		case '*': thunderscopehw_math_affine(ps, k, 0); break;
+		default:  thunderscopehw_math_affine(ps, 1 / k, 0); break;
+		}
+		return;
+	}
+	if (left_const && op != '/') {
+		// Drop the constant in front of the right operand.
+		float k = m->ops[left].b;
+		memmove(&m->ops[left], &m->ops[right], (end - right) * sizeof(struct ThunderScopeHWMathOp));
+		m->count--;
+		switch (op) {
+		case '+': thunderscopehw_math_affine(ps, 1, k); break;
+		case '-': thunderscopehw_math_affine(ps, -1, k); break;
+		default:  thunderscopehw_math_affine(ps, k, 0); break;
+		}
+		return;
+	}
+	switch (op) {
+	case '+': thunderscopehw_math_emit(ps, THUNDERSCOPEHW_MATH_ADD, 0, 0); break;
+	case '-': thunderscopehw_math_emit(ps, THUNDERSCOPEHW_MATH_SUB, 0, 0); break;
+	case '*': thunderscopehw_math_emit(ps, THUNDERSCOPEHW_MATH_MUL, 0, 0); break;
+	default:  thunderscopehw_math_emit(ps, THUNDERSCOPEHW_MATH_DIV, 0, 0); break;
+	}
+}
+
+static void thunderscopehw_math_space(struct ThunderScopeHWMathParser* ps)
+{
+	while (isspace((unsigned char)*ps->p)) ps->p++;
+}
+
+static bool thunderscopehw_math_word(struct ThunderScopeHWMathParser* ps, const char* word)
+{
+	size_t n = strlen(word);
+	for (size_t i = 0; i < n; i++) {
+		if (tolower((unsigned char)ps->p[i]) != word[i]) return false;
+	}
+	ps->p += n;
+	return true;
+}
+
+static size_t thunderscopehw_math_expression(struct ThunderScopeHWMathParser* ps);
+
+// Consumes the closing parenthesis, false on any error so far.
+static bool thunderscopehw_math_close(struct ThunderScopeHWMathParser* ps)
+{
+	if (ps->error) return false;
+	thunderscopehw_math_space(ps);
+	if (*ps->p != ')') {
+		ps->error = true;
+		return false;
+	}
+	ps->p++;
+	return true;
+}
+
+static size_t thunderscopehw_math_primary(struct ThunderScopeHWMathParser* ps)
+{
+	static const struct {
+		const char* name;
+		enum ThunderScopeHWMathOpcode opcode;
+	} functions[] = {
+		{ "integ(", THUNDERSCOPEHW_MATH_INTEG },
+		{ "deriv(", THUNDERSCOPEHW_MATH_DERIV },
+		{ "abs(",   THUNDERSCOPEHW_MATH_ABS },
+	};
+	size_t start = ps->m->count;
+	thunderscopehw_math_space(ps);
+
+	if (*ps->p == '(') {
+		ps->p++;
+		thunderscopehw_math_expression(ps);
+		thunderscopehw_math_close(ps);
+		return start;
+	}
+	for (size_t f = 0; f < sizeof(functions) / sizeof(functions[0]); f++) {
+		if (!thunderscopehw_math_word(ps, functions[f].name)) continue;
+		thunderscopehw_math_expression(ps);
+		if (!thunderscopehw_math_close(ps)) return start;
+		if (functions[f].opcode == THUNDERSCOPEHW_MATH_ABS && thunderscopehw_math_is_const(ps, start, ps->m->count)) {
+			ps->m->ops[start].b = fabsf(ps->m->ops[start].b);
+		} else {
+			thunderscopehw_math_emit(ps, functions[f].opcode, 0, 0);
+		}
+		return start;
+	}
+	if (thunderscopehw_math_word(ps, "ch")) {
+		int channel = *ps->p - '1';
+		if (channel < 0 || channel >= THUNDERSCOPEHW_CHANNELS) {
+			ps->error = true;
+			return start;
+		}
+		ps->p++;
+		float scale = ps->volts_per_lsb ? (float)ps->volts_per_lsb[channel] : 1.0f;
+		ps->m->ops[thunderscopehw_math_emit(ps, THUNDERSCOPEHW_MATH_LOAD, scale, 0)].channel = channel;
+		ps->m->channels |= 1 << channel;
+		return start;
+	}
+	char* end;
+	double value = strtod(ps->p, &end);
+	if (end == ps->p) {
+		ps->error = true;
+		return start;
+	}
+	ps->p = end;
+	thunderscopehw_math_emit(ps, THUNDERSCOPEHW_MATH_CONST, 0, (float)value);
+	return start;
+}
+
+static size_t thunderscopehw_math_unary(struct ThunderScopeHWMathParser* ps)
+{
+	thunderscopehw_math_space(ps);
+	if (*ps->p == '-') {
+		ps->p++;
+		size_t start = thunderscopehw_math_unary(ps);
+		if (!ps->error) thunderscopehw_math_affine(ps, -1, 0);
+		return start;
+	}
+	return thunderscopehw_math_primary(ps);
+}
+
+static size_t thunderscopehw_math_term(struct ThunderScopeHWMathParser* ps)
+{
+	size_t start = thunderscopehw_math_unary(ps);
+	while (!ps->error) {
+		thunderscopehw_math_space(ps);
+		char op = *ps->p;
+		if (op != '*' && op != '/') break;
+		ps->p++;
+		size_t right = thunderscopehw_math_unary(ps);
+		if (!ps->error) thunderscopehw_math_binary(ps, start, right, op);
+	}
+	return start;
+}
+
+static size_t thunderscopehw_math_expression(struct ThunderScopeHWMathParser* ps)
+{
+	size_t start = thunderscopehw_math_term(ps);
+	while (!ps->error) {
+		thunderscopehw_math_space(ps);
+		char op = *ps->p;
+		if (op != '+' && op != '-') break;
+		ps->p++;
+		size_t right = thunderscopehw_math_term(ps);
+		if (!ps->error) thunderscopehw_math_binary(ps, start, right, op);
+	}
+	return start;
+}
+
+struct ThunderScopeHWMath* thunderscopehw_math_create(const char* expression, double sample_rate, const double* volts_per_lsb)
+{
+	if (!expression || sample_rate <= 0) return NULL;
+	struct ThunderScopeHWMath* m;
+	m = (struct ThunderScopeHWMath*)calloc(1, sizeof(struct ThunderScopeHWMath));
+	if (!m) return m;
+
+	m->seconds_per_sample = 1.0 / sample_rate;
+	// Every kernel consumes at least one character.
+	m->ops = (struct ThunderScopeHWMathOp*)malloc((strlen(expression) + 1) * sizeof(struct ThunderScopeHWMathOp));
+	if (!m->ops) {
+		thunderscopehw_math_destroy(m);
+		return NULL;
+	}
+	struct ThunderScopeHWMathParser ps = { expression, m, volts_per_lsb, false };
+	thunderscopehw_math_expression(&ps);
+	if (!ps.error) thunderscopehw_math_space(&ps);
+	if (ps.error || *ps.p || m->count == 0) {
+		thunderscopehw_math_destroy(m);
+		return NULL;
+	}
+
+	int depth = 0;
+	for (size_t i = 0; i < m->count; i++) {
+		switch (m->ops[i].opcode) {
+		case THUNDERSCOPEHW_MATH_LOAD:
+		case THUNDERSCOPEHW_MATH_CONST:
+			depth++;
+			break;
+		case THUNDERSCOPEHW_MATH_ADD:
+		case THUNDERSCOPEHW_MATH_SUB:
+		case THUNDERSCOPEHW_MATH_MUL:
+		case THUNDERSCOPEHW_MATH_DIV:
+			depth--;
+			break;
+		default:
+			break;
+		}
+		if (depth > m->depth) m->depth = depth;
+	}
+	m->stack = (float*)malloc((size_t)m->depth * THUNDERSCOPEHW_TILE_SAMPLES * sizeof(float));
+	if (!m->stack) {
+		thunderscopehw_math_destroy(m);
+		return NULL;
+	}
+	thunderscopehw_math_reset(m);
+	return m;
+}
+
+void thunderscopehw_math_destroy(struct ThunderScopeHWMath* m)
+{
+	if (!m) return;
+	free(m->ops);
+	free(m->stack);
+	free(m);
+}
+
+void thunderscopehw_math_reset(struct ThunderScopeHWMath* m)
+{
+	for (size_t i = 0; i < m->count; i++) {
+		m->ops[i].state = 0;
+		m->ops[i].primed = false;
+	}
+}
+
+int thunderscopehw_math_channels(struct ThunderScopeHWMath* m)
+{
+	return m->channels;
+}
+
+static void thunderscopehw_math_affine_f32(float* x, size_t n, float a, float b)
+{
+	size_t i = 0;
+#ifdef THUNDERSCOPEHW_SSE2
+	__m128 va = _mm_set1_ps(a), vb = _mm_set1_ps(b);
+	for (; i + 4 <= n; i += 4) _mm_storeu_ps(x + i, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(x + i), va), vb));
+#endif
+	for (; i < n; i++) x[i] = x[i] * a + b;
+}
+
+static void thunderscopehw_math_binary_f32(enum ThunderScopeHWMathOpcode opcode, float* x, const float* y, size_t n)
+{
+	size_t i = 0;
+#ifdef THUNDERSCOPEHW_SSE2
+	for (; i + 4 <= n; i += 4) {
+		__m128 a = _mm_loadu_ps(x + i), b = _mm_loadu_ps(y + i);
+		switch (opcode) {
+		case THUNDERSCOPEHW_MATH_ADD: a = _mm_add_ps(a, b); break;
+		case THUNDERSCOPEHW_MATH_SUB: a = _mm_sub_ps(a, b); break;
+		case THUNDERSCOPEHW_MATH_MUL: a = _mm_mul_ps(a, b); break;
+		default:                      a = _mm_div_ps(a, b); break;
+		}
+		_mm_storeu_ps(x + i, a);
+	}
+#endif
+	for (; i < n; i++) {
+		switch (opcode) {
+		case THUNDERSCOPEHW_MATH_ADD: x[i] += y[i]; break;
+		case THUNDERSCOPEHW_MATH_SUB: x[i] -= y[i]; break;
+		case THUNDERSCOPEHW_MATH_MUL: x[i] *= y[i]; break;
+		default:                      x[i] /= y[i]; break;
+		}
+	}
+}
+
+static void thunderscopehw_math_abs_f32(float* x, size_t n)
+{
+	size_t i = 0;
+#ifdef THUNDERSCOPEHW_SSE2
+	const __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	for (; i + 4 <= n; i += 4) _mm_storeu_ps(x + i, _mm_and_ps(_mm_loadu_ps(x + i), mask));
+#endif
+	for (; i < n; i++) x[i] = fabsf(x[i]);
+}
+
+// Differences in place, walking down so each input is read before it is overwritten.
+static void thunderscopehw_math_deriv_f32(struct ThunderScopeHWMathOp* op, float* x, size_t n, float rate)
+{
+	float last = x[n - 1];
+	float first = op->primed ? (float)op->state : x[0];
+	size_t i = n;
+#ifdef THUNDERSCOPEHW_SSE2
+	__m128 vrate = _mm_set1_ps(rate);
+	while (i >= 5) {
+		i -= 4;
+		__m128 d = _mm_sub_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(x + i - 1));
+		_mm_storeu_ps(x + i, _mm_mul_ps(d, vrate));
+	}
+#endif
+	while (--i > 0) x[i] = (x[i] - x[i - 1]) * rate;
+	x[0] = (x[0] - first) * rate;
+	op->state = last;
+	op->primed = true;
+}
+
+static void thunderscopehw_math_integ_f32(struct ThunderScopeHWMathOp* op, float* x, size_t n, double dt)
+{
+	double sum = op->state;
+	for (size_t i = 0; i < n; i++) {
+		sum += x[i] * dt;
+		x[i] = (float)sum;
+	}
+	op->state = sum;
+}
+
+// Runs the program over one tile, the result is left in the first stack buffer.
+static void thunderscopehw_math_tile(struct ThunderScopeHWMath* m, const int8_t* const* channels, size_t offset, size_t n)
+{
+	int sp = -1;
+	for (size_t i = 0; i < m->count; i++) {
+		struct ThunderScopeHWMathOp* op = &m->ops[i];
+		float* top;
+		switch (op->opcode) {
+		case THUNDERSCOPEHW_MATH_LOAD:
+			top = m->stack + (size_t)++sp * THUNDERSCOPEHW_TILE_SAMPLES;
+			thunderscopehw_i8_to_f32(channels[op->channel] + offset, n, op->a, top);
+			if (op->b != 0) thunderscopehw_math_affine_f32(top, n, 1, op->b);
+			break;
+		case THUNDERSCOPEHW_MATH_CONST:
+			top = m->stack + (size_t)++sp * THUNDERSCOPEHW_TILE_SAMPLES;
+			for (size_t j = 0; j < n; j++) top[j] = op->b;
+			break;
+		case THUNDERSCOPEHW_MATH_AFFINE:
+			thunderscopehw_math_affine_f32(m->stack + (size_t)sp * THUNDERSCOPEHW_TILE_SAMPLES, n, op->a, op->b);
+			break;
+		case THUNDERSCOPEHW_MATH_ABS:
+			thunderscopehw_math_abs_f32(m->stack + (size_t)sp * THUNDERSCOPEHW_TILE_SAMPLES, n);
+			break;
+		case THUNDERSCOPEHW_MATH_INTEG:
+			thunderscopehw_math_integ_f32(op, m->stack + (size_t)sp * THUNDERSCOPEHW_TILE_SAMPLES, n, m->seconds_per_sample);
+			break;
+		case THUNDERSCOPEHW_MATH_DERIV:
+			thunderscopehw_math_deriv_f32(op, m->stack + (size_t)sp * THUNDERSCOPEHW_TILE_SAMPLES, n,
+						      (float)(1.0 / m->seconds_per_sample));
+			break;
+		default:
+			sp--;
+			thunderscopehw_math_binary_f32(op->opcode, m->stack + (size_t)sp * THUNDERSCOPEHW_TILE_SAMPLES,
+						       m->stack + (size_t)(sp + 1) * THUNDERSCOPEHW_TILE_SAMPLES, n);
+			break;
+		}
+	}
+}
+
+void thunderscopehw_math_process(struct ThunderScopeHWMath* m, const int8_t* const* channels, size_t length, float* out)
+{
+	for (size_t offset = 0; offset < length; offset += THUNDERSCOPEHW_TILE_SAMPLES) {
+		size_t n = length - offset;
+		if (n > THUNDERSCOPEHW_TILE_SAMPLES) n = THUNDERSCOPEHW_TILE_SAMPLES;
+		thunderscopehw_math_tile(m, channels, offset, n);
+		memcpy(out + offset, m->stack, n * sizeof(float));
+	}
+}
+
+void thunderscopehw_math_process_i8(struct ThunderScopeHWMath* m, const int8_t* const* channels, size_t length,
+				    double units_per_code, int8_t* out)
+{
+	float scale = (float)(1.0 / units_per_code);
+	for (size_t offset = 0; offset < length; offset += THUNDERSCOPEHW_TILE_SAMPLES) {
+		size_t n = length - offset;
+		if (n > THUNDERSCOPEHW_TILE_SAMPLES) n = THUNDERSCOPEHW_TILE_SAMPLES;
+		thunderscopehw_math_tile(m, channels, offset, n);
+		const float* x = m->stack;
+		int8_t* o = out + offset;
+		size_t i = 0;
+#ifdef THUNDERSCOPEHW_SSE2
+		// Clamp in float first, the conversion turns NaN, infinities and anything
+		// past 2^31 into INT32_MIN. NaN (0 / 0) gives 0.
+		__m128 vscale = _mm_set1_ps(scale);
+		__m128 vmax = _mm_set1_ps(INT8_MAX);
+		__m128 vmin = _mm_set1_ps(-INT8_MAX);
+		__m128i q[4];
+		for (; i + 16 <= n; i += 16) {
+			for (int k = 0; k < 4; k++) {
+				__m128 v = _mm_mul_ps(_mm_loadu_ps(x + i + 4 * k), vscale);
+				v = _mm_and_ps(v, _mm_cmpord_ps(v, v));
+				q[k] = _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(v, vmax), vmin));
+			}
+			_mm_storeu_si128((__m128i*)(o + i), _mm_packs_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3])));
+		}
+#endif
+		for (; i < n; i++) {
+			float v = x[i] * scale;
+			if (v != v) v = 0;
+			if (v > INT8_MAX) v = INT8_MAX;
+			if (v < -INT8_MAX) v = -INT8_MAX;
+			v = rintf(v);
+			o[i] = (int8_t)v;
+		}
+	}
+}
@@ -0,0 +1,95 @@
+#include "thunderscopehw_private.h"
+
+#include <stdlib.h>
+
+struct ThunderScopeHWPeakDetect {
+	int num_channels;
+	uint64_t decimation;
+	// Samples per channel already folded into the current point.
+	uint64_t filled;
+	int8_t min[THUNDERSCOPEHW_CHANNELS];
+	int8_t max[THUNDERSCOPEHW_CHANNELS];
+	int8_t tile[THUNDERSCOPEHW_CHANNELS][THUNDERSCOPEHW_TILE_SAMPLES];
+};
+
+struct ThunderScopeHWPeakDetect* thunderscopehw_peak_detect_create(int num_channels, uint64_t decimation)
+{
+	if (num_channels < 1 || num_channels > THUNDERSCOPEHW_CHANNELS || decimation == 0)
+		return NULL;
+	struct ThunderScopeHWPeakDetect* pd;
+	pd = (struct ThunderScopeHWPeakDetect*)malloc(sizeof(struct ThunderScopeHWPeakDetect));
+	if (!pd) return pd;
+
+	pd->num_channels = num_channels;
+	pd->decimation = decimation;
+	thunderscopehw_peak_detect_reset(pd);
+	return pd;
+}
+
+void thunderscopehw_peak_detect_destroy(struct ThunderScopeHWPeakDetect* pd)
+{
+	free(pd);
+}
+
+void thunderscopehw_peak_detect_reset(struct ThunderScopeHWPeakDetect* pd)
+{
+	pd->filled = 0;
+	for (int channel = 0; channel < THUNDERSCOPEHW_CHANNELS; channel++) {
+		pd->min[channel] = INT8_MAX;
+		pd->max[channel] = INT8_MIN;
+	}
+}
+
+uint64_t thunderscopehw_peak_detect_decimation(int num_channels, double output_rate)
+{
+	double decimation = (double)THUNDERSCOPEHW_SAMPLE_RATE / num_channels / output_rate;
+	if (decimation < 1.0) return 1;
+	return (uint64_t)(decimation + 0.5);
+}
+
+size_t thunderscopehw_peak_detect_max_points(struct ThunderScopeHWPeakDetect* pd, size_t length)
+{
+	return (size_t)((pd->filled + length / pd->num_channels) / pd->decimation);
+}
+
+size_t thunderscopehw_peak_detect_process(struct ThunderScopeHWPeakDetect* pd, const int8_t* data, size_t length, int8_t* out)
+{
+	int8_t* tiles[THUNDERSCOPEHW_CHANNELS];
+	size_t points = 0;
+	size_t samples = length / pd->num_channels;
+
+	for (int channel = 0; channel < pd->num_channels; channel++)
+		tiles[channel] = pd->tile[channel];
+
+	while (samples) {
+		size_t tile_samples = samples;
+		if (tile_samples > THUNDERSCOPEHW_TILE_SAMPLES) tile_samples = THUNDERSCOPEHW_TILE_SAMPLES;
+		thunderscopehw_deinterleave(data, tile_samples * pd->num_channels, pd->num_channels, tiles);
+
+		size_t pos = 0;
+		while (pos < tile_samples) {
+			size_t take = tile_samples - pos;
+			if (take > pd->decimation - pd->filled) take = (size_t)(pd->decimation - pd->filled);
+			for (int channel = 0; channel < pd->num_channels; channel++) {
+				int8_t lo, hi;
+				thunderscopehw_minmax_i8(tiles[channel] + pos, take, &lo, &hi);
+				if (lo < pd->min[channel]) pd->min[channel] = lo;
+				if (hi > pd->max[channel]) pd->max[channel] = hi;
+			}
+			pos += take;
+			pd->filled += take;
+			if (pd->filled == pd->decimation) {
+				for (int channel = 0; channel < pd->num_channels; channel++) {
+					*out++ = pd->min[channel];
+					*out++ = pd->max[channel];
+				}
+				points++;
+				thunderscopehw_peak_detect_reset(pd);
+			}
+		}
+
+		data += tile_samples * pd->num_channels;
+		samples -= tile_samples;
+	}
+	return points;
+}
@@ -0,0 +1,123 @@
+#include "thunderscopehw_private.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define THUNDERSCOPEHW_PERSISTENCE_CODES 256
+
+struct ThunderScopeHWPersistence {
+	size_t time_bins;
+	enum ThunderScopeHWPersistenceMode mode;
+	uint32_t decay_records;
+	uint32_t records_since_decay;
+	uint64_t records;
+	// One column of 256 codes per time bin, so a record walks memory forwards.
+	uint32_t* counts;
+};
+
+struct ThunderScopeHWPersistence* thunderscopehw_persistence_create(size_t time_bins, enum ThunderScopeHWPersistenceMode mode, uint32_t decay_records)
+{
+	if (time_bins == 0) return NULL;
+	if (mode == THUNDERSCOPEHW_PERSISTENCE_DECAY && decay_records == 0) return NULL;
+	struct ThunderScopeHWPersistence* p;
+	p = (struct ThunderScopeHWPersistence*)malloc(sizeof(struct ThunderScopeHWPersistence));
+	if (!p) return p;
+
+	p->time_bins = time_bins;
+	p->mode = mode;
+	p->decay_records = decay_records;
+	p->counts = (uint32_t*)malloc(time_bins * THUNDERSCOPEHW_PERSISTENCE_CODES * sizeof(uint32_t));
+	if (!p->counts) {
+		free(p);
+		return NULL;
+	}
+	thunderscopehw_persistence_clear(p);
+	return p;
+}
+
+void thunderscopehw_persistence_destroy(struct ThunderScopeHWPersistence* p)
+{
+	if (!p) return;
+	free(p->counts);
+	free(p);
+}
+
+void thunderscopehw_persistence_clear(struct ThunderScopeHWPersistence* p)
+{
+	memset(p->counts, 0, p->time_bins * THUNDERSCOPEHW_PERSISTENCE_CODES * sizeof(uint32_t));
+	p->records = 0;
+	p->records_since_decay = 0;
+}
+
+static void thunderscopehw_persistence_decay(struct ThunderScopeHWPersistence* p)
+{
+	if (p->mode != THUNDERSCOPEHW_PERSISTENCE_DECAY) return;
+	while (p->records_since_decay >= p->decay_records) {
+		size_t cells = p->time_bins * THUNDERSCOPEHW_PERSISTENCE_CODES;
+		for (size_t i = 0; i < cells; i++) p->counts[i] >>= 1;
+		p->records_since_decay -= p->decay_records;
+	}
+}
+
+void thunderscopehw_persistence_add(struct ThunderScopeHWPersistence* p, const int8_t* record, size_t length)
+{
+	uint32_t* counts = p->counts;
+	if (length == p->time_bins) {
+		for (size_t i = 0; i < length; i++) {
+			counts[i * THUNDERSCOPEHW_PERSISTENCE_CODES + (uint8_t)(record[i] + 128)]++;
+		}
+	} else if (length) {
+		// 32.32 fixed point step from sample index to time bin.
+		uint64_t step = ((uint64_t)p->time_bins << 32) / length;
+		uint64_t pos = 0;
+		for (size_t i = 0; i < length; i++, pos += step) {
+			size_t bin = (size_t)(pos >> 32);
+			counts[bin * THUNDERSCOPEHW_PERSISTENCE_CODES + (uint8_t)(record[i] + 128)]++;
+		}
+	}
+	p->records++;
+	p->records_since_decay++;
+	thunderscopehw_persistence_decay(p);
+}
+
+enum ThunderScopeHWStatus thunderscopehw_persistence_merge(struct ThunderScopeHWPersistence* dst, struct ThunderScopeHWPersistence* src)
+{
+	if (dst->time_bins != src->time_bins) return THUNDERSCOPEHW_STATUS_INVALID_PARAMETER;
+	size_t cells = dst->time_bins * THUNDERSCOPEHW_PERSISTENCE_CODES;
+	for (size_t i = 0; i < cells; i++) dst->counts[i] += src->counts[i];
+	dst->records += src->records;
+	dst->records_since_decay += src->records_since_decay;
+	thunderscopehw_persistence_decay(dst);
+	thunderscopehw_persistence_clear(src);
+	return THUNDERSCOPEHW_STATUS_OK;
+}
+
+uint64_t thunderscopehw_persistence_records(struct ThunderScopeHWPersistence* p)
+{
+	return p->records;
+}
+
+const uint32_t* thunderscopehw_persistence_counts(struct ThunderScopeHWPersistence* p)
+{
+	return p->counts;
+}
+
+void thunderscopehw_persistence_image(struct ThunderScopeHWPersistence* p, uint8_t* image)
+{
+	size_t cells = p->time_bins * THUNDERSCOPEHW_PERSISTENCE_CODES;
+	uint32_t peak = 0;
+	for (size_t i = 0; i < cells; i++) {
+		if (p->counts[i] > peak) peak = p->counts[i];
+	}
+	for (size_t bin = 0; bin < p->time_bins; bin++) {
+		const uint32_t* column = p->counts + bin * THUNDERSCOPEHW_PERSISTENCE_CODES;
+		for (int code = 0; code < THUNDERSCOPEHW_PERSISTENCE_CODES; code++) {
+			uint8_t intensity = 0;
+			if (column[code]) {
+				// Any hit stays visible.
+				intensity = (uint8_t)(((uint64_t)column[code] * 254 + peak - 1) / peak + 1);
+			}
+			image[(size_t)(THUNDERSCOPEHW_PERSISTENCE_CODES - 1 - code) * p->time_bins + bin] = intensity;
+		}
+	}
+}
@@ -0,0 +1,140 @@
+#include "thunderscopehw_private.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define THUNDERSCOPEHW_POLYPHASE_MAX_PHASES     1024
+#define THUNDERSCOPEHW_POLYPHASE_PHASES         256
+#define THUNDERSCOPEHW_POLYPHASE_TAPS           16
+
+static bool thunderscopehw_integral_rate(double rate)
+{
+	return rate >= 1 && rate < 9007199254740992.0 && rate == floor(rate);
+}
+
+static uint64_t thunderscopehw_gcd(uint64_t a, uint64_t b)
+{
+	while (b) {
+		uint64_t t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+bool thunderscopehw_polyphase_init(struct ThunderScopeHWPolyphase* pp, double input_rate, double output_rate)
+{
+	memset(pp, 0, sizeof(*pp));
+	if (!(input_rate > 0) || !(output_rate > 0)) return false;
+
+	if (thunderscopehw_integral_rate(input_rate) && thunderscopehw_integral_rate(output_rate)) {
+		uint64_t g = thunderscopehw_gcd((uint64_t)input_rate, (uint64_t)output_rate);
+		uint64_t up = (uint64_t)output_rate / g;
+		uint64_t down = (uint64_t)input_rate / g;
+		if (up <= THUNDERSCOPEHW_POLYPHASE_MAX_PHASES && down <= UINT32_MAX) {
+			pp->rational = true;
+			pp->up = (uint32_t)up;
+			pp->down = (uint32_t)down;
+		}
+	}
+	pp->phases = pp->rational ? pp->up : THUNDERSCOPEHW_POLYPHASE_PHASES;
+	pp->step = input_rate / output_rate;
+
+	// When decimating the filter has to span proportionally more inputs.
+	double ratio = pp->step > 1 ? pp->step : 1;
+	pp->taps = ((size_t)ceil(THUNDERSCOPEHW_POLYPHASE_TAPS * ratio) + 3) & ~(size_t)3;
+
+	size_t rows = pp->phases + 1;
+	pp->bank = (float*)malloc(rows * pp->taps * sizeof(float));
+	pp->history = (float*)malloc(2 * pp->taps * sizeof(float));
+	if (!pp->bank || !pp->history) {
+		thunderscopehw_polyphase_free(pp);
+		return false;
+	}
+
+	// Blackman windowed sinc at phases times the input rate, cutting off at
+	// 90% of the lower Nyquist frequency. Row p holds taps p, p + phases, ...
+	// reversed, row phases is row 0 one input later.
+	double length = (double)pp->taps * pp->phases;
+	double cutoff = 0.45 / ratio / pp->phases;
+	for (size_t p = 0; p < rows; p++) {
+		float* row = pp->bank + p * pp->taps;
+		double sum = 0;
+		for (size_t j = 0; j < pp->taps; j++) {
+			double m = (double)j * pp->phases + p;
+			double x = m - length / 2;
+			double h = x == 0 ? 2 * cutoff : sin(2 * M_PI * cutoff * x) / (M_PI * x);
+			double w = 2 * M_PI * m / length;
+			h *= 0.42 - 0.5 * cos(w) + 0.08 * cos(2 * w);
+			row[pp->taps - 1 - j] = (float)h;
+			sum += h;
+		}
+		// Unity gain at DC for every phase.
+		for (size_t j = 0; j < pp->taps; j++) row[j] = (float)(row[j] / sum);
+	}
+	thunderscopehw_polyphase_reset(pp);
+	return true;
+}
+
+void thunderscopehw_polyphase_free(struct ThunderScopeHWPolyphase* pp)
+{
+	free(pp->bank);
+	free(pp->history);
+	pp->bank = NULL;
+	pp->history = NULL;
+}
+
+void thunderscopehw_polyphase_reset(struct ThunderScopeHWPolyphase* pp)
+{
+	memset(pp->history, 0, 2 * pp->taps * sizeof(float));
+	pp->position = 0;
+	pp->phase = 0;
+	pp->fraction = 0;
+	pp->wait = 1;
+}
+
+size_t thunderscopehw_polyphase_max_output(struct ThunderScopeHWPolyphase* pp, size_t length)
+{
+	return (size_t)(length / pp->step) + 2;
+}
+
+size_t thunderscopehw_polyphase_process(struct ThunderScopeHWPolyphase* pp, const float* in, size_t length, float* out)
+{
+	size_t outputs = 0;
+	size_t n = pp->taps;
+	for (size_t i = 0; i < length; i++) {
+		// Same doubled history as the FIR, last n inputs oldest first.
+		pp->history[pp->position] = in[i];
+		pp->history[pp->position + n] = in[i];
+		pp->position = pp->position + 1 == n ? 0 : pp->position + 1;
+		if (--pp->wait) continue;
+
+		const float* window = pp->history + pp->position;
+		do {
+			if (pp->rational) {
+				out[outputs++] = thunderscopehw_dot_f32(window, pp->bank + (size_t)pp->phase * n, n);
+				pp->phase += pp->down;
+				pp->wait += pp->phase / pp->up;
+				pp->phase %= pp->up;
+			} else {
+				// Linear interpolation between the two nearest phases.
+				double position = pp->fraction * pp->phases;
+				uint32_t p = (uint32_t)position;
+				float mix = (float)(position - p);
+				float a = thunderscopehw_dot_f32(window, pp->bank + (size_t)p * n, n);
+				float b = thunderscopehw_dot_f32(window, pp->bank + (size_t)(p + 1) * n, n);
+				out[outputs++] = a + mix * (b - a);
+				pp->fraction += pp->step;
+				double advance = floor(pp->fraction);
+				pp->fraction -= advance;
+				pp->wait += (uint64_t)advance;
+			}
+		} while (!pp->wait);
+	}
+	return outputs;
+}
@@ -41,6 +41,8 @@
 #define CLOCK_GEN_I2C_ADDRESS_READ          0b10110001 //IF WE COULD
 
 #define THUNDERSCOPEHW_CHANNELS               4
+// Bandwidth limit settings: 20, 100, 200 and 350 MHz.
+#define THUNDERSCOPEHW_BANDWIDTHS             4
 
 #define THUNDERSCOPEHW_RUN(X) do {			\
   enum ThunderScopeHWStatus ret = (thunderscopehw_##X);	\
@@ -60,8 +62,12 @@ struct ThunderScopeHWChannel {
 	enum ThunderScopeHWCouplingType coupling;
 };
 
+// Core trims kept for interleave counts 1, 2 and 4.
+#define THUNDERSCOPEHW_CORE_TRIM_MODES        3
+
 struct ThunderScopeHW {
 	bool connected;
+	uint64_t scope_id;
 	bool board_en;   // general front end en
 	bool adc_en;     // adc values
 	bool pll_en;     // PLL enable
@@ -69,6 +75,16 @@ struct ThunderScopeHW {
 	bool datamover_en;
 	bool fpga_adc_en;
 	struct ThunderScopeHWChannel channels[4];
+	// Front end equalizer per channel and bandwidth setting.
+	float* equalizer_taps[THUNDERSCOPEHW_CHANNELS][THUNDERSCOPEHW_BANDWIDTHS];
+	size_t equalizer_taps_count[THUNDERSCOPEHW_CHANNELS][THUNDERSCOPEHW_BANDWIDTHS];
+	bool core_correction;
+	bool core_trim_valid[THUNDERSCOPEHW_CORE_TRIM_MODES];
+	struct ThunderScopeHWCoreTrim core_trim[THUNDERSCOPEHW_CORE_TRIM_MODES];
+	// Mapped calibration file, NULL without one.
+	const struct ThunderScopeHWCalibration* calibration;
+	void* calibration_map;
+	size_t calibration_map_size;
 
 	THUNDERSCOPEHW_FILE_HANDLE user_handle;
 	THUNDERSCOPEHW_FILE_HANDLE c2h0_handle;
@@ -85,6 +101,8 @@ enum ThunderScopeHWStatus thunderscopehw_fifo_write(struct ThunderScopeHW* ts, u
 enum ThunderScopeHWStatus thunderscopehw_set_datamover_reg(struct ThunderScopeHW* ts);
 enum ThunderScopeHWStatus thunderscopehw_set_pga(struct ThunderScopeHW* ts, int channel);
 enum ThunderScopeHWStatus thunderscopehw_set_dac(struct ThunderScopeHW* ts, int channel);
+// Writes a 12 bit offset DAC code directly.
+enum ThunderScopeHWStatus thunderscopehw_set_dac_raw(struct ThunderScopeHW* ts, int channel, int dac_value);
 enum ThunderScopeHWStatus thunderscopehw_configure_channels(struct ThunderScopeHW* ts);
 enum ThunderScopeHWStatus thunderscopehw_configure_channel(struct ThunderScopeHW* ts, int channel);
 uint32_t thunderscopehw_read32(struct ThunderScopeHW*ts, size_t addr);
@@ -110,6 +128,294 @@ enum ThunderScopeHWStatus thunderscopehw_adc_power(struct ThunderScopeHW* ts, bo
 enum ThunderScopeHWStatus thunderscopehw_configure_adc(struct ThunderScopeHW* ts);
 enum ThunderScopeHWStatus thunderscopehw_configure_pll(struct ThunderScopeHW* ts);
 
+// Sample kernels (thunderscopehw_dsp.c)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define THUNDERSCOPEHW_SSE2 1
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Index of the lowest set bit, x must not be 0.
+static inline int thunderscopehw_ctz64(uint64_t x)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, x);
+	return (int)index;
+#else
+	return __builtin_ctzll(x);
+#endif
+}
+
+// Samples per channel processed per pass by the streaming stages.
+#define THUNDERSCOPEHW_TILE_SAMPLES         4096
+
+void thunderscopehw_minmax_i8(const int8_t* data, size_t length, int8_t* min, int8_t* max);
+
+float thunderscopehw_dot_f32(const float* a, const float* b, size_t length);
+// Per device calibration file name, false if it does not fit. Touches nothing on disk.
+bool thunderscopehw_calibration_path(struct ThunderScopeHW* ts, const char* suffix, char* path, size_t size);
+// Maps the calibration file of the connected device, if any, and takes the core trims from it.
+void thunderscopehw_calibration_load(struct ThunderScopeHW* ts);
+void thunderscopehw_calibration_unload(struct ThunderScopeHW* ts);
+// Applies the core trim of the current channel mode to data read from the device.
+void thunderscopehw_core_trim_apply(struct ThunderScopeHW* ts, uint8_t* data, size_t length);
+
+// thunderscopehw_volts_per_lsb for a vdiv and bandwidth other than the current ones.
+double thunderscopehw_volts_per_lsb_setting(struct ThunderScopeHW* ts, int channel, int vdiv, int bandwidth);
+
+// Index of a bandwidth setting in the per bandwidth tables, -1 if invalid.
+int thunderscopehw_bandwidth_index(int bandwidth);
+// Index of a vdiv setting in the per vdiv tables, -1 if invalid.
+int thunderscopehw_vdiv_index(int vdiv);
+
+// out[i] = samples[i] * scale.
+void thunderscopehw_i8_to_f32(const int8_t* samples, size_t length, float scale, float* out);
+// Polynomial atan2, within 1e-5 rad, atan2(0, 0) is 0.
+void thunderscopehw_atan2_f32(const float* y, const float* x, size_t length, float* out);
+// Magnitudes of interleaved I/Q pairs.
+void thunderscopehw_magnitude_f32(const float* iq, size_t pairs, float* out);
+
+// Decimation building blocks (thunderscopehw_decimate.c)
+#define THUNDERSCOPEHW_CIC_MAX_STAGES       5
+
+// Integrators wrap modulo 2^64, only the comb outputs need to fit.
+struct ThunderScopeHWCic {
+	int stages;
+	uint32_t decimation;
+	uint32_t phase;
+	uint64_t integrators[THUNDERSCOPEHW_CIC_MAX_STAGES];
+	uint64_t combs[THUNDERSCOPEHW_CIC_MAX_STAGES];
+};
+
+void thunderscopehw_cic_init(struct ThunderScopeHWCic* cic, int stages, uint32_t decimation);
+// DC gain, decimation ^ stages.
+double thunderscopehw_cic_gain(const struct ThunderScopeHWCic* cic);
+// Both return the number of outputs, at most length / decimation + 1.
+size_t thunderscopehw_cic_process_i8(struct ThunderScopeHWCic* cic, const int8_t* in, size_t length, int64_t* out);
+size_t thunderscopehw_cic_process_i32(struct ThunderScopeHWCic* cic, const int32_t* in, size_t length, int64_t* out);
+
+// Decimating FIR with a doubled history so every output is one contiguous dot product.
+struct ThunderScopeHWFir {
+	size_t taps_count;
+	float* taps;       // reversed, so taps line up with the oldest sample first
+	float* history;
+	size_t position;
+	uint32_t decimation;
+	uint32_t phase;
+};
+
+bool thunderscopehw_fir_init(struct ThunderScopeHWFir* fir, const float* taps, size_t taps_count, uint32_t decimation);
+void thunderscopehw_fir_free(struct ThunderScopeHWFir* fir);
+void thunderscopehw_fir_reset(struct ThunderScopeHWFir* fir);
+size_t thunderscopehw_fir_process(struct ThunderScopeHWFir* fir, const float* in, size_t length, float* out);
+// Low pass at `cutoff` (cycles per input sample) that also undoes the droop of a
+// CIC with the given stages and decimation at its output (0 stages for a plain low pass).
+void thunderscopehw_fir_design(float* taps, size_t taps_count, double cutoff, int cic_stages, uint32_t cic_decimation);
+
+// Polyphase resampler over floats (thunderscopehw_polyphase.c).
+struct ThunderScopeHWPolyphase {
+	size_t taps;
+	uint32_t phases;
+	// phases + 1 rows of reversed taps, the last row is phase 0 one input later.
+	float* bank;
+	float* history;
+	size_t position;
+	// Input samples per output, as L/M when rational.
+	bool rational;
+	uint32_t up;
+	uint32_t down;
+	uint32_t phase;
+	double step;
+	double fraction;
+	// Inputs still to consume before the next output.
+	uint64_t wait;
+};
+
+bool thunderscopehw_polyphase_init(struct ThunderScopeHWPolyphase* pp, double input_rate, double output_rate);
+void thunderscopehw_polyphase_free(struct ThunderScopeHWPolyphase* pp);
+void thunderscopehw_polyphase_reset(struct ThunderScopeHWPolyphase* pp);
+size_t thunderscopehw_polyphase_max_output(struct ThunderScopeHWPolyphase* pp, size_t length);
+size_t thunderscopehw_polyphase_process(struct ThunderScopeHWPolyphase* pp, const float* in, size_t length, float* out);
+
+// Real FFT (thunderscopehw_fft.c), n a power of two >= 4.
+// Spectra hold n / 2 + 1 bins as interleaved re, im pairs.
+struct ThunderScopeHWFft;
+
+struct ThunderScopeHWFft* thunderscopehw_fft_create(size_t n);
+void thunderscopehw_fft_destroy(struct ThunderScopeHWFft* fft);
+void thunderscopehw_fft_forward(struct ThunderScopeHWFft* fft, const float* in, float* spectrum);
+// Exact inverse of thunderscopehw_fft_forward.
+void thunderscopehw_fft_inverse(struct ThunderScopeHWFft* fft, const float* spectrum, float* out);
+// Fills n window coefficients and returns their mean (coherent gain).
+double thunderscopehw_window_fill(enum ThunderScopeHWWindow window, float* coefficients, size_t n);
+
+// Threshold crossings interpolated at the middle of a hysteresis band
+// (thunderscopehw_logic.c), in samples since the last reset.
+struct ThunderScopeHWCrossings {
+	struct ThunderScopeHWLogic* logic;
+	uint64_t* transitions;
+	float threshold;
+	// Twice the threshold, compared against twice the samples.
+	int twice_threshold;
+	int8_t previous;
+	// 1 / (b - a) for every step between two codes, indexed by b - a + 255.
+	float reciprocal[511];
+};
+
+bool thunderscopehw_crossings_init(struct ThunderScopeHWCrossings* c, int8_t low, int8_t high);
+void thunderscopehw_crossings_free(struct ThunderScopeHWCrossings* c);
+void thunderscopehw_crossings_reset(struct ThunderScopeHWCrossings* c);
+// At most THUNDERSCOPEHW_TILE_SAMPLES samples, times and rising need room for length.
+size_t thunderscopehw_crossings_process(struct ThunderScopeHWCrossings* c, const int8_t* samples, size_t length,
+					double* times, bool* rising);
+
+// Serial decoders (thunderscopehw_decoder.c thresholds and merges the inputs, each
+// protocol file gets their edges in time order).
+#define THUNDERSCOPEHW_DECODER_INPUTS 4
+#define THUNDERSCOPEHW_UART_AUTOBAUD_EDGES 64
+
+enum ThunderScopeHWProtocol {
+	THUNDERSCOPEHW_PROTOCOL_UART,
+	THUNDERSCOPEHW_PROTOCOL_SPI,
+	THUNDERSCOPEHW_PROTOCOL_I2C,
+	THUNDERSCOPEHW_PROTOCOL_CAN,
+	THUNDERSCOPEHW_PROTOCOL_LIN,
+};
+
+struct ThunderScopeHWUart {
+	double sample_rate;
+	int data_bits;
+	enum ThunderScopeHWParity parity;
+	// Samples per bit, 0 while measuring.
+	double bit;
+	bool autobaud;
+	bool in_frame;
+	uint64_t frame_start;
+	int next_bit;
+	int frame_bits;
+	uint32_t shift;
+	// Edges held back while measuring.
+	int pending;
+	uint64_t pending_time[THUNDERSCOPEHW_UART_AUTOBAUD_EDGES];
+	bool pending_level[THUNDERSCOPEHW_UART_AUTOBAUD_EDGES];
+};
+
+struct ThunderScopeHWSpi {
+	int mode;
+	int word_bits;
+	bool msb_first;
+	int bits;
+	uint32_t mosi;
+	uint32_t miso;
+	uint64_t word_start;
+};
+
+struct ThunderScopeHWI2c {
+	bool active;
+	bool address_next;
+	int bits;
+	uint32_t byte;
+	uint64_t byte_start;
+};
+
+struct ThunderScopeHWCan {
+	double nominal_bit;
+	double data_bit;
+	bool dominant_high;
+	// Bit timing, the current bit starts at bit_start and lasts `bit`.
+	bool in_frame;
+	double bit_start;
+	double bit;
+	// Stuffing: run of equal bits, dynamic stuff bits seen, bits to the next fixed one.
+	bool stuffing;
+	bool fixed_stuffing;
+	bool last;
+	int run;
+	int stuff_count;
+	int fixed_left;
+	// Field being received and bits left in it.
+	int field;
+	int remaining;
+	uint32_t shift;
+	bool crc_active;
+	uint32_t crc15;
+	uint32_t crc17;
+	uint32_t crc21;
+	uint64_t frame_start;
+	uint32_t id;
+	uint32_t flags;
+	uint32_t dlc;
+	uint32_t length;
+	uint32_t received;
+	uint8_t data[THUNDERSCOPEHW_PACKET_MAX_DATA];
+};
+
+// LIN bytes come from the UART state at the front.
+struct ThunderScopeHWLin {
+	struct ThunderScopeHWUart uart;
+	int state;
+	bool break_pending;
+	uint64_t break_start;
+	uint64_t frame_start;
+	uint64_t last_end;
+	uint32_t flags;
+	uint8_t pid;
+	uint32_t count;
+	uint8_t bytes[THUNDERSCOPEHW_PACKET_MAX_DATA];
+};
+
+struct ThunderScopeHWDecoder {
+	enum ThunderScopeHWProtocol protocol;
+	int inputs;
+	struct ThunderScopeHWLogic* logic[THUNDERSCOPEHW_DECODER_INPUTS];
+	uint64_t* transitions[THUNDERSCOPEHW_DECODER_INPUTS];
+	// Current level of each input and whether it was given this call.
+	bool level[THUNDERSCOPEHW_DECODER_INPUTS];
+	bool present[THUNDERSCOPEHW_DECODER_INPUTS];
+	uint64_t position;
+	struct ThunderScopeHWPacket* packets;
+	size_t max_packets;
+	size_t count;
+	uint64_t dropped;
+	union {
+		struct ThunderScopeHWUart uart;
+		struct ThunderScopeHWSpi spi;
+		struct ThunderScopeHWI2c i2c;
+		struct ThunderScopeHWCan can;
+		struct ThunderScopeHWLin lin;
+	} u;
+};
+
+static inline struct ThunderScopeHWUart* thunderscopehw_uart_state(struct ThunderScopeHWDecoder* d)
+{
+	return d->protocol == THUNDERSCOPEHW_PROTOCOL_LIN ? &d->u.lin.uart : &d->u.uart;
+}
+
+struct ThunderScopeHWDecoder* thunderscopehw_decoder_alloc(enum ThunderScopeHWProtocol protocol, int inputs,
+							   int8_t low, int8_t high);
+void thunderscopehw_decoder_emit(struct ThunderScopeHWDecoder* d, const struct ThunderScopeHWPacket* packet);
+// Edges give the level after them. Flush tells that nothing changed before `now`.
+void thunderscopehw_uart_init(struct ThunderScopeHWUart* u, double sample_rate, double baud, int data_bits,
+			      enum ThunderScopeHWParity parity);
+void thunderscopehw_uart_reset(struct ThunderScopeHWDecoder* d);
+void thunderscopehw_uart_edge(struct ThunderScopeHWDecoder* d, uint64_t time, int input, bool level);
+void thunderscopehw_uart_flush(struct ThunderScopeHWDecoder* d, uint64_t now);
+void thunderscopehw_spi_reset(struct ThunderScopeHWDecoder* d);
+void thunderscopehw_spi_edge(struct ThunderScopeHWDecoder* d, uint64_t time, int input, bool level);
+void thunderscopehw_i2c_reset(struct ThunderScopeHWDecoder* d);
+void thunderscopehw_i2c_edge(struct ThunderScopeHWDecoder* d, uint64_t time, int input, bool level);
+void thunderscopehw_can_reset(struct ThunderScopeHWDecoder* d);
+void thunderscopehw_can_edge(struct ThunderScopeHWDecoder* d, uint64_t time, int input, bool level);
+void thunderscopehw_can_flush(struct ThunderScopeHWDecoder* d, uint64_t now);
+// LIN sits on the UART: bytes are handed over as UART packets.
+void thunderscopehw_lin_reset(struct ThunderScopeHWDecoder* d);
+void thunderscopehw_lin_byte(struct ThunderScopeHWDecoder* d, const struct ThunderScopeHWPacket* byte);
+void thunderscopehw_lin_edge(struct ThunderScopeHWDecoder* d, uint64_t time, int input, bool level);
+void thunderscopehw_lin_flush(struct ThunderScopeHWDecoder* d, uint64_t now);
+
 enum ThunderScopeHWStatus thunderscopehw_read_handle(struct ThunderScopeHW* ts, THUNDERSCOPEHW_FILE_HANDLE h, uint8_t* data, uint64_t addr, int64_t bytes);
 enum ThunderScopeHWStatus thunderscopehw_write_handle(struct ThunderScopeHW* ts, THUNDERSCOPEHW_FILE_HANDLE h, uint8_t* data, uint64_t addr, int64_t bytes);
 
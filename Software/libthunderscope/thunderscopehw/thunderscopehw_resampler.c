@@ -0,0 +1,90 @@
+#include "thunderscopehw_private.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#define THUNDERSCOPEHW_RESAMPLER_STAGES         4
+// The CIC leaves at least this many times the output rate for the polyphase
+// stage, its aliases then stay below -90 dB.
+#define THUNDERSCOPEHW_RESAMPLER_OVERSAMPLING   8
+#define THUNDERSCOPEHW_RESAMPLER_MAX_CIC        16384
+
+struct ThunderScopeHWResampler {
+	uint32_t decimation;
+	struct ThunderScopeHWCic cic;
+	struct ThunderScopeHWPolyphase polyphase;
+	float scale;
+	int64_t cic_out[THUNDERSCOPEHW_TILE_SAMPLES];
+	float polyphase_in[THUNDERSCOPEHW_TILE_SAMPLES];
+};
+
+// Largest CIC decimation keeping the oversampling margin, preferring one that
+// divides the input rate so the polyphase stage stays rational.
+static uint32_t thunderscopehw_resampler_decimation(double input_rate, double output_rate)
+{
+	double limit = floor(input_rate / (output_rate * THUNDERSCOPEHW_RESAMPLER_OVERSAMPLING));
+	if (limit < 2) return 1;
+	if (limit > THUNDERSCOPEHW_RESAMPLER_MAX_CIC) limit = THUNDERSCOPEHW_RESAMPLER_MAX_CIC;
+	uint32_t d = (uint32_t)limit;
+	if (input_rate == floor(input_rate) && input_rate < 9007199254740992.0) {
+		uint64_t rate = (uint64_t)input_rate;
+		for (uint32_t c = d; c > d / 2; c--) {
+			if (rate % c == 0) return c;
+		}
+	}
+	return d;
+}
+
+struct ThunderScopeHWResampler* thunderscopehw_resampler_create(double input_rate, double output_rate)
+{
+	if (!(input_rate > 0) || !(output_rate > 0)) return NULL;
+	struct ThunderScopeHWResampler* r;
+	r = (struct ThunderScopeHWResampler*)malloc(sizeof(struct ThunderScopeHWResampler));
+	if (!r) return r;
+
+	r->decimation = thunderscopehw_resampler_decimation(input_rate, output_rate);
+	thunderscopehw_cic_init(&r->cic, THUNDERSCOPEHW_RESAMPLER_STAGES, r->decimation);
+	if (!thunderscopehw_polyphase_init(&r->polyphase, input_rate / r->decimation, output_rate)) {
+		free(r);
+		return NULL;
+	}
+	r->scale = (float)(1.0 / thunderscopehw_cic_gain(&r->cic));
+	return r;
+}
+
+void thunderscopehw_resampler_destroy(struct ThunderScopeHWResampler* r)
+{
+	if (!r) return;
+	thunderscopehw_polyphase_free(&r->polyphase);
+	free(r);
+}
+
+void thunderscopehw_resampler_reset(struct ThunderScopeHWResampler* r)
+{
+	thunderscopehw_cic_init(&r->cic, THUNDERSCOPEHW_RESAMPLER_STAGES, r->decimation);
+	thunderscopehw_polyphase_reset(&r->polyphase);
+}
+
+size_t thunderscopehw_resampler_max_output(struct ThunderScopeHWResampler* r, size_t length)
+{
+	return thunderscopehw_polyphase_max_output(&r->polyphase, length / r->decimation + 1);
+}
+
+size_t thunderscopehw_resampler_process(struct ThunderScopeHWResampler* r, const int8_t* samples, size_t length, float* out)
+{
+	size_t outputs = 0;
+	while (length) {
+		size_t tile = length < THUNDERSCOPEHW_TILE_SAMPLES ? length : THUNDERSCOPEHW_TILE_SAMPLES;
+		size_t inputs = tile;
+		if (r->decimation > 1) {
+			inputs = thunderscopehw_cic_process_i8(&r->cic, samples, tile, r->cic_out);
+			for (size_t i = 0; i < inputs; i++) r->polyphase_in[i] = r->cic_out[i] * r->scale;
+		} else {
+			for (size_t i = 0; i < tile; i++) r->polyphase_in[i] = samples[i];
+		}
+		outputs += thunderscopehw_polyphase_process(&r->polyphase, r->polyphase_in, inputs, out + outputs);
+		samples += tile;
+		length -= tile;
+	}
+	return outputs;
+}
@@ -0,0 +1,102 @@
+#include "thunderscopehw_private.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct ThunderScopeHWRoll {
+	struct ThunderScopeHWPeakDetect* pd;
+	int num_channels;
+	size_t point_bytes;
+	size_t history_points;
+	uint64_t total_points;
+	int8_t* history;
+	// Points produced by one tile of input.
+	int8_t* scratch;
+};
+
+struct ThunderScopeHWRoll* thunderscopehw_roll_create(int num_channels, double points_per_second, size_t history_points)
+{
+	if (num_channels < 1 || num_channels > THUNDERSCOPEHW_CHANNELS || points_per_second <= 0.0 || history_points == 0)
+		return NULL;
+	struct ThunderScopeHWRoll* roll;
+	roll = (struct ThunderScopeHWRoll*)calloc(1, sizeof(struct ThunderScopeHWRoll));
+	if (!roll) return roll;
+
+	roll->num_channels = num_channels;
+	roll->point_bytes = 2 * num_channels;
+	roll->history_points = history_points;
+	roll->total_points = 0;
+	roll->pd = thunderscopehw_peak_detect_create(num_channels,
+						thunderscopehw_peak_detect_decimation(num_channels, points_per_second));
+	roll->history = (int8_t*)malloc(history_points * roll->point_bytes);
+	roll->scratch = (int8_t*)malloc((THUNDERSCOPEHW_TILE_SAMPLES + 1) * roll->point_bytes);
+	if (!roll->pd || !roll->history || !roll->scratch) {
+		thunderscopehw_roll_destroy(roll);
+		return NULL;
+	}
+	return roll;
+}
+
+void thunderscopehw_roll_destroy(struct ThunderScopeHWRoll* roll)
+{
+	if (!roll) return;
+	thunderscopehw_peak_detect_destroy(roll->pd);
+	free(roll->history);
+	free(roll->scratch);
+	free(roll);
+}
+
+void thunderscopehw_roll_reset(struct ThunderScopeHWRoll* roll)
+{
+	thunderscopehw_peak_detect_reset(roll->pd);
+	roll->total_points = 0;
+}
+
+size_t thunderscopehw_roll_process(struct ThunderScopeHWRoll* roll, const int8_t* data, size_t length)
+{
+	size_t appended = 0;
+	size_t tile_bytes = (size_t)THUNDERSCOPEHW_TILE_SAMPLES * roll->num_channels;
+	length -= length % roll->num_channels;
+
+	while (length) {
+		size_t chunk = length < tile_bytes ? length : tile_bytes;
+		size_t points = thunderscopehw_peak_detect_process(roll->pd, data, chunk, roll->scratch);
+		// Only the newest history_points of a burst can be kept.
+		size_t skip = points > roll->history_points ? points - roll->history_points : 0;
+		roll->total_points += skip;
+		for (size_t i = skip; i < points; i++) {
+			size_t slot = (size_t)(roll->total_points % roll->history_points);
+			memcpy(roll->history + slot * roll->point_bytes, roll->scratch + i * roll->point_bytes, roll->point_bytes);
+			roll->total_points++;
+		}
+		appended += points;
+		data += chunk;
+		length -= chunk;
+	}
+	return appended;
+}
+
+uint64_t thunderscopehw_roll_total_points(struct ThunderScopeHWRoll* roll)
+{
+	return roll->total_points;
+}
+
+size_t thunderscopehw_roll_read(struct ThunderScopeHWRoll* roll, uint64_t* cursor, int8_t* out, size_t max_points)
+{
+	uint64_t oldest = roll->total_points > roll->history_points ? roll->total_points - roll->history_points : 0;
+	if (*cursor < oldest) *cursor = oldest;
+	if (*cursor > roll->total_points) *cursor = roll->total_points;
+
+	size_t copied = 0;
+	while (copied < max_points && *cursor < roll->total_points) {
+		size_t slot = (size_t)(*cursor % roll->history_points);
+		// Copy up to the end of the ring in one go.
+		size_t run = roll->history_points - slot;
+		if (run > roll->total_points - *cursor) run = (size_t)(roll->total_points - *cursor);
+		if (run > max_points - copied) run = max_points - copied;
+		memcpy(out + copied * roll->point_bytes, roll->history + slot * roll->point_bytes, run * roll->point_bytes);
+		copied += run;
+		*cursor += run;
+	}
+	return copied;
+}
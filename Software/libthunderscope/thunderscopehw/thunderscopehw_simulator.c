@@ -21,6 +21,7 @@ enum ThunderScopeHWStatus thunderscopehw_connect(struct ThunderScopeHW* ts, uint
 	ts->user_handle = (THUNDERSCOPEHW_FILE_HANDLE)101;
 	ts->c2h0_handle = (THUNDERSCOPEHW_FILE_HANDLE)102;
 	ts->connected = true;
+	ts->scope_id = scope_id;
 	return thunderscopehw_initboard(ts);
 }
 
@@ -45,17 +46,19 @@ static char* thunderscopehw_identify_handle(THUNDERSCOPEHW_FILE_HANDLE h) {
 static uint16_t blocks = 0;
 enum ThunderScopeHWStatus thunderscopehw_read_handle(struct ThunderScopeHW* ts, THUNDERSCOPEHW_FILE_HANDLE h, uint8_t* data, uint64_t addr, int64_t bytes)
 {
-	(void)ts;
 	printf("READ  %lld from %s at 0x%06llx :",
 		(long long)bytes,
 	        thunderscopehw_identify_handle(h),
 		(long long)addr);
 	memset(data, 0, bytes);
+	// Registers are on the user handle, DMA reads are all zero.
+	if (h != ts->user_handle) addr = ~0ULL;
 	switch (addr) {
 	case 8:
 		blocks++;
-		data[3] = blocks & 255;
-		data[2] = blocks >> 8;
+		// Pages moved in the low 16 bits, as thunderscopehw_read32 assembles them.
+		data[0] = blocks & 255;
+		data[1] = blocks >> 8;
 		break;
 
 	case SERIAL_FIFO_ISR_ADDRESS:
@@ -0,0 +1,160 @@
+#include "thunderscopehw_private.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct ThunderScopeHWSpectrum {
+	struct ThunderScopeHWFft* fft;
+	size_t n;
+	size_t hop;
+	enum ThunderScopeHWAveraging averaging;
+	double averaging_param;
+	double coherent_gain;
+	float* window;
+	// Raw samples of the frame being collected.
+	int8_t* history;
+	size_t fill;
+	float* frame;
+	float* bins;
+	float* power;
+	uint64_t frames;
+};
+
+struct ThunderScopeHWSpectrum* thunderscopehw_spectrum_create(size_t fft_size, enum ThunderScopeHWWindow window, double overlap,
+                                                               enum ThunderScopeHWAveraging averaging, double averaging_param)
+{
+	if (overlap < 0.0 || overlap >= 1.0) return NULL;
+	if (averaging == THUNDERSCOPEHW_AVERAGING_LINEAR && averaging_param < 1.0) return NULL;
+	if (averaging == THUNDERSCOPEHW_AVERAGING_EXPONENTIAL && (averaging_param <= 0.0 || averaging_param > 1.0)) return NULL;
+	struct ThunderScopeHWSpectrum* s;
+	s = (struct ThunderScopeHWSpectrum*)calloc(1, sizeof(struct ThunderScopeHWSpectrum));
+	if (!s) return s;
+
+	s->n = fft_size;
+	s->hop = (size_t)(fft_size * (1.0 - overlap));
+	if (s->hop < 1) s->hop = 1;
+	s->averaging = averaging;
+	s->averaging_param = averaging_param;
+	s->fft = thunderscopehw_fft_create(fft_size);
+	s->window = (float*)malloc(fft_size * sizeof(float));
+	s->history = (int8_t*)malloc(fft_size);
+	s->frame = (float*)malloc(fft_size * sizeof(float));
+	s->bins = (float*)malloc((fft_size + 2) * sizeof(float));
+	s->power = (float*)malloc((fft_size / 2 + 1) * sizeof(float));
+	if (!s->fft || !s->window || !s->history || !s->frame || !s->bins || !s->power) {
+		thunderscopehw_spectrum_destroy(s);
+		return NULL;
+	}
+	s->coherent_gain = thunderscopehw_window_fill(window, s->window, fft_size);
+	thunderscopehw_spectrum_reset(s);
+	return s;
+}
+
+void thunderscopehw_spectrum_destroy(struct ThunderScopeHWSpectrum* s)
+{
+	if (!s) return;
+	thunderscopehw_fft_destroy(s->fft);
+	free(s->window);
+	free(s->history);
+	free(s->frame);
+	free(s->bins);
+	free(s->power);
+	free(s);
+}
+
+void thunderscopehw_spectrum_reset(struct ThunderScopeHWSpectrum* s)
+{
+	s->fill = 0;
+	s->frames = 0;
+	memset(s->power, 0, (s->n / 2 + 1) * sizeof(float));
+}
+
+static void thunderscopehw_spectrum_frame(struct ThunderScopeHWSpectrum* s)
+{
+	size_t bins = s->n / 2 + 1;
+	// Window straight from the int8 samples, the capture is never widened as a whole.
+	for (size_t i = 0; i < s->n; i++) {
+		s->frame[i] = s->window[i] * s->history[i];
+	}
+	thunderscopehw_fft_forward(s->fft, s->frame, s->bins);
+	s->frames++;
+
+	float weight = 1.0f;
+	switch (s->averaging) {
+	case THUNDERSCOPEHW_AVERAGING_LINEAR:
+		weight = 1.0f / (float)(s->frames < s->averaging_param ? s->frames : s->averaging_param);
+		break;
+	case THUNDERSCOPEHW_AVERAGING_EXPONENTIAL:
+		if (s->frames > 1) weight = (float)s->averaging_param;
+		break;
+	default:
+		break;
+	}
+	if (s->averaging == THUNDERSCOPEHW_AVERAGING_PEAK_HOLD) {
+		for (size_t k = 0; k < bins; k++) {
+			float p = s->bins[2 * k] * s->bins[2 * k] + s->bins[2 * k + 1] * s->bins[2 * k + 1];
+			if (p > s->power[k] || s->frames == 1) s->power[k] = p;
+		}
+	} else {
+		for (size_t k = 0; k < bins; k++) {
+			float p = s->bins[2 * k] * s->bins[2 * k] + s->bins[2 * k + 1] * s->bins[2 * k + 1];
+			s->power[k] += (p - s->power[k]) * weight;
+		}
+	}
+}
+
+size_t thunderscopehw_spectrum_process(struct ThunderScopeHWSpectrum* s, const int8_t* samples, size_t length)
+{
+	size_t frames = 0;
+	while (length) {
+		size_t take = s->n - s->fill;
+		if (take > length) take = length;
+		memcpy(s->history + s->fill, samples, take);
+		s->fill += take;
+		samples += take;
+		length -= take;
+		if (s->fill == s->n) {
+			thunderscopehw_spectrum_frame(s);
+			frames++;
+			memmove(s->history, s->history + s->hop, s->n - s->hop);
+			s->fill = s->n - s->hop;
+		}
+	}
+	return frames;
+}
+
+uint64_t thunderscopehw_spectrum_frames(struct ThunderScopeHWSpectrum* s)
+{
+	return s->frames;
+}
+
+size_t thunderscopehw_spectrum_bins(struct ThunderScopeHWSpectrum* s)
+{
+	return s->n / 2 + 1;
+}
+
+// Squared amplitude in codes of a sine centred on bin k.
+static double thunderscopehw_spectrum_amplitude2(struct ThunderScopeHWSpectrum* s, size_t k)
+{
+	double scale = s->n * s->coherent_gain / 2;
+	return s->power[k] / (scale * scale) + 1e-20;
+}
+
+void thunderscopehw_spectrum_dbfs(struct ThunderScopeHWSpectrum* s, float* out)
+{
+	size_t bins = s->n / 2 + 1;
+	for (size_t k = 0; k < bins; k++) {
+		out[k] = (float)(10 * log10(thunderscopehw_spectrum_amplitude2(s, k) / (128.0 * 128.0)));
+	}
+}
+
+void thunderscopehw_spectrum_dbm(struct ThunderScopeHWSpectrum* s, double volts_per_lsb, float* out)
+{
+	size_t bins = s->n / 2 + 1;
+	// Vpeak^2 / 2 / 50 ohm in mW.
+	double scale = volts_per_lsb * volts_per_lsb * 10;
+	for (size_t k = 0; k < bins; k++) {
+		out[k] = (float)(10 * log10(thunderscopehw_spectrum_amplitude2(s, k) * scale));
+	}
+}
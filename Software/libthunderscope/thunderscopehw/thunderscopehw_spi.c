@@ -0,0 +1,66 @@
+#include "thunderscopehw_private.h"
+
+#define THUNDERSCOPEHW_SPI_SCLK 0
+#define THUNDERSCOPEHW_SPI_MOSI 1
+#define THUNDERSCOPEHW_SPI_MISO 2
+#define THUNDERSCOPEHW_SPI_CS   3
+
+struct ThunderScopeHWDecoder* thunderscopehw_spi_decoder_create(int mode, int word_bits, bool msb_first,
+								int8_t low, int8_t high)
+{
+	if (mode < 0 || mode > 3 || word_bits < 1 || word_bits > 32) return NULL;
+	struct ThunderScopeHWDecoder* d = thunderscopehw_decoder_alloc(THUNDERSCOPEHW_PROTOCOL_SPI, 4, low, high);
+	if (!d) return d;
+
+	d->u.spi.mode = mode;
+	d->u.spi.word_bits = word_bits;
+	d->u.spi.msb_first = msb_first;
+	thunderscopehw_decoder_reset(d);
+	return d;
+}
+
+void thunderscopehw_spi_reset(struct ThunderScopeHWDecoder* d)
+{
+	d->u.spi.bits = 0;
+	d->u.spi.mosi = 0;
+	d->u.spi.miso = 0;
+}
+
+void thunderscopehw_spi_edge(struct ThunderScopeHWDecoder* d, uint64_t time, int input, bool level)
+{
+	struct ThunderScopeHWSpi* s = &d->u.spi;
+	if (input == THUNDERSCOPEHW_SPI_CS) {
+		thunderscopehw_spi_reset(d);
+		return;
+	}
+	if (input != THUNDERSCOPEHW_SPI_SCLK) return;
+	if (d->present[THUNDERSCOPEHW_SPI_CS] && d->level[THUNDERSCOPEHW_SPI_CS]) return;
+	// Modes 0 and 3 sample on the rising edge, 1 and 2 on the falling one. Clock
+	// edges come before data edges on the same sample, so data is taken as it
+	// was before.
+	bool rising = s->mode == 0 || s->mode == 3;
+	if (level != rising) return;
+
+	uint32_t mosi = d->level[THUNDERSCOPEHW_SPI_MOSI];
+	uint32_t miso = d->level[THUNDERSCOPEHW_SPI_MISO];
+	if (s->bits == 0) s->word_start = time;
+	if (s->msb_first) {
+		s->mosi = (s->mosi << 1) | mosi;
+		s->miso = (s->miso << 1) | miso;
+	} else {
+		s->mosi |= mosi << s->bits;
+		s->miso |= miso << s->bits;
+	}
+	if (++s->bits < s->word_bits) return;
+
+	struct ThunderScopeHWPacket p;
+	p.type = THUNDERSCOPEHW_PACKET_SPI;
+	p.flags = 0;
+	p.start = s->word_start;
+	p.end = time;
+	p.value = s->mosi;
+	p.value2 = s->miso;
+	p.length = 0;
+	thunderscopehw_decoder_emit(d, &p);
+	thunderscopehw_spi_reset(d);
+}
@@ -0,0 +1,236 @@
+#include "thunderscopehw_private.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef THUNDERSCOPEHW_SSE2
+#include <emmintrin.h>
+#endif
+
+void thunderscopehw_stats_init(struct ThunderScopeHWStats* stats, int8_t threshold, bool with_histogram)
+{
+	memset(stats, 0, sizeof(*stats));
+	stats->threshold = threshold;
+	stats->with_histogram = with_histogram;
+	stats->min = INT8_MAX;
+	stats->max = INT8_MIN;
+}
+
+#ifdef THUNDERSCOPEHW_SSE2
+// Byte lane counters and 32 bit square sums are flushed to
+// 64 bits every 255 vectors, before either can overflow.
+#define THUNDERSCOPEHW_STATS_BLOCK_VECTORS 255
+
+static size_t thunderscopehw_stats_update_sse2(struct ThunderScopeHWStats* stats, const int8_t* samples, size_t length)
+{
+	const __m128i sign = _mm_set1_epi8((char)0x80);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i threshold = _mm_set1_epi8(stats->threshold);
+	__m128i vmin = _mm_set1_epi8((char)0xFF);
+	__m128i vmax = zero;
+	uint64_t unsigned_sum = 0;
+	uint64_t sum_squares = 0;
+	uint64_t high = 0;
+	uint64_t low = 0;
+	size_t i = 0;
+
+	while (i + 16 <= length) {
+		__m128i sum = zero;
+		__m128i squares = zero;
+		__m128i high_count = zero;
+		__m128i low_count = zero;
+		for (int j = 0; j < THUNDERSCOPEHW_STATS_BLOCK_VECTORS && i + 16 <= length; j++, i += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i*)(samples + i));
+			__m128i u = _mm_xor_si128(v, sign);
+			sum = _mm_add_epi64(sum, _mm_sad_epu8(u, zero));
+			vmin = _mm_min_epu8(vmin, u);
+			vmax = _mm_max_epu8(vmax, u);
+			__m128i extend = _mm_cmpgt_epi8(zero, v);
+			__m128i lo = _mm_unpacklo_epi8(v, extend);
+			__m128i hi = _mm_unpackhi_epi8(v, extend);
+			squares = _mm_add_epi32(squares, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+			high_count = _mm_sub_epi8(high_count, _mm_cmpgt_epi8(v, threshold));
+			low_count = _mm_sub_epi8(low_count, _mm_cmplt_epi8(v, threshold));
+		}
+		uint64_t lanes[2];
+		uint32_t squares_lanes[4];
+		_mm_storeu_si128((__m128i*)lanes, sum);
+		unsigned_sum += lanes[0] + lanes[1];
+		_mm_storeu_si128((__m128i*)squares_lanes, squares);
+		sum_squares += (uint64_t)squares_lanes[0] + squares_lanes[1] + squares_lanes[2] + squares_lanes[3];
+		_mm_storeu_si128((__m128i*)lanes, _mm_sad_epu8(high_count, zero));
+		high += lanes[0] + lanes[1];
+		_mm_storeu_si128((__m128i*)lanes, _mm_sad_epu8(low_count, zero));
+		low += lanes[0] + lanes[1];
+	}
+
+	uint8_t lanes_min[16], lanes_max[16];
+	_mm_storeu_si128((__m128i*)lanes_min, _mm_xor_si128(vmin, sign));
+	_mm_storeu_si128((__m128i*)lanes_max, _mm_xor_si128(vmax, sign));
+	for (int j = 0; j < 16 && i; j++) {
+		if ((int8_t)lanes_min[j] < stats->min) stats->min = (int8_t)lanes_min[j];
+		if ((int8_t)lanes_max[j] > stats->max) stats->max = (int8_t)lanes_max[j];
+	}
+	stats->sum += (int64_t)unsigned_sum - 128 * (int64_t)i;
+	stats->sum_squares += sum_squares;
+	stats->high += high;
+	stats->low += low;
+	stats->count += i;
+	return i;
+}
+#endif
+
+static void thunderscopehw_stats_update_scalar(struct ThunderScopeHWStats* stats, const int8_t* samples, size_t length)
+{
+	for (size_t i = 0; i < length; i++) {
+		int8_t x = samples[i];
+		stats->sum += x;
+		stats->sum_squares += x * x;
+		if (x < stats->min) stats->min = x;
+		if (x > stats->max) stats->max = x;
+		if (x > stats->threshold) stats->high++;
+		if (x < stats->threshold) stats->low++;
+		stats->count++;
+	}
+}
+
+void thunderscopehw_stats_update(struct ThunderScopeHWStats* stats, const int8_t* samples, size_t length)
+{
+	// Four partial histograms keep consecutive equal codes
+	// from serializing on the same counter.
+	uint32_t partial[4][256];
+	size_t partial_count = 0;
+	if (stats->with_histogram) memset(partial, 0, sizeof(partial));
+
+	// The histogram walks each tile right after the arithmetic
+	// pass, while it is still in L1.
+	while (length) {
+		size_t tile = length < THUNDERSCOPEHW_TILE_SAMPLES ? length : THUNDERSCOPEHW_TILE_SAMPLES;
+		size_t i = 0;
+#ifdef THUNDERSCOPEHW_SSE2
+		i = thunderscopehw_stats_update_sse2(stats, samples, tile);
+#endif
+		thunderscopehw_stats_update_scalar(stats, samples + i, tile - i);
+
+		if (stats->with_histogram) {
+			size_t j = 0;
+			for (; j + 4 <= tile; j += 4) {
+				partial[0][(uint8_t)(samples[j] + 128)]++;
+				partial[1][(uint8_t)(samples[j + 1] + 128)]++;
+				partial[2][(uint8_t)(samples[j + 2] + 128)]++;
+				partial[3][(uint8_t)(samples[j + 3] + 128)]++;
+			}
+			for (; j < tile; j++) partial[0][(uint8_t)(samples[j] + 128)]++;
+			partial_count += tile;
+			// Flush before the 32 bit counters could wrap.
+			if (partial_count >= ((size_t)1 << 30) || tile == length) {
+				for (int code = 0; code < 256; code++) {
+					stats->histogram[code] += (uint64_t)partial[0][code] + partial[1][code] + partial[2][code] + partial[3][code];
+				}
+				memset(partial, 0, sizeof(partial));
+				partial_count = 0;
+			}
+		}
+		samples += tile;
+		length -= tile;
+	}
+}
+
+void thunderscopehw_stats_merge(struct ThunderScopeHWStats* dst, const struct ThunderScopeHWStats* src)
+{
+	dst->count += src->count;
+	dst->sum += src->sum;
+	dst->sum_squares += src->sum_squares;
+	if (src->min < dst->min) dst->min = src->min;
+	if (src->max > dst->max) dst->max = src->max;
+	dst->high += src->high;
+	dst->low += src->low;
+	if (dst->with_histogram && src->with_histogram) {
+		for (int code = 0; code < 256; code++) dst->histogram[code] += src->histogram[code];
+	}
+}
+
+void thunderscopehw_stats_measure(const struct ThunderScopeHWStats* stats, double volts_per_lsb, struct ThunderScopeHWMeasurements* out)
+{
+	memset(out, 0, sizeof(*out));
+	if (!stats->count) return;
+	double mean = (double)stats->sum / stats->count;
+	double mean_square = (double)stats->sum_squares / stats->count;
+	double variance = mean_square - mean * mean;
+	out->mean = mean * volts_per_lsb;
+	out->rms = sqrt(mean_square) * volts_per_lsb;
+	out->ac_rms = sqrt(variance > 0 ? variance : 0) * volts_per_lsb;
+	out->min = stats->min * volts_per_lsb;
+	out->max = stats->max * volts_per_lsb;
+	out->peak_to_peak = (stats->max - stats->min) * volts_per_lsb;
+	double peak = -stats->min > stats->max ? -stats->min : stats->max;
+	if (mean_square > 0) out->crest_factor = peak / sqrt(mean_square);
+}
+
+struct ThunderScopeHWStatsWindow {
+	size_t block_size;
+	size_t blocks;
+	int8_t threshold;
+	uint64_t completed;
+	struct ThunderScopeHWStats current;
+	struct ThunderScopeHWStats* ring;
+};
+
+struct ThunderScopeHWStatsWindow* thunderscopehw_stats_window_create(size_t block_size, size_t blocks, int8_t threshold)
+{
+	if (block_size == 0 || blocks == 0) return NULL;
+	struct ThunderScopeHWStatsWindow* w;
+	w = (struct ThunderScopeHWStatsWindow*)malloc(sizeof(struct ThunderScopeHWStatsWindow));
+	if (!w) return w;
+
+	w->block_size = block_size;
+	w->blocks = blocks;
+	w->threshold = threshold;
+	w->ring = (struct ThunderScopeHWStats*)malloc(blocks * sizeof(struct ThunderScopeHWStats));
+	if (!w->ring) {
+		free(w);
+		return NULL;
+	}
+	thunderscopehw_stats_window_reset(w);
+	return w;
+}
+
+void thunderscopehw_stats_window_destroy(struct ThunderScopeHWStatsWindow* w)
+{
+	if (!w) return;
+	free(w->ring);
+	free(w);
+}
+
+void thunderscopehw_stats_window_reset(struct ThunderScopeHWStatsWindow* w)
+{
+	w->completed = 0;
+	thunderscopehw_stats_init(&w->current, w->threshold, false);
+}
+
+size_t thunderscopehw_stats_window_process(struct ThunderScopeHWStatsWindow* w, const int8_t* samples, size_t length)
+{
+	size_t completed = 0;
+	while (length) {
+		size_t take = w->block_size - (size_t)w->current.count;
+		if (take > length) take = length;
+		thunderscopehw_stats_update(&w->current, samples, take);
+		samples += take;
+		length -= take;
+		if (w->current.count == w->block_size) {
+			w->ring[w->completed % w->blocks] = w->current;
+			w->completed++;
+			completed++;
+			thunderscopehw_stats_init(&w->current, w->threshold, false);
+		}
+	}
+	return completed;
+}
+
+void thunderscopehw_stats_window_get(struct ThunderScopeHWStatsWindow* w, struct ThunderScopeHWStats* stats)
+{
+	size_t blocks = w->completed < w->blocks ? (size_t)w->completed : w->blocks;
+	thunderscopehw_stats_init(stats, w->threshold, false);
+	for (size_t i = 0; i < blocks; i++) thunderscopehw_stats_merge(stats, &w->ring[i]);
+}
@@ -0,0 +1,286 @@
+#include "thunderscopehw_private.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+void thunderscopehw_measure_stat_clear(struct ThunderScopeHWMeasureStat* stat)
+{
+	memset(stat, 0, sizeof(*stat));
+}
+
+void thunderscopehw_measure_stat_add(struct ThunderScopeHWMeasureStat* stat, double value)
+{
+	// Welford's update keeps the deviation stable over millions of edges.
+	stat->count++;
+	double delta = value - stat->mean;
+	stat->mean += delta / stat->count;
+	stat->m2 += delta * (value - stat->mean);
+	if (stat->count == 1 || value < stat->min) stat->min = value;
+	if (stat->count == 1 || value > stat->max) stat->max = value;
+	stat->last = value;
+}
+
+double thunderscopehw_measure_stat_stddev(const struct ThunderScopeHWMeasureStat* stat)
+{
+	if (stat->count < 2) return 0.0;
+	return sqrt(stat->m2 / (stat->count - 1));
+}
+
+enum ThunderScopeHWTimingState {
+	THUNDERSCOPEHW_TIMING_UNKNOWN,
+	THUNDERSCOPEHW_TIMING_LOW,
+	THUNDERSCOPEHW_TIMING_RISING,
+	THUNDERSCOPEHW_TIMING_HIGH,
+	THUNDERSCOPEHW_TIMING_FALLING,
+};
+
+// Highest value over a state, split where its tail begins. The segments grow by a
+// quarter each, so at the end the last two, the tail, cover roughly the last fifth
+// to third of the state and `early` the rest.
+struct ThunderScopeHWTimingExtremes {
+	uint64_t start;
+	uint64_t next;
+	float early;
+	float previous;
+	float current;
+};
+
+struct ThunderScopeHWTiming {
+	double seconds_per_sample;
+	float base;
+	float top;
+	float low_ref;
+	float mid_ref;
+	float high_ref;
+
+	enum ThunderScopeHWTimingState state;
+	// Index of the next sample and the value of the previous one.
+	uint64_t position;
+	float previous;
+	bool low_seen;
+	// Lows are tracked negated.
+	struct ThunderScopeHWTimingExtremes low;
+	struct ThunderScopeHWTimingExtremes high;
+	// Crossing times in samples, NAN until seen.
+	double low_cross;
+	double high_cross;
+	double mid_cross;
+	double last_rise_mid;
+	double last_fall_mid;
+
+	struct ThunderScopeHWTimingResults results;
+};
+
+struct ThunderScopeHWTiming* thunderscopehw_timing_create(double sample_rate, float base, float top)
+{
+	if (sample_rate <= 0.0 || top <= base) return NULL;
+	struct ThunderScopeHWTiming* t;
+	t = (struct ThunderScopeHWTiming*)malloc(sizeof(struct ThunderScopeHWTiming));
+	if (!t) return t;
+
+	t->seconds_per_sample = 1.0 / sample_rate;
+	thunderscopehw_timing_set_levels(t, base, top);
+	thunderscopehw_timing_restart(t);
+	thunderscopehw_timing_clear_results(t);
+	return t;
+}
+
+void thunderscopehw_timing_destroy(struct ThunderScopeHWTiming* t)
+{
+	free(t);
+}
+
+void thunderscopehw_timing_set_levels(struct ThunderScopeHWTiming* t, float base, float top)
+{
+	t->base = base;
+	t->top = top;
+	t->low_ref = base + 0.1f * (top - base);
+	t->mid_ref = base + 0.5f * (top - base);
+	t->high_ref = base + 0.9f * (top - base);
+}
+
+void thunderscopehw_timing_levels(const struct ThunderScopeHWStats* stats, float* base, float* top)
+{
+	*base = stats->min;
+	*top = stats->max;
+	if (!stats->with_histogram || stats->max <= stats->min) return;
+
+	int middle = (stats->min + stats->max) / 2 + 128;
+	uint64_t best_low = 0, best_high = 0;
+	for (int code = stats->min + 128; code <= middle; code++) {
+		if (stats->histogram[code] > best_low) {
+			best_low = stats->histogram[code];
+			*base = (float)(code - 128);
+		}
+	}
+	for (int code = middle + 1; code <= stats->max + 128; code++) {
+		if (stats->histogram[code] > best_high) {
+			best_high = stats->histogram[code];
+			*top = (float)(code - 128);
+		}
+	}
+}
+
+static void thunderscopehw_timing_extremes_start(struct ThunderScopeHWTimingExtremes* e, uint64_t position, float value)
+{
+	e->start = position;
+	e->next = 1;
+	e->early = -INFINITY;
+	e->previous = -INFINITY;
+	e->current = value;
+}
+
+static inline void thunderscopehw_timing_extremes_add(struct ThunderScopeHWTimingExtremes* e, uint64_t position, float value)
+{
+	uint64_t elapsed = position - e->start;
+	if (elapsed >= e->next) {
+		if (e->previous > e->early) e->early = e->previous;
+		e->previous = e->current;
+		e->current = -INFINITY;
+		e->next = elapsed + elapsed / 4 + 1;
+	}
+	if (value > e->current) e->current = value;
+}
+
+static float thunderscopehw_timing_extremes_tail(const struct ThunderScopeHWTimingExtremes* e)
+{
+	return e->previous > e->current ? e->previous : e->current;
+}
+
+// The whole state when it was too short to have a tail of its own.
+static float thunderscopehw_timing_extremes_early(const struct ThunderScopeHWTimingExtremes* e)
+{
+	return e->early > -INFINITY ? e->early : thunderscopehw_timing_extremes_tail(e);
+}
+
+void thunderscopehw_timing_restart(struct ThunderScopeHWTiming* t)
+{
+	t->state = THUNDERSCOPEHW_TIMING_UNKNOWN;
+	t->position = 0;
+	t->previous = 0;
+	t->low_seen = false;
+	thunderscopehw_timing_extremes_start(&t->low, 0, 0);
+	thunderscopehw_timing_extremes_start(&t->high, 0, 0);
+	t->low_cross = t->high_cross = t->mid_cross = NAN;
+	t->last_rise_mid = t->last_fall_mid = NAN;
+}
+
+void thunderscopehw_timing_clear_results(struct ThunderScopeHWTiming* t)
+{
+	memset(&t->results, 0, sizeof(t->results));
+}
+
+static void thunderscopehw_timing_rising(struct ThunderScopeHWTiming* t, double high_cross)
+{
+	struct ThunderScopeHWTimingResults* r = &t->results;
+	double amplitude = t->top - t->base;
+	double rise_mid = t->mid_cross;
+
+	thunderscopehw_measure_stat_add(&r->rise_time, (high_cross - t->low_cross) * t->seconds_per_sample);
+	if (t->low_seen) {
+		// Ringing after the fall is over by the tail of the low state.
+		double preshoot = (t->base + thunderscopehw_timing_extremes_tail(&t->low)) / amplitude * 100;
+		thunderscopehw_measure_stat_add(&r->preshoot, preshoot > 0 ? preshoot : 0);
+		double undershoot = (t->base + thunderscopehw_timing_extremes_early(&t->low)) / amplitude * 100;
+		thunderscopehw_measure_stat_add(&r->undershoot, undershoot > 0 ? undershoot : 0);
+	}
+	if (!isnan(t->last_fall_mid)) {
+		thunderscopehw_measure_stat_add(&r->negative_width, (rise_mid - t->last_fall_mid) * t->seconds_per_sample);
+	}
+	if (!isnan(t->last_rise_mid)) {
+		double period = rise_mid - t->last_rise_mid;
+		thunderscopehw_measure_stat_add(&r->period, period * t->seconds_per_sample);
+		thunderscopehw_measure_stat_add(&r->frequency, 1.0 / (period * t->seconds_per_sample));
+		if (!isnan(t->last_fall_mid) && t->last_fall_mid > t->last_rise_mid) {
+			thunderscopehw_measure_stat_add(&r->duty_cycle, (t->last_fall_mid - t->last_rise_mid) / period * 100);
+		}
+	}
+	t->last_rise_mid = rise_mid;
+}
+
+static void thunderscopehw_timing_falling(struct ThunderScopeHWTiming* t, double low_cross)
+{
+	struct ThunderScopeHWTimingResults* r = &t->results;
+	double amplitude = t->top - t->base;
+
+	thunderscopehw_measure_stat_add(&r->fall_time, (low_cross - t->high_cross) * t->seconds_per_sample);
+	double overshoot = (thunderscopehw_timing_extremes_early(&t->high) - t->top) / amplitude * 100;
+	thunderscopehw_measure_stat_add(&r->overshoot, overshoot > 0 ? overshoot : 0);
+	if (!isnan(t->last_rise_mid)) {
+		thunderscopehw_measure_stat_add(&r->positive_width, (t->mid_cross - t->last_rise_mid) * t->seconds_per_sample);
+	}
+	t->last_fall_mid = t->mid_cross;
+}
+
+size_t thunderscopehw_timing_process(struct ThunderScopeHWTiming* t, const int8_t* samples, size_t length)
+{
+	size_t edges = 0;
+	float a = t->previous;
+	// Samples are only widened at the few places that need interpolation.
+#define THUNDERSCOPEHW_CROSS(level) ((double)(t->position + i) - 1 + ((level) - a) / (b - a))
+
+	for (size_t i = 0; i < length; i++, a = samples[i - 1]) {
+		float b = samples[i];
+		switch (t->state) {
+		case THUNDERSCOPEHW_TIMING_UNKNOWN:
+			if (b <= t->low_ref) {
+				t->state = THUNDERSCOPEHW_TIMING_LOW;
+				thunderscopehw_timing_extremes_start(&t->low, t->position + i, -b);
+			} else if (b >= t->high_ref) {
+				t->state = THUNDERSCOPEHW_TIMING_HIGH;
+				thunderscopehw_timing_extremes_start(&t->high, t->position + i, b);
+			}
+			break;
+
+		case THUNDERSCOPEHW_TIMING_LOW:
+			thunderscopehw_timing_extremes_add(&t->low, t->position + i, -b);
+			if (b <= t->low_ref) break;
+			t->low_cross = THUNDERSCOPEHW_CROSS(t->low_ref);
+			t->state = THUNDERSCOPEHW_TIMING_RISING;
+			/* fall through */
+		case THUNDERSCOPEHW_TIMING_RISING:
+			if (b <= t->low_ref) {
+				t->state = THUNDERSCOPEHW_TIMING_LOW;
+				break;
+			}
+			if (a <= t->mid_ref && b > t->mid_ref) t->mid_cross = THUNDERSCOPEHW_CROSS(t->mid_ref);
+			if (b < t->high_ref) break;
+			t->high_cross = THUNDERSCOPEHW_CROSS(t->high_ref);
+			thunderscopehw_timing_rising(t, t->high_cross);
+			edges++;
+			t->state = THUNDERSCOPEHW_TIMING_HIGH;
+			thunderscopehw_timing_extremes_start(&t->high, t->position + i, b);
+			t->low_seen = true;
+			break;
+
+		case THUNDERSCOPEHW_TIMING_HIGH:
+			thunderscopehw_timing_extremes_add(&t->high, t->position + i, b);
+			if (b >= t->high_ref) break;
+			t->high_cross = THUNDERSCOPEHW_CROSS(t->high_ref);
+			t->state = THUNDERSCOPEHW_TIMING_FALLING;
+			/* fall through */
+		case THUNDERSCOPEHW_TIMING_FALLING:
+			if (b >= t->high_ref) {
+				t->state = THUNDERSCOPEHW_TIMING_HIGH;
+				break;
+			}
+			if (a >= t->mid_ref && b < t->mid_ref) t->mid_cross = THUNDERSCOPEHW_CROSS(t->mid_ref);
+			if (b > t->low_ref) break;
+			thunderscopehw_timing_falling(t, THUNDERSCOPEHW_CROSS(t->low_ref));
+			edges++;
+			t->state = THUNDERSCOPEHW_TIMING_LOW;
+			thunderscopehw_timing_extremes_start(&t->low, t->position + i, -b);
+			break;
+		}
+	}
+#undef THUNDERSCOPEHW_CROSS
+	if (length) t->previous = samples[length - 1];
+	t->position += length;
+	return edges;
+}
+
+const struct ThunderScopeHWTimingResults* thunderscopehw_timing_results(struct ThunderScopeHWTiming* t)
+{
+	return &t->results;
+}
@@ -0,0 +1,159 @@
+#include "thunderscopehw_private.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// Measured rates within this fraction of one of these are taken as it.
+#define THUNDERSCOPEHW_UART_SNAP 0.02
+
+static const double thunderscopehw_uart_rates[] = {
+	300, 600, 1200, 2400, 4800, 9600, 14400, 19200, 28800, 38400, 57600, 76800,
+	115200, 230400, 250000, 460800, 500000, 921600, 1000000, 1500000, 2000000,
+	3000000, 4000000
+};
+
+struct ThunderScopeHWDecoder* thunderscopehw_uart_decoder_create(double sample_rate, double baud, int data_bits,
+								 enum ThunderScopeHWParity parity,
+								 int8_t low, int8_t high)
+{
+	if (!(sample_rate > 0) || !(baud >= 0) || baud * 2 > sample_rate || data_bits < 5 || data_bits > 9)
+		return NULL;
+	if (parity != THUNDERSCOPEHW_PARITY_NONE && parity != THUNDERSCOPEHW_PARITY_ODD &&
+	    parity != THUNDERSCOPEHW_PARITY_EVEN)
+		return NULL;
+	struct ThunderScopeHWDecoder* d = thunderscopehw_decoder_alloc(THUNDERSCOPEHW_PROTOCOL_UART, 1, low, high);
+	if (!d) return d;
+
+	thunderscopehw_uart_init(&d->u.uart, sample_rate, baud, data_bits, parity);
+	thunderscopehw_decoder_reset(d);
+	return d;
+}
+
+void thunderscopehw_uart_init(struct ThunderScopeHWUart* u, double sample_rate, double baud, int data_bits,
+			      enum ThunderScopeHWParity parity)
+{
+	u->sample_rate = sample_rate;
+	u->data_bits = data_bits;
+	u->parity = parity;
+	u->autobaud = baud == 0;
+	u->bit = u->autobaud ? 0 : sample_rate / baud;
+	// Start, data, parity and stop bits.
+	u->frame_bits = data_bits + (parity != THUNDERSCOPEHW_PARITY_NONE) + 2;
+}
+
+double thunderscopehw_uart_decoder_baud(struct ThunderScopeHWDecoder* d)
+{
+	if (d->protocol != THUNDERSCOPEHW_PROTOCOL_UART || d->u.uart.bit == 0) return 0;
+	return d->u.uart.sample_rate / d->u.uart.bit;
+}
+
+void thunderscopehw_uart_reset(struct ThunderScopeHWDecoder* d)
+{
+	struct ThunderScopeHWUart* u = thunderscopehw_uart_state(d);
+	if (u->autobaud) u->bit = 0;
+	u->in_frame = false;
+	u->pending = 0;
+}
+
+static void thunderscopehw_uart_frame(struct ThunderScopeHWDecoder* d)
+{
+	struct ThunderScopeHWUart* u = thunderscopehw_uart_state(d);
+	struct ThunderScopeHWPacket p;
+	p.type = THUNDERSCOPEHW_PACKET_UART;
+	p.flags = 0;
+	p.start = u->frame_start;
+	p.end = u->frame_start + (uint64_t)llround(u->frame_bits * u->bit) - 1;
+	p.value = (u->shift >> 1) & ((1U << u->data_bits) - 1);
+	p.value2 = 0;
+	p.length = 0;
+	if (u->parity != THUNDERSCOPEHW_PARITY_NONE) {
+		uint32_t ones = (u->shift >> 1) & ((2U << u->data_bits) - 1);
+		int odd = 0;
+		for (; ones; ones &= ones - 1) odd ^= 1;
+		if (odd != (u->parity == THUNDERSCOPEHW_PARITY_ODD)) p.flags |= THUNDERSCOPEHW_PACKET_PARITY_ERROR;
+	}
+	if (!((u->shift >> (u->frame_bits - 1)) & 1)) p.flags |= THUNDERSCOPEHW_PACKET_FRAMING_ERROR;
+	u->in_frame = false;
+	if (d->protocol == THUNDERSCOPEHW_PROTOCOL_LIN) {
+		thunderscopehw_lin_byte(d, &p);
+	} else {
+		thunderscopehw_decoder_emit(d, &p);
+	}
+}
+
+// Samples the bit centres before `until`, the line having been at `level`.
+static void thunderscopehw_uart_advance(struct ThunderScopeHWDecoder* d, uint64_t until, bool level)
+{
+	struct ThunderScopeHWUart* u = thunderscopehw_uart_state(d);
+	while (u->in_frame) {
+		double center = u->frame_start + (u->next_bit + 0.5) * u->bit;
+		if (center >= (double)until) return;
+		// Back high before the middle of the start bit, a glitch.
+		if (u->next_bit == 0 && level) {
+			u->in_frame = false;
+			return;
+		}
+		u->shift |= (uint32_t)level << u->next_bit;
+		if (++u->next_bit == u->frame_bits) thunderscopehw_uart_frame(d);
+	}
+}
+
+// Bit time from the held back edges: runs are whole multiples of the shortest.
+static void thunderscopehw_uart_measure(struct ThunderScopeHWDecoder* d)
+{
+	struct ThunderScopeHWUart* u = thunderscopehw_uart_state(d);
+	uint64_t shortest = UINT64_MAX;
+	for (int i = 1; i < u->pending; i++) {
+		uint64_t run = u->pending_time[i] - u->pending_time[i - 1];
+		if (run < shortest) shortest = run;
+	}
+	double sum = 0;
+	double bits = 0;
+	for (int i = 1; i < u->pending; i++) {
+		uint64_t run = u->pending_time[i] - u->pending_time[i - 1];
+		double k = floor((double)run / shortest + 0.5);
+		// Longer runs include idle time.
+		if (k > u->frame_bits) continue;
+		sum += run;
+		bits += k;
+	}
+	double baud = u->sample_rate * bits / sum;
+	for (size_t i = 0; i < sizeof(thunderscopehw_uart_rates) / sizeof(thunderscopehw_uart_rates[0]); i++) {
+		if (fabs(baud - thunderscopehw_uart_rates[i]) <= thunderscopehw_uart_rates[i] * THUNDERSCOPEHW_UART_SNAP) {
+			baud = thunderscopehw_uart_rates[i];
+			break;
+		}
+	}
+	u->bit = u->sample_rate / baud;
+
+	int pending = u->pending;
+	u->pending = 0;
+	for (int i = 0; i < pending; i++)
+		thunderscopehw_uart_edge(d, u->pending_time[i], 0, u->pending_level[i]);
+}
+
+void thunderscopehw_uart_edge(struct ThunderScopeHWDecoder* d, uint64_t time, int input, bool level)
+{
+	struct ThunderScopeHWUart* u = thunderscopehw_uart_state(d);
+	(void)input;
+	if (u->bit == 0) {
+		u->pending_time[u->pending] = time;
+		u->pending_level[u->pending] = level;
+		if (++u->pending == THUNDERSCOPEHW_UART_AUTOBAUD_EDGES) thunderscopehw_uart_measure(d);
+		return;
+	}
+
+	thunderscopehw_uart_advance(d, time, !level);
+	if (!u->in_frame && !level) {
+		u->in_frame = true;
+		u->frame_start = time;
+		u->next_bit = 0;
+		u->shift = 0;
+	}
+}
+
+void thunderscopehw_uart_flush(struct ThunderScopeHWDecoder* d, uint64_t now)
+{
+	if (thunderscopehw_uart_state(d)->bit == 0) return;
+	thunderscopehw_uart_advance(d, now, d->level[0]);
+}
@@ -0,0 +1,116 @@
+#include "thunderscopehw_private.h"
+
+#include <stdlib.h>
+
+struct ThunderScopeHWWaterfall {
+	struct ThunderScopeHWSpectrum* spectrum;
+	size_t n;
+	size_t width;
+	uint64_t row_interval;
+	// Position inside the current row interval.
+	uint64_t position;
+	size_t depth;
+	uint64_t total_rows;
+	float db_min;
+	float db_scale;
+	float* db;
+	uint8_t* rows;
+};
+
+struct ThunderScopeHWWaterfall* thunderscopehw_waterfall_create(size_t fft_size, enum ThunderScopeHWWindow window, uint64_t row_interval,
+                                                                 size_t depth, float db_min, float db_max)
+{
+	if (row_interval < fft_size || depth == 0 || db_max <= db_min) return NULL;
+	struct ThunderScopeHWWaterfall* w;
+	w = (struct ThunderScopeHWWaterfall*)calloc(1, sizeof(struct ThunderScopeHWWaterfall));
+	if (!w) return w;
+
+	w->n = fft_size;
+	w->width = fft_size / 2 + 1;
+	w->row_interval = row_interval;
+	w->depth = depth;
+	w->db_min = db_min;
+	w->db_scale = 255.0f / (db_max - db_min);
+	w->spectrum = thunderscopehw_spectrum_create(fft_size, window, 0.0, THUNDERSCOPEHW_AVERAGING_NONE, 0.0);
+	w->db = (float*)malloc(w->width * sizeof(float));
+	w->rows = (uint8_t*)malloc(w->width * depth);
+	if (!w->spectrum || !w->db || !w->rows) {
+		thunderscopehw_waterfall_destroy(w);
+		return NULL;
+	}
+	thunderscopehw_waterfall_reset(w);
+	return w;
+}
+
+void thunderscopehw_waterfall_destroy(struct ThunderScopeHWWaterfall* w)
+{
+	if (!w) return;
+	thunderscopehw_spectrum_destroy(w->spectrum);
+	free(w->db);
+	free(w->rows);
+	free(w);
+}
+
+void thunderscopehw_waterfall_reset(struct ThunderScopeHWWaterfall* w)
+{
+	thunderscopehw_spectrum_reset(w->spectrum);
+	w->position = 0;
+	w->total_rows = 0;
+}
+
+static void thunderscopehw_waterfall_row_done(struct ThunderScopeHWWaterfall* w)
+{
+	uint8_t* row = w->rows + (size_t)(w->total_rows % w->depth) * w->width;
+	thunderscopehw_spectrum_dbfs(w->spectrum, w->db);
+	for (size_t k = 0; k < w->width; k++) {
+		float level = (w->db[k] - w->db_min) * w->db_scale;
+		if (level < 0.0f) level = 0.0f;
+		if (level > 255.0f) level = 255.0f;
+		row[k] = (uint8_t)(level + 0.5f);
+	}
+	w->total_rows++;
+}
+
+size_t thunderscopehw_waterfall_process(struct ThunderScopeHWWaterfall* w, const int8_t* samples, size_t length)
+{
+	size_t rows = 0;
+	while (length) {
+		if (w->position < w->n) {
+			// Collect the FFT frame at the start of the interval.
+			size_t take = (size_t)(w->n - w->position);
+			if (take > length) take = length;
+			if (thunderscopehw_spectrum_process(w->spectrum, samples, take)) {
+				thunderscopehw_waterfall_row_done(w);
+				rows++;
+			}
+			w->position += take;
+			samples += take;
+			length -= take;
+		} else {
+			// Skip the rest without touching it.
+			uint64_t skip = w->row_interval - w->position;
+			if (skip > length) skip = length;
+			w->position += skip;
+			samples += skip;
+			length -= (size_t)skip;
+		}
+		if (w->position == w->row_interval) w->position = 0;
+	}
+	return rows;
+}
+
+uint64_t thunderscopehw_waterfall_total_rows(struct ThunderScopeHWWaterfall* w)
+{
+	return w->total_rows;
+}
+
+size_t thunderscopehw_waterfall_width(struct ThunderScopeHWWaterfall* w)
+{
+	return w->width;
+}
+
+const uint8_t* thunderscopehw_waterfall_row(struct ThunderScopeHWWaterfall* w, uint64_t row)
+{
+	if (row >= w->total_rows || w->total_rows - row > w->depth) return NULL;
+	return w->rows + (size_t)(row % w->depth) * w->width;
+}
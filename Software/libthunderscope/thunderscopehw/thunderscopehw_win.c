@@ -116,6 +116,7 @@ enum ThunderScopeHWStatus thunderscopehw_connect(struct ThunderScopeHW* ts, uint
 	thunderscopehw_iterate_devices(&thunderscopehw_connect_callback, (void*)&context);
 	if (!ts->connected)
 		return THUNDERSCOPEHW_STATUS_OPEN_FAILED;
+	ts->scope_id = scope_id;
 	return thunderscopehw_initboard(ts);
 }
 
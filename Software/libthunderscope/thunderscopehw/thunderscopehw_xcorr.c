@@ -0,0 +1,248 @@
+#include "thunderscopehw_private.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+struct ThunderScopeHWXcorr {
+	struct ThunderScopeHWFft* fft;
+	size_t block_size;
+	size_t fill;
+	uint64_t blocks;
+	int8_t* a;
+	int8_t* b;
+	float* frame;
+	float* spectrum_a;
+	float* spectrum_b;
+	// Spectra of the last block, correlated with the next one.
+	float* previous_a;
+	float* previous_b;
+	// Accumulated conj(A) * B over 2 * block_size point transforms, of each block
+	// and of the blocks next to each other (a before b, b before a), so every lag
+	// overlaps the whole capture rather than only the part of a block it shares.
+	double* cross;
+	double* cross_next;
+	double* cross_previous;
+	// The first block's means, taken off every block so the blocks stay one signal;
+	// what is left of the mean comes off at the end.
+	float offset_a;
+	float offset_b;
+	double sum_a;
+	double sum_b;
+	double energy_a;
+	double energy_b;
+	float* correlation;
+};
+
+struct ThunderScopeHWXcorr* thunderscopehw_xcorr_create(size_t block_size)
+{
+	if (block_size < 2 || 2 * block_size > THUNDERSCOPEHW_FFT_MAX_SIZE || (block_size & (block_size - 1)))
+		return NULL;
+	struct ThunderScopeHWXcorr* x;
+	x = (struct ThunderScopeHWXcorr*)calloc(1, sizeof(struct ThunderScopeHWXcorr));
+	if (!x) return x;
+
+	size_t n = 2 * block_size;
+	x->block_size = block_size;
+	x->fft = thunderscopehw_fft_create(n);
+	x->a = (int8_t*)malloc(block_size);
+	x->b = (int8_t*)malloc(block_size);
+	x->frame = (float*)malloc(n * sizeof(float));
+	x->spectrum_a = (float*)malloc((n + 2) * sizeof(float));
+	x->spectrum_b = (float*)malloc((n + 2) * sizeof(float));
+	x->previous_a = (float*)malloc((n + 2) * sizeof(float));
+	x->previous_b = (float*)malloc((n + 2) * sizeof(float));
+	x->cross = (double*)malloc((n + 2) * sizeof(double));
+	x->cross_next = (double*)malloc((n + 2) * sizeof(double));
+	x->cross_previous = (double*)malloc((n + 2) * sizeof(double));
+	x->correlation = (float*)malloc(n * sizeof(float));
+	if (!x->fft || !x->a || !x->b || !x->frame || !x->spectrum_a || !x->spectrum_b || !x->previous_a ||
+	    !x->previous_b || !x->cross || !x->cross_next || !x->cross_previous || !x->correlation) {
+		thunderscopehw_xcorr_destroy(x);
+		return NULL;
+	}
+	thunderscopehw_xcorr_reset(x);
+	return x;
+}
+
+void thunderscopehw_xcorr_destroy(struct ThunderScopeHWXcorr* x)
+{
+	if (!x) return;
+	thunderscopehw_fft_destroy(x->fft);
+	free(x->a);
+	free(x->b);
+	free(x->frame);
+	free(x->spectrum_a);
+	free(x->spectrum_b);
+	free(x->previous_a);
+	free(x->previous_b);
+	free(x->cross);
+	free(x->cross_next);
+	free(x->cross_previous);
+	free(x->correlation);
+	free(x);
+}
+
+void thunderscopehw_xcorr_reset(struct ThunderScopeHWXcorr* x)
+{
+	x->fill = 0;
+	x->blocks = 0;
+	x->offset_a = 0;
+	x->offset_b = 0;
+	x->sum_a = 0;
+	x->sum_b = 0;
+	x->energy_a = 0;
+	x->energy_b = 0;
+	memset(x->cross, 0, (2 * x->block_size + 2) * sizeof(double));
+	memset(x->cross_next, 0, (2 * x->block_size + 2) * sizeof(double));
+	memset(x->cross_previous, 0, (2 * x->block_size + 2) * sizeof(double));
+}
+
+// Offset removed, zero padded block into the FFT, adds to its sum and energy.
+static void thunderscopehw_xcorr_transform(struct ThunderScopeHWXcorr* x, const int8_t* samples, float* offset,
+					   double* sum, double* energy, float* spectrum)
+{
+	if (!x->blocks) {
+		int64_t total = 0;
+		for (size_t i = 0; i < x->block_size; i++) total += samples[i];
+		*offset = (float)total / x->block_size;
+	}
+	for (size_t i = 0; i < x->block_size; i++) {
+		x->frame[i] = samples[i] - *offset;
+		*sum += x->frame[i];
+		*energy += x->frame[i] * x->frame[i];
+	}
+	memset(x->frame + x->block_size, 0, x->block_size * sizeof(float));
+	thunderscopehw_fft_forward(x->fft, x->frame, spectrum);
+}
+
+// cross += conj(A) * B
+static void thunderscopehw_xcorr_accumulate(double* cross, const float* a, const float* b, size_t bins)
+{
+	for (size_t k = 0; k < bins; k++) {
+		float ar = a[2 * k], ai = a[2 * k + 1];
+		float br = b[2 * k], bi = b[2 * k + 1];
+		cross[2 * k] += ar * br + ai * bi;
+		cross[2 * k + 1] += ar * bi - ai * br;
+	}
+}
+
+static void thunderscopehw_xcorr_block(struct ThunderScopeHWXcorr* x)
+{
+	size_t bins = x->block_size + 1;
+	thunderscopehw_xcorr_transform(x, x->a, &x->offset_a, &x->sum_a, &x->energy_a, x->spectrum_a);
+	thunderscopehw_xcorr_transform(x, x->b, &x->offset_b, &x->sum_b, &x->energy_b, x->spectrum_b);
+	thunderscopehw_xcorr_accumulate(x->cross, x->spectrum_a, x->spectrum_b, bins);
+	if (x->blocks) {
+		thunderscopehw_xcorr_accumulate(x->cross_next, x->previous_a, x->spectrum_b, bins);
+		thunderscopehw_xcorr_accumulate(x->cross_previous, x->spectrum_a, x->previous_b, bins);
+	}
+	float* swap = x->previous_a;
+	x->previous_a = x->spectrum_a;
+	x->spectrum_a = swap;
+	swap = x->previous_b;
+	x->previous_b = x->spectrum_b;
+	x->spectrum_b = swap;
+	x->blocks++;
+}
+
+size_t thunderscopehw_xcorr_process(struct ThunderScopeHWXcorr* x, const int8_t* a, const int8_t* b, size_t length)
+{
+	size_t blocks = 0;
+	while (length) {
+		size_t take = x->block_size - x->fill;
+		if (take > length) take = length;
+		memcpy(x->a + x->fill, a, take);
+		memcpy(x->b + x->fill, b, take);
+		x->fill += take;
+		a += take;
+		b += take;
+		length -= take;
+		if (x->fill == x->block_size) {
+			thunderscopehw_xcorr_block(x);
+			x->fill = 0;
+			blocks++;
+		}
+	}
+	return blocks;
+}
+
+size_t thunderscopehw_xcorr_process_interleaved(struct ThunderScopeHWXcorr* x, const int8_t* data, size_t length,
+                                                int num_channels, int channel_a, int channel_b)
+{
+	if (num_channels < 1 || num_channels > THUNDERSCOPEHW_CHANNELS ||
+	    channel_a < 0 || channel_a >= num_channels || channel_b < 0 || channel_b >= num_channels)
+		return 0;
+	int8_t tile[THUNDERSCOPEHW_CHANNELS][THUNDERSCOPEHW_TILE_SAMPLES];
+	int8_t* tiles[THUNDERSCOPEHW_CHANNELS] = { tile[0], tile[1], tile[2], tile[3] };
+	size_t samples = length / num_channels;
+	size_t blocks = 0;
+	while (samples) {
+		size_t tile_samples = samples < THUNDERSCOPEHW_TILE_SAMPLES ? samples : THUNDERSCOPEHW_TILE_SAMPLES;
+		thunderscopehw_deinterleave(data, tile_samples * num_channels, num_channels, tiles);
+		blocks += thunderscopehw_xcorr_process(x, tiles[channel_a], tiles[channel_b], tile_samples);
+		data += tile_samples * num_channels;
+		samples -= tile_samples;
+	}
+	return blocks;
+}
+
+enum ThunderScopeHWStatus thunderscopehw_xcorr_delay(struct ThunderScopeHWXcorr* x, double max_lag, double* delay, double* coefficient)
+{
+	size_t n = 2 * x->block_size;
+	if (!x->blocks || max_lag < 1 || max_lag >= x->block_size) return THUNDERSCOPEHW_STATUS_INVALID_PARAMETER;
+
+	size_t block_size = x->block_size;
+	for (size_t k = 0; k < n + 2; k++) x->spectrum_a[k] = (float)x->cross[k];
+	thunderscopehw_fft_inverse(x->fft, x->spectrum_a, x->correlation);
+
+	// Lag l lives at index l, negative lags wrap to the end. Within the pairs of
+	// blocks lag l is at l + block_size, b's block coming after a's for l > 0.
+	for (size_t k = 0; k < n + 2; k++) x->spectrum_a[k] = (float)x->cross_next[k];
+	thunderscopehw_fft_inverse(x->fft, x->spectrum_a, x->frame);
+	for (size_t l = 1; l < block_size; l++) x->correlation[l] += x->frame[l + block_size];
+	for (size_t k = 0; k < n + 2; k++) x->spectrum_a[k] = (float)x->cross_previous[k];
+	thunderscopehw_fft_inverse(x->fft, x->spectrum_a, x->frame);
+	for (size_t l = 1; l < block_size; l++) x->correlation[n - l] += x->frame[block_size - l];
+
+	// Take off the rest of the means and scale every lag up from the samples it
+	// overlaps to the whole capture.
+	double total = (double)x->blocks * block_size;
+	double mean_a = x->sum_a / total, mean_b = x->sum_b / total;
+	for (size_t i = 0; i < n; i++) {
+		size_t lag = i < block_size ? i : n - i;
+		double overlap = total - lag;
+		x->correlation[i] = lag < block_size ? (float)((x->correlation[i] - overlap * mean_a * mean_b) * total / overlap) : 0.0f;
+	}
+
+	long lag_limit = (long)max_lag;
+	long best = 0;
+	// A periodic signal matches as well a period away: searched outwards, a lag
+	// further from 0 has to be clearly higher.
+	for (long distance = 1; distance <= lag_limit; distance++) {
+		for (long lag = -distance; lag <= distance; lag += 2 * distance) {
+			float peak = x->correlation[(best + n) % n];
+			if (x->correlation[(lag + n) % n] > peak + 1e-4f * fabsf(peak)) best = lag;
+		}
+	}
+	double y0 = x->correlation[(best + n) % n];
+	double ym = x->correlation[(best - 1 + n) % n];
+	double yp = x->correlation[(best + 1 + n) % n];
+	double curvature = ym - 2 * y0 + yp;
+	double offset = curvature < 0 ? 0.5 * (ym - yp) / curvature : 0.0;
+	*delay = best + offset;
+	double norm = sqrt((x->energy_a - total * mean_a * mean_a) * (x->energy_b - total * mean_b * mean_b));
+	*coefficient = norm > 0 ? (y0 - 0.25 * (ym - yp) * offset) / norm : 0.0;
+	return THUNDERSCOPEHW_STATUS_OK;
+}
+
+double thunderscopehw_xcorr_phase(struct ThunderScopeHWXcorr* x, double frequency)
+{
+	size_t k = (size_t)(frequency * 2 * x->block_size + 0.5);
+	if (k > x->block_size) k = x->block_size;
+	return atan2(x->cross[2 * k + 1], x->cross[2 * k]) * 180 / M_PI;
+}